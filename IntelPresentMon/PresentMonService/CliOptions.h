@@ -15,6 +15,10 @@ namespace clio
 		Option<long long> timedStop{ this, "--timed-stop", -1, "Signal stop event after specified number of milliseconds" };
 		Option<std::string> etwSessionName{ this, "--etw-session-name", "", "Name to use when creating the ETW session" };
 		Option<std::string> etlTestFile{ this, "--etl-test-file", "", "Etl test file including necessary path" };
+		Option<long long> trackedPresentMemoryMb{ this, "--tracked-present-memory-mb", 0, "Memory (in MB) that in-progress presents can use before the oldest is considered lost" };
+		Option<long long> sweepIdleHorizonMs{ this, "--sweep-idle-horizon-ms", 30000, "Time (in ms) after which state for exited processes and idle presents is reclaimed; 0 disables reclamation" };
+		Option<long long> engineUtilizationIntervalMs{ this, "--engine-utilization-interval-ms", 0, "Length (in ms) of each GPU engine utilization sample, which are summarized in the log when the session stops; 0 (the default) disables engine utilization tracking" };
+		Flag adaptiveEtwBuffers{ this, "--adaptive-etw-buffers", "Adjust the ETW session's buffer count and flush timer to the event rate; larger buffers are used when the session is next started" };
 		static constexpr const char* description = "Intel PresentMon service for frame and system performance measurement";
 		static constexpr const char* name = "PresentMonService.exe";
 	};
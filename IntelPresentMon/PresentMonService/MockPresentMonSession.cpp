@@ -3,6 +3,7 @@
 #include "MockPresentMonSession.h"
 #include "CliOptions.h"
 #include "..\CommonUtilities\str\String.h"
+#include <glog/logging.h>
 
 static const std::wstring kMockEtwSessionName = L"MockETWSession";
 
@@ -100,6 +101,10 @@ PM_STATUS MockPresentMonSession::StartTraceSession(uint32_t processId) {
     pm_consumer_->mTrackInput = true;
     pm_consumer_->mTrackFrameType = true;
 
+    if (opt.trackedPresentMemoryMb && *opt.trackedPresentMemoryMb > 0) {
+        pm_consumer_->mTrackedPresentMemoryLimit = (uint64_t) *opt.trackedPresentMemoryMb * 1024 * 1024;
+    }
+
     if (opt.etwSessionName.AsOptional().has_value()) {
         pm_session_name_ =
             pmon::util::str::ToWide(opt.etwSessionName.AsOptional().value());
@@ -162,6 +167,10 @@ void MockPresentMonSession::StopTraceSession() {
     streamer_.StopAllStreams();
 
     if (pm_consumer_) {
+        LOG(INFO) << "Presents lost: " << pm_consumer_->mLostPresentCount.load()
+            << ", evicted from a full present ring: " << pm_consumer_->mEvictedPresentCount.load()
+            << " (ring size " << pm_consumer_->mTrackedPresentCapacity.load() << ")"
+            << ", dropped before they were dequeued: " << pm_consumer_->mDroppedPresentCount.load() << std::endl;
         pm_consumer_.reset();
     }
 }
@@ -178,13 +187,13 @@ void MockPresentMonSession::WaitForConsumerThreadToExit() {
 
 void MockPresentMonSession::DequeueAnalyzedInfo(
     std::vector<ProcessEvent>* processEvents,
-    std::vector<std::shared_ptr<PresentEvent>>* presentEvents) {
+    std::vector<DequeuedPresentPtr>* presentEvents) {
     pm_consumer_->DequeueProcessEvents(*processEvents);
     pm_consumer_->DequeuePresentEvents(*presentEvents);
 }
 
 void MockPresentMonSession::AddPresents(
-    std::vector<std::shared_ptr<PresentEvent>> const& presentEvents,
+    std::vector<DequeuedPresentPtr> const& presentEvents,
     size_t* presentEventIndex, bool recording, bool checkStopQpc,
     uint64_t stopQpc, bool* hitStopQpc) {
     auto i = *presentEventIndex;
@@ -276,7 +285,7 @@ void MockPresentMonSession::AddPresents(
 
 void MockPresentMonSession::ProcessEvents(
     std::vector<ProcessEvent>* processEvents,
-    std::vector<std::shared_ptr<PresentEvent>>* presentEvents,
+    std::vector<DequeuedPresentPtr>* presentEvents,
     std::vector<std::pair<uint32_t, uint64_t>>* terminatedProcesses) {
     bool eventProcessingDone = false;
 
@@ -372,7 +381,7 @@ void MockPresentMonSession::Consume(TRACEHANDLE traceHandle) {
 void MockPresentMonSession::Output() {
     // Structures to track processes and statistics from recorded events.
     std::vector<ProcessEvent> processEvents;
-    std::vector<std::shared_ptr<PresentEvent>> presentEvents;
+    std::vector<DequeuedPresentPtr> presentEvents;
     std::vector<std::pair<uint32_t, uint64_t>> terminatedProcesses;
     processEvents.reserve(128);
     presentEvents.reserve(4096);
@@ -24,14 +24,14 @@ private:
 
     void DequeueAnalyzedInfo(
         std::vector<ProcessEvent>* processEvents,
-        std::vector<std::shared_ptr<PresentEvent>>* presentEvents);
+        std::vector<DequeuedPresentPtr>* presentEvents);
     void AddPresents(
-        std::vector<std::shared_ptr<PresentEvent>> const& presentEvents,
+        std::vector<DequeuedPresentPtr> const& presentEvents,
         size_t* presentEventIndex, bool recording, bool checkStopQpc,
         uint64_t stopQpc, bool* hitStopQpc);
     void ProcessEvents(
         std::vector<ProcessEvent>* processEvents,
-        std::vector<std::shared_ptr<PresentEvent>>* presentEvents,
+        std::vector<DequeuedPresentPtr>* presentEvents,
         std::vector<std::pair<uint32_t, uint64_t>>* terminatedProcesses);
 
     void StartOutputThread();
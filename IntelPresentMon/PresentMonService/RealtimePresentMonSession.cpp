@@ -4,6 +4,7 @@
 #include "RealtimePresentMonSession.h"
 #include "CliOptions.h"
 #include "..\CommonUtilities\str\String.h"
+#include <glog/logging.h>
 
 static const std::wstring kRealTimeSessionName = L"PMService";
 
@@ -112,6 +113,20 @@ PM_STATUS RealtimePresentMonSession::StartTraceSession() {
     pm_consumer_->mTrackFrameType = true;
 
     auto& opt = clio::Options::Get();
+    if (opt.trackedPresentMemoryMb && *opt.trackedPresentMemoryMb > 0) {
+        pm_consumer_->mTrackedPresentMemoryLimit = (uint64_t) *opt.trackedPresentMemoryMb * 1024 * 1024;
+    }
+
+    // Sample GPU engine utilization.  This is set before the session starts
+    // so that it enables the engine type events; realtime sessions use QPC
+    // timestamps.
+    engine_utilization_.clear();
+    if (opt.engineUtilizationIntervalMs && *opt.engineUtilizationIntervalMs > 0) {
+        LARGE_INTEGER frequency = {};
+        QueryPerformanceFrequency(&frequency);
+        pm_consumer_->mEngineUtilizationInterval = (uint64_t) *opt.engineUtilizationIntervalMs * frequency.QuadPart / 1000;
+    }
+
     if (opt.etwSessionName.AsOptional().has_value()) {
         pm_session_name_ =
             pmon::util::str::ToWide(opt.etwSessionName.AsOptional().value());
@@ -120,6 +135,11 @@ PM_STATUS RealtimePresentMonSession::StartTraceSession() {
         pm_session_name_ = kRealTimeSessionName;
     }
 
+    // Start with any buffer settings that the previous session's policy
+    // recommended but couldn't apply without a restart.
+    adaptive_etw_buffers_ = (bool) opt.adaptiveEtwBuffers;
+    trace_session_.mBufferSettings = adaptive_etw_buffers_ ? etw_buffer_policy_.RestartSettings() : EtwBufferSettings{};
+
     const wchar_t* etl_file_name = nullptr;
     // Start the session. If a session with this name is already running, we stop
     // it and start a new session. This is useful if a previous process failed to
@@ -150,6 +170,16 @@ PM_STATUS RealtimePresentMonSession::StartTraceSession() {
         }
     }
 
+    // Reclaim the state of exited processes and idle presents, so that the
+    // consumer's memory use stays bounded however long the session runs.
+    if (opt.sweepIdleHorizonMs && *opt.sweepIdleHorizonMs > 0) {
+        pm_consumer_->mSweepIdleHorizon = (uint64_t) *opt.sweepIdleHorizonMs * trace_session_.mTimestampFrequency.QuadPart / 1000;
+    }
+
+    if (adaptive_etw_buffers_) {
+        etw_buffer_policy_.Reset(trace_session_.mBufferSettings, (uint64_t) trace_session_.mTimestampFrequency.QuadPart);
+    }
+
     // Start the consumer and output threads
     StartConsumerThread(trace_session_.mTraceHandle);
     StartOutputThread();
@@ -173,10 +203,64 @@ void RealtimePresentMonSession::StopTraceSession() {
     }
 
     if (pm_consumer_) {
+        LOG(INFO) << "Presents lost: " << pm_consumer_->mLostPresentCount.load()
+            << ", evicted from a full present ring: " << pm_consumer_->mEvictedPresentCount.load()
+            << " (ring size " << pm_consumer_->mTrackedPresentCapacity.load() << ")"
+            << ", dropped before they were dequeued: " << pm_consumer_->mDroppedPresentCount.load() << std::endl;
+        if (pm_consumer_->mSweepIdleHorizon != 0) {
+            LOG(INFO) << "Tracking state entries reclaimed: " << pm_consumer_->mSweptEntryCount.load() << std::endl;
+            for (int i = 0; i < PMTraceConsumer::STATE_GAUGE_COUNT; ++i) {
+                auto gauge = (PMTraceConsumer::StateGauge) i;
+                LOG(INFO) << "    " << pmon::util::str::ToNarrow(PMTraceConsumer::GetStateGaugeName(gauge))
+                    << ": " << pm_consumer_->mStateGauges[i].mEntryCount.load() << " entries, "
+                    << pm_consumer_->mStateGauges[i].mByteCount.load() << " bytes" << std::endl;
+            }
+        }
+        if (adaptive_etw_buffers_) {
+            auto const& settings = etw_buffer_policy_.Settings();
+            LOG(INFO) << "ETW buffer settings changed " << etw_buffer_policy_.ChangeCount() << " times, to "
+                << settings.maximumBuffers_ << " x " << settings.bufferSizeKB_ << " KB buffers and a "
+                << settings.flushTimerMs_ << " ms flush timer" << std::endl;
+        }
+        if (pm_consumer_->mEngineUtilizationInterval != 0) {
+            LOG(INFO) << "GPU engine utilization samples dropped: " << pm_consumer_->mDroppedEngineUtilizationSampleCount.load() << std::endl;
+            for (auto const& e : engine_utilization_) {
+                LOG(INFO) << "    Adapter 0x" << std::hex << e.first.first << std::dec << " "
+                    << pmon::util::str::ToNarrow(PMTraceConsumer::GetEngineTypeName(e.first.second))
+                    << ": " << (e.second.duration == 0 ? 0.0 : 100.0 * (double) e.second.busy_time / (double) e.second.duration)
+                    << "% average, " << e.second.last_utilization << "% last" << std::endl;
+            }
+        }
         pm_consumer_.reset();
     }
 }
 
+void RealtimePresentMonSession::UpdateEtwBufferSettings() {
+    EtwSessionSample sample = {};
+    if (!trace_session_.QueryBufferStats(nullptr, &sample)) {
+        return;
+    }
+
+    auto action = etw_buffer_policy_.Update(sample);
+    if (action == EtwBufferPolicy::ACTION_NONE) {
+        return;
+    }
+
+    auto const& settings = etw_buffer_policy_.Settings();
+    auto status = trace_session_.UpdateBufferSettings(settings);
+    if (status != ERROR_SUCCESS) {
+        LOG(WARNING) << "Failed to update ETW buffer settings: " << status << std::endl;
+        return;
+    }
+    LOG(INFO) << "ETW buffer settings updated: " << settings.maximumBuffers_ << " buffers, "
+        << settings.flushTimerMs_ << " ms flush timer" << std::endl;
+
+    if (action == EtwBufferPolicy::ACTION_RESTART) {
+        LOG(INFO) << "ETW buffers of " << etw_buffer_policy_.RestartSettings().bufferSizeKB_
+            << " KB will be used when the trace session is next started" << std::endl;
+    }
+}
+
 void RealtimePresentMonSession::StartConsumerThread(TRACEHANDLE traceHandle) {
     consumer_thread_ = std::thread(&RealtimePresentMonSession::Consume, this, traceHandle);
 }
@@ -189,13 +273,26 @@ void RealtimePresentMonSession::WaitForConsumerThreadToExit() {
 
 void RealtimePresentMonSession::DequeueAnalyzedInfo(
     std::vector<ProcessEvent>* processEvents,
-    std::vector<std::shared_ptr<PresentEvent>>* presentEvents) {
+    std::vector<DequeuedPresentPtr>* presentEvents) {
     pm_consumer_->DequeueProcessEvents(*processEvents);
     pm_consumer_->DequeuePresentEvents(*presentEvents);
+    if (pm_consumer_->mEngineUtilizationInterval != 0) {
+        UpdateEngineUtilization();
+    }
+}
+
+void RealtimePresentMonSession::UpdateEngineUtilization() {
+    pm_consumer_->DequeueEngineUtilizationSamples(engine_utilization_samples_);
+    for (auto const& sample : engine_utilization_samples_) {
+        auto& utilization = engine_utilization_[std::make_pair(sample.pDxgAdapter, sample.EngineType)];
+        utilization.busy_time += sample.BusyTime;
+        utilization.duration += sample.Duration;
+        utilization.last_utilization = 100.0 * (double) sample.BusyTime / (double) sample.Duration;
+    }
 }
 
 void RealtimePresentMonSession::AddPresents(
-    std::vector<std::shared_ptr<PresentEvent>> const& presentEvents,
+    std::vector<DequeuedPresentPtr> const& presentEvents,
     size_t* presentEventIndex, bool recording, bool checkStopQpc,
     uint64_t stopQpc, bool* hitStopQpc) {
     auto i = *presentEventIndex;
@@ -289,7 +386,7 @@ void RealtimePresentMonSession::AddPresents(
 
 void RealtimePresentMonSession::ProcessEvents(
     std::vector<ProcessEvent>* processEvents,
-    std::vector<std::shared_ptr<PresentEvent>>* presentEvents,
+    std::vector<DequeuedPresentPtr>* presentEvents,
     std::vector<std::pair<uint32_t, uint64_t>>* terminatedProcesses) {
     bool eventProcessingDone = false;
 
@@ -381,12 +478,15 @@ void RealtimePresentMonSession::Consume(TRACEHANDLE traceHandle) {
 void RealtimePresentMonSession::Output() {
     // Structures to track processes and statistics from recorded events.
     std::vector<ProcessEvent> processEvents;
-    std::vector<std::shared_ptr<PresentEvent>> presentEvents;
+    std::vector<DequeuedPresentPtr> presentEvents;
     std::vector<std::pair<uint32_t, uint64_t>> terminatedProcesses;
     processEvents.reserve(128);
     presentEvents.reserve(4096);
     terminatedProcesses.reserve(16);
 
+    // Sample the trace session's buffers about once a second.
+    auto nextEtwBufferSampleTime = GetTickCount64() + 1000;
+
     for (;;) {
         // Read quit_output_thread_ here, but then check it after processing
         // queued events. This ensures that we call DequeueAnalyzedInfo() at
@@ -407,6 +507,11 @@ void RealtimePresentMonSession::Output() {
         // Update tracking information.
         CheckForTerminatedRealtimeProcesses(&terminatedProcesses);
 
+        if (adaptive_etw_buffers_ && GetTickCount64() >= nextEtwBufferSampleTime) {
+            nextEtwBufferSampleTime = GetTickCount64() + 1000;
+            UpdateEtwBufferSettings();
+        }
+
         // Sleep to reduce overhead.
         Sleep(100);
     }
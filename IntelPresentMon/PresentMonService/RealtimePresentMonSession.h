@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: MIT
 #pragma once
 #include "PresentMonSession.h"
+#include <map>
 
 class RealtimePresentMonSession : public PresentMonSession
 {
@@ -24,14 +25,14 @@ private:
 
     void DequeueAnalyzedInfo(
         std::vector<ProcessEvent>* processEvents,
-        std::vector<std::shared_ptr<PresentEvent>>* presentEvents);
+        std::vector<DequeuedPresentPtr>* presentEvents);
     void AddPresents(
-        std::vector<std::shared_ptr<PresentEvent>> const& presentEvents,
+        std::vector<DequeuedPresentPtr> const& presentEvents,
         size_t* presentEventIndex, bool recording, bool checkStopQpc,
         uint64_t stopQpc, bool* hitStopQpc);
     void ProcessEvents(
         std::vector<ProcessEvent>* processEvents,
-        std::vector<std::shared_ptr<PresentEvent>>* presentEvents,
+        std::vector<DequeuedPresentPtr>* presentEvents,
         std::vector<std::pair<uint32_t, uint64_t>>* terminatedProcesses);
 
     void StartOutputThread();
@@ -52,6 +53,9 @@ private:
     void CheckForTerminatedRealtimeProcesses(
         std::vector<std::pair<uint32_t, uint64_t>>* terminatedProcesses);
 
+    void UpdateEngineUtilization();
+    void UpdateEtwBufferSettings();
+
     // data
     std::wstring pm_session_name_;
 
@@ -65,6 +69,24 @@ private:
     std::unordered_map<uint32_t, ProcessInfo> processes_;
     uint32_t target_process_count_;
 
+    // GPU engine utilization since the trace session started, per (adapter,
+    // engine type).  Only used by the output thread while the session is
+    // running.
+    struct EngineUtilization {
+        uint64_t busy_time = 0;     // QPC duration
+        uint64_t duration = 0;      // QPC duration
+        double last_utilization = 0.0;
+    };
+    std::map<std::pair<uint64_t, Microsoft_Windows_DxgKrnl::DXGK_ENGINE>, EngineUtilization> engine_utilization_;
+    std::vector<EngineUtilizationSample> engine_utilization_samples_;
+
+    // Adapts the trace session's buffer settings to the event rate, if
+    // --adaptive-etw-buffers is used.  Settings that need the session to be
+    // restarted are applied the next time streaming starts the session.
+    // Only used by the output thread while the session is running.
+    bool adaptive_etw_buffers_ = false;
+    EtwBufferPolicy etw_buffer_policy_;
+
     // Event for when streaming has started
     std::unique_ptr<std::remove_pointer_t<HANDLE>, HandleDeleter>
         streaming_started_;
@@ -0,0 +1,875 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include "AnalysisSnapshot.hpp"
+#include "PresentMonTraceConsumer.hpp"
+
+#include <algorithm>
+
+namespace {
+
+enum : uint32_t {
+    SNAPSHOT_PACKET_TRACE_NONE  = 0,
+    SNAPSHOT_PACKET_TRACE_VIDEO = 1,
+    SNAPSHOT_PACKET_TRACE_OTHER = 2,
+};
+
+// The fields of a PresentEvent, other than its PresentIds and its references to other presents.
+// Present is PresentEvent const when saving, and PresentEvent when restoring.
+template<typename Archive, typename Present>
+void SerializePresentFields(Archive* ar, Present* p)
+{
+    ar->Value(&p->PresentStartTime);
+    ar->Value(&p->ProcessId);
+    ar->Value(&p->ThreadId);
+    ar->Value(&p->TimeInPresent);
+    ar->Value(&p->GPUStartTime);
+    ar->Value(&p->ReadyTime);
+    ar->Value(&p->GPUDuration);
+    ar->Value(&p->GPUVideoDuration);
+    ar->Value(&p->ScreenTime);
+    ar->Value(&p->InputTime);
+    ar->Value(&p->SwapChainAddress);
+    ar->Value(&p->SyncInterval);
+    ar->Value(&p->PresentFlags);
+    ar->Value(&p->CompositionSurfaceLuid);
+    ar->Value(&p->Win32KPresentCount);
+    ar->Value(&p->Win32KBindId);
+    ar->Value(&p->DxgkPresentHistoryToken);
+    ar->Value(&p->DxgkPresentHistoryTokenData);
+    ar->Value(&p->DxgkContext);
+    ar->Value(&p->Hwnd);
+    ar->Value(&p->QueueSubmitSequence);
+    ar->Value(&p->RingIndex);
+    ar->Value(&p->DestWidth);
+    ar->Value(&p->DestHeight);
+    ar->Value(&p->DriverThreadId);
+    ar->Value(&p->FrameId);
+    ar->Value(&p->Runtime);
+    ar->Value(&p->PresentMode);
+    ar->Value(&p->FinalState);
+    ar->Value(&p->InputType);
+    ar->Value(&p->FrameType);
+    ar->Value(&p->SupportsTearing);
+    ar->Value(&p->WaitForFlipEvent);
+    ar->Value(&p->WaitForMPOFlipEvent);
+    ar->Value(&p->SeenDxgkPresent);
+    ar->Value(&p->SeenWin32KEvents);
+    ar->Value(&p->SeenInFrameEvent);
+    ar->Value(&p->GpuFrameCompleted);
+    ar->Value(&p->IsCompleted);
+    ar->Value(&p->IsLost);
+    ar->Value(&p->PresentFailed);
+    ar->Value(&p->PresentInDwmWaitingStruct);
+    ar->Value(&p->DeferredReason);
+    #ifdef TRACK_PRESENT_PATHS
+    ar->Value(&p->AnalysisPath);
+    #endif
+}
+
+// Map keys are integers, except for Win32KPresentHistoryToken whose tuple layout isn't specified.
+template<typename Key>
+void WriteKey(AnalysisSnapshotWriter* writer, Key const& key)
+{
+    writer->Value(&key);
+}
+
+void WriteKey(AnalysisSnapshotWriter* writer, std::tuple<uint64_t, uint64_t, uint64_t> const& key)
+{
+    writer->Value(&std::get<0>(key));
+    writer->Value(&std::get<1>(key));
+    writer->Value(&std::get<2>(key));
+}
+
+template<typename Key>
+void ReadKey(AnalysisSnapshotReader* reader, Key* key)
+{
+    reader->Value(key);
+}
+
+void ReadKey(AnalysisSnapshotReader* reader, std::tuple<uint64_t, uint64_t, uint64_t>* key)
+{
+    reader->Value(&std::get<0>(*key));
+    reader->Value(&std::get<1>(*key));
+    reader->Value(&std::get<2>(*key));
+}
+
+template<typename Map>
+std::vector<std::pair<typename Map::key_type, typename Map::mapped_type const*>> SortByKey(Map const& map)
+{
+    std::vector<std::pair<typename Map::key_type, typename Map::mapped_type const*>> entries;
+    entries.reserve(map.size());
+    for (auto const& pr : map) {
+        entries.emplace_back(pr.first, &pr.second);
+    }
+    std::sort(entries.begin(), entries.end(), [](auto const& a, auto const& b) { return a.first < b.first; });
+    return entries;
+}
+
+// SnapshotPresents numbers the presents referenced by a consumer's state, while saving it.
+struct SnapshotPresents {
+    std::vector<PresentEvent const*> presents_;
+    std::unordered_map<PresentEvent const*, uint32_t> indices_;
+
+    void Add(PresentEvent const* present)
+    {
+        if (present != nullptr && indices_.emplace(present, (uint32_t) presents_.size()).second) {
+            presents_.push_back(present);
+        }
+    }
+
+    void WriteRef(AnalysisSnapshotWriter* writer, PresentEvent const* present) const
+    {
+        auto index = indices_.find(present)->second;
+        writer->Value(&index);
+    }
+
+    void WriteList(AnalysisSnapshotWriter* writer, DependentPresentList const& list) const
+    {
+        uint32_t count = 0;
+        for (auto p = list.mHead.get(); p != nullptr; p = p->DependentPresentLink.mNext.get()) {
+            count += 1;
+        }
+        writer->Count(count);
+        for (auto p = list.mHead.get(); p != nullptr; p = p->DependentPresentLink.mNext.get()) {
+            WriteRef(writer, p);
+        }
+    }
+
+    template<typename Map>
+    void WriteMap(AnalysisSnapshotWriter* writer, Map const& map) const
+    {
+        auto entries = SortByKey(map);
+        writer->Count(entries.size());
+        for (auto const& e : entries) {
+            WriteKey(writer, e.first);
+            WriteRef(writer, e.second->get());
+        }
+    }
+};
+
+PresentEventPtr ReadPresentRef(AnalysisSnapshotReader* reader, std::vector<PresentEventPtr> const& presents)
+{
+    uint32_t index = 0;
+    reader->Value(&index);
+    if (index >= presents.size()) {
+        reader->error_ = true;
+        return PresentEventPtr();
+    }
+    return presents[index];
+}
+
+void ReadPresentList(AnalysisSnapshotReader* reader, std::vector<PresentEventPtr> const& presents, DependentPresentList* list)
+{
+    auto count = reader->Count(sizeof(uint32_t));
+    for (uint32_t i = 0; i < count; ++i) {
+        auto present = ReadPresentRef(reader, presents);
+        if (present == nullptr || present->DependentPresentLink.mLinked) {
+            reader->error_ = true;
+            return;
+        }
+        list->PushBack(present);
+    }
+}
+
+template<typename Map>
+void ReadPresentMap(AnalysisSnapshotReader* reader, std::vector<PresentEventPtr> const& presents, Map* map)
+{
+    auto count = reader->Count(sizeof(uint32_t) * 2);
+    for (uint32_t i = 0; i < count; ++i) {
+        typename Map::key_type key;
+        ReadKey(reader, &key);
+        auto present = ReadPresentRef(reader, presents);
+        if (present != nullptr) {
+            map->emplace(key, present);
+        }
+    }
+}
+
+}
+
+void PMTraceConsumer::SaveSnapshot(std::vector<uint8_t>* snapshot) const
+{
+    AnalysisSnapshotWriter writer;
+    writer.data_ = snapshot;
+
+    // Number the referenced presents: tracked presents in ring order, then completed presents,
+    // then any others referenced by the lookup tables or by the DWM dependency lists.
+    SnapshotPresents presents;
+    for (auto const& present : mTrackedPresents) {
+        presents.Add(present.get());
+    }
+    for (uint32_t i = 0; i < mCompletedCount; ++i) {
+        presents.Add(mCompletedPresents[(mCompletedIndex + i) % mCompletedPresents.size()].get());
+    }
+    for (auto p = mPresentsWaitingForDWM.mHead.get(); p != nullptr; p = p->DependentPresentLink.mNext.get()) {
+        presents.Add(p);
+    }
+    for (auto const& pr : mPresentByThreadId) {
+        presents.Add(pr.second.get());
+    }
+    for (auto const& pr : mOrderedPresentsByProcessId) {
+        for (size_t i = 0, n = pr.second.size(); i < n; ++i) {
+            presents.Add(pr.second[i].get());
+        }
+    }
+    mPresentBySubmitSequence.ForEach([&](uint32_t, uint64_t, PresentEventPtr const& present) {
+        presents.Add(present.get());
+    });
+    for (auto const& pr : mPresentByWin32KPresentHistoryToken)   presents.Add(pr.second.get());
+    for (auto const& pr : mPresentByDxgkPresentHistoryToken)     presents.Add(pr.second.get());
+    for (auto const& pr : mPresentByDxgkPresentHistoryTokenData) presents.Add(pr.second.get());
+    for (auto const& pr : mPresentByDxgkContext)                 presents.Add(pr.second.get());
+    for (auto const& pr : mPresentByVidPnLayerId)                presents.Add(pr.second.get());
+    for (auto const& pr : mLastPresentByWindow)                  presents.Add(pr.second.get());
+    for (size_t i = 0; i < presents.presents_.size(); ++i) {
+        auto const& list = presents.presents_[i]->DependentPresents;
+        for (auto p = list.mHead.get(); p != nullptr; p = p->DependentPresentLink.mNext.get()) {
+            presents.Add(p);
+        }
+    }
+
+    AnalysisSnapshotHeader header = {};
+    header.magic_ = ANALYSIS_SNAPSHOT_MAGIC;
+    header.version_ = ANALYSIS_SNAPSHOT_VERSION;
+    header.config_ = (mTrackDisplay   ? (uint32_t) ANALYSIS_SNAPSHOT_TRACK_DISPLAY    : 0u) |
+                     (mTrackGPU       ? (uint32_t) ANALYSIS_SNAPSHOT_TRACK_GPU        : 0u) |
+                     (mTrackGPUVideo  ? (uint32_t) ANALYSIS_SNAPSHOT_TRACK_GPU_VIDEO  : 0u) |
+                     (mTrackInput     ? (uint32_t) ANALYSIS_SNAPSHOT_TRACK_INPUT      : 0u) |
+                     (mTrackFrameType ? (uint32_t) ANALYSIS_SNAPSHOT_TRACK_FRAME_TYPE : 0u);
+    header.presentCount_ = (uint32_t) presents.presents_.size();
+    writer.Value(&header);
+
+    // Presents
+    for (auto present : presents.presents_) {
+        SerializePresentFields(&writer, present);
+
+        writer.Count(present->PresentIds.size());
+        for (auto const& pr : present->PresentIds) {
+            writer.Value(&pr.first);
+            writer.Value(&pr.second);
+        }
+    }
+    for (auto present : presents.presents_) {
+        presents.WriteList(&writer, present->DependentPresents);
+    }
+    writer.Value(&mPresentEventPool->mNextFrameId);
+
+    // Tracked and completed presents
+    auto trackedCapacity = (uint32_t) mTrackedPresents.size();
+    writer.Value(&trackedCapacity);
+    writer.Value(&mNextFreeRingIndex);
+    uint32_t trackedCount = 0;
+    for (auto const& present : mTrackedPresents) {
+        trackedCount += present != nullptr ? 1 : 0;
+    }
+    writer.Count(trackedCount);
+    for (uint32_t i = 0, n = (uint32_t) mTrackedPresents.size(); i < n; ++i) {
+        if (mTrackedPresents[i] != nullptr) {
+            writer.Value(&i);
+            presents.WriteRef(&writer, mTrackedPresents[i].get());
+        }
+    }
+
+    auto completedCapacity = (uint32_t) mCompletedPresents.size();
+    writer.Value(&completedCapacity);
+    writer.Value(&mCompletedIndex);
+    writer.Count(mCompletedCount);
+    for (uint32_t i = 0; i < mCompletedCount; ++i) {
+        presents.WriteRef(&writer, mCompletedPresents[(mCompletedIndex + i) % mCompletedPresents.size()].get());
+    }
+
+    // Lookup tables
+    presents.WriteList(&writer, mPresentsWaitingForDWM);
+    presents.WriteMap(&writer, mPresentByThreadId);
+
+    auto orderedPresents = SortByKey(mOrderedPresentsByProcessId);
+    writer.Count(orderedPresents.size());
+    for (auto const& e : orderedPresents) {
+        writer.Value(&e.first);
+        writer.Count(e.second->size());
+        for (size_t i = 0, n = e.second->size(); i < n; ++i) {
+            presents.WriteRef(&writer, (*e.second)[i].get());
+        }
+    }
+
+    std::vector<std::tuple<uint32_t, uint64_t, PresentEvent const*>> submitSequences;
+    mPresentBySubmitSequence.ForEach([&](uint32_t sequence, uint64_t hContext, PresentEventPtr const& present) {
+        submitSequences.emplace_back(sequence, hContext, present.get());
+    });
+    std::sort(submitSequences.begin(), submitSequences.end(), [](auto const& a, auto const& b) {
+        return std::get<0>(a) != std::get<0>(b) ? std::get<0>(a) < std::get<0>(b) : std::get<1>(a) < std::get<1>(b);
+    });
+    writer.Count(submitSequences.size());
+    for (auto const& e : submitSequences) {
+        writer.Value(&std::get<0>(e));
+        writer.Value(&std::get<1>(e));
+        presents.WriteRef(&writer, std::get<2>(e));
+    }
+
+    presents.WriteMap(&writer, mPresentByWin32KPresentHistoryToken);
+    presents.WriteMap(&writer, mPresentByDxgkPresentHistoryToken);
+    presents.WriteMap(&writer, mPresentByDxgkPresentHistoryTokenData);
+    presents.WriteMap(&writer, mPresentByDxgkContext);
+    presents.WriteMap(&writer, mPresentByVidPnLayerId);
+    presents.WriteMap(&writer, mLastPresentByWindow);
+
+    // DWM, frame type, and input state
+    writer.Value(&mHasCompletedAPresent);
+    writer.Value(&DwmProcessId);
+    writer.Value(&DwmPresentThreadId);
+    writer.Value(&mEnableFlipFrameTypeEvents);
+    writer.Value(&mLastInputDeviceReadTime);
+    writer.Value(&mLastInputDeviceType);
+
+    auto presentFrameTypes = SortByKey(mPendingPresentFrameTypeEvents);
+    writer.Count(presentFrameTypes.size());
+    for (auto const& e : presentFrameTypes) {
+        writer.Value(&e.first);
+        writer.Value(&e.second->FrameId);
+        writer.Value(&e.second->FrameType);
+    }
+
+    auto flipFrameTypes = SortByKey(mPendingFlipFrameTypeEvents);
+    writer.Count(flipFrameTypes.size());
+    for (auto const& e : flipFrameTypes) {
+        writer.Value(&e.first);
+        writer.Value(&e.second->PresentId);
+        writer.Value(&e.second->Timestamp);
+        writer.Value(&e.second->FrameType);
+    }
+
+    auto retrievedInput = SortByKey(mRetrievedInput);
+    writer.Count(retrievedInput.size());
+    for (auto const& e : retrievedInput) {
+        writer.Value(&e.first);
+        writer.Value(&e.second->first);
+        writer.Value(&e.second->second);
+    }
+
+    // State sweep.  The sweep position is a bucket (or context) index, which may not refer to the
+    // same entries in the restored structures; as after a rehash, entries may then be skipped
+    // until the next pass.
+    auto exitedProcesses = SortByKey(mExitedProcesses);
+    writer.Count(exitedProcesses.size());
+    for (auto const& e : exitedProcesses) {
+        writer.Value(&e.first);
+        writer.Value(e.second);
+    }
+
+    auto sweepBucket = (uint64_t) mSweepBucket;
+    writer.Value(&mSweepPassTime);
+    writer.Value(&mNextSweepTime);
+    writer.Value(&sweepBucket);
+    writer.Value(&mSweepPhase);
+    writer.Value(&mSweepInProgress);
+
+    // Event metadata, including any that came from the trace's EventMetadata events.
+    std::vector<EventMetadataTable::Slot const*> metadata;
+    for (auto const& slot : mMetadata.metadata_.slots_) {
+        if (slot.tei_ != nullptr) {
+            metadata.push_back(&slot);
+        }
+    }
+    std::sort(metadata.begin(), metadata.end(), [](EventMetadataTable::Slot const* a, EventMetadataTable::Slot const* b) {
+        return memcmp(&a->key_, &b->key_, sizeof(EventMetadataKey)) < 0;
+    });
+    writer.Count(metadata.size());
+    for (auto slot : metadata) {
+        writer.Value(&slot->key_);
+        writer.Value(&slot->teiSize_);
+        writer.Write(slot->tei_, slot->teiSize_);
+    }
+
+    mGpuTrace.SaveSnapshot(&writer);
+
+    uint32_t magic = ANALYSIS_SNAPSHOT_MAGIC;
+    writer.Value(&magic);
+}
+
+bool PMTraceConsumer::RestoreSnapshot(uint8_t const* snapshot, size_t size)
+{
+    assert(mTrackedPresents.empty() && mCompletedCount == 0 && mOrderedPresentsByProcessId.empty());
+
+    AnalysisSnapshotReader reader;
+    reader.data_ = snapshot;
+    reader.size_ = size;
+
+    AnalysisSnapshotHeader header = {};
+    reader.Value(&header);
+
+    uint32_t config = (mTrackDisplay   ? (uint32_t) ANALYSIS_SNAPSHOT_TRACK_DISPLAY    : 0u) |
+                      (mTrackGPU       ? (uint32_t) ANALYSIS_SNAPSHOT_TRACK_GPU        : 0u) |
+                      (mTrackGPUVideo  ? (uint32_t) ANALYSIS_SNAPSHOT_TRACK_GPU_VIDEO  : 0u) |
+                      (mTrackInput     ? (uint32_t) ANALYSIS_SNAPSHOT_TRACK_INPUT      : 0u) |
+                      (mTrackFrameType ? (uint32_t) ANALYSIS_SNAPSHOT_TRACK_FRAME_TYPE : 0u);
+    if (reader.error_ ||
+        header.magic_ != ANALYSIS_SNAPSHOT_MAGIC ||
+        header.version_ != ANALYSIS_SNAPSHOT_VERSION ||
+        header.config_ != config ||
+        header.presentCount_ > (size - reader.offset_) / sizeof(uint64_t)) {
+        return false;
+    }
+
+    // Presents
+    std::vector<PresentEventPtr> presents(header.presentCount_);
+    for (auto& present : presents) {
+        present = mPresentEventPool->Allocate();
+        SerializePresentFields(&reader, present.get());
+
+        auto presentIdCount = reader.Count(sizeof(uint64_t) * 2);
+        for (uint32_t i = 0; i < presentIdCount; ++i) {
+            uint64_t vidPnLayerId = 0;
+            uint64_t presentId = 0;
+            reader.Value(&vidPnLayerId);
+            reader.Value(&presentId);
+            present->PresentIds.emplace(vidPnLayerId, presentId);
+        }
+    }
+    for (auto const& present : presents) {
+        ReadPresentList(&reader, presents, &present->DependentPresents);
+    }
+    reader.Value(&mPresentEventPool->mNextFrameId);
+
+    // Tracked and completed presents.  The ring may have grown, but no larger than the limits
+    // allow (and it is empty until the first present is created).
+    uint32_t trackedCapacity = 0;
+    reader.Value(&trackedCapacity);
+    reader.Value(&mNextFreeRingIndex);
+    auto maxTrackedCapacity = 2 * std::max<uint64_t>(mTrackedPresentRingSize, mTrackedPresentMemoryLimit / sizeof(PresentEvent));
+    if ((trackedCapacity & (trackedCapacity - 1)) != 0 ||
+        trackedCapacity > maxTrackedCapacity ||
+        mNextFreeRingIndex >= std::max(trackedCapacity, 1u)) {
+        reader.error_ = true;
+        trackedCapacity = 0;
+    }
+    mTrackedPresents.resize(trackedCapacity);
+    mTrackedPresentCapacity.store(trackedCapacity, std::memory_order_relaxed);
+
+    auto trackedCount = reader.Count(sizeof(uint32_t) * 2);
+    for (uint32_t i = 0; i < trackedCount; ++i) {
+        uint32_t ringIndex = 0;
+        reader.Value(&ringIndex);
+        auto present = ReadPresentRef(&reader, presents);
+        if (ringIndex >= mTrackedPresents.size()) {
+            reader.error_ = true;
+            break;
+        }
+        mTrackedPresents[ringIndex] = present;
+    }
+
+    uint32_t completedCapacity = 0;
+    reader.Value(&completedCapacity);
+    if ((completedCapacity & (completedCapacity - 1)) != 0 ||
+        completedCapacity < mCompletedPresents.size() ||
+        completedCapacity > std::max<uint64_t>(mCompletedPresents.size(), maxTrackedCapacity)) {
+        reader.error_ = true;
+    } else {
+        mCompletedPresents.resize(completedCapacity);
+    }
+
+    reader.Value(&mCompletedIndex);
+    auto completedCount = reader.Count(sizeof(uint32_t));
+    if (mCompletedIndex >= mCompletedPresents.size() ||
+        completedCount > mCompletedPresents.size()) {
+        reader.error_ = true;
+        completedCount = 0;
+    }
+    for (uint32_t i = 0; i < completedCount; ++i) {
+        auto present = ReadPresentRef(&reader, presents);
+        mCompletedPresents[(mCompletedIndex + i) % mCompletedPresents.size()] = DequeuedPresentPtr(present.get());
+        mCompletedCount += 1;
+        if (present != nullptr && present->DeferredReason != DeferredReason_None) {
+            AddDeferredPresent(present);
+        }
+    }
+
+    // Lookup tables
+    ReadPresentList(&reader, presents, &mPresentsWaitingForDWM);
+    ReadPresentMap(&reader, presents, &mPresentByThreadId);
+
+    auto processCount = reader.Count(sizeof(uint32_t) * 2);
+    for (uint32_t i = 0; i < processCount; ++i) {
+        uint32_t processId = 0;
+        reader.Value(&processId);
+        auto orderedPresents = &mOrderedPresentsByProcessId[processId];
+        auto presentCount = reader.Count(sizeof(uint32_t));
+        for (uint32_t j = 0; j < presentCount; ++j) {
+            auto present = ReadPresentRef(&reader, presents);
+            if (present != nullptr && !orderedPresents->Insert(present)) {
+                reader.error_ = true;
+            }
+        }
+    }
+
+    auto submitSequenceCount = reader.Count(sizeof(uint32_t) * 2 + sizeof(uint64_t));
+    for (uint32_t i = 0; i < submitSequenceCount; ++i) {
+        uint32_t sequence = 0;
+        uint64_t hContext = 0;
+        reader.Value(&sequence);
+        reader.Value(&hContext);
+        auto present = ReadPresentRef(&reader, presents);
+        if (present != nullptr) {
+            mPresentBySubmitSequence.Insert(sequence, hContext, present);
+        }
+    }
+
+    ReadPresentMap(&reader, presents, &mPresentByWin32KPresentHistoryToken);
+    ReadPresentMap(&reader, presents, &mPresentByDxgkPresentHistoryToken);
+    ReadPresentMap(&reader, presents, &mPresentByDxgkPresentHistoryTokenData);
+    ReadPresentMap(&reader, presents, &mPresentByDxgkContext);
+    ReadPresentMap(&reader, presents, &mPresentByVidPnLayerId);
+    ReadPresentMap(&reader, presents, &mLastPresentByWindow);
+
+    // DWM, frame type, and input state
+    reader.Value(&mHasCompletedAPresent);
+    reader.Value(&DwmProcessId);
+    reader.Value(&DwmPresentThreadId);
+    reader.Value(&mEnableFlipFrameTypeEvents);
+    reader.Value(&mLastInputDeviceReadTime);
+    reader.Value(&mLastInputDeviceType);
+
+    auto presentFrameTypeCount = reader.Count(sizeof(uint32_t) * 3);
+    for (uint32_t i = 0; i < presentFrameTypeCount; ++i) {
+        uint32_t threadId = 0;
+        PresentFrameTypeEvent event = {};
+        reader.Value(&threadId);
+        reader.Value(&event.FrameId);
+        reader.Value(&event.FrameType);
+        mPendingPresentFrameTypeEvents.emplace(threadId, event);
+    }
+
+    auto flipFrameTypeCount = reader.Count(sizeof(uint64_t) * 3);
+    for (uint32_t i = 0; i < flipFrameTypeCount; ++i) {
+        uint64_t vidPnLayerId = 0;
+        FlipFrameTypeEvent event = {};
+        reader.Value(&vidPnLayerId);
+        reader.Value(&event.PresentId);
+        reader.Value(&event.Timestamp);
+        reader.Value(&event.FrameType);
+        mPendingFlipFrameTypeEvents.emplace(vidPnLayerId, event);
+    }
+
+    auto retrievedInputCount = reader.Count(sizeof(uint32_t) + sizeof(uint64_t));
+    for (uint32_t i = 0; i < retrievedInputCount; ++i) {
+        uint32_t processId = 0;
+        std::pair<uint64_t, InputDeviceType> input;
+        reader.Value(&processId);
+        reader.Value(&input.first);
+        reader.Value(&input.second);
+        mRetrievedInput.emplace(processId, input);
+    }
+
+    // State sweep
+    auto exitedProcessCount = reader.Count(sizeof(uint32_t) + sizeof(uint64_t));
+    for (uint32_t i = 0; i < exitedProcessCount; ++i) {
+        uint32_t processId = 0;
+        uint64_t stopTime = 0;
+        reader.Value(&processId);
+        reader.Value(&stopTime);
+        mExitedProcesses.emplace(processId, stopTime);
+    }
+
+    uint64_t sweepBucket = 0;
+    reader.Value(&mSweepPassTime);
+    reader.Value(&mNextSweepTime);
+    reader.Value(&sweepBucket);
+    reader.Value(&mSweepPhase);
+    reader.Value(&mSweepInProgress);
+    mSweepBucket = (size_t) sweepBucket;
+
+    // Event metadata
+    auto metadataCount = reader.Count(sizeof(EventMetadataKey) + sizeof(uint32_t));
+    std::vector<uint8_t> tei;
+    for (uint32_t i = 0; i < metadataCount && !reader.error_; ++i) {
+        EventMetadataKey key = {};
+        uint32_t teiSize = 0;
+        reader.Value(&key);
+        reader.Value(&teiSize);
+        if (teiSize > size - reader.offset_) {
+            reader.error_ = true;
+            break;
+        }
+        tei.resize(teiSize);
+        reader.Read(tei.data(), teiSize);
+        mMetadata.AddEventInfo(key, tei.data(), teiSize);
+    }
+
+    mGpuTrace.RestoreSnapshot(&reader);
+
+    uint32_t magic = 0;
+    reader.Value(&magic);
+    if (reader.error_ || magic != ANALYSIS_SNAPSHOT_MAGIC || reader.offset_ != size) {
+        return false;
+    }
+
+    // Hand off any completed presents that were only held back because mReadyPresents was full.
+    PublishCompletedPresents();
+    return true;
+}
+
+void GpuTrace::SaveSnapshot(AnalysisSnapshotWriter* writer) const
+{
+    // PacketTraces are referenced by their process id and engine, and adapter nodes by their
+    // adapter and node ordinal.  HwQueue contexts own their node, so it is written with them.
+    std::unordered_map<PacketTrace const*, std::pair<uint32_t, uint32_t>> packetTraceRefs;
+    for (auto const& pr : mProcessFrameInfo) {
+        packetTraceRefs.emplace(&pr.second.mVideoEngines, std::make_pair(pr.first, (uint32_t) SNAPSHOT_PACKET_TRACE_VIDEO));
+        packetTraceRefs.emplace(&pr.second.mOtherEngines, std::make_pair(pr.first, (uint32_t) SNAPSHOT_PACKET_TRACE_OTHER));
+    }
+
+    auto writePacketTraceRef = [&](PacketTrace const* packetTrace) {
+        auto ref = std::make_pair(0u, (uint32_t) SNAPSHOT_PACKET_TRACE_NONE);
+        auto ii = packetTraceRefs.find(packetTrace);
+        if (ii != packetTraceRefs.end()) {
+            ref = ii->second;
+        }
+        writer->Value(&ref.first);
+        writer->Value(&ref.second);
+    };
+
+    auto writePacketTrace = [&](PacketTrace const& packetTrace) {
+        writer->Value(&packetTrace.mFirstPacketTime);
+        writer->Value(&packetTrace.mLastPacketTime);
+        writer->Value(&packetTrace.mAccumulatedPacketTime);
+        writer->Value(&packetTrace.mRunningPacketStartTime);
+        writer->Value(&packetTrace.mRunningPacketCount);
+    };
+
+    auto writeNode = [&](Node const& node) {
+        writer->Value(&node.mQueueIndex);
+        writer->Value(&node.mQueueCount);
+        writer->Value(&node.mAdapter);
+        writer->Value(&node.mEngineType);
+        writer->Value(&node.mIsVideo);
+        writer->Count(node.mQueue.size());
+        for (auto const& packet : node.mQueue) {
+            writePacketTraceRef(packet.mPacketTrace);
+            writer->Value(&packet.mSequenceId);
+            writer->Value(&packet.mCompleted);
+        }
+    };
+
+    auto devices = SortByKey(mDevices);
+    writer->Count(devices.size());
+    for (auto const& e : devices) {
+        writer->Value(&e.first);
+        writer->Value(e.second);
+    }
+
+    auto processFrameInfo = SortByKey(mProcessFrameInfo);
+    writer->Count(processFrameInfo.size());
+    for (auto const& e : processFrameInfo) {
+        writer->Value(&e.first);
+        writePacketTrace(e.second->mVideoEngines);
+        writePacketTrace(e.second->mOtherEngines);
+    }
+
+    // Nodes and contexts are saved by their (pDxgAdapter, NodeOrdinal) and hContext rather than
+    // their indices, which depend on the order they were registered in.
+    std::unordered_map<uint32_t, std::pair<uint64_t, uint32_t>> nodeRefs; // node index -> (pDxgAdapter, NodeOrdinal)
+    auto adapters = SortByKey(mAdapterNodes);
+    writer->Count(adapters.size());
+    for (auto const& adapter : adapters) {
+        auto const& nodeIndices = *adapter.second;
+        writer->Value(&adapter.first);
+        writer->Count((size_t) std::count_if(nodeIndices.begin(), nodeIndices.end(),
+                                             [](uint32_t nodeIndex) { return nodeIndex != HandleIndexTable::INVALID_INDEX; }));
+        for (uint32_t nodeOrdinal = 0, n = (uint32_t) nodeIndices.size(); nodeOrdinal < n; ++nodeOrdinal) {
+            auto nodeIndex = nodeIndices[nodeOrdinal];
+            if (nodeIndex != HandleIndexTable::INVALID_INDEX) {
+                nodeRefs.emplace(nodeIndex, std::make_pair(adapter.first, nodeOrdinal));
+                writer->Value(&nodeOrdinal);
+                writeNode(mNodes[nodeIndex]);
+            }
+        }
+    }
+
+    std::vector<Context const*> contexts;
+    for (auto const& context : mContexts) {
+        if (context.mIsAllocated) {
+            contexts.push_back(&context);
+        }
+    }
+    std::sort(contexts.begin(), contexts.end(), [](Context const* a, Context const* b) { return a->mHandle < b->mHandle; });
+    writer->Count(contexts.size());
+    for (auto context : contexts) {
+        writer->Value(&context->mHandle);
+        writePacketTraceRef(context->mPacketTrace);
+        writer->Value(&context->mParentContext);
+        writer->Value(&context->mIsParentContext);
+        writer->Value(&context->mIsHwQueue);
+        if (context->mIsHwQueue) {
+            writeNode(mNodes[context->mNodeIndex]);
+        } else {
+            auto ref = nodeRefs.find(context->mNodeIndex)->second;
+            writer->Value(&ref.first);
+            writer->Value(&ref.second);
+        }
+    }
+
+    auto pagingSequenceIds = SortByKey(mPagingSequenceIds);
+    writer->Count(pagingSequenceIds.size());
+    for (auto const& e : pagingSequenceIds) {
+        writer->Value(&e.first);
+        writer->Value(e.second);
+    }
+}
+
+void GpuTrace::RestoreSnapshot(AnalysisSnapshotReader* reader)
+{
+    assert(mContexts.empty() && mNodes.empty());
+
+    auto readPacketTraceRef = [&](uint32_t* processIdOut) -> PacketTrace* {
+        uint32_t processId = 0;
+        uint32_t engine = SNAPSHOT_PACKET_TRACE_NONE;
+        reader->Value(&processId);
+        reader->Value(&engine);
+        if (processIdOut != nullptr) {
+            *processIdOut = engine == SNAPSHOT_PACKET_TRACE_NONE ? 0 : processId;
+        }
+        switch (engine) {
+        case SNAPSHOT_PACKET_TRACE_NONE:  return nullptr;
+        case SNAPSHOT_PACKET_TRACE_VIDEO: return &mProcessFrameInfo[processId].mVideoEngines;
+        case SNAPSHOT_PACKET_TRACE_OTHER: return &mProcessFrameInfo[processId].mOtherEngines;
+        }
+        reader->error_ = true;
+        return nullptr;
+    };
+
+    auto readPacketTrace = [&](PacketTrace* packetTrace) {
+        reader->Value(&packetTrace->mFirstPacketTime);
+        reader->Value(&packetTrace->mLastPacketTime);
+        reader->Value(&packetTrace->mAccumulatedPacketTime);
+        reader->Value(&packetTrace->mRunningPacketStartTime);
+        reader->Value(&packetTrace->mRunningPacketCount);
+    };
+
+    // The queued packets are repacked into a power-of-two ring, starting at index 0.
+    auto readNode = [&](uint32_t nodeIndex) {
+        uint32_t queueIndex = 0;
+        uint32_t queueCount = 0;
+        uint64_t adapter = 0;
+        Microsoft_Windows_DxgKrnl::DXGK_ENGINE engineType = Microsoft_Windows_DxgKrnl::DXGK_ENGINE::OTHER;
+        bool isVideo = false;
+        reader->Value(&queueIndex);
+        reader->Value(&queueCount);
+        reader->Value(&adapter);
+        reader->Value(&engineType);
+        reader->Value(&isVideo);
+        std::vector<Node::EnqueuedPacket> packets(reader->Count(sizeof(uint32_t) * 3));
+        for (auto& packet : packets) {
+            packet.mPacketTrace = readPacketTraceRef(nullptr);
+            reader->Value(&packet.mSequenceId);
+            reader->Value(&packet.mCompleted);
+        }
+        if (queueCount > packets.size() || (queueIndex >= packets.size() && !packets.empty())) {
+            reader->error_ = true;
+            queueIndex = 0;
+            queueCount = 0;
+        }
+
+        // Queues are power-of-two rings; one saved by a build that grew them
+        // differently is repacked into one.
+        auto node = &mNodes[nodeIndex];
+        auto packetCount = (uint32_t) packets.size();
+        if ((packetCount & (packetCount - 1)) == 0) {
+            node->mQueue.swap(packets);
+            node->mQueueIndex = packetCount == 0 ? 0 : queueIndex;
+        } else {
+            uint32_t queueSize = QUEUE_INITIAL_SIZE;
+            while (queueSize < queueCount) {
+                queueSize *= 2;
+            }
+            node->mQueue.resize(queueSize);
+            for (uint32_t i = 0; i < queueCount; ++i) {
+                node->mQueue[i] = packets[(queueIndex + i) % packetCount];
+            }
+            node->mQueueIndex = 0;
+        }
+        node->mQueueCount = queueCount;
+        node->mAdapter = adapter;
+        node->mEngineType = engineType;
+        node->mIsVideo = isVideo;
+    };
+
+    auto deviceCount = reader->Count(sizeof(uint64_t) * 2);
+    for (uint32_t i = 0; i < deviceCount; ++i) {
+        uint64_t hDevice = 0;
+        uint64_t pDxgAdapter = 0;
+        reader->Value(&hDevice);
+        reader->Value(&pDxgAdapter);
+        mDevices.emplace(hDevice, pDxgAdapter);
+    }
+
+    auto processCount = reader->Count(sizeof(uint32_t));
+    for (uint32_t i = 0; i < processCount; ++i) {
+        uint32_t processId = 0;
+        reader->Value(&processId);
+        auto frameInfo = &mProcessFrameInfo[processId];
+        readPacketTrace(&frameInfo->mVideoEngines);
+        readPacketTrace(&frameInfo->mOtherEngines);
+    }
+
+    auto adapterCount = reader->Count(sizeof(uint64_t) + sizeof(uint32_t));
+    for (uint32_t i = 0; i < adapterCount; ++i) {
+        uint64_t pDxgAdapter = 0;
+        reader->Value(&pDxgAdapter);
+        auto nodeCount = reader->Count(sizeof(uint32_t) * 3);
+        for (uint32_t j = 0; j < nodeCount && !reader->error_; ++j) {
+            uint32_t nodeOrdinal = 0;
+            reader->Value(&nodeOrdinal);
+            if (nodeOrdinal > UINT16_MAX) {
+                reader->error_ = true;
+                break;
+            }
+            readNode(FindOrCreateAdapterNode(pDxgAdapter, nodeOrdinal));
+        }
+    }
+
+    auto contextCount = reader->Count(sizeof(uint64_t) * 2);
+    for (uint32_t i = 0; i < contextCount && !reader->error_; ++i) {
+        uint64_t hContext = 0;
+        reader->Value(&hContext);
+        if (mContextIndices.Find(hContext) != HandleIndexTable::INVALID_INDEX) {
+            reader->error_ = true;
+            break;
+        }
+
+        Context context = {};
+        context.mPacketTrace = readPacketTraceRef(&context.mProcessId);
+        reader->Value(&context.mParentContext);
+        reader->Value(&context.mIsParentContext);
+        reader->Value(&context.mIsHwQueue);
+        if (context.mIsHwQueue) {
+            context.mNodeIndex = AllocateNode();
+            readNode(context.mNodeIndex);
+        } else {
+            uint64_t pDxgAdapter = 0;
+            uint32_t nodeOrdinal = 0;
+            reader->Value(&pDxgAdapter);
+            reader->Value(&nodeOrdinal);
+
+            auto ii = mAdapterNodes.find(pDxgAdapter);
+            if (ii == mAdapterNodes.end() || nodeOrdinal >= ii->second.size() || ii->second[nodeOrdinal] == HandleIndexTable::INVALID_INDEX) {
+                reader->error_ = true;
+                break;
+            }
+            context.mNodeIndex = ii->second[nodeOrdinal];
+        }
+
+        auto contextIndex = AllocateContext(hContext, 0);
+        context.mHandle = hContext;
+        context.mIsAllocated = true;
+        mContexts[contextIndex] = context;
+    }
+
+    auto pagingSequenceIdCount = reader->Count(sizeof(uint64_t) + sizeof(uint32_t));
+    for (uint32_t i = 0; i < pagingSequenceIdCount; ++i) {
+        uint64_t sequenceId = 0;
+        uint32_t processId = 0;
+        reader->Value(&sequenceId);
+        reader->Value(&processId);
+        mPagingSequenceIds.emplace(sequenceId, processId);
+    }
+}
@@ -0,0 +1,126 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// An analysis snapshot is the in-flight analysis state of a PMTraceConsumer
+// (and its GpuTrace) at some point in a trace.  A new consumer restored from
+// the snapshot continues the analysis as if it had handled every event before
+// that point, so separate parts of a long trace can be analyzed in parallel:
+// snapshots are taken periodically while handling the trace once, and each
+// worker then restores one and handles the events after it.
+//
+// The snapshot includes the tracked presents (with their ring indices and DWM
+// dependencies) and the next FrameId to assign, completed presents that haven't been handed off for
+// dequeuing yet, the DWM, frame type, and input state, the state sweep's
+// exited processes and position, the event metadata, and GpuTrace's devices,
+// nodes, contexts, and per-process packet state.  It
+// doesn't include presents or process events that were already handed off,
+// since they belong to the output before the snapshot; nor the consumer's
+// configuration, which must match (the snapshot is rejected if the tracking
+// options differ).
+//
+// Since presents that started before the snapshot are completed by both the
+// worker that restored it and the worker analyzing the preceding events, the
+// workers should only output presents whose PresentStartTime is within their
+// own part of the trace.
+//
+// A snapshot is an AnalysisSnapshotHeader followed by the serialized state
+// and ANALYSIS_SNAPSHOT_MAGIC again, to detect truncation.  Containers are
+// written as a uint32_t count followed by their entries, sorted by key so
+// that the same state always produces the same snapshot, and presents are
+// referenced by their index in the snapshot's present array.  All values are
+// little-endian, and a snapshot is only valid for the same build.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+enum : uint32_t {
+    ANALYSIS_SNAPSHOT_MAGIC   = 0x53414d50, // "PMAS"
+    ANALYSIS_SNAPSHOT_VERSION = 6,
+};
+
+// Consumer options that the snapshot depends on.
+enum : uint32_t {
+    ANALYSIS_SNAPSHOT_TRACK_DISPLAY    = 1 << 0,
+    ANALYSIS_SNAPSHOT_TRACK_GPU        = 1 << 1,
+    ANALYSIS_SNAPSHOT_TRACK_GPU_VIDEO  = 1 << 2,
+    ANALYSIS_SNAPSHOT_TRACK_INPUT      = 1 << 3,
+    ANALYSIS_SNAPSHOT_TRACK_FRAME_TYPE = 1 << 4,
+};
+
+struct AnalysisSnapshotHeader {
+    uint32_t magic_;
+    uint32_t version_;
+    uint32_t config_;               // ANALYSIS_SNAPSHOT_TRACK_* flags
+    uint32_t presentCount_;
+};
+
+static_assert(sizeof(AnalysisSnapshotHeader) == 16, "Unexpected AnalysisSnapshotHeader size");
+
+// The writer appends to data_.  Value() is used for trivially-copyable
+// values without padding; structures with padding are written a field at a
+// time so that snapshots are reproducible.
+struct AnalysisSnapshotWriter {
+    std::vector<uint8_t>* data_;
+
+    void Write(void const* data, size_t size)
+    {
+        auto p = (uint8_t const*) data;
+        data_->insert(data_->end(), p, p + size);
+    }
+
+    template<typename T> void Value(T const* value) { Write(value, sizeof(T)); }
+
+    void Count(size_t count)
+    {
+        auto c = (uint32_t) count;
+        Value(&c);
+    }
+};
+
+// The reader sets error_, and zero-fills the remaining values, if it reads
+// past the end of the data or the caller finds an invalid value.  Callers
+// only need to check error_ once they are done.
+struct AnalysisSnapshotReader {
+    uint8_t const* data_;
+    size_t size_;
+    size_t offset_ = 0;
+    bool error_ = false;
+
+    void Read(void* data, size_t size)
+    {
+        if (error_ || size > size_ - offset_) {
+            error_ = true;
+            memset(data, 0, size);
+            return;
+        }
+
+        memcpy(data, data_ + offset_, size);
+        offset_ += size;
+    }
+
+    template<typename T> void Value(T* value) { Read(value, sizeof(T)); }
+
+    void Value(bool* value)
+    {
+        uint8_t b = 0;
+        Read(&b, sizeof(b));
+        error_ |= b > 1;
+        *value = b == 1;
+    }
+
+    // Each entry takes at least minEntrySize bytes, so a count larger than the
+    // remaining data can be rejected before anything is allocated for it.
+    uint32_t Count(size_t minEntrySize)
+    {
+        uint32_t count = 0;
+        Value(&count);
+        if (minEntrySize > 0 && count > (size_ - offset_) / minEntrySize) {
+            error_ = true;
+            count = 0;
+        }
+        return count;
+    }
+};
@@ -205,18 +205,18 @@ void PrintFrameType(FrameType type)
     }
 }
 
-void PrintEventHeader(EVENT_HEADER const& hdr)
+void PrintEventHeader(PMEventHeader const& hdr)
 {
     wprintf(L"%16hs %5u %5u ", AddCommas(ConvertTimestampToNs(hdr.TimeStamp.QuadPart)), hdr.ProcessId, hdr.ThreadId);
 }
 
-void PrintEventHeader(EVENT_HEADER const& hdr, char const* name)
+void PrintEventHeader(PMEventHeader const& hdr, char const* name)
 {
     PrintEventHeader(hdr);
     wprintf(L"%hs\n", name);
 }
 
-void PrintEventHeader(EVENT_RECORD* eventRecord, EventMetadata* metadata, char const* name, std::initializer_list<void*> props)
+void PrintEventHeader(PMEventRecord* eventRecord, EventMetadata* metadata, char const* name, std::initializer_list<void*> props)
 {
     assert((props.size() % 2) == 0);
 
@@ -378,7 +378,7 @@ void DebugAssertImpl(wchar_t const* msg, wchar_t const* file, int line)
     }
 }
 
-void VerboseTraceEventImpl(PMTraceConsumer* pmConsumer, EVENT_RECORD* eventRecord, EventMetadata* metadata)
+void VerboseTraceEventImpl(PMTraceConsumer* pmConsumer, PMEventRecord* eventRecord, EventMetadata* metadata)
 {
     auto const& hdr = eventRecord->EventHeader;
 
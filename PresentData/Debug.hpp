@@ -14,7 +14,7 @@
 struct PresentEvent; // Can't include PresentMonTraceConsumer.hpp because it includes Debug.hpp (before defining PresentEvent)
 struct PMTraceConsumer;
 struct EventMetadata;
-struct _EVENT_RECORD;
+struct PMEventRecord;
 union _LARGE_INTEGER;
 
 #if PRESENTMON_ENABLE_DEBUG_TRACE
@@ -27,7 +27,7 @@ bool IsVerboseTraceEnabled();
 void DebugAssertImpl(wchar_t const* msg, wchar_t const* file, int line);
 #define DebugAssertWide1(x) L##x
 #define DebugAssertWide2(x) DebugAssertWide1(x)
-#define DebugAssert(condition) !!(condition) || (DebugAssertImpl(L#condition, DebugAssertWide2(__FILE__), __LINE__), false)
+#define DebugAssert(condition) !!(condition) || (DebugAssertImpl(DebugAssertWide1(#condition), DebugAssertWide2(__FILE__), __LINE__), false)
 
 // Should call this before modifying a PresentEvent member; causes those changes to be
 // included in the verbose trace.
@@ -35,7 +35,7 @@ void VerboseTraceBeforeModifyingPresentImpl(PresentEvent const* p);
 #define VerboseTraceBeforeModifyingPresent(p) !IsVerboseTraceEnabled() || (VerboseTraceBeforeModifyingPresentImpl(p), false)
 
 // Print debug information about the handled event
-void VerboseTraceEventImpl(PMTraceConsumer* pmConsumer, _EVENT_RECORD* eventRecord, EventMetadata* metadata);
+void VerboseTraceEventImpl(PMTraceConsumer* pmConsumer, PMEventRecord* eventRecord, EventMetadata* metadata);
 #define VerboseTraceEvent(c, e, m) !IsVerboseTraceEnabled() || (VerboseTraceEventImpl(c, e, m), false)
 
 #else
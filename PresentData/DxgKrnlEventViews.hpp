@@ -0,0 +1,99 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// Fixed-layout views of the highest-frequency Microsoft-Windows-DxgKrnl
+// events.  Member names match the event property names.  Pointer-size
+// properties are stored as uint64_t.
+//
+// These are decoded with EventMetadata::GetEventView(), which validates each
+// view against the event metadata once and then copies the properties directly
+// from their offsets, falling back to the generic metadata decoder if the
+// layout ever changes (e.g., on a new OS build).
+#pragma once
+
+#include "TraceConsumer.hpp"
+
+namespace Microsoft_Windows_DxgKrnl {
+
+#define EVENT_VIEW_FIELDS(...) \
+    static EventViewField const* Fields(uint32_t* count) \
+    { \
+        static EventViewField const fields[] = { __VA_ARGS__ }; \
+        *count = _countof(fields); \
+        return fields; \
+    }
+
+struct QueuePacket_Start_View {
+    uint32_t PacketType;
+    uint32_t SubmitSequence;
+    uint64_t hContext;
+    BOOL     bPresent;
+
+    EVENT_VIEW_FIELDS(
+        EVENT_VIEW_FIELD(QueuePacket_Start_View, PacketType),
+        EVENT_VIEW_FIELD(QueuePacket_Start_View, SubmitSequence),
+        EVENT_VIEW_FIELD(QueuePacket_Start_View, hContext),
+        EVENT_VIEW_FIELD(QueuePacket_Start_View, bPresent))
+};
+
+// Used for QueuePacket_Start_2 and QueuePacket_Stop
+struct QueuePacket_View {
+    uint64_t hContext;
+    uint32_t SubmitSequence;
+
+    EVENT_VIEW_FIELDS(
+        EVENT_VIEW_FIELD(QueuePacket_View, hContext),
+        EVENT_VIEW_FIELD(QueuePacket_View, SubmitSequence))
+};
+
+// Used for DmaPacket_Start and DmaPacket_Info
+struct DmaPacket_View {
+    uint64_t hContext;
+    uint32_t ulQueueSubmitSequence;
+
+    EVENT_VIEW_FIELDS(
+        EVENT_VIEW_FIELD(DmaPacket_View, hContext),
+        EVENT_VIEW_FIELD(DmaPacket_View, ulQueueSubmitSequence))
+};
+
+struct VSyncDPC_Info_View {
+    uint64_t FlipFenceId;
+
+    EVENT_VIEW_FIELDS(
+        EVENT_VIEW_FIELD(VSyncDPC_Info_View, FlipFenceId))
+};
+
+struct MMIOFlip_Info_View {
+    uint32_t FlipSubmitSequence;
+    uint32_t Flags;
+
+    EVENT_VIEW_FIELDS(
+        EVENT_VIEW_FIELD(MMIOFlip_Info_View, FlipSubmitSequence),
+        EVENT_VIEW_FIELD(MMIOFlip_Info_View, Flags))
+};
+
+// FlipEntryStatusAfterFlip is only present in version >= 2
+struct MMIOFlipMultiPlaneOverlay_Info_View {
+    uint64_t FlipSubmitSequence;
+    uint32_t FlipEntryStatusAfterFlip;
+
+    EVENT_VIEW_FIELDS(
+        EVENT_VIEW_FIELD(MMIOFlipMultiPlaneOverlay_Info_View, FlipSubmitSequence),
+        EVENT_VIEW_OPTIONAL_FIELD(MMIOFlipMultiPlaneOverlay_Info_View, FlipEntryStatusAfterFlip))
+};
+
+#undef EVENT_VIEW_FIELDS
+
+// The validated layout of each view, per event.
+struct EventViewLayouts {
+    EventViewLayout QueuePacket_Start;
+    EventViewLayout QueuePacket_Start_2;
+    EventViewLayout QueuePacket_Stop;
+    EventViewLayout DmaPacket_Start;
+    EventViewLayout DmaPacket_Info;
+    EventViewLayout VSyncDPC_Info;
+    EventViewLayout MMIOFlip_Info;
+    EventViewLayout MMIOFlipMultiPlaneOverlay_Info;
+};
+
+}
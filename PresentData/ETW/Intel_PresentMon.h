@@ -7,8 +7,7 @@
 
 namespace Intel_PresentMon {
 
-struct __declspec(uuid("{ECAA4712-4644-442F-B94C-A32F6CF8A499}")) GUID_STRUCT;
-static const auto GUID = __uuidof(GUID_STRUCT);
+static const auto GUID = ParseGuid("{ECAA4712-4644-442F-B94C-A32F6CF8A499}");
 
 enum class Keyword : uint64_t {
     FrameTypes = 0x1,
@@ -26,7 +25,7 @@ enum class Level : uint8_t {
     static uint8_t  const Level   = level_; \
     static uint8_t  const Opcode  = opcode_; \
     static uint16_t const Task    = task_; \
-    static Keyword  const Keyword = (Keyword) keyword_; \
+    static enum Keyword const Keyword = (enum Keyword) keyword_; \
 }
 
 EVENT_DESCRIPTOR_DECL(FlipFrameType_Info   , 0x0002, 0x00, 0x00, 0x04, 0x00, 0x0002, 0x0000000000000001);
@@ -47,12 +46,12 @@ struct FlipFrameType_Info_Props {
     uint32_t VidPnSourceId;
     uint32_t LayerIndex;
     uint64_t PresentId;
-    FrameType FrameType;
+    enum FrameType FrameType;
 };
 
 struct PresentFrameType_Info_Props {
     uint32_t FrameId;
-    FrameType FrameType;
+    enum FrameType FrameType;
 };
 
 #pragma pack(pop)
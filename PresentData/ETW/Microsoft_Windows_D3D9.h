@@ -8,8 +8,7 @@
 
 namespace Microsoft_Windows_D3D9 {
 
-struct __declspec(uuid("{783ACA0A-790E-4D7F-8451-AA850511C6B9}")) GUID_STRUCT;
-static const auto GUID = __uuidof(GUID_STRUCT);
+static const auto GUID = ParseGuid("{783ACA0A-790E-4D7F-8451-AA850511C6B9}");
 
 enum class Keyword : uint64_t {
     Events                               = 0x2,
@@ -32,7 +31,7 @@ enum class Channel : uint8_t {
     static uint8_t  const Level   = level_; \
     static uint8_t  const Opcode  = opcode_; \
     static uint16_t const Task    = task_; \
-    static Keyword  const Keyword = (Keyword) keyword_; \
+    static enum Keyword const Keyword = (enum Keyword) keyword_; \
 };
 
 EVENT_DESCRIPTOR_DECL(Present_Start, 0x0001, 0x00, 0x10, 0x00, 0x01, 0x0001, 0x8000000000000002)
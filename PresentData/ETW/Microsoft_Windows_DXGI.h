@@ -8,8 +8,7 @@
 
 namespace Microsoft_Windows_DXGI {
 
-struct __declspec(uuid("{CA11C036-0102-4A2D-A6AD-F03CFED5D3C9}")) GUID_STRUCT;
-static const auto GUID = __uuidof(GUID_STRUCT);
+static const auto GUID = ParseGuid("{CA11C036-0102-4A2D-A6AD-F03CFED5D3C9}");
 
 enum class Keyword : uint64_t {
     Objects                         = 0x1,
@@ -36,7 +35,7 @@ enum class Channel : uint8_t {
     static uint8_t  const Level   = level_; \
     static uint8_t  const Opcode  = opcode_; \
     static uint16_t const Task    = task_; \
-    static Keyword  const Keyword = (Keyword) keyword_; \
+    static enum Keyword const Keyword = (enum Keyword) keyword_; \
 };
 
 EVENT_DESCRIPTOR_DECL(PresentMultiplaneOverlay_Start, 0x0037, 0x00, 0x10, 0x00, 0x01, 0x000e, 0x8000000000000002)
@@ -8,8 +8,7 @@
 
 namespace Microsoft_Windows_Dwm_Core {
 
-struct __declspec(uuid("{9E9BBA3C-2E38-40CB-99F4-9E8281425164}")) GUID_STRUCT;
-static const auto GUID = __uuidof(GUID_STRUCT);
+static const auto GUID = ParseGuid("{9E9BBA3C-2E38-40CB-99F4-9E8281425164}");
 
 enum class Keyword : uint64_t {
     Composition                           = 0x1,
@@ -52,7 +51,7 @@ enum class Channel : uint8_t {
     static uint8_t  const Level   = level_; \
     static uint8_t  const Opcode  = opcode_; \
     static uint16_t const Task    = task_; \
-    static Keyword  const Keyword = (Keyword) keyword_; \
+    static enum Keyword const Keyword = (enum Keyword) keyword_; \
 }
 
 EVENT_DESCRIPTOR_DECL(MILEVENT_MEDIA_UCE_PROCESSPRESENTHISTORY_GetPresentHistory_Info, 0x0040, 0x00, 0x10, 0x05, 0x00, 0x003f, 0x8000000000000001);
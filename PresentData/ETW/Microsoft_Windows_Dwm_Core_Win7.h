@@ -5,8 +5,7 @@
 namespace Microsoft_Windows_Dwm_Core {
 namespace Win7 {
 
-struct __declspec(uuid("{8c9dd1ad-e6e5-4b07-b455-684a9d879900}")) GUID_STRUCT;
-static const auto GUID = __uuidof(GUID_STRUCT);
+static const auto GUID = ParseGuid("{8c9dd1ad-e6e5-4b07-b455-684a9d879900}");
 
 }
 }
@@ -5,20 +5,13 @@
 namespace Microsoft_Windows_DxgKrnl {
 namespace Win7 {
 
-struct __declspec(uuid("{65cd4c8a-0848-4583-92a0-31c0fbaf00c0}")) GUID_STRUCT;
-struct __declspec(uuid("{069f67f2-c380-4a65-8a61-071cd4a87275}")) BLT_GUID_STRUCT;
-struct __declspec(uuid("{22412531-670b-4cd3-81d1-e709c154ae3d}")) FLIP_GUID_STRUCT;
-struct __declspec(uuid("{c19f763a-c0c1-479d-9f74-22abfc3a5f0a}")) PRESENTHISTORY_GUID_STRUCT;
-struct __declspec(uuid("{295e0d8e-51ec-43b8-9cc6-9f79331d27d6}")) QUEUEPACKET_GUID_STRUCT;
-struct __declspec(uuid("{5ccf1378-6b2c-4c0f-bd56-8eeb9e4c5c77}")) VSYNCDPC_GUID_STRUCT;
-struct __declspec(uuid("{547820fe-5666-4b41-93dc-6cfd5dea28cc}")) MMIOFLIP_GUID_STRUCT;
-static const auto GUID                = __uuidof(GUID_STRUCT);
-static const auto BLT_GUID            = __uuidof(BLT_GUID_STRUCT);
-static const auto FLIP_GUID           = __uuidof(FLIP_GUID_STRUCT);
-static const auto PRESENTHISTORY_GUID = __uuidof(PRESENTHISTORY_GUID_STRUCT);
-static const auto QUEUEPACKET_GUID    = __uuidof(QUEUEPACKET_GUID_STRUCT);
-static const auto VSYNCDPC_GUID       = __uuidof(VSYNCDPC_GUID_STRUCT);
-static const auto MMIOFLIP_GUID       = __uuidof(MMIOFLIP_GUID_STRUCT);
+static const auto GUID                = ParseGuid("{65cd4c8a-0848-4583-92a0-31c0fbaf00c0}");
+static const auto BLT_GUID            = ParseGuid("{069f67f2-c380-4a65-8a61-071cd4a87275}");
+static const auto FLIP_GUID           = ParseGuid("{22412531-670b-4cd3-81d1-e709c154ae3d}");
+static const auto PRESENTHISTORY_GUID = ParseGuid("{c19f763a-c0c1-479d-9f74-22abfc3a5f0a}");
+static const auto QUEUEPACKET_GUID    = ParseGuid("{295e0d8e-51ec-43b8-9cc6-9f79331d27d6}");
+static const auto VSYNCDPC_GUID       = ParseGuid("{5ccf1378-6b2c-4c0f-bd56-8eeb9e4c5c77}");
+static const auto MMIOFLIP_GUID       = ParseGuid("{547820fe-5666-4b41-93dc-6cfd5dea28cc}");
 
 typedef LARGE_INTEGER PHYSICAL_ADDRESS;
 
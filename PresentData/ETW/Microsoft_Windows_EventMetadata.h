@@ -4,8 +4,7 @@
 
 namespace Microsoft_Windows_EventMetadata {
 
-struct __declspec(uuid("{bbccf6c1-6cd1-48C4-80ff-839482e37671}")) GUID_STRUCT;
-static const auto GUID = __uuidof(GUID_STRUCT);
+static const auto GUID = ParseGuid("{bbccf6c1-6cd1-48C4-80ff-839482e37671}");
 
 // Event descriptors:
 #define EVENT_DESCRIPTOR_DECL(name_, id_, version_, channel_, level_, opcode_, task_, keyword_) struct name_ { \
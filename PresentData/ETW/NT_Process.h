@@ -7,7 +7,6 @@
 
 namespace NT_Process {
 
-struct __declspec(uuid("{3d6fa8d0-fe05-11d0-9dda-00c04fd7ba7c}")) GUID_STRUCT;
-static const auto GUID = __uuidof(GUID_STRUCT);
+static const auto GUID = ParseGuid("{3d6fa8d0-fe05-11d0-9dda-00c04fd7ba7c}");
 
 }
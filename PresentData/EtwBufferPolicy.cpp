@@ -0,0 +1,128 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include "EtwBufferPolicy.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+void EtwBufferPolicy::Reset(EtwBufferSettings const& settings, uint64_t timestampFrequency)
+{
+    // A flush timer of 0 means ETW's default of one second.
+    settings_ = settings;
+    if (settings_.flushTimerMs_ == 0) {
+        settings_.flushTimerMs_ = 1000;
+    }
+    restartSettings_ = settings_;
+    previous_ = {};
+    frequency_ = timestampFrequency == 0 ? 1 : timestampFrequency;
+    lastChangeTime_ = 0;
+    lastPressureTime_ = 0;
+    peakBufferRate_ = 0.0;
+    changeCount_ = 0;
+    hasPrevious_ = false;
+}
+
+EtwBufferPolicy::Action EtwBufferPolicy::Update(EtwSessionSample const& sample)
+{
+    // The first sample is only used as a baseline, as is any sample where the
+    // counters went backwards (e.g., if the session was restarted without a
+    // Reset()).
+    if (!hasPrevious_ ||
+        sample.time_ <= previous_.time_ ||
+        sample.buffersWritten_ < previous_.buffersWritten_ ||
+        sample.eventsLost_ < previous_.eventsLost_ ||
+        sample.buffersLost_ < previous_.buffersLost_) {
+        if (!hasPrevious_) {
+            lastChangeTime_ = sample.time_;
+            lastPressureTime_ = sample.time_;
+        }
+        previous_ = sample;
+        hasPrevious_ = true;
+        return ACTION_NONE;
+    }
+
+    auto seconds = (double) (sample.time_ - previous_.time_) / (double) frequency_;
+    auto buffersWritten = sample.buffersWritten_ - previous_.buffersWritten_;
+    auto lostCount = (sample.eventsLost_ - previous_.eventsLost_) + (sample.buffersLost_ - previous_.buffersLost_);
+    auto buffersInUse = sample.numberOfBuffers_ > sample.freeBuffers_ ? sample.numberOfBuffers_ - sample.freeBuffers_ : 0;
+    previous_ = sample;
+
+    // Track the peak rate that buffers are filled, which decays by half every
+    // peakHalfLifeMs_ so that a burst is remembered for a while.
+    auto rate = (double) buffersWritten / seconds;
+    peakBufferRate_ = std::max(rate, peakBufferRate_ * pow(0.5, 1000.0 * seconds / (double) peakHalfLifeMs_));
+
+    // The buffers needed are those that fill, at the peak rate, while the
+    // consumer catches up and until the next sample.
+    auto backlogSeconds = (double) sample.consumerLag_ / (double) frequency_ + seconds;
+    auto requiredBuffers = (uint32_t) std::min(ceil(peakBufferRate_ * backlogSeconds * (double) headroom_), (double) UINT32_MAX / 2);
+    requiredBuffers = std::max(requiredBuffers, settings_.minimumBuffers_);
+
+    auto pressure = lostCount != 0 ||
+                    requiredBuffers > settings_.maximumBuffers_ ||
+                    (uint64_t) buffersInUse * 4 >= (uint64_t) settings_.maximumBuffers_ * 3;
+    if (pressure) {
+        lastPressureTime_ = sample.time_;
+    }
+
+    if (sample.time_ - lastChangeTime_ < MillisecondsToTimestamp(minChangeIntervalMs_)) {
+        return ACTION_NONE;
+    }
+
+    auto maximumBuffers = settings_.maximumBuffers_;
+    auto flushTimerMs = settings_.flushTimerMs_;
+    if (lostCount != 0) {
+        maximumBuffers = std::max(requiredBuffers, maximumBuffers * 2);
+        flushTimerMs = std::min(flushTimerMs * 2, maxFlushTimerMs_);
+    } else if (pressure) {
+        maximumBuffers = std::max(requiredBuffers, maximumBuffers + std::max(maximumBuffers / 2, 1u));
+    } else if (sample.time_ - lastPressureTime_ >= MillisecondsToTimestamp(quietPeriodMs_) &&
+               flushTimerMs > minFlushTimerMs_ &&
+               (uint64_t) requiredBuffers * 2 <= maximumBuffers) {
+        flushTimerMs = std::max(flushTimerMs / 2, minFlushTimerMs_);
+    }
+
+    // If more buffers are needed than are allowed, recommend larger buffers
+    // with the same total capacity for when the session is restarted.
+    auto restart = false;
+    if (maximumBuffers > maxMaximumBuffers_) {
+        auto capacityKB = (uint64_t) maximumBuffers * settings_.bufferSizeKB_;
+        auto bufferSizeKB = std::max(restartSettings_.bufferSizeKB_, 1u);
+        while (bufferSizeKB < maxBufferSizeKB_ && capacityKB > (uint64_t) maxMaximumBuffers_ * bufferSizeKB) {
+            bufferSizeKB *= 2;
+        }
+        bufferSizeKB = std::min(bufferSizeKB, maxBufferSizeKB_);
+
+        if (bufferSizeKB > restartSettings_.bufferSizeKB_) {
+            restartSettings_.bufferSizeKB_ = bufferSizeKB;
+            restartSettings_.maximumBuffers_ = (uint32_t) std::min<uint64_t>((capacityKB + bufferSizeKB - 1) / bufferSizeKB, maxMaximumBuffers_);
+            restart = true;
+        }
+
+        maximumBuffers = maxMaximumBuffers_;
+    }
+
+    auto action = ACTION_NONE;
+    if (maximumBuffers != settings_.maximumBuffers_ || flushTimerMs != settings_.flushTimerMs_) {
+        settings_.maximumBuffers_ = maximumBuffers;
+        settings_.flushTimerMs_ = flushTimerMs;
+        action = ACTION_UPDATE;
+    }
+
+    // Changes to the running session carry over to the restart settings,
+    // unless they are for a different buffer size.
+    restartSettings_.flushTimerMs_ = settings_.flushTimerMs_;
+    if (restartSettings_.bufferSizeKB_ == settings_.bufferSizeKB_) {
+        restartSettings_.maximumBuffers_ = settings_.maximumBuffers_;
+    }
+
+    if (restart) {
+        action = ACTION_RESTART;
+    }
+    if (action != ACTION_NONE) {
+        lastChangeTime_ = sample.time_;
+        changeCount_ += 1;
+    }
+    return action;
+}
@@ -0,0 +1,82 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// EtwBufferPolicy decides how a realtime ETW session's buffers should be
+// configured, from periodic samples of the session's counters and of how far
+// the consumer is behind.  If events are lost or the buffers are nearly all in
+// use it grows the maximum buffer count, and flushes less often so that fewer
+// partially-filled buffers are in flight; once the session has been quiet for
+// a while it flushes more often again to reduce latency.
+//
+// The maximum buffer count and flush timer can be changed while the session is
+// running.  If more buffers than maxMaximumBuffers_ would be needed, larger
+// buffers are recommended instead, which only take effect when the session is
+// restarted; the caller decides when that is safe.
+//
+// The policy has no dependency on ETW, so it can be driven by recorded
+// sequences of samples (see Tests/EtwBufferPolicyTests.cpp).
+#pragma once
+
+#include <stdint.h>
+
+struct EtwBufferSettings {
+    uint32_t bufferSizeKB_;     // Size of each buffer
+    uint32_t minimumBuffers_;   // Buffers allocated when the session starts
+    uint32_t maximumBuffers_;   // Limit on the buffers allocated as the event rate increases
+    uint32_t flushTimerMs_;     // Partially-filled buffers are delivered at least this often
+};
+
+struct EtwSessionSample {
+    uint64_t time_;             // When the sample was taken (QPC)
+    uint64_t consumerLag_;      // How far the consumer was behind time_, or 0 if it is idle (QPC duration)
+    uint32_t buffersWritten_;   // The session's counters, since it started
+    uint32_t eventsLost_;
+    uint32_t buffersLost_;
+    uint32_t numberOfBuffers_;  // Buffers currently allocated
+    uint32_t freeBuffers_;      // Allocated buffers that aren't holding events
+};
+
+class EtwBufferPolicy {
+public:
+    enum Action {
+        ACTION_NONE,            // Keep the current settings
+        ACTION_UPDATE,          // Apply Settings() to the running session
+        ACTION_RESTART,         // Apply Settings(), and RestartSettings() once the session can be restarted
+    };
+
+    // Limits, which should be set before Reset().
+    uint32_t maxBufferSizeKB_     = 1024;
+    uint32_t maxMaximumBuffers_   = 1024;
+    uint32_t minFlushTimerMs_     = 100;
+    uint32_t maxFlushTimerMs_     = 1000;
+    uint32_t headroom_            = 2;      // Buffers kept available, as a multiple of the expected backlog
+    uint32_t peakHalfLifeMs_      = 10000;  // How quickly the peak event rate is forgotten
+    uint32_t quietPeriodMs_       = 10000;  // Time without buffer pressure before flushing more often
+    uint32_t minChangeIntervalMs_ = 1000;   // Minimum time between changes
+
+    // Start a new session with the settings it is actually using.
+    void Reset(EtwBufferSettings const& settings, uint64_t timestampFrequency);
+
+    // Update the policy with a new sample of the session, and return whether
+    // the settings should change.
+    Action Update(EtwSessionSample const& sample);
+
+    // The settings for the running session, and for when it is next started.
+    EtwBufferSettings const& Settings() const { return settings_; }
+    EtwBufferSettings const& RestartSettings() const { return restartSettings_; }
+
+    uint32_t ChangeCount() const { return changeCount_; }
+
+private:
+    uint64_t MillisecondsToTimestamp(uint32_t ms) const { return frequency_ * ms / 1000; }
+
+    EtwBufferSettings settings_ = {};
+    EtwBufferSettings restartSettings_ = {};
+    EtwSessionSample previous_ = {};
+    uint64_t frequency_ = 1;
+    uint64_t lastChangeTime_ = 0;
+    uint64_t lastPressureTime_ = 0;
+    double peakBufferRate_ = 0.0;       // Buffers written per second
+    uint32_t changeCount_ = 0;
+    bool hasPrevious_ = false;
+};
@@ -0,0 +1,34 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// PMEventRecord is the event as seen by the analysis: the header fields that
+// PMTraceConsumer uses, the event descriptor, and the user data.  Members are
+// named as in EVENT_RECORD/EVENT_HEADER.
+//
+// The ETW callback builds one from each EVENT_RECORD (see
+// PresentMonTraceSession.cpp), and the raw event stream readers build them
+// from the recorded events, so the handlers don't depend on ETW.
+#pragma once
+
+#include "PlatformCompat.hpp"
+
+struct _EVENT_RECORD;
+
+struct PMEventHeader {
+    GUID ProviderId;
+    EVENT_DESCRIPTOR EventDescriptor;
+    LARGE_INTEGER TimeStamp;
+    uint32_t ProcessId;
+    uint32_t ThreadId;
+    uint16_t Flags;                 // EVENT_HEADER_FLAG_*
+};
+
+struct PMEventRecord {
+    PMEventHeader EventHeader;
+    void* UserData;
+    uint16_t UserDataLength;
+
+    // The ETW event this record was built from, or nullptr if the event was
+    // replayed.  Only used to look up metadata with TDH.
+    _EVENT_RECORD* EtwEventRecord;
+};
@@ -0,0 +1,309 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include "FlightRecorder.hpp"
+#include "PresentMonTraceConsumer.hpp"
+#include "PresentMonTraceSession.hpp"
+
+#include "ETW/Intel_PresentMon.h"
+#include "ETW/Microsoft_Windows_D3D9.h"
+#include "ETW/Microsoft_Windows_Dwm_Core.h"
+#include "ETW/Microsoft_Windows_Dwm_Core_Win7.h"
+#include "ETW/Microsoft_Windows_DXGI.h"
+#include "ETW/Microsoft_Windows_DxgKrnl.h"
+#include "ETW/Microsoft_Windows_Kernel_Process.h"
+#include "ETW/Microsoft_Windows_Win32k.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+uint32_t FlightRecorder::TakeRecords(std::vector<FlightRecord>* records, FlightRecordingHeader* header, uint32_t reason, uint32_t frameId)
+{
+    assert(records->size() == records_.size());
+
+    uint32_t capacity = mask_ + 1;
+    uint64_t newCount = count_ - takenCount_;
+    uint32_t recordCount = newCount < capacity ? (uint32_t) newCount : capacity;
+
+    *header = {};
+    header->magic_              = FLIGHT_RECORDING_MAGIC;
+    header->version_            = FLIGHT_RECORDING_VERSION;
+    header->recordSize_         = sizeof(FlightRecord);
+    header->recordCount_        = recordCount;
+    header->startTimestamp_     = startTimestamp_;
+    header->timestampFrequency_ = timestampFrequency_;
+    header->totalRecordCount_   = count_;
+    header->reason_             = reason;
+    header->frameId_            = frameId;
+
+    records_.swap(*records);
+    takenCount_ = count_;
+    return (uint32_t) (count_ - recordCount) & mask_;
+}
+
+namespace {
+
+// The records are written in up to two pieces: from the oldest record to the
+// end of the ring, and then from the start of the ring.
+bool WriteFlightRecordingFile(wchar_t const* path, FlightRecordingHeader const& header, std::vector<FlightRecord> const& records, uint32_t first)
+{
+    FILE* fp = nullptr;
+#ifdef _WIN32
+    if (_wfopen_s(&fp, path, L"wb") != 0) {
+        return false;
+    }
+#else
+    char narrowPath[4096];
+    auto narrowLength = wcstombs(narrowPath, path, sizeof(narrowPath));
+    if (narrowLength >= sizeof(narrowPath) || (fp = fopen(narrowPath, "wb")) == nullptr) {
+        return false;
+    }
+#endif
+
+    uint32_t capacity = (uint32_t) records.size();
+    uint32_t recordCount = header.recordCount_;
+    uint32_t firstCount = recordCount < capacity - first ? recordCount : capacity - first;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(&records[first], sizeof(FlightRecord), firstCount, fp) == firstCount &&
+              fwrite(&records[0], sizeof(FlightRecord), recordCount - firstCount, fp) == recordCount - firstCount;
+
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    return ok;
+}
+
+}
+
+FlightRecordingWriter::~FlightRecordingWriter()
+{
+    Stop();
+}
+
+void FlightRecordingWriter::Start(wchar_t const* pathPrefix, uint32_t maxFiles, uint32_t capacity)
+{
+    assert(!writerThread_.joinable());
+
+    pathPrefix_ = pathPrefix;
+    records_.resize(capacity);
+    maxFiles_ = maxFiles;
+    submittedCount_ = 0;
+    state_.store(STATE_IDLE, std::memory_order_relaxed);
+    writtenCount_.store(0, std::memory_order_relaxed);
+    failedCount_.store(0, std::memory_order_relaxed);
+    stop_.store(false, std::memory_order_relaxed);
+    writerThread_ = std::thread(&FlightRecordingWriter::WriterThread, this);
+}
+
+void FlightRecordingWriter::Stop()
+{
+    if (!writerThread_.joinable()) {
+        return;
+    }
+
+    stop_.store(true, std::memory_order_release);
+    pendingEvent_.Notify();
+    writerThread_.join();
+}
+
+void FlightRecordingWriter::Flush()
+{
+    while (IsBusy() && writerThread_.joinable()) {
+        auto key = idleEvent_.PrepareWait();
+        if (!IsBusy()) {
+            idleEvent_.CancelWait();
+        } else {
+            idleEvent_.Wait(key, 100);
+        }
+    }
+}
+
+bool FlightRecordingWriter::Submit(FlightRecorder* recorder, uint32_t reason, uint32_t frameId)
+{
+    uint32_t expected = STATE_IDLE;
+    if (!state_.compare_exchange_strong(expected, STATE_SUBMITTING, std::memory_order_acquire)) {
+        return false;
+    }
+
+    if (submittedCount_ == maxFiles_) {
+        state_.store(STATE_IDLE, std::memory_order_release);
+        return false;
+    }
+
+    first_ = recorder->TakeRecords(&records_, &header_, reason, frameId);
+    submittedCount_ += 1;
+    state_.store(STATE_PENDING, std::memory_order_release);
+    pendingEvent_.Notify();
+    return true;
+}
+
+void FlightRecordingWriter::WriterThread()
+{
+    for (;;) {
+        if (state_.load(std::memory_order_acquire) == STATE_PENDING) {
+            auto path = pathPrefix_ + L"-" + std::to_wstring(submittedCount_) + L".pmfr";
+            if (WriteFlightRecordingFile(path.c_str(), header_, records_, first_)) {
+                writtenCount_.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                failedCount_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            state_.store(STATE_IDLE, std::memory_order_release);
+            idleEvent_.Notify();
+            continue;
+        }
+
+        // Stop() is only called once nothing more will be submitted, so once
+        // stop_ is seen the state only needs to be checked once more.
+        if (stop_.load(std::memory_order_acquire)) {
+            if (state_.load(std::memory_order_acquire) != STATE_PENDING) {
+                break;
+            }
+            continue;
+        }
+
+        auto key = pendingEvent_.PrepareWait();
+        if (state_.load(std::memory_order_acquire) == STATE_PENDING || stop_.load(std::memory_order_acquire)) {
+            pendingEvent_.CancelWait();
+        } else {
+            pendingEvent_.Wait(key, 100);
+        }
+    }
+}
+
+char const* GetFlightRecordProviderName(uint8_t provider)
+{
+    switch (provider) {
+    case PMTraceSession::PROVIDER_DXGKRNL:                      return "DxgKrnl";
+    case PMTraceSession::PROVIDER_DXGI:                         return "DXGI";
+    case PMTraceSession::PROVIDER_D3D9:                         return "D3D9";
+    case PMTraceSession::PROVIDER_DWM_CORE:                     return "DWM";
+    case PMTraceSession::PROVIDER_WIN32K:                       return "Win32K";
+    case PMTraceSession::PROVIDER_KERNEL_PROCESS:               return "Kernel_Process";
+    case PMTraceSession::PROVIDER_NT_PROCESS:                   return "NT_Process";
+    case PMTraceSession::PROVIDER_EVENT_METADATA:               return "EventMetadata";
+    case PMTraceSession::PROVIDER_INTEL_PRESENTMON:             return "PM";
+    case PMTraceSession::PROVIDER_DWM_CORE_WIN7:                return "DWM(Win7)";
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_BLT:             return "Win7::BLT";
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_FLIP:            return "Win7::FLIP";
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_PRESENTHISTORY:  return "Win7::PRESENTHISTORY";
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_QUEUEPACKET:     return "Win7::QUEUEPACKET";
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_VSYNCDPC:        return "Win7::VSYNCDPC";
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_MMIOFLIP:        return "Win7::MMIOFLIP";
+    }
+    return "Unknown";
+}
+
+// These match the names printed by VerboseTraceEventImpl() in Debug.cpp.
+char const* GetFlightRecordEventName(FlightEventInfo const& event)
+{
+    switch (event.provider_) {
+    case PMTraceSession::PROVIDER_DXGKRNL: {
+        using namespace Microsoft_Windows_DxgKrnl;
+        switch (event.id_) {
+        case Blit_Info::Id:                         return "Blit_Info";
+        case BlitCancel_Info::Id:                   return "BlitCancel_Info";
+        case FlipMultiPlaneOverlay_Info::Id:        return "FlipMultiPlaneOverlay_Info";
+        case Present_Info::Id:                      return "DxgKrnl_Present_Info";
+        case MMIOFlip_Info::Id:                     return "MMIOFlip_Info";
+        case Flip_Info::Id:                         return "Flip_Info";
+        case IndependentFlip_Info::Id:              return "IndependentFlip_Info";
+        case PresentHistory_Start::Id:              return "PresentHistory_Start";
+        case PresentHistory_Info::Id:               return "PresentHistory_Info";
+        case PresentHistoryDetailed_Start::Id:      return "PresentHistoryDetailed_Start";
+        case QueuePacket_Start::Id:                 return "QueuePacket_Start";
+        case QueuePacket_Start_2::Id:               return "QueuePacket_Start WAIT";
+        case QueuePacket_Stop::Id:                  return "QueuePacket_Stop";
+        case VSyncDPC_Info::Id:                     return "VSyncDPC_Info";
+        case HSyncDPCMultiPlane_Info::Id:           return "HSyncDPCMultiPlane_Info";
+        case VSyncDPCMultiPlane_Info::Id:           return "VSyncDPCMultiPlane_Info";
+        case MMIOFlipMultiPlaneOverlay_Info::Id:    return "DXGKrnl_MMIOFlipMultiPlaneOverlay_Info";
+        case MMIOFlipMultiPlaneOverlay3_Info::Id:   return "DXGKrnl_MMIOFlipMultiPlaneOverlay3_Info";
+        case Context_DCStart::Id:
+        case Context_Start::Id:                     return "Context_Start";
+        case Context_Stop::Id:                      return "Context_Stop";
+        case Device_DCStart::Id:
+        case Device_Start::Id:                      return "Device_Start";
+        case Device_Stop::Id:                       return "Device_Stop";
+        case HwQueue_DCStart::Id:
+        case HwQueue_Start::Id:                     return "HwQueue_Start";
+        case DmaPacket_Info::Id:                    return "DmaPacket_Info";
+        case DmaPacket_Start::Id:                   return "DmaPacket_Start";
+        }
+        break;
+    }
+    case PMTraceSession::PROVIDER_DXGI: {
+        using namespace Microsoft_Windows_DXGI;
+        switch (event.id_) {
+        case Present_Start::Id:                     return "DXGIPresent_Start";
+        case PresentMultiplaneOverlay_Start::Id:    return "DXGIPresentMPO_Start";
+        case Present_Stop::Id:                      return "DXGIPresent_Stop";
+        case PresentMultiplaneOverlay_Stop::Id:     return "DXGIPresentMPO_Stop";
+        }
+        break;
+    }
+    case PMTraceSession::PROVIDER_D3D9: {
+        using namespace Microsoft_Windows_D3D9;
+        switch (event.id_) {
+        case Present_Start::Id:                     return "D3D9PresentStart";
+        case Present_Stop::Id:                      return "D3D9PresentStop";
+        }
+        break;
+    }
+    case PMTraceSession::PROVIDER_DWM_CORE:
+    case PMTraceSession::PROVIDER_DWM_CORE_WIN7: {
+        using namespace Microsoft_Windows_Dwm_Core;
+        switch (event.id_) {
+        case MILEVENT_MEDIA_UCE_PROCESSPRESENTHISTORY_GetPresentHistory_Info::Id:
+                                                    return "DWM_MILEVENT_MEDIA_UCS_PROCESSPRESENTHISTORY_GetPresentHistory";
+        case SCHEDULE_PRESENT_Start::Id:            return "DWM_SCHEDULE_PRESENT_Start";
+        case FlipChain_Pending::Id:                 return "DWM_FlipChain_Pending";
+        case FlipChain_Complete::Id:                return "DWM_FlipChain_Complete";
+        case FlipChain_Dirty::Id:                   return "DWM_FlipChain_Dirty";
+        case SCHEDULE_SURFACEUPDATE_Info::Id:       return "DWM_SCHEDULE_SURFACEUPDATE";
+        }
+        break;
+    }
+    case PMTraceSession::PROVIDER_WIN32K: {
+        using namespace Microsoft_Windows_Win32k;
+        switch (event.id_) {
+        case TokenCompositionSurfaceObject_Info::Id: return "Win32k_TokenCompositionSurfaceObject";
+        case TokenStateChanged_Info::Id:            return "Win32K_TokenStateChanged";
+        case InputDeviceRead_Stop::Id:              return "Win32k_InputDeviceRead_Stop";
+        case RetrieveInputMessage_Info::Id:         return "Win32k_RetrieveInputMessage";
+        }
+        break;
+    }
+    case PMTraceSession::PROVIDER_KERNEL_PROCESS: {
+        using namespace Microsoft_Windows_Kernel_Process;
+        switch (event.id_) {
+        case ProcessStart_Start::Id:                return "ProcessStart";
+        case ProcessStop_Stop::Id:                  return "ProcessStop";
+        }
+        break;
+    }
+    case PMTraceSession::PROVIDER_NT_PROCESS:
+        switch (event.opcode_) {
+        case EVENT_TRACE_TYPE_START:
+        case EVENT_TRACE_TYPE_DC_START:             return "ProcessStart";
+        case EVENT_TRACE_TYPE_END:
+        case EVENT_TRACE_TYPE_DC_END:               return "ProcessStop";
+        }
+        break;
+    case PMTraceSession::PROVIDER_INTEL_PRESENTMON: {
+        using namespace Intel_PresentMon;
+        switch (event.id_) {
+        case FlipFrameType_Info::Id:                return "PM_FlipFrameType";
+        case PresentFrameType_Info::Id:             return "PM_PresentFrameType";
+        }
+        break;
+    }
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_BLT:            return "Win7::BLT";
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_FLIP:           return "Win7::FLIP";
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_PRESENTHISTORY: return "Win7::PRESENTHISTORY";
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_QUEUEPACKET:    return "Win7::QUEUEPACKET";
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_VSYNCDPC:       return "Win7::VSYNCDPC";
+    case PMTraceSession::PROVIDER_DXGKRNL_WIN7_MMIOFLIP:       return "Win7::MMIOFLIP";
+    }
+    return nullptr;
+}
@@ -0,0 +1,255 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// FlightRecorder keeps the last events handled by a PMTraceConsumer, and the
+// state of its presents as they are created and completed, as fixed-size
+// binary records in a preallocated ring.  Unlike the verbose trace (see
+// Debug.hpp) it is always on: recording an event is a handful of stores, and
+// nothing is formatted until the ring is written to a file.  That happens when
+// requested (see PMTraceConsumer::RequestFlightRecording()) or when a present
+// is lost, and Tools/pm_flight_decode renders the file in the same layout as
+// the verbose trace.
+//
+// Only the first FLIGHT_RECORD_DATA_SIZE bytes of each event's user data are
+// kept, which for most events includes the key (e.g., hContext or
+// pSwapchain) that ties it to a present.
+//
+// The recorder is only used by the consumer thread.  Recordings are written by
+// a FlightRecordingWriter's background thread: the consumer thread swaps the
+// recorder's ring for the writer's spare one, which is constant time, and
+// keeps recording into it while the full ring is written.
+#pragma once
+
+#include <assert.h>
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EventRecord.hpp"
+#include "SpscRing.hpp"
+
+enum : uint8_t {
+    FLIGHT_RECORD_EVENT            = 1,    // An event was handled
+    FLIGHT_RECORD_PRESENT_START    = 2,    // A present was created
+    FLIGHT_RECORD_PRESENT_COMPLETE = 3,    // A present was completed
+    FLIGHT_RECORD_PRESENT_LOST     = 4,    // A present was completed as lost
+    FLIGHT_RECORD_PRESENT_EVICTED  = 5,    // A present was completed as lost because the tracked present ring was full
+};
+
+// FlightPresentInfo::flags_
+enum : uint16_t {
+    FLIGHT_PRESENT_SUPPORTS_TEARING      = 1 << 0,
+    FLIGHT_PRESENT_WAIT_FOR_FLIP         = 1 << 1,
+    FLIGHT_PRESENT_WAIT_FOR_MPO_FLIP     = 1 << 2,
+    FLIGHT_PRESENT_SEEN_DXGK_PRESENT     = 1 << 3,
+    FLIGHT_PRESENT_SEEN_WIN32K_EVENTS    = 1 << 4,
+    FLIGHT_PRESENT_SEEN_IN_FRAME_EVENT   = 1 << 5,
+    FLIGHT_PRESENT_GPU_FRAME_COMPLETED   = 1 << 6,
+    FLIGHT_PRESENT_IS_COMPLETED          = 1 << 7,
+    FLIGHT_PRESENT_IS_LOST               = 1 << 8,
+    FLIGHT_PRESENT_FAILED                = 1 << 9,
+    FLIGHT_PRESENT_IN_DWM_WAITING_STRUCT = 1 << 10,
+};
+
+enum { FLIGHT_RECORD_DATA_SIZE = 8 };
+
+struct FlightEventInfo {
+    uint8_t kind_;              // FLIGHT_RECORD_EVENT
+    uint8_t provider_;          // PMTraceSession::Provider
+    uint8_t opcode_;
+    uint8_t version_;
+    uint16_t id_;
+    uint16_t dataSize_;         // The event's UserDataLength
+    uint8_t data_[FLIGHT_RECORD_DATA_SIZE]; // The start of the event's UserData, zero-padded
+};
+
+struct FlightPresentInfo {
+    uint8_t kind_;              // FLIGHT_RECORD_PRESENT_*
+    uint8_t runtime_;           // Runtime
+    uint8_t presentMode_;       // PresentMode
+    uint8_t finalState_;        // PresentResult
+    uint16_t flags_;            // FLIGHT_PRESENT_*
+    uint8_t deferredReason_;    // DeferredReason_*
+    uint8_t frameType_;         // FrameType
+    uint32_t frameId_;
+    uint32_t reserved_;
+};
+
+// time_ is the timestamp of the event being handled when the record was
+// made, and processId_/threadId_ are the event's or the present's.  The kind_
+// at the start of either info struct says which one is used.
+struct FlightRecord {
+    uint64_t time_;
+    uint32_t processId_;
+    uint32_t threadId_;
+    union {
+        FlightEventInfo event_;
+        FlightPresentInfo present_;
+    };
+};
+
+static_assert(sizeof(FlightRecord) == 32, "Unexpected FlightRecord size");
+
+enum : uint32_t {
+    FLIGHT_RECORDING_MAGIC   = 0x52464d50, // "PMFR"
+    FLIGHT_RECORDING_VERSION = 1,
+};
+
+// Why a flight recording was written.
+enum : uint32_t {
+    FLIGHT_RECORDING_ON_DEMAND    = 0,
+    FLIGHT_RECORDING_LOST_PRESENT = 1,
+};
+
+// A flight recording file is a FlightRecordingHeader followed by recordCount_
+// FlightRecords, oldest first.
+struct FlightRecordingHeader {
+    uint32_t magic_;
+    uint32_t version_;
+    uint32_t recordSize_;           // sizeof(FlightRecord)
+    uint32_t recordCount_;
+    uint64_t startTimestamp_;       // Timestamp that times are reported relative to
+    uint64_t timestampFrequency_;
+    uint64_t totalRecordCount_;     // Records made since the consumer started, including overwritten ones
+    uint32_t reason_;               // FLIGHT_RECORDING_*
+    uint32_t frameId_;              // The lost present's FrameId, for FLIGHT_RECORDING_LOST_PRESENT
+};
+
+static_assert(sizeof(FlightRecordingHeader) == 48, "Unexpected FlightRecordingHeader size");
+
+class FlightRecorder {
+public:
+    enum : uint32_t { DEFAULT_CAPACITY = 64 * 1024 }; // Records (2 MB)
+
+    // capacity must be a power of two.
+    explicit FlightRecorder(uint32_t capacity = DEFAULT_CAPACITY)
+        : records_(capacity)
+        , mask_(capacity - 1)
+    {
+        assert(capacity != 0 && (capacity & (capacity - 1)) == 0);
+    }
+
+    FlightRecorder(FlightRecorder const&) = delete;
+    FlightRecorder& operator=(FlightRecorder const&) = delete;
+
+    uint32_t Capacity() const { return mask_ + 1; }
+    uint64_t RecordCount() const { return count_; }     // Including records that were written or overwritten
+
+    void SetTimestampInfo(uint64_t startTimestamp, uint64_t timestampFrequency)
+    {
+        startTimestamp_ = startTimestamp;
+        timestampFrequency_ = timestampFrequency;
+    }
+
+    void RecordEvent(uint8_t provider, PMEventRecord const* eventRecord)
+    {
+        auto const& hdr = eventRecord->EventHeader;
+        auto record = &records_[(uint32_t) count_ & mask_];
+        count_ += 1;
+        time_ = (uint64_t) hdr.TimeStamp.QuadPart;
+
+        record->time_ = time_;
+        record->processId_ = hdr.ProcessId;
+        record->threadId_ = hdr.ThreadId;
+        record->event_.kind_ = FLIGHT_RECORD_EVENT;
+        record->event_.provider_ = provider;
+        record->event_.opcode_ = hdr.EventDescriptor.Opcode;
+        record->event_.version_ = hdr.EventDescriptor.Version;
+        record->event_.id_ = hdr.EventDescriptor.Id;
+        record->event_.dataSize_ = eventRecord->UserDataLength;
+        memset(record->event_.data_, 0, FLIGHT_RECORD_DATA_SIZE);
+        memcpy(record->event_.data_, eventRecord->UserData,
+               eventRecord->UserDataLength < FLIGHT_RECORD_DATA_SIZE ? (size_t) eventRecord->UserDataLength : (size_t) FLIGHT_RECORD_DATA_SIZE);
+    }
+
+    // The record's time_ is that of the last recorded event.
+    void RecordPresent(uint32_t processId, uint32_t threadId, FlightPresentInfo const& info)
+    {
+        auto record = &records_[(uint32_t) count_ & mask_];
+        count_ += 1;
+
+        record->time_ = time_;
+        record->processId_ = processId;
+        record->threadId_ = threadId;
+        record->present_ = info;
+    }
+
+    // Swap the ring with *records, which must have the same capacity, and fill
+    // in *header for the records made since the last TakeRecords().  Returns
+    // the index in *records of the oldest of them; the rest follow it, wrapping
+    // around the end.  Recording continues into the old contents of *records.
+    uint32_t TakeRecords(std::vector<FlightRecord>* records, FlightRecordingHeader* header, uint32_t reason, uint32_t frameId);
+
+private:
+    std::vector<FlightRecord> records_;
+    uint64_t count_ = 0;
+    uint64_t takenCount_ = 0;   // count_ at the last TakeRecords()
+    uint64_t time_ = 0;
+    uint32_t mask_;
+    uint64_t startTimestamp_ = 0;
+    uint64_t timestampFrequency_ = 0;
+};
+
+// FlightRecordingWriter writes flight recordings to "<pathPrefix>-<n>.pmfr" on
+// a background thread, one at a time.  Submit() may be called by any number
+// of consumer threads; a recording submitted while the previous one is still
+// being written is refused rather than waited for.
+class FlightRecordingWriter {
+public:
+    FlightRecordingWriter() = default;
+    ~FlightRecordingWriter();
+
+    FlightRecordingWriter(FlightRecordingWriter const&) = delete;
+    FlightRecordingWriter& operator=(FlightRecordingWriter const&) = delete;
+
+    // Start the writer thread.  At most maxFiles recordings are written, and
+    // capacity must match the Capacity() of the recorders that are submitted.
+    void Start(wchar_t const* pathPrefix, uint32_t maxFiles = 8, uint32_t capacity = FlightRecorder::DEFAULT_CAPACITY);
+
+    // Write any submitted recording and stop the writer thread.  Must not be
+    // called until no more recordings will be submitted.
+    void Stop();
+
+    // Wait until any submitted recording has been written.
+    void Flush();
+
+    // Hand the records made since the recorder's last TakeRecords() to the
+    // writer thread.  Returns false, leaving the recorder unchanged, if a
+    // recording is still being written or maxFiles have been submitted.
+    bool Submit(FlightRecorder* recorder, uint32_t reason, uint32_t frameId);
+
+    bool IsBusy() const { return state_.load(std::memory_order_acquire) != STATE_IDLE; }
+    uint32_t WrittenCount() const { return writtenCount_.load(std::memory_order_relaxed); }
+    uint32_t FailedCount() const { return failedCount_.load(std::memory_order_relaxed); }
+
+private:
+    enum : uint32_t {
+        STATE_IDLE,         // records_ is free
+        STATE_SUBMITTING,   // A Submit() call is filling records_
+        STATE_PENDING,      // records_ is waiting to be written, or being written
+    };
+
+    void WriterThread();
+
+    std::wstring pathPrefix_;
+    std::vector<FlightRecord> records_;
+    FlightRecordingHeader header_ = {};
+    uint32_t first_ = 0;            // Index in records_ of the oldest record
+    uint32_t maxFiles_ = 0;
+    uint32_t submittedCount_ = 0;   // Only used by the thread that set STATE_SUBMITTING
+    std::atomic<uint32_t> state_{ STATE_IDLE };
+    std::atomic<uint32_t> writtenCount_{ 0 };
+    std::atomic<uint32_t> failedCount_{ 0 };
+    std::atomic<bool> stop_{ false };
+    EventCount pendingEvent_;
+    EventCount idleEvent_;
+    std::thread writerThread_;
+};
+
+// The name of a FLIGHT_RECORD_EVENT record's event, as printed by the verbose
+// trace where there is one; or nullptr if the event isn't known.
+char const* GetFlightRecordEventName(FlightEventInfo const& event);
+char const* GetFlightRecordProviderName(uint8_t provider);
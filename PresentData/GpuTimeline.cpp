@@ -0,0 +1,139 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include "GpuTimeline.hpp"
+
+GpuTimelineWriter::GpuTimelineWriter()
+    : fullBlocks_(BLOCK_COUNT)
+    , freeBlocks_(BLOCK_COUNT)
+{
+    for (uint32_t i = 0; i < BLOCK_COUNT; ++i) {
+        std::unique_ptr<Block> block(new Block);
+        block->records_.resize(BLOCK_RECORD_COUNT);
+        block->count_ = 0;
+        freeBlocks_.TryPush(block.get());
+        blocks_.emplace_back(std::move(block));
+    }
+}
+
+GpuTimelineWriter::~GpuTimelineWriter()
+{
+    Close();
+}
+
+bool GpuTimelineWriter::Open(FILE* fp, uint64_t startTimestamp, uint64_t timestampFrequency)
+{
+    assert(fp_ == nullptr);
+    assert(!writerThread_.joinable());
+
+    header_ = {};
+    header_.magic_              = GPU_TIMELINE_MAGIC;
+    header_.version_            = GPU_TIMELINE_VERSION;
+    header_.recordSize_         = (uint32_t) sizeof(GpuTimelineRecord);
+    header_.startTimestamp_     = startTimestamp;
+    header_.timestampFrequency_ = timestampFrequency;
+
+    if (fwrite(&header_, sizeof(header_), 1, fp) != 1) {
+        fclose(fp);
+        return false;
+    }
+
+    fp_ = fp;
+    recordCount_ = 0;
+    writtenRecordCount_ = 0;
+    droppedRecordCount_.store(0, std::memory_order_relaxed);
+    writeError_.store(false, std::memory_order_relaxed);
+    stop_.store(false, std::memory_order_relaxed);
+    writerThread_ = std::thread(&GpuTimelineWriter::WriterThread, this);
+    return true;
+}
+
+void GpuTimelineWriter::Close()
+{
+    if (fp_ == nullptr) {
+        return;
+    }
+
+    // Pass the partial block to the writer thread, and then stop it once it
+    // has written everything.
+    if (current_ != nullptr) {
+        auto pushed = fullBlocks_.TryPush(std::move(current_));
+        assert(pushed);
+        (void) pushed;
+        current_ = nullptr;
+    }
+
+    stop_.store(true, std::memory_order_release);
+    fullBlockEvent_.Notify();
+    writerThread_.join();
+
+    // Records that couldn't be written were counted as dropped by the writer
+    // thread, so the header's count matches what is in the file.
+    header_.recordCount_        = writtenRecordCount_;
+    header_.droppedRecordCount_ = droppedRecordCount_.load(std::memory_order_relaxed);
+    if (fseek(fp_, 0, SEEK_SET) == 0) {
+        fwrite(&header_, sizeof(header_), 1, fp_);
+    }
+
+    fclose(fp_);
+    fp_ = nullptr;
+}
+
+// Pass the current block, if any, to the writer thread and start recording
+// into a free one.  If the writer thread hasn't freed a block yet, current_ is
+// left null and the caller drops its record.
+void GpuTimelineWriter::NextBlock()
+{
+    if (current_ != nullptr) {
+        // Every block fits in fullBlocks_, so this never fails.
+        auto pushed = fullBlocks_.TryPush(std::move(current_));
+        assert(pushed);
+        (void) pushed;
+        current_ = nullptr;
+        fullBlockEvent_.Notify();
+    }
+
+    freeBlocks_.PopBatch(&current_, 1);
+}
+
+void GpuTimelineWriter::WriterThread()
+{
+    for (;;) {
+        Block* block = nullptr;
+        if (fullBlocks_.PopBatch(&block, 1) == 0) {
+            // Close() pushes the last block before setting stop_, so once
+            // stop_ is seen the ring only needs to be checked once more.
+            if (stop_.load(std::memory_order_acquire)) {
+                if (fullBlocks_.empty()) {
+                    break;
+                }
+                continue;
+            }
+
+            auto key = fullBlockEvent_.PrepareWait();
+            if (!fullBlocks_.empty() || stop_.load(std::memory_order_acquire)) {
+                fullBlockEvent_.CancelWait();
+            } else {
+                fullBlockEvent_.Wait(key, 100);
+            }
+            continue;
+        }
+
+        // After a write error, the remaining records are discarded and
+        // counted as dropped.
+        if (!writeError_.load(std::memory_order_relaxed) &&
+            fwrite(block->records_.data(), sizeof(GpuTimelineRecord), block->count_, fp_) != block->count_) {
+            writeError_.store(true, std::memory_order_relaxed);
+        }
+        if (writeError_.load(std::memory_order_relaxed)) {
+            droppedRecordCount_.fetch_add(block->count_, std::memory_order_relaxed);
+        } else {
+            writtenRecordCount_ += block->count_;
+        }
+
+        block->count_ = 0;
+        auto pushed = freeBlocks_.TryPush(std::move(block));
+        assert(pushed);
+        (void) pushed;
+    }
+}
@@ -0,0 +1,150 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// GpuTimelineWriter streams the packet timeline that GpuTrace reconstructs to
+// a file: when each packet is enqueued to a node, when it starts running at
+// the head of the node's queue, and when it completes, along with each frame
+// that GpuTrace completes.  Tools/pm_gpu_timeline converts the file into
+// Chrome trace JSON, attributing each packet to the next frame completed for
+// its process, which is how GpuTrace accumulates GPUDuration.
+//
+// Recording a packet is a few stores into the current block of fixed-size
+// records.  Full blocks are written to the file by a background thread, and
+// if it falls behind the records are dropped (and counted) rather than
+// stalling the consumer thread.
+//
+// The file is a GpuTimelineHeader followed by GpuTimelineRecords, in the order
+// they were recorded.  Packets are identified by their node and SequenceId;
+// only the enqueue record has the packet's hContext and ProcessId.
+#pragma once
+
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#include "SpscRing.hpp"
+
+enum : uint8_t {
+    GPU_TIMELINE_ENQUEUE  = 1,  // A packet was enqueued to a node
+    GPU_TIMELINE_START    = 2,  // A packet reached the head of its node's queue and started running
+    GPU_TIMELINE_COMPLETE = 3,  // The packet at the head of a node's queue completed
+    GPU_TIMELINE_FRAME    = 4,  // GpuTrace completed the GPU work for a process' frame
+};
+
+// GpuTimelineRecord::flags_
+enum : uint8_t {
+    GPU_TIMELINE_WAIT_PACKET = 1 << 0, // A wait packet, which blocks the node but isn't counted as GPU work
+    GPU_TIMELINE_VIDEO_NODE  = 1 << 1, // The node is a video encode/decode engine
+    GPU_TIMELINE_HW_QUEUE    = 1 << 2, // The context is a hardware queue
+};
+
+struct GpuTimelineRecord {
+    uint64_t time_;
+    uint64_t handle_;           // ENQUEUE: hContext; FRAME: the present's SwapChainAddress; otherwise 0
+    uint32_t processId_;        // ENQUEUE and FRAME only
+    uint32_t id_;               // Packet SequenceId, or the present's FrameId
+    uint32_t node_;             // GpuTrace's index of the node; not used for FRAME
+    uint8_t kind_;              // GPU_TIMELINE_*
+    uint8_t flags_;             // GPU_TIMELINE_WAIT_PACKET, etc.
+    uint16_t reserved_;
+};
+
+static_assert(sizeof(GpuTimelineRecord) == 32, "Unexpected GpuTimelineRecord size");
+
+enum : uint32_t {
+    GPU_TIMELINE_MAGIC   = 0x54474d50, // "PMGT"
+    GPU_TIMELINE_VERSION = 1,
+};
+
+// recordCount_ and droppedRecordCount_ are filled in when the writer is
+// closed; a reader should read records until the end of the file.
+struct GpuTimelineHeader {
+    uint32_t magic_;
+    uint32_t version_;
+    uint32_t recordSize_;           // sizeof(GpuTimelineRecord)
+    uint32_t reserved_;
+    uint64_t startTimestamp_;       // 0 if the session started with the first event
+    uint64_t timestampFrequency_;
+    uint64_t recordCount_;
+    uint64_t droppedRecordCount_;
+};
+
+static_assert(sizeof(GpuTimelineHeader) == 48, "Unexpected GpuTimelineHeader size");
+
+class GpuTimelineWriter {
+public:
+    enum {
+        BLOCK_RECORD_COUNT = 16 * 1024, // Records per block (512 KB)
+        BLOCK_COUNT = 8,                // Must be a power of two
+    };
+
+    GpuTimelineWriter();
+    ~GpuTimelineWriter();
+
+    GpuTimelineWriter(GpuTimelineWriter const&) = delete;
+    GpuTimelineWriter& operator=(GpuTimelineWriter const&) = delete;
+
+    // The writer takes ownership of fp, which must be opened for binary
+    // writing, and starts the writer thread.  Returns false on error.
+    bool Open(FILE* fp, uint64_t startTimestamp, uint64_t timestampFrequency);
+
+    // Write any remaining records and the final header, and close the file.
+    // Must not be called until recording has stopped.
+    void Close();
+
+    bool IsOpen() const { return fp_ != nullptr; }
+    bool HasWriteError() const { return writeError_.load(std::memory_order_relaxed); }
+    uint64_t RecordCount() const { return recordCount_; }
+    uint64_t DroppedRecordCount() const { return droppedRecordCount_.load(std::memory_order_relaxed); }
+
+    void Record(uint8_t kind, uint8_t flags, uint64_t time, uint64_t handle, uint32_t processId, uint32_t id, uint32_t node)
+    {
+        if (current_ == nullptr || current_->count_ == BLOCK_RECORD_COUNT) {
+            NextBlock();
+            if (current_ == nullptr) {
+                droppedRecordCount_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        auto record = &current_->records_[current_->count_];
+        current_->count_ += 1;
+        recordCount_ += 1;
+
+        record->time_ = time;
+        record->handle_ = handle;
+        record->processId_ = processId;
+        record->id_ = id;
+        record->node_ = node;
+        record->kind_ = kind;
+        record->flags_ = flags;
+        record->reserved_ = 0;
+    }
+
+private:
+    struct Block {
+        std::vector<GpuTimelineRecord> records_;
+        uint32_t count_;
+    };
+
+    void NextBlock();
+    void WriterThread();
+
+    FILE* fp_ = nullptr;
+    GpuTimelineHeader header_ = {};
+    std::vector<std::unique_ptr<Block>> blocks_;
+    SpscRing<Block*> fullBlocks_;   // Recording thread -> writer thread
+    SpscRing<Block*> freeBlocks_;   // Writer thread -> recording thread
+    EventCount fullBlockEvent_;
+    Block* current_ = nullptr;
+    uint64_t recordCount_ = 0;          // Recorded by the recording thread
+    uint64_t writtenRecordCount_ = 0;   // Written by the writer thread
+    std::atomic<uint64_t> droppedRecordCount_{ 0 };
+    std::atomic<bool> writeError_{ false };
+    std::atomic<bool> stop_{ false };
+    std::thread writerThread_;
+};
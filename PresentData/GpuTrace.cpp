@@ -37,16 +37,18 @@ uint32_t GpuTrace::LookupPacketTraceProcessId(PacketTrace* packetTrace) const
 
 void GpuTrace::PrintRunningContexts() const
 {
-    for (auto const& pr : mContexts) {
-        auto hContext = pr.first;
-        auto const& context = pr.second;
-        auto const& node = *context.mNode;
+    for (auto const& context : mContexts) {
+        if (!context.mIsAllocated) {
+            continue;
+        }
+        auto hContext = context.mHandle;
+        auto const& node = mNodes[context.mNodeIndex];
 
         if (node.mQueueCount > 0) {
             wprintf(L"                             hContext=0x%llx [", hContext);
 
             for (uint32_t i = 0; i < node.mQueueCount; ++i) {
-                auto queueIdx = (node.mQueueIndex + i) % (uint32_t) node.mQueue.size();
+                auto queueIdx = (node.mQueueIndex + i) & ((uint32_t) node.mQueue.size() - 1);
                 auto const& entry = node.mQueue[queueIdx];
 
                 if (i > 0) {
@@ -89,22 +91,101 @@ void GpuTrace::UnregisterDevice(uint64_t hDevice)
     mDevices.erase(hDevice);
 }
 
-void GpuTrace::RegisterContext(uint64_t hContext, uint64_t hDevice, uint32_t nodeOrdinal, uint32_t processId)
+uint32_t GpuTrace::AllocateNode()
+{
+    uint32_t nodeIndex;
+    if (mFreeNodeIndices.empty()) {
+        nodeIndex = (uint32_t) mNodes.size();
+        mNodes.emplace_back(Node{});
+    } else {
+        // Reuse the slot, and its queue storage.
+        nodeIndex = mFreeNodeIndices.back();
+        mFreeNodeIndices.pop_back();
+    }
+
+    auto node = &mNodes[nodeIndex];
+    node->mQueueIndex = 0;
+    node->mQueueCount = 0;
+    node->mAdapter = 0;
+    node->mEngineType = Microsoft_Windows_DxgKrnl::DXGK_ENGINE::OTHER;
+    node->mEngineTraceIndex = HandleIndexTable::INVALID_INDEX;
+    node->mIsVideo = false;
+    node->mIsEngineBusy = false;
+    return nodeIndex;
+}
+
+uint32_t GpuTrace::FindOrCreateAdapterNode(uint64_t pDxgAdapter, uint32_t nodeOrdinal)
+{
+    auto nodeIndices = &mAdapterNodes[pDxgAdapter];
+    if (nodeOrdinal >= nodeIndices->size()) {
+        nodeIndices->resize(nodeOrdinal + 1, HandleIndexTable::INVALID_INDEX);
+    }
+    if ((*nodeIndices)[nodeOrdinal] == HandleIndexTable::INVALID_INDEX) {
+        auto nodeIndex = AllocateNode();
+        mNodes[nodeIndex].mAdapter = pDxgAdapter;
+        (*nodeIndices)[nodeOrdinal] = nodeIndex;
+    }
+    return (*nodeIndices)[nodeOrdinal];
+}
+
+// Returns the index of an unused context slot, registered with hContext.  If
+// hContext is already registered, its previous context is freed first.  The
+// caller must initialize the context.
+uint32_t GpuTrace::AllocateContext(uint64_t hContext, uint64_t timestamp)
+{
+    auto contextIndex = mContextIndices.Find(hContext);
+    if (contextIndex != HandleIndexTable::INVALID_INDEX) {
+        FreeContext(contextIndex, timestamp);
+    }
+
+    if (mFreeContextIndices.empty()) {
+        contextIndex = (uint32_t) mContexts.size();
+        mContexts.emplace_back(Context{});
+    } else {
+        contextIndex = mFreeContextIndices.back();
+        mFreeContextIndices.pop_back();
+    }
+
+    mContexts[contextIndex].mHandle = hContext;
+    mContexts[contextIndex].mIsAllocated = true;
+    mContextIndices.Insert(hContext, contextIndex);
+    return contextIndex;
+}
+
+// A HwQueue context's node is freed along with it.
+void GpuTrace::FreeContext(uint32_t contextIndex, uint64_t timestamp)
+{
+    auto context = &mContexts[contextIndex];
+    DebugAssert(context->mIsAllocated);
+
+    mContextIndices.Erase(context->mHandle);
+    if (context->mIsHwQueue) {
+        CompleteEngineWork(&mNodes[context->mNodeIndex], timestamp);
+        mFreeNodeIndices.push_back(context->mNodeIndex);
+    }
+
+    context->mPacketTrace = nullptr;
+    context->mIsAllocated = false;
+    mFreeContextIndices.push_back(contextIndex);
+}
+
+void GpuTrace::RegisterContext(uint64_t hContext, uint64_t hDevice, uint32_t nodeOrdinal, uint32_t processId, uint64_t timestamp)
 {
     auto deviceIter = mDevices.find(hDevice);
     if (deviceIter == mDevices.end()) {
         return;
     }
     auto pDxgAdapter = deviceIter->second;
-    auto node = &mNodes[pDxgAdapter].emplace(nodeOrdinal, Node{}).first->second;
+    auto nodeIndex = FindOrCreateAdapterNode(pDxgAdapter, nodeOrdinal);
 
     // Sometimes there are duplicate start events, make sure that they say the same thing
-    DebugAssert(mContexts.find(hContext) == mContexts.end() || mContexts.find(hContext)->second.mNode == node);
+    DebugAssert(FindContext(hContext) == nullptr || FindContext(hContext)->mNodeIndex == nodeIndex);
 
-    auto context = &mContexts.emplace(hContext, Context()).first->second;
+    auto context = &mContexts[AllocateContext(hContext, timestamp)];
     context->mPacketTrace = nullptr;
-    context->mNode = node;
+    context->mNodeIndex = nodeIndex;
     context->mParentContext = 0;
+    context->mProcessId = 0;
     context->mIsParentContext = false;
     context->mIsHwQueue = false;
 
@@ -128,23 +209,30 @@ void GpuTrace::RegisterContext(uint64_t hContext, uint64_t hDevice, uint32_t nod
 //     HwQueue_Stop hContext=C hHwQueue=0x0 ParentDxgHwQueue=Q2
 //     HwQueue_Stop hContext=C hHwQueue=0x0 ParentDxgHwQueue=Q1
 //     Context_Stop hContext=C
-void GpuTrace::RegisterHwQueueContext(uint64_t hContext, uint64_t parentDxgHwQueue)
+void GpuTrace::RegisterHwQueueContext(uint64_t hContext, uint64_t parentDxgHwQueue, uint64_t timestamp)
 {
-    DebugAssert(mContexts.find(hContext)         != mContexts.end());
-    DebugAssert(mContexts.find(parentDxgHwQueue) == mContexts.end());
+    DebugAssert(FindContext(hContext)         != nullptr);
+    DebugAssert(FindContext(parentDxgHwQueue) == nullptr);
 
     // Look up the context C, which we're calling the parent context.  We
     // should already have seen a Context_Start event.
-    auto ii = mContexts.find(hContext);
-    if (ii == mContexts.end()) {
+    auto parentContext = FindContext(hContext);
+    if (parentContext == nullptr) {
         return;
     }
-    auto parentContext = &ii->second;
 
     DebugAssert(parentContext->mParentContext == 0);
     DebugAssert(parentContext->mIsHwQueue == false);
     parentContext->mIsParentContext = true;
 
+    // Registering the node and context can move the parent context, so copy
+    // what is needed from it first.
+    auto packetTrace = parentContext->mPacketTrace;
+    auto processId = parentContext->mProcessId;
+    auto adapter = mNodes[parentContext->mNodeIndex].mAdapter;
+    auto engineType = mNodes[parentContext->mNodeIndex].mEngineType;
+    auto isVideo = mNodes[parentContext->mNodeIndex].mIsVideo;
+
     // Create a new context for the HWQueue.  Even though they map the same
     // device engine, HWQueues need their own context so that tracked sequence
     // IDs are ordered.
@@ -154,49 +242,57 @@ void GpuTrace::RegisterHwQueueContext(uint64_t hContext, uint64_t parentDxgHwQue
     // simultaneous, but since we're counting any duration where at least one
     // node is running it doesn't matter.
 
-    Node* node = new Node();
-    node->mQueueIndex = 0;
-    node->mQueueCount = 0;
-    node->mIsVideo = parentContext->mNode->mIsVideo;
+    auto nodeIndex = AllocateNode();
+    mNodes[nodeIndex].mAdapter = adapter;
+    mNodes[nodeIndex].mEngineType = engineType;
+    mNodes[nodeIndex].mIsVideo = isVideo;
 
-    auto hwQueueContext = &mContexts.emplace(parentDxgHwQueue, Context()).first->second;
-    hwQueueContext->mPacketTrace = parentContext->mPacketTrace;
-    hwQueueContext->mNode = node;
+    auto hwQueueContext = &mContexts[AllocateContext(parentDxgHwQueue, timestamp)];
+    hwQueueContext->mPacketTrace = packetTrace;
+    hwQueueContext->mNodeIndex = nodeIndex;
     hwQueueContext->mParentContext = hContext;
+    hwQueueContext->mProcessId = processId;
     hwQueueContext->mIsParentContext = false;
     hwQueueContext->mIsHwQueue = true;
 }
 
-void GpuTrace::UnregisterContext(uint64_t hContext)
+void GpuTrace::UnregisterContext(uint64_t hContext, uint64_t timestamp)
 {
     // Sometimes there are duplicate stop events so it's ok if it's already
     // removed
-    auto ii = mContexts.find(hContext);
-    auto ie = mContexts.end();
-    if (ii != ie) {
-        auto isParentContext = ii->second.mIsParentContext;
-        mContexts.erase(ii);
+    auto contextIndex = mContextIndices.Find(hContext);
+    if (contextIndex != HandleIndexTable::INVALID_INDEX) {
+        auto isParentContext = mContexts[contextIndex].mIsParentContext;
+        FreeContext(contextIndex, timestamp);
 
         if (isParentContext) {
-            for (ii = mContexts.begin(); ii != ie; ) {
-                auto const& context = ii->second;
-                if (context.mParentContext == hContext) {
+            for (uint32_t i = 0, n = (uint32_t) mContexts.size(); i < n; ++i) {
+                auto const& context = mContexts[i];
+                if (context.mIsAllocated && context.mParentContext == hContext) {
                     DebugAssert(context.mIsHwQueue);
-                    delete context.mNode;
-                    ii = mContexts.erase(ii);
-                } else {
-                    ++ii;
+                    FreeContext(i, timestamp);
                 }
             }
         }
     }
 }
 
-void GpuTrace::SetEngineType(uint64_t pDxgAdapter, uint32_t nodeOrdinal, Microsoft_Windows_DxgKrnl::DXGK_ENGINE engineType)
+void GpuTrace::SetEngineType(uint64_t pDxgAdapter, uint32_t nodeOrdinal, Microsoft_Windows_DxgKrnl::DXGK_ENGINE engineType, uint64_t timestamp)
 {
     // Node should already be created (DxgKrnl::Context_Start comes
     // first) but just to be sure...
-    auto node = &mNodes[pDxgAdapter].emplace(nodeOrdinal, Node{}).first->second;
+    auto node = &mNodes[FindOrCreateAdapterNode(pDxgAdapter, nodeOrdinal)];
+
+    // If the node is already running work, move it to the new engine's trace.
+    if (node->mEngineType != engineType) {
+        auto isEngineBusy = node->mIsEngineBusy;
+        CompleteEngineWork(node, timestamp);
+        node->mEngineType = engineType;
+        node->mEngineTraceIndex = HandleIndexTable::INVALID_INDEX;
+        if (isEngineBusy) {
+            StartEngineWork(node, timestamp);
+        }
+    }
 
     if (engineType == Microsoft_Windows_DxgKrnl::DXGK_ENGINE::VIDEO_DECODE ||
         engineType == Microsoft_Windows_DxgKrnl::DXGK_ENGINE::VIDEO_ENCODE ||
@@ -208,8 +304,13 @@ void GpuTrace::SetEngineType(uint64_t pDxgAdapter, uint32_t nodeOrdinal, Microso
 void GpuTrace::SetContextProcessId(Context* context, uint32_t processId)
 {
     auto p = mProcessFrameInfo.emplace(processId, ProcessFrameInfo{});
+    context->mProcessId = processId;
 
-    if (mPMConsumer->mTrackGPUVideo && context->mNode->mIsVideo) {
+    // A process that was thought to have exited is evidently still running, so its state must
+    // not be reclaimed.
+    mPMConsumer->mExitedProcesses.erase(processId);
+
+    if (mPMConsumer->mTrackGPUVideo && mNodes[context->mNodeIndex].mIsVideo) {
         context->mPacketTrace = &p.first->second.mVideoEngines;
     } else {
         context->mPacketTrace = &p.first->second.mOtherEngines;
@@ -247,10 +348,136 @@ void GpuTrace::CompletePacket(PacketTrace* packetTrace, uint64_t timestamp) cons
     packetTrace->mRunningPacketStartTime = 0;
 }
 
+GpuTrace::EngineTrace* GpuTrace::FindOrCreateEngineTrace(Node* node)
+{
+    if (node->mEngineTraceIndex == HandleIndexTable::INVALID_INDEX) {
+        uint32_t traceIndex = 0;
+        for (uint32_t n = (uint32_t) mEngineTraces.size(); traceIndex < n; ++traceIndex) {
+            if (mEngineTraces[traceIndex].mAdapter == node->mAdapter &&
+                mEngineTraces[traceIndex].mEngineType == node->mEngineType) {
+                break;
+            }
+        }
+        if (traceIndex == mEngineTraces.size()) {
+            EngineTrace trace = {};
+            trace.mAdapter = node->mAdapter;
+            trace.mEngineType = node->mEngineType;
+            mEngineTraces.push_back(trace);
+        }
+        node->mEngineTraceIndex = traceIndex;
+    }
+    return &mEngineTraces[node->mEngineTraceIndex];
+}
+
+// The node started running a packet.  Time isn't accumulated before the
+// current interval began, in case events arrive slightly out of order.
+void GpuTrace::StartEngineWork(Node* node, uint64_t timestamp)
+{
+    if (node->mIsEngineBusy) {
+        return;
+    }
+    node->mIsEngineBusy = true;
+
+    auto trace = FindOrCreateEngineTrace(node);
+    trace->mRunningNodeCount += 1;
+    if (trace->mRunningNodeCount == 1) {
+        trace->mRunningStartTime = std::max(timestamp, mEngineIntervalStartTime);
+    }
+}
+
+// The node's running packet completed, or the node is being freed.
+void GpuTrace::CompleteEngineWork(Node* node, uint64_t timestamp)
+{
+    if (!node->mIsEngineBusy) {
+        return;
+    }
+    node->mIsEngineBusy = false;
+
+    auto trace = &mEngineTraces[node->mEngineTraceIndex];
+    trace->mRunningNodeCount -= 1;
+    if (trace->mRunningNodeCount == 0 && timestamp > trace->mRunningStartTime) {
+        trace->mAccumulatedBusyTime += timestamp - trace->mRunningStartTime;
+    }
+}
+
+void GpuTrace::SampleEngineUtilization(uint64_t timestamp)
+{
+    if (mEngineIntervalStartTime == 0) {
+        mEngineIntervalStartTime = timestamp;
+        return;
+    }
+
+    // Events can be slightly out of order, so compare without wrapping.
+    auto interval = mPMConsumer->mEngineUtilizationInterval;
+    while (timestamp >= mEngineIntervalStartTime + interval) {
+        auto endTime = mEngineIntervalStartTime + interval;
+
+        for (auto& trace : mEngineTraces) {
+            auto busyTime = trace.mAccumulatedBusyTime;
+            if (trace.mRunningNodeCount > 0) {
+                busyTime += endTime - trace.mRunningStartTime;
+                trace.mRunningStartTime = endTime;
+            }
+
+            EngineUtilizationSample sample;
+            sample.pDxgAdapter = trace.mAdapter;
+            sample.StartTime = mEngineIntervalStartTime;
+            sample.Duration = interval;
+            sample.BusyTime = std::min(busyTime, interval);
+            sample.EngineType = trace.mEngineType;
+            mPMConsumer->EnqueueEngineUtilizationSample(sample);
+
+            trace.mAccumulatedBusyTime = 0;
+        }
+
+        mEngineIntervalStartTime = endTime;
+    }
+}
+
+uint64_t GpuTrace::GetEngineIntervalEndTime() const
+{
+    return mEngineIntervalStartTime + mPMConsumer->mEngineUtilizationInterval;
+}
+
+wchar_t const* PMTraceConsumer::GetEngineTypeName(Microsoft_Windows_DxgKrnl::DXGK_ENGINE engineType)
+{
+    using namespace Microsoft_Windows_DxgKrnl;
+    switch (engineType) {
+    case DXGK_ENGINE::OTHER:            return L"Other";
+    case DXGK_ENGINE::_3D:              return L"3D";
+    case DXGK_ENGINE::VIDEO_DECODE:     return L"VideoDecode";
+    case DXGK_ENGINE::VIDEO_ENCODE:     return L"VideoEncode";
+    case DXGK_ENGINE::VIDEO_PROCESSING: return L"VideoProcessing";
+    case DXGK_ENGINE::SCENE_ASSEMBLY:   return L"SceneAssembly";
+    case DXGK_ENGINE::COPY:             return L"Copy";
+    case DXGK_ENGINE::OVERLAY:          return L"Overlay";
+    case DXGK_ENGINE::CRYPTO:           return L"Crypto";
+    }
+    return L"Unknown";
+}
+
+uint8_t GpuTrace::TimelineFlags(Node const* node, Node::EnqueuedPacket const* entry)
+{
+    uint8_t flags = 0;
+    if (entry->mPacketTrace == nullptr) {
+        flags |= GPU_TIMELINE_WAIT_PACKET;
+    }
+    if (node->mIsVideo) {
+        flags |= GPU_TIMELINE_VIDEO_NODE;
+    }
+    return flags;
+}
+
+void GpuTrace::RecordTimeline(uint8_t kind, uint32_t nodeIndex, Node::EnqueuedPacket const* entry, uint64_t timestamp) const
+{
+    mPMConsumer->mGpuTimelineWriter->Record(kind, TimelineFlags(&mNodes[nodeIndex], entry), timestamp, 0, 0,
+                                            entry->mSequenceId, nodeIndex);
+}
+
 void GpuTrace::EnqueueWork(Context* context, uint32_t sequenceId, uint64_t timestamp, bool isWaitPacket)
 {
     auto packetTrace = context->mPacketTrace;
-    auto node = context->mNode;
+    auto node = &mNodes[context->mNodeIndex];
 
     // A very rare (never observed) race exists where packetTrace can still be
     // nullptr here.  The context must have been created and this packet must
@@ -262,16 +489,20 @@ void GpuTrace::EnqueueWork(Context* context, uint32_t sequenceId, uint64_t times
         return;
     }
 
-    // If the queue is too small, enlarge it by 16 entries at a time.  Typically, this will only be
-    // needed for the first packet observed on this node, which will result in sizing the queue from
-    // 0 to 16.  However, there are other cases where the queue entries can grow beyond that.  e.g.,
-    // this seems to always happen when an application closes.
+    // If the queue is full, double its size.  Typically, this will only be needed for the first
+    // packet observed on this node, which will result in sizing the queue from 0 to
+    // QUEUE_INITIAL_SIZE.  However, there are other cases where the queue entries can grow beyond
+    // that.  e.g., this seems to always happen when an application closes.  The queue is never
+    // shrunk, so once a node has seen its deepest queue no further allocations are made.
     uint32_t queueSize = (uint32_t) node->mQueue.size();
     if (node->mQueueCount == queueSize) {
-        Node::EnqueuedPacket empty{};
-        node->mQueue.insert(node->mQueue.begin() + node->mQueueIndex, 16, empty);
-        queueSize += 16;
-        node->mQueueIndex = (node->mQueueIndex + 16) % queueSize;
+        std::vector<Node::EnqueuedPacket> queue(queueSize == 0 ? (size_t) QUEUE_INITIAL_SIZE : 2 * (size_t) queueSize);
+        for (uint32_t i = 0; i < node->mQueueCount; ++i) {
+            queue[i] = node->mQueue[(node->mQueueIndex + i) & (queueSize - 1)];
+        }
+        node->mQueue.swap(queue);
+        node->mQueueIndex = 0;
+        queueSize = (uint32_t) node->mQueue.size();
     }
 
     // Enqueue the packet.
@@ -284,18 +515,33 @@ void GpuTrace::EnqueueWork(Context* context, uint32_t sequenceId, uint64_t times
         packetTrace = nullptr;
     }
 
-    auto queueIndex = (node->mQueueIndex + node->mQueueCount) % queueSize;
+    auto queueIndex = (node->mQueueIndex + node->mQueueCount) & (queueSize - 1);
     auto entry = &node->mQueue[queueIndex];
     entry->mPacketTrace = packetTrace;
     entry->mSequenceId = sequenceId;
     entry->mCompleted = false;
     node->mQueueCount += 1;
 
+    if (mPMConsumer->mGpuTimelineWriter != nullptr) {
+        auto flags = TimelineFlags(node, entry);
+        if (context->mIsHwQueue) {
+            flags |= GPU_TIMELINE_HW_QUEUE;
+        }
+        mPMConsumer->mGpuTimelineWriter->Record(GPU_TIMELINE_ENQUEUE, flags, timestamp, context->mHandle,
+                                                context->mProcessId, sequenceId, context->mNodeIndex);
+        if (node->mQueueCount == 1) {
+            RecordTimeline(GPU_TIMELINE_START, context->mNodeIndex, entry, timestamp);
+        }
+    }
+
     // If the queue was empty, the packet starts running right away, otherwise
     // it is just enqueued and will start running after all previous packets
     // complete.
     if (packetTrace != nullptr && node->mQueueCount == 1) {
         StartPacket(packetTrace, timestamp);
+        if (mPMConsumer->mEngineUtilizationInterval != 0) {
+            StartEngineWork(node, timestamp);
+        }
     }
 
     if (IsVerboseTraceEnabled()) {
@@ -305,7 +551,7 @@ void GpuTrace::EnqueueWork(Context* context, uint32_t sequenceId, uint64_t times
 
 bool GpuTrace::CompleteWork(Context* context, uint32_t sequenceId, uint64_t timestamp)
 {
-    auto node = context->mNode;
+    auto node = &mNodes[context->mNodeIndex];
 
     // It's possible to miss DmaPacket events during realtime analysis, so try
     // to handle it gracefully here.
@@ -326,6 +572,7 @@ bool GpuTrace::CompleteWork(Context* context, uint32_t sequenceId, uint64_t time
         return false;
     }
 
+    auto queueMask = (uint32_t) node->mQueue.size() - 1;
     auto runningSequenceId = node->mQueue[node->mQueueIndex].mSequenceId;
     if (sequenceId < runningSequenceId) {
         return false;
@@ -358,7 +605,7 @@ bool GpuTrace::CompleteWork(Context* context, uint32_t sequenceId, uint64_t time
                 return false;
             }
 
-            uint32_t queueIndex = (node->mQueueIndex + missingCount) % (uint32_t) node->mQueue.size();
+            uint32_t queueIndex = (node->mQueueIndex + missingCount) & queueMask;
             auto entry = &node->mQueue[queueIndex];
             if (entry->mSequenceId == sequenceId) {
 
@@ -372,7 +619,15 @@ bool GpuTrace::CompleteWork(Context* context, uint32_t sequenceId, uint64_t time
                     return true;
                 }
 
-                // Otherwise, move current packet into this slot
+                // Otherwise, move current packet into this slot.  The
+                // timeline records the skipped packets as completing without
+                // having started.
+                if (mPMConsumer->mGpuTimelineWriter != nullptr) {
+                    for (uint32_t i = 1; i <= missingCount; ++i) {
+                        RecordTimeline(GPU_TIMELINE_COMPLETE, context->mNodeIndex,
+                                       &node->mQueue[(node->mQueueIndex + i) & queueMask], timestamp);
+                    }
+                }
                 *entry = node->mQueue[node->mQueueIndex];
                 node->mQueueIndex = queueIndex;
                 node->mQueueCount -= missingCount;
@@ -389,20 +644,37 @@ bool GpuTrace::CompleteWork(Context* context, uint32_t sequenceId, uint64_t time
         if (entry->mPacketTrace->mRunningPacketCount == 0) {
             CompletePacket(entry->mPacketTrace, timestamp);
         }
+        if (mPMConsumer->mEngineUtilizationInterval != 0) {
+            CompleteEngineWork(node, timestamp);
+        }
+    }
+    if (mPMConsumer->mGpuTimelineWriter != nullptr) {
+        RecordTimeline(GPU_TIMELINE_COMPLETE, context->mNodeIndex, entry, timestamp);
     }
 
-    // Pop the completed packet from the queue, and start the next one.
-    uint32_t queueSize = (uint32_t) node->mQueue.size();
+    // Pop the completed packet from the queue, and start the next one.  Wait
+    // packets that already completed out of order are recorded as running for
+    // no time.
     for (;;) {
-        node->mQueueIndex = (node->mQueueIndex + 1) % queueSize;
+        node->mQueueIndex = (node->mQueueIndex + 1) & queueMask;
         node->mQueueCount -= 1;
         if (node->mQueueCount == 0) {
             break;
         }
 
         entry = &node->mQueue[node->mQueueIndex];
+        if (mPMConsumer->mGpuTimelineWriter != nullptr) {
+            RecordTimeline(GPU_TIMELINE_START, context->mNodeIndex, entry, timestamp);
+            if (entry->mPacketTrace == nullptr && entry->mCompleted) {
+                RecordTimeline(GPU_TIMELINE_COMPLETE, context->mNodeIndex, entry, timestamp);
+            }
+        }
+
         if (entry->mPacketTrace != nullptr) {
             StartPacket(entry->mPacketTrace, timestamp);
+            if (mPMConsumer->mEngineUtilizationInterval != 0) {
+                StartEngineWork(node, timestamp);
+            }
             break;
         }
 
@@ -411,30 +683,13 @@ bool GpuTrace::CompleteWork(Context* context, uint32_t sequenceId, uint64_t time
         }
     }
 
-    // Decrease queue storage in multiples of 16.
-    uint32_t N = (queueSize - node->mQueueCount) / 16;
-    if (N >= 2) {
-        N = (N - 1) * 16;
-        if (node->mQueueIndex >= N) {
-            node->mQueue.erase(node->mQueue.begin() + node->mQueueIndex - N, node->mQueue.begin() + node->mQueueIndex);
-            node->mQueueIndex -= N;
-        } else {
-            node->mQueue.erase(node->mQueue.begin() + queueSize - (N - node->mQueueIndex), node->mQueue.end());
-            node->mQueue.erase(node->mQueue.begin(), node->mQueue.begin() + node->mQueueIndex);
-            node->mQueueIndex = 0;
-        }
-        node->mQueue.shrink_to_fit();
-    }
-
     return true;
 }
 
 void GpuTrace::EnqueueQueuePacket(uint64_t hContext, uint32_t sequenceId, uint32_t processId, uint64_t timestamp, bool isWaitPacket)
 {
-    auto contextIter = mContexts.find(hContext);
-    if (contextIter != mContexts.end()) {
-        auto context = &contextIter->second;
-
+    auto context = FindContext(hContext);
+    if (context != nullptr) {
         // Ensure that the process id is registered with this context, for
         // cases where the context was created before the capture was started
         // so we didn't see a Context_Start event.
@@ -452,10 +707,8 @@ void GpuTrace::EnqueueQueuePacket(uint64_t hContext, uint32_t sequenceId, uint32
 
 void GpuTrace::CompleteQueuePacket(uint64_t hContext, uint32_t sequenceId, uint64_t timestamp)
 {
-    auto contextIter = mContexts.find(hContext);
-    if (contextIter != mContexts.end()) {
-        auto context = &contextIter->second;
-
+    auto context = FindContext(hContext);
+    if (context != nullptr) {
         // Use queue packet duration as a proxy for dma duration for cases we
         // don't get dma events for (HWS).
         if (context->mIsHwQueue) {
@@ -474,11 +727,10 @@ void GpuTrace::EnqueueDmaPacket(uint64_t hContext, uint32_t sequenceId, uint64_t
     // Lookup the context.  This can fail sometimes e.g. if parsing the
     // beginning of an ETL file where we can get packet events before the
     // context mapping.
-    auto ii = mContexts.find(hContext);
-    if (ii == mContexts.end()) {
+    auto context = FindContext(hContext);
+    if (context == nullptr) {
         return;
     }
-    auto context = &ii->second;
 
     // Should not see any dma packets on a HwQueue
     DebugAssert(!context->mIsHwQueue);
@@ -493,11 +745,10 @@ void GpuTrace::CompleteDmaPacket(uint64_t hContext, uint32_t sequenceId, uint64_
     // Lookup the context.  This can fail sometimes e.g. if parsing the
     // beginning of an ETL file where we can get packet events before the
     // context mapping.
-    auto ii = mContexts.find(hContext);
-    if (ii == mContexts.end()) {
+    auto context = FindContext(hContext);
+    if (context == nullptr) {
         return;
     }
-    auto context = &ii->second;
 
     // Should not see any dma packets on a HwQueue
     DebugAssert(!context->mIsHwQueue);
@@ -519,6 +770,11 @@ void GpuTrace::CompleteFrame(PresentEvent* pEvent, uint64_t timestamp)
     VerboseTraceBeforeModifyingPresent(pEvent);
     pEvent->GpuFrameCompleted = true;
 
+    if (mPMConsumer->mGpuTimelineWriter != nullptr) {
+        mPMConsumer->mGpuTimelineWriter->Record(GPU_TIMELINE_FRAME, 0, timestamp, pEvent->SwapChainAddress,
+                                                pEvent->ProcessId, pEvent->FrameId, 0);
+    }
+
     auto ii = mProcessFrameInfo.find(pEvent->ProcessId);
     if (ii != mProcessFrameInfo.end()) {
         auto frameInfo = &ii->second;
@@ -4,9 +4,13 @@
 
 #include <stdint.h>
 #include <unordered_map>
+#include <vector>
 
-#include "etw/Microsoft_Windows_DxgKrnl.h"
+#include "HandleIndexTable.hpp"
+#include "ETW/Microsoft_Windows_DxgKrnl.h"
 
+struct AnalysisSnapshotReader;
+struct AnalysisSnapshotWriter;
 struct PresentEvent;
 struct PMTraceConsumer;
 
@@ -24,26 +28,40 @@ class GpuTrace {
     // packets currently running/queued to it.  For implementations with
     // hardware scheduling enabled, there is one node per HWQueue many of which
     // may map to the same device engine.
+    //
+    // mQueue is a power-of-two ring that is allocated at QUEUE_INITIAL_SIZE
+    // for the first packet and only grows (doubling) if more packets are
+    // queued than ever before, so enqueuing and completing work doesn't
+    // allocate.
     struct Node {
         struct EnqueuedPacket {
             PacketTrace* mPacketTrace;      // Frame trace for this packet
             uint32_t mSequenceId;           // Sequence ID for this packet
             bool mCompleted;                // Flag to signal that the packet completed out-of-order
         };
-        std::vector<EnqueuedPacket> mQueue; // Ring buffer of current enqueued packets
+        std::vector<EnqueuedPacket> mQueue; // Ring buffer of current enqueued packets; size is 0 or a power of two
         uint32_t mQueueIndex;               // Index into mQueue for currently-running packet
         uint32_t mQueueCount;               // Number of enqueued packets
+        uint64_t mAdapter;                  // pDxgAdapter of the engine (of the parent context's node, for HwQueues)
+        Microsoft_Windows_DxgKrnl::DXGK_ENGINE mEngineType;
+        uint32_t mEngineTraceIndex;         // Index into mEngineTraces, or INVALID_INDEX if not looked up yet
         bool mIsVideo;
+        bool mIsEngineBusy;                 // Whether the node is counted in its EngineTrace's mRunningNodeCount
     };
 
+    enum : uint32_t { QUEUE_INITIAL_SIZE = 16 };
+
     // Context is a process' gpu context, mapping a PacketTrace to a
     // particular Node.
     struct Context {
         PacketTrace* mPacketTrace;
-        Node* mNode;
+        uint64_t mHandle;               // The hContext (or ParentDxgHwQueue) this context was registered with
         uint64_t mParentContext;
+        uint32_t mNodeIndex;            // Index into mNodes
+        uint32_t mProcessId;            // The process that mPacketTrace belongs to, if it is set
         bool mIsParentContext;
         bool mIsHwQueue;
+        bool mIsAllocated;              // False if the slot is on mFreeContextIndices
     };
 
     // State for tracking GPU execution per-frame, per-process
@@ -53,20 +71,67 @@ class GpuTrace {
         PacketTrace mOtherEngines;
     };
 
-    std::unordered_map<uint64_t, std::unordered_map<uint32_t, Node> > mNodes;   // pDxgAdapter -> NodeOrdinal -> Node
+    // EngineTrace accumulates the time that any node of an engine type, on an
+    // adapter, was running a packet during the current utilization interval.
+    struct EngineTrace {
+        uint64_t mAdapter;
+        Microsoft_Windows_DxgKrnl::DXGK_ENGINE mEngineType;
+        uint64_t mAccumulatedBusyTime;      // QPC duration while at least one node was running, up to mRunningStartTime
+        uint64_t mRunningStartTime;         // QPC when the running nodes started, or the interval began if later
+        uint32_t mRunningNodeCount;         // Number of nodes currently running a packet
+    };
+
+    // Nodes and contexts are assigned dense indices into mNodes and mContexts when they are
+    // registered.  Packet events are looked up from their hContext through mContextIndices, and
+    // then reach their node by index.  The slots of unregistered contexts, and of the nodes owned by
+    // HwQueue contexts, are reused through the free lists.  Pointers into mNodes and mContexts are
+    // invalidated when a node or context is registered.
+    std::vector<Node> mNodes;
+    std::vector<Context> mContexts;
+    std::vector<uint32_t> mFreeNodeIndices;
+    std::vector<uint32_t> mFreeContextIndices;
+    HandleIndexTable mContextIndices;                                           // hContext -> index into mContexts
+    std::unordered_map<uint64_t, std::vector<uint32_t> > mAdapterNodes;         // pDxgAdapter -> NodeOrdinal -> index into mNodes
     std::unordered_map<uint64_t, uint64_t> mDevices;                            // hDevice -> pDxgAdapter
-    std::unordered_map<uint64_t, Context> mContexts;                            // hContext -> Context
     std::unordered_map<uint32_t, ProcessFrameInfo> mProcessFrameInfo;           // ProcessID -> ProcessFrameInfo
     std::unordered_map<uint64_t, uint32_t> mPagingSequenceIds;                  // SequenceID -> ProcessID
 
+    // Engine utilization state, used when PMTraceConsumer::mEngineUtilizationInterval is set.
+    // There are only a handful of engines per adapter, so mEngineTraces is searched linearly
+    // and each node caches the index of its trace.
+    std::vector<EngineTrace> mEngineTraces;
+    uint64_t mEngineIntervalStartTime = 0;      // QPC when the current interval began, or 0 before the first event
+
     // The parent trace consumer
     PMTraceConsumer* mPMConsumer;
 
+    // Processes whose contexts couldn't be reclaimed by the current sweep pass because they still
+    // have queued work, so their ProcessFrameInfo must be kept.
+    std::vector<uint32_t> mSweepBusyProcessIds;
+
+    uint32_t FindOrCreateAdapterNode(uint64_t pDxgAdapter, uint32_t nodeOrdinal);
+    uint32_t AllocateNode();
+    uint32_t AllocateContext(uint64_t hContext, uint64_t timestamp);
+    void FreeContext(uint32_t contextIndex, uint64_t timestamp);
+    Context* FindContext(uint64_t hContext)
+    {
+        auto contextIndex = mContextIndices.Find(hContext);
+        return contextIndex == HandleIndexTable::INVALID_INDEX ? nullptr : &mContexts[contextIndex];
+    }
+
     void SetContextProcessId(Context* context, uint32_t processId);
 
     void StartPacket(PacketTrace* packetTrace, uint64_t timestamp) const;
     void CompletePacket(PacketTrace* packetTrace, uint64_t timestamp) const;
 
+    EngineTrace* FindOrCreateEngineTrace(Node* node);
+    void StartEngineWork(Node* node, uint64_t timestamp);
+    void CompleteEngineWork(Node* node, uint64_t timestamp);
+
+    // Record a packet's state change to mPMConsumer->mGpuTimelineWriter.
+    static uint8_t TimelineFlags(Node const* node, Node::EnqueuedPacket const* entry);
+    void RecordTimeline(uint8_t kind, uint32_t nodeIndex, Node::EnqueuedPacket const* entry, uint64_t timestamp) const;
+
     void EnqueueWork(Context* context, uint32_t sequenceId, uint64_t timestamp, bool isWaitPacket);
     bool CompleteWork(Context* context, uint32_t sequenceId, uint64_t timestamp);
 
@@ -79,11 +144,11 @@ public:
     void RegisterDevice(uint64_t hDevice, uint64_t pDxgAdapter);
     void UnregisterDevice(uint64_t hDevice);
 
-    void RegisterContext(uint64_t hContext, uint64_t hDevice, uint32_t nodeOrdinal, uint32_t processId);
-    void RegisterHwQueueContext(uint64_t hContext, uint64_t parentDxgHwQueue);
-    void UnregisterContext(uint64_t hContext);
+    void RegisterContext(uint64_t hContext, uint64_t hDevice, uint32_t nodeOrdinal, uint32_t processId, uint64_t timestamp);
+    void RegisterHwQueueContext(uint64_t hContext, uint64_t parentDxgHwQueue, uint64_t timestamp);
+    void UnregisterContext(uint64_t hContext, uint64_t timestamp);
 
-    void SetEngineType(uint64_t pDxgAdapter, uint32_t nodeOrdinal, Microsoft_Windows_DxgKrnl::DXGK_ENGINE engineType);
+    void SetEngineType(uint64_t pDxgAdapter, uint32_t nodeOrdinal, Microsoft_Windows_DxgKrnl::DXGK_ENGINE engineType, uint64_t timestamp);
 
     void EnqueueQueuePacket(uint64_t hContext, uint32_t sequenceId, uint32_t processId, uint64_t timestamp, bool isWaitPacket);
     void CompleteQueuePacket(uint64_t hContext, uint32_t sequenceId, uint64_t timestamp);
@@ -92,4 +157,25 @@ public:
     void CompleteDmaPacket(uint64_t hContext, uint32_t sequenceId, uint64_t timestamp);
 
     void CompleteFrame(PresentEvent* pEvent, uint64_t timestamp);
+
+    // Complete the EngineUtilizationSamples of every interval that ended at or before timestamp.
+    // Called when PMTraceConsumer::mEngineUtilizationInterval is set, once an event reaches
+    // GetEngineIntervalEndTime().
+    void SampleEngineUtilization(uint64_t timestamp);
+    uint64_t GetEngineIntervalEndTime() const;
+
+    // Save or restore the tracking state (see AnalysisSnapshot.hpp).
+    // RestoreSnapshot() must be called before any events are handled.
+    void SaveSnapshot(AnalysisSnapshotWriter* writer) const;
+    void RestoreSnapshot(AnalysisSnapshotReader* reader);
+
+    // Reclaim the state of processes that have exited (see StateSweep.cpp).  Each function
+    // examines about *budget entries starting at *bucket (a bucket or context index), and returns
+    // true once the whole structure has been examined.  SweepContexts() must be called before
+    // SweepProcessFrameInfo() in each pass.
+    bool SweepContexts(size_t* contextIndex, uint32_t* budget);
+    bool SweepProcessFrameInfo(size_t* bucket, uint32_t* budget, std::vector<uint64_t>* keys);
+    bool SweepPagingSequenceIds(size_t* bucket, uint32_t* budget, std::vector<uint64_t>* keys);
+    bool HasProcessState(uint32_t processId) const;
+    void UpdateStateGauges() const;
 };
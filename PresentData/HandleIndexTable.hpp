@@ -0,0 +1,145 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// HandleIndexTable maps a 64-bit kernel handle (e.g., an hContext) to a dense
+// uint32_t index, using a single open-addressing table with linear probing.
+// It is used where a handle-keyed std::unordered_map would otherwise be
+// consulted for every event, so that the lookup is one probe run over a
+// contiguous array with no per-entry allocation.
+//
+// Handles are kernel addresses whose low bits are mostly zero, so the slot is
+// taken from the high bits of a Fibonacci hash of the whole handle.  Erase()
+// uses backward-shift deletion, so there are no tombstones and erasing never
+// allocates.  INVALID_INDEX marks an empty slot and can't be stored.
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class HandleIndexTable {
+public:
+    enum : uint32_t { INVALID_INDEX = UINT32_MAX };
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+    size_t capacity() const { return entries_.size(); }
+
+    // Returns INVALID_INDEX if the handle is not in the table.
+    uint32_t Find(uint64_t handle) const
+    {
+        if (size_ != 0) {
+            auto mask = entries_.size() - 1;
+            for (auto i = Home(handle); entries_[i].index_ != INVALID_INDEX; i = (i + 1) & mask) {
+                if (entries_[i].handle_ == handle) {
+                    return entries_[i].index_;
+                }
+            }
+        }
+        return INVALID_INDEX;
+    }
+
+    // Replaces the index if the handle is already in the table.
+    void Insert(uint64_t handle, uint32_t index)
+    {
+        assert(index != INVALID_INDEX);
+
+        if (2 * (size_ + 1) > entries_.size()) {
+            Grow();
+        }
+
+        auto mask = entries_.size() - 1;
+        auto i = Home(handle);
+        for (; entries_[i].index_ != INVALID_INDEX; i = (i + 1) & mask) {
+            if (entries_[i].handle_ == handle) {
+                entries_[i].index_ = index;
+                return;
+            }
+        }
+
+        entries_[i].handle_ = handle;
+        entries_[i].index_ = index;
+        size_ += 1;
+    }
+
+    // Returns the erased index, or INVALID_INDEX if the handle is not in the
+    // table.
+    uint32_t Erase(uint64_t handle)
+    {
+        if (size_ != 0) {
+            auto mask = entries_.size() - 1;
+            for (auto i = Home(handle); entries_[i].index_ != INVALID_INDEX; i = (i + 1) & mask) {
+                if (entries_[i].handle_ == handle) {
+                    auto index = entries_[i].index_;
+                    EraseSlot(i);
+                    return index;
+                }
+            }
+        }
+        return INVALID_INDEX;
+    }
+
+    void clear()
+    {
+        entries_.clear();
+        shift_ = 64;
+        size_ = 0;
+    }
+
+private:
+    struct Entry {
+        uint64_t handle_ = 0;
+        uint32_t index_ = INVALID_INDEX;
+    };
+
+    enum { INITIAL_CAPACITY = 64 };
+
+    size_t Home(uint64_t handle) const
+    {
+        return (size_t) ((handle * 0x9E3779B97F4A7C15ull) >> shift_);
+    }
+
+    // Shift any following entries in the probe run back into the empty slot
+    // at i, so that every entry remains reachable from its home slot.
+    void EraseSlot(size_t i)
+    {
+        auto mask = entries_.size() - 1;
+        for (auto j = (i + 1) & mask; entries_[j].index_ != INVALID_INDEX; j = (j + 1) & mask) {
+            auto home = Home(entries_[j].handle_);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                entries_[i] = entries_[j];
+                i = j;
+            }
+        }
+        entries_[i].index_ = INVALID_INDEX;
+        size_ -= 1;
+    }
+
+    void Grow()
+    {
+        std::vector<Entry> old;
+        old.swap(entries_);
+        entries_.resize(old.empty() ? (size_t) INITIAL_CAPACITY : 2 * old.size());
+
+        shift_ = 64;
+        for (auto n = entries_.size(); n > 1; n >>= 1) {
+            shift_ -= 1;
+        }
+
+        auto mask = entries_.size() - 1;
+        for (auto const& e : old) {
+            if (e.index_ != INVALID_INDEX) {
+                auto i = Home(e.handle_);
+                while (entries_[i].index_ != INVALID_INDEX) {
+                    i = (i + 1) & mask;
+                }
+                entries_[i] = e;
+            }
+        }
+    }
+
+    std::vector<Entry> entries_;    // Size is 0 or a power of two
+    uint32_t shift_ = 64;           // 64 - log2(entries_.size())
+    size_t size_ = 0;
+};
@@ -0,0 +1,269 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// The Windows types and constants used by the event analysis.  On Windows
+// these come from the SDK.  Elsewhere (e.g., to replay a raw event stream or
+// run the analysis tests on Linux), this header defines the subset that the
+// analysis uses with the same sizes, layouts, and values as the SDK, so that
+// recorded EventMetadataKeys and TRACE_EVENT_INFO can be read on either.
+//
+// The ETW session, TDH lookups, and anything else that needs the OS stay
+// Windows-only (see PresentMonTraceSession.cpp).
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <windows.h>
+#include <evntcons.h> // must include after windows.h
+#include <tdh.h>      // must include after windows.h
+
+#else
+
+typedef int32_t  BOOL;
+typedef uint8_t  BOOLEAN;
+typedef uint8_t  BYTE;
+typedef uint8_t  UCHAR;
+typedef uint16_t USHORT;
+typedef uint16_t WORD;
+typedef uint32_t UINT;
+typedef uint32_t ULONG;
+typedef uint32_t DWORD;
+typedef int32_t  LONG;
+typedef int32_t  HRESULT;
+typedef int64_t  LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef uint64_t ULONG64;
+typedef char16_t WCHAR;     // Event strings are UTF-16 regardless of sizeof(wchar_t)
+
+#define TRUE  1
+#define FALSE 0
+
+#define _countof(_Array) (sizeof(_Array) / sizeof((_Array)[0]))
+#define FAILED(hr) (((HRESULT) (hr)) < 0)
+
+#define _fseeki64 fseeko
+#define _ftelli64 ftello
+
+typedef struct _GUID {
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t  Data4[8];
+} GUID;
+
+inline bool InlineIsEqualGUID(GUID const& lhs, GUID const& rhs) { return memcmp(&lhs, &rhs, sizeof(GUID)) == 0; }
+inline bool operator==(GUID const& lhs, GUID const& rhs) { return InlineIsEqualGUID(lhs, rhs); }
+inline bool operator!=(GUID const& lhs, GUID const& rhs) { return !InlineIsEqualGUID(lhs, rhs); }
+
+typedef union _LARGE_INTEGER {
+    struct {
+        DWORD LowPart;
+        LONG HighPart;
+    } u;
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef union _ULARGE_INTEGER {
+    struct {
+        DWORD LowPart;
+        DWORD HighPart;
+    } u;
+    ULONGLONG QuadPart;
+} ULARGE_INTEGER;
+
+typedef LARGE_INTEGER PHYSICAL_ADDRESS;
+
+typedef struct tagRECT {
+    LONG left;
+    LONG top;
+    LONG right;
+    LONG bottom;
+} RECT;
+
+// evntprov.h / evntcons.h / evntrace.h
+typedef struct _EVENT_DESCRIPTOR {
+    USHORT Id;
+    UCHAR Version;
+    UCHAR Channel;
+    UCHAR Level;
+    UCHAR Opcode;
+    USHORT Task;
+    ULONGLONG Keyword;
+} EVENT_DESCRIPTOR;
+
+#define EVENT_HEADER_FLAG_32_BIT_HEADER  0x0020
+#define EVENT_HEADER_FLAG_64_BIT_HEADER  0x0040
+#define EVENT_HEADER_FLAG_CLASSIC_HEADER 0x0100
+
+#define EVENT_TRACE_TYPE_INFO     0x00
+#define EVENT_TRACE_TYPE_START    0x01
+#define EVENT_TRACE_TYPE_END      0x02
+#define EVENT_TRACE_TYPE_STOP     0x02
+#define EVENT_TRACE_TYPE_DC_START 0x03
+#define EVENT_TRACE_TYPE_DC_END   0x04
+
+// tdh.h
+enum _TDH_IN_TYPE {
+    TDH_INTYPE_NULL,
+    TDH_INTYPE_UNICODESTRING,
+    TDH_INTYPE_ANSISTRING,
+    TDH_INTYPE_INT8,
+    TDH_INTYPE_UINT8,
+    TDH_INTYPE_INT16,
+    TDH_INTYPE_UINT16,
+    TDH_INTYPE_INT32,
+    TDH_INTYPE_UINT32,
+    TDH_INTYPE_INT64,
+    TDH_INTYPE_UINT64,
+    TDH_INTYPE_FLOAT,
+    TDH_INTYPE_DOUBLE,
+    TDH_INTYPE_BOOLEAN,
+    TDH_INTYPE_BINARY,
+    TDH_INTYPE_GUID,
+    TDH_INTYPE_POINTER,
+    TDH_INTYPE_FILETIME,
+    TDH_INTYPE_SYSTEMTIME,
+    TDH_INTYPE_SID,
+    TDH_INTYPE_HEXINT32,
+    TDH_INTYPE_HEXINT64,
+    TDH_INTYPE_COUNTEDSTRING = 300,
+    TDH_INTYPE_COUNTEDANSISTRING,
+    TDH_INTYPE_REVERSEDCOUNTEDSTRING,
+    TDH_INTYPE_REVERSEDCOUNTEDANSISTRING,
+    TDH_INTYPE_NONNULLTERMINATEDSTRING,
+    TDH_INTYPE_NONNULLTERMINATEDANSISTRING,
+    TDH_INTYPE_UNICODECHAR,
+    TDH_INTYPE_ANSICHAR,
+    TDH_INTYPE_SIZET,
+    TDH_INTYPE_HEXDUMP,
+    TDH_INTYPE_WBEMSID,
+};
+
+typedef enum _PROPERTY_FLAGS {
+    PropertyStruct           = 0x1,
+    PropertyParamLength      = 0x2,
+    PropertyParamCount       = 0x4,
+    PropertyWBEMXmlFragment  = 0x8,
+    PropertyParamFixedLength = 0x10,
+    PropertyParamFixedCount  = 0x20,
+} PROPERTY_FLAGS;
+
+typedef enum _DECODING_SOURCE {
+    DecodingSourceXMLFile,
+    DecodingSourceWbem,
+    DecodingSourceWPP,
+    DecodingSourceTlg,
+} DECODING_SOURCE;
+
+typedef struct _EVENT_PROPERTY_INFO {
+    PROPERTY_FLAGS Flags;
+    ULONG NameOffset;
+    union {
+        struct {
+            USHORT InType;
+            USHORT OutType;
+            ULONG MapNameOffset;
+        } nonStructType;
+        struct {
+            USHORT StructStartIndex;
+            USHORT NumOfStructMembers;
+            ULONG padding;
+        } structType;
+    };
+    union {
+        USHORT count;
+        USHORT countPropertyIndex;
+    };
+    union {
+        USHORT length;
+        USHORT lengthPropertyIndex;
+    };
+    ULONG Reserved;
+} EVENT_PROPERTY_INFO;
+
+typedef struct _TRACE_EVENT_INFO {
+    GUID ProviderGuid;
+    GUID EventGuid;
+    EVENT_DESCRIPTOR EventDescriptor;
+    DECODING_SOURCE DecodingSource;
+    ULONG ProviderNameOffset;
+    ULONG LevelNameOffset;
+    ULONG ChannelNameOffset;
+    ULONG KeywordsNameOffset;
+    ULONG TaskNameOffset;
+    ULONG OpcodeNameOffset;
+    ULONG EventMessageOffset;
+    ULONG ProviderMessageOffset;
+    ULONG BinaryXMLOffset;
+    ULONG BinaryXMLSize;
+    ULONG ActivityIDNameOffset;
+    ULONG RelatedActivityIDNameOffset;
+    ULONG PropertyCount;
+    ULONG TopLevelPropertyCount;
+    ULONG Flags;
+    EVENT_PROPERTY_INFO EventPropertyInfoArray[1];
+} TRACE_EVENT_INFO;
+
+static_assert(sizeof(EVENT_DESCRIPTOR) == 16, "EVENT_DESCRIPTOR must match the Windows SDK");
+static_assert(sizeof(EVENT_PROPERTY_INFO) == 24, "EVENT_PROPERTY_INFO must match the Windows SDK");
+static_assert(offsetof(TRACE_EVENT_INFO, EventPropertyInfoArray) == 112, "TRACE_EVENT_INFO must match the Windows SDK");
+
+#define TEI_PROPERTY_NAME(tei, epi) ((WCHAR const*) ((epi)->NameOffset ? ((BYTE const*) (tei) + (epi)->NameOffset) : nullptr))
+
+// Used in the declaration of PMTraceSession, whose implementation is
+// Windows-only.
+#define MAX_PATH 260
+
+typedef ULONG64 TRACEHANDLE;
+#define INVALID_PROCESSTRACE_HANDLE ((TRACEHANDLE) -1)
+
+typedef struct _SYSTEMTIME {
+    WORD wYear;
+    WORD wMonth;
+    WORD wDayOfWeek;
+    WORD wDay;
+    WORD wHour;
+    WORD wMinute;
+    WORD wSecond;
+    WORD wMilliseconds;
+} SYSTEMTIME;
+
+#endif
+
+// Parse a "{xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx}" string into a GUID at
+// compile time.  The ETW provider headers use this instead of __uuidof() so
+// that they don't depend on MSVC.
+constexpr uint32_t ParseGuidHex(char const* s, uint32_t digitCount)
+{
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < digitCount; ++i) {
+        auto c = s[i];
+        value = (value << 4) | (uint32_t) (c >= 'a' ? c - 'a' + 10 :
+                                           c >= 'A' ? c - 'A' + 10 :
+                                                      c - '0');
+    }
+    return value;
+}
+
+constexpr GUID ParseGuid(char const (&s)[39])
+{
+    GUID guid = {};
+    guid.Data1 = ParseGuidHex(s + 1, 8);
+    guid.Data2 = (uint16_t) ParseGuidHex(s + 10, 4);
+    guid.Data3 = (uint16_t) ParseGuidHex(s + 15, 4);
+    guid.Data4[0] = (uint8_t) ParseGuidHex(s + 20, 2);
+    guid.Data4[1] = (uint8_t) ParseGuidHex(s + 22, 2);
+    for (uint32_t i = 0; i < 6; ++i) {
+        guid.Data4[2 + i] = (uint8_t) ParseGuidHex(s + 25 + 2 * i, 2);
+    }
+    return guid;
+}
@@ -16,12 +16,31 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <stdlib.h>
+#ifdef _WIN32
 #include <d3d9.h>
 #include <dxgi.h>
-#include <stdlib.h>
-#include <unordered_set>
+#else
+#define D3DPRESENT_DONOTWAIT      0x00000001L
+#define D3DPRESENT_DONOTFLIP      0x00000004L
+#define D3DPRESENT_FLIPRESTART    0x00000008L
+#define D3DPRESENT_FORCEIMMEDIATE 0x00000100L
+
+#define DXGI_PRESENT_TEST             0x00000001UL
+#define DXGI_PRESENT_DO_NOT_SEQUENCE  0x00000002UL
+#define DXGI_PRESENT_RESTART          0x00000004UL
+#define DXGI_PRESENT_DO_NOT_WAIT      0x00000008UL
+
+#define DXGI_STATUS_OCCLUDED                ((HRESULT) 0x087A0001L)
+#define DXGI_STATUS_NO_DESKTOP_ACCESS       ((HRESULT) 0x087A0005L)
+#define DXGI_STATUS_MODE_CHANGE_IN_PROGRESS ((HRESULT) 0x087A0008L)
+#define S_PRESENT_OCCLUDED                  ((HRESULT) 0x08760868L)
+#endif
 
 static constexpr int PRESENTEVENT_CIRCULAR_BUFFER_SIZE = 1024;
+static constexpr uint32_t READY_PRESENT_QUEUE_SIZE = 4096;
+static constexpr uint32_t PROCESS_EVENT_QUEUE_SIZE = 4096;
+static constexpr uint32_t ENGINE_UTILIZATION_QUEUE_SIZE = 4096;
 
 // These macros, when enabled, record what PresentMon analysis below was done
 // for each present.  The primary use case is to compute usage statistics and
@@ -49,11 +68,17 @@ static constexpr int PRESENTEVENT_CIRCULAR_BUFFER_SIZE = 1024;
 #define TRACK_PRESENT_PATH_SAVE_GENERATED_ID(present) (void) present
 #endif
 
-static uint32_t gNextFrameId = 1;
+// The memory used by each tracked present, for mTrackedPresentMemoryLimit.
+static constexpr uint64_t TRACKED_PRESENT_SIZE = sizeof(PresentEvent) + sizeof(PresentEventPtr);
 
-static inline uint32_t GetRingIndex(uint32_t index)
+// Use mDeferredPresents ticks of about 1/32 to 1/64 of the deferral time limit.
+static uint32_t GetDeferralTickShift(uint64_t deferralTimeLimit)
 {
-    return index % PRESENTEVENT_CIRCULAR_BUFFER_SIZE;
+    uint32_t shift = 0;
+    while ((deferralTimeLimit >> shift) >= 64) {
+        shift += 1;
+    }
+    return shift;
 }
 
 static inline uint64_t GenerateVidPnLayerId(uint32_t vidPnSourceId, uint32_t layerIndex)
@@ -104,7 +129,7 @@ PresentEvent::PresentEvent()
     , DestHeight(0)
     , DriverThreadId(0)
 
-    , FrameId(gNextFrameId++)
+    , FrameId(0)
 
     , Runtime(Runtime::Other)
     , PresentMode(PresentMode::Unknown)
@@ -132,14 +157,250 @@ PresentEvent::PresentEvent()
 {
 }
 
+PresentEventPool::~PresentEventPool()
+{
+    assert(mOwnerCount == 0);
+}
+
+PresentEventPtr PresentEventPool::Allocate()
+{
+    // If the free list is empty, take the presents that have been returned by the dequeuing
+    // thread, or add a new slab if there aren't any.
+    if (mFreeList == nullptr) {
+        mFreeList = mReturnedList.exchange(nullptr, std::memory_order_acquire);
+        if (mFreeList == nullptr) {
+            auto slab = new Storage[SLAB_SIZE];
+            mSlabs.emplace_back(slab);
+            for (uint32_t i = SLAB_SIZE; i-- > 0; ) {
+                auto node = new (&slab[i]) FreeNode;
+                node->mNext = mFreeList;
+                mFreeList = node;
+            }
+        }
+    }
+
+    auto node = mFreeList;
+    mFreeList = node->mNext;
+
+    auto present = new (node) PresentEvent;
+    present->mPool = this;
+    present->FrameId = mNextFrameId++;
+    present->mOwners.store(PresentEventRefCount::OWNER_CONSUMER, std::memory_order_relaxed);
+    return PresentEventPtr(present);
+}
+
+void PresentEventPool::Detach()
+{
+    ReleaseOwnerCount();
+}
+
+void PresentEventPool::ReleaseOwnerCount()
+{
+    if (mOwnerCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
+
+// Called on the consumer thread when the first PresentEventPtr to a present is created.  This is
+// either a newly-allocated present, or one that is only referenced by mCompletedPresents (e.g., a
+// deferred present being expired) which cannot be dequeued until the consumer releases it.
+void PresentEventPool::AddConsumerOwner(PresentEvent* present)
+{
+    if ((present->mOwners.load(std::memory_order_relaxed) & PresentEventRefCount::OWNER_CONSUMER) == 0) {
+        present->mOwners.fetch_or(PresentEventRefCount::OWNER_CONSUMER, std::memory_order_relaxed);
+    }
+}
+
+// Called on the consumer thread when a completed present is added to mCompletedPresents.  The
+// present is published to the dequeuing thread later, by the release store that pushes it into
+// mReadyPresents.
+void PresentEventPool::AddDequeuedOwner(PresentEvent* present)
+{
+    assert((present->mOwners.load(std::memory_order_relaxed) & PresentEventRefCount::OWNER_DEQUEUED) == 0);
+
+    mOwnerCount.fetch_add(1, std::memory_order_relaxed);
+    present->mOwners.fetch_or(PresentEventRefCount::OWNER_DEQUEUED, std::memory_order_relaxed);
+}
+
+// Called on the consumer thread when the last PresentEventPtr to a present is released.  Only the
+// consumer thread can add the dequeued owner, so if it isn't set the present can be freed without
+// an atomic read-modify-write.
+void PresentEventPool::ReleaseConsumerOwner(PresentEvent* present)
+{
+    if (present->mOwners.load(std::memory_order_acquire) == PresentEventRefCount::OWNER_CONSUMER ||
+        present->mOwners.fetch_and(~PresentEventRefCount::OWNER_CONSUMER, std::memory_order_acq_rel) == PresentEventRefCount::OWNER_CONSUMER) {
+        present->~PresentEvent();
+
+        auto node = new (present) FreeNode;
+        node->mNext = mFreeList;
+        mFreeList = node;
+    }
+}
+
+// Called when the last DequeuedPresentPtr to a present is released, usually on the dequeuing
+// thread.  Completed presents have no DependentPresents, and a present in a DependentPresentList
+// is referenced by the list, so destroying the present here does not release any PresentEventPtrs.
+void PresentEventPool::ReleaseDequeuedOwner(PresentEvent* present)
+{
+    if (present->mOwners.fetch_and(~PresentEventRefCount::OWNER_DEQUEUED, std::memory_order_acq_rel) == PresentEventRefCount::OWNER_DEQUEUED) {
+        assert(present->DependentPresents.IsEmpty());
+        assert(!present->DependentPresentLink.mLinked);
+        present->~PresentEvent();
+
+        auto node = new (present) FreeNode;
+        node->mNext = mReturnedList.load(std::memory_order_relaxed);
+        while (!mReturnedList.compare_exchange_weak(node->mNext, node, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    ReleaseOwnerCount();
+}
+
+void DependentPresentList::PushBack(PresentEventPtr const& present)
+{
+    auto link = &present->DependentPresentLink;
+    assert(!link->mLinked);
+
+    link->mLinked = true;
+    link->mPrev = mTail;
+    if (mTail == nullptr) {
+        mHead = present;
+    } else {
+        mTail->DependentPresentLink.mNext = present;
+    }
+    mTail = present.get();
+}
+
+void DependentPresentList::Remove(PresentEvent* present)
+{
+    auto link = &present->DependentPresentLink;
+    assert(link->mLinked);
+
+    // Take the list's reference to present, so it stays alive until it is unlinked.
+    auto prev = link->mPrev;
+    auto self = prev == nullptr ? std::move(mHead) : std::move(prev->DependentPresentLink.mNext);
+    assert(self.get() == present);
+
+    if (link->mNext == nullptr) {
+        mTail = prev;
+    } else {
+        link->mNext->DependentPresentLink.mPrev = prev;
+    }
+    if (prev == nullptr) {
+        mHead = std::move(link->mNext);
+    } else {
+        prev->DependentPresentLink.mNext = std::move(link->mNext);
+    }
+
+    link->mPrev = nullptr;
+    link->mLinked = false;
+}
+
+void DependentPresentList::MoveTo(DependentPresentList* dst)
+{
+    if (mHead == nullptr) {
+        return;
+    }
+
+    if (dst->mTail == nullptr) {
+        dst->mHead = std::move(mHead);
+    } else {
+        mHead->DependentPresentLink.mPrev = dst->mTail;
+        dst->mTail->DependentPresentLink.mNext = std::move(mHead);
+    }
+    dst->mTail = mTail;
+    mTail = nullptr;
+}
+
+void DependentPresentList::Clear()
+{
+    // Unlink the presents one at a time, rather than letting each release the next, so that
+    // releasing a long list doesn't recurse.
+    while (mHead != nullptr) {
+        auto present = std::move(mHead);
+        auto link = &present->DependentPresentLink;
+        mHead = std::move(link->mNext);
+        link->mPrev = nullptr;
+        link->mLinked = false;
+    }
+    mTail = nullptr;
+}
+
+bool PMTraceConsumer::OrderedPresents::Insert(PresentEventPtr const& present)
+{
+    auto presentStartTime = present->PresentStartTime;
+    auto index = mCount;
+    if (mCount > 0 && (*this)[mCount - 1]->PresentStartTime >= presentStartTime) {
+        index = LowerBound(presentStartTime);
+        if ((*this)[index]->PresentStartTime == presentStartTime) {
+            return false;
+        }
+    }
+
+    if (mCount == mRing.size()) {
+        std::vector<PresentEventPtr> ring(mRing.empty() ? 8 : 2 * mRing.size());
+        for (size_t i = 0; i < mCount; ++i) {
+            ring[i] = std::move(At(i));
+        }
+        mRing.swap(ring);
+        mFirst = 0;
+    }
+
+    for (auto i = mCount; i > index; --i) {
+        At(i) = std::move(At(i - 1));
+    }
+    At(index) = present;
+    mCount += 1;
+    return true;
+}
+
+void PMTraceConsumer::OrderedPresents::Erase(uint64_t presentStartTime)
+{
+    auto index = LowerBound(presentStartTime);
+    if (index == mCount || (*this)[index]->PresentStartTime != presentStartTime) {
+        return;
+    }
+
+    // Update the ring before the erased reference is released.
+    PresentEventPtr erased;
+    if (index == 0) {
+        erased = std::move(At(0));
+        mFirst = (mFirst + 1) & (mRing.size() - 1);
+    } else {
+        erased = std::move(At(index));
+        for (auto i = index + 1; i < mCount; ++i) {
+            At(i - 1) = std::move(At(i));
+        }
+    }
+    mCount -= 1;
+}
+
+size_t PMTraceConsumer::OrderedPresents::LowerBound(uint64_t presentStartTime) const
+{
+    size_t lo = 0;
+    size_t hi = mCount;
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+        if ((*this)[mid]->PresentStartTime < presentStartTime) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
 PMTraceConsumer::PMTraceConsumer()
-    : mTrackedPresents(PRESENTEVENT_CIRCULAR_BUFFER_SIZE)
+    : mPresentEventPool(new PresentEventPool)
     , mCompletedPresents(PRESENTEVENT_CIRCULAR_BUFFER_SIZE)
+    , mReadyPresents(READY_PRESENT_QUEUE_SIZE)
+    , mProcessEvents(PROCESS_EVENT_QUEUE_SIZE)
+    , mEngineUtilizationSamples(ENGINE_UTILIZATION_QUEUE_SIZE)
     , mGpuTrace(this)
 {
 }
 
-void PMTraceConsumer::HandleD3D9Event(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleD3D9Event(PMEventRecord* pEventRecord)
 {
     auto const& hdr = pEventRecord->EventHeader;
     switch (hdr.EventDescriptor.Id) {
@@ -179,7 +440,7 @@ void PMTraceConsumer::HandleD3D9Event(EVENT_RECORD* pEventRecord)
     }
 }
 
-void PMTraceConsumer::HandleDXGIEvent(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleDXGIEvent(PMEventRecord* pEventRecord)
 {
     auto const& hdr = pEventRecord->EventHeader;
     switch (hdr.EventDescriptor.Id) {
@@ -213,12 +474,12 @@ void PMTraceConsumer::HandleDXGIEvent(EVENT_RECORD* pEventRecord)
     }
 }
 
-void PMTraceConsumer::HandleDxgkBlt(EVENT_HEADER const& hdr, uint64_t hwnd, bool redirectedPresent)
+void PMTraceConsumer::HandleDxgkBlt(PMEventHeader const& hdr, uint64_t hwnd, bool redirectedPresent)
 {
     // Lookup the in-progress present.  It should not have a known present mode
     // yet, so if it does we assume we looked up a present whose tracking was
     // lost.
-    std::shared_ptr<PresentEvent> presentEvent;
+    PresentEventPtr presentEvent;
     for (;;) {
         presentEvent = FindOrCreatePresent(hdr);
         if (presentEvent == nullptr) {
@@ -256,7 +517,7 @@ void PMTraceConsumer::HandleDxgkBlt(EVENT_HEADER const& hdr, uint64_t hwnd, bool
 //     QueuePacket_Start SubmitSequence MMIOFLIP bPresent=1
 //     QueuePacket_Stop SubmitSequence
 //     PresentStop
-void PMTraceConsumer::HandleDxgkFlip(EVENT_HEADER const& hdr, int32_t flipInterval, bool isMMIOFlip, bool isMPOFlip)
+void PMTraceConsumer::HandleDxgkFlip(PMEventHeader const& hdr, int32_t flipInterval, bool isMMIOFlip, bool isMPOFlip)
 {
     // First, lookup the in-progress present on the same thread.
     //
@@ -267,7 +528,7 @@ void PMTraceConsumer::HandleDxgkFlip(EVENT_HEADER const& hdr, int32_t flipInterv
     // However, DWM on recent windows may omit the PresentStart/PresentStop events.  In this case,
     // we'll end up creating the present here and, because there is no PresentStop, it will be left
     // in mPresentByThreadId and looked up again in the next HandleDxgkFlip().
-    std::shared_ptr<PresentEvent> presentEvent;
+    PresentEventPtr presentEvent;
     for (;;) {
         // Lookup the in-progress present on this thread.
         auto ii = mPresentByThreadId.find(hdr.ThreadId);
@@ -307,7 +568,7 @@ void PMTraceConsumer::HandleDxgkFlip(EVENT_HEADER const& hdr, int32_t flipInterv
             return;
         }
 
-        presentEvent = std::make_shared<PresentEvent>();
+        presentEvent = mPresentEventPool->Allocate();
 
         VerboseTraceBeforeModifyingPresent(presentEvent.get());
         presentEvent->PresentStartTime = *(uint64_t*) &hdr.TimeStamp;
@@ -340,17 +601,17 @@ void PMTraceConsumer::HandleDxgkFlip(EVENT_HEADER const& hdr, int32_t flipInterv
     // If this is the DWM thread, make any presents waiting for DWM dependent on it (i.e., they will
     // be displayed when it is).
     if (hdr.ThreadId == DwmPresentThreadId) {
-        DebugAssert(presentEvent->DependentPresents.empty());
+        DebugAssert(presentEvent->DependentPresents.IsEmpty());
 
-        for (auto& p : mPresentsWaitingForDWM) {
+        for (auto p = mPresentsWaitingForDWM.mHead.get(); p != nullptr; p = p->DependentPresentLink.mNext.get()) {
             p->PresentInDwmWaitingStruct = false;
         }
-        std::swap(presentEvent->DependentPresents, mPresentsWaitingForDWM);
+        mPresentsWaitingForDWM.MoveTo(&presentEvent->DependentPresents);
     }
 }
 
 void PMTraceConsumer::HandleDxgkQueueSubmit(
-    EVENT_HEADER const& hdr,
+    PMEventHeader const& hdr,
     uint64_t hContext,
     uint32_t submitSequence,
     uint32_t packetType,
@@ -408,9 +669,8 @@ void PMTraceConsumer::HandleDxgkQueueSubmit(
             VerboseTraceBeforeModifyingPresent(present.get());
             present->QueueSubmitSequence = submitSequence;
 
-            auto presentsBySubmitSequence = &mPresentBySubmitSequence[submitSequence];
-            DebugAssert(presentsBySubmitSequence->find(hContext) == presentsBySubmitSequence->end());
-            (*presentsBySubmitSequence)[hContext] = present;
+            DebugAssert(mPresentBySubmitSequence.Find(submitSequence, hContext) == nullptr);
+            mPresentBySubmitSequence.Insert(submitSequence, hContext, present);
 
             if (isWin7 && present->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
                 mPresentByDxgkContext[hContext] = present;
@@ -428,50 +688,46 @@ void PMTraceConsumer::HandleDxgkQueueComplete(uint64_t timestamp, uint64_t hCont
     }
 
     // If this packet was a present packet being tracked...
-    auto ii = mPresentBySubmitSequence.find(submitSequence);
-    if (ii != mPresentBySubmitSequence.end()) {
-        auto presentsBySubmitSequence = &ii->second;
-        auto jj = presentsBySubmitSequence->find(hContext);
-        if (jj != presentsBySubmitSequence->end()) {
-            auto pEvent = jj->second;
-
-            TRACK_PRESENT_PATH_SAVE_GENERATED_ID(pEvent);
-
-            // Stop tracking GPU work for this present.
-            //
-            // Note: there is a potential race here because QueuePacket_Stop
-            // occurs sometime after DmaPacket_Info it's possible that some
-            // small portion of the next frame's GPU work has started before
-            // QueuePacket_Stop and will be attributed to this frame.  However,
-            // this is necessarily a small amount of work, and we can't use DMA
-            // packets as not all present types create them.
-            if (mTrackGPU) {
-                mGpuTrace.CompleteFrame(pEvent.get(), timestamp);
-            }
+    auto ii = mPresentBySubmitSequence.Find(submitSequence, hContext);
+    if (ii != nullptr) {
+        auto pEvent = *ii;
 
-            // We use present packet completion as the screen time for
-            // Hardware_Legacy_Copy_To_Front_Buffer and Hardware_Legacy_Flip
-            // present modes, unless we are expecting a subsequent flip/*sync
-            // event from DXGK.
-            if (pEvent->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer ||
-                (pEvent->PresentMode == PresentMode::Hardware_Legacy_Flip && !pEvent->WaitForFlipEvent)) {
-                VerboseTraceBeforeModifyingPresent(pEvent.get());
+        TRACK_PRESENT_PATH_SAVE_GENERATED_ID(pEvent);
 
-                if (pEvent->ReadyTime == 0) {
-                    pEvent->ReadyTime = timestamp;
-                }
+        // Stop tracking GPU work for this present.
+        //
+        // Note: there is a potential race here because QueuePacket_Stop
+        // occurs sometime after DmaPacket_Info it's possible that some
+        // small portion of the next frame's GPU work has started before
+        // QueuePacket_Stop and will be attributed to this frame.  However,
+        // this is necessarily a small amount of work, and we can't use DMA
+        // packets as not all present types create them.
+        if (mTrackGPU) {
+            mGpuTrace.CompleteFrame(pEvent.get(), timestamp);
+        }
+
+        // We use present packet completion as the screen time for
+        // Hardware_Legacy_Copy_To_Front_Buffer and Hardware_Legacy_Flip
+        // present modes, unless we are expecting a subsequent flip/*sync
+        // event from DXGK.
+        if (pEvent->PresentMode == PresentMode::Hardware_Legacy_Copy_To_Front_Buffer ||
+            (pEvent->PresentMode == PresentMode::Hardware_Legacy_Flip && !pEvent->WaitForFlipEvent)) {
+            VerboseTraceBeforeModifyingPresent(pEvent.get());
+
+            if (pEvent->ReadyTime == 0) {
+                pEvent->ReadyTime = timestamp;
+            }
 
-                pEvent->ScreenTime = timestamp;
-                pEvent->FinalState = PresentResult::Presented;
+            pEvent->ScreenTime = timestamp;
+            pEvent->FinalState = PresentResult::Presented;
 
-                // Sometimes, the queue packets associated with a present will complete
-                // before the DxgKrnl PresentInfo event is fired.  For blit presents in
-                // this case, we have no way to differentiate between fullscreen and
-                // windowed blits, so we defer the completion of this present until
-                // we've also seen the Dxgk Present_Info event.
-                if (pEvent->SeenDxgkPresent || pEvent->PresentMode != PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
-                    CompletePresent(pEvent);
-                }
+            // Sometimes, the queue packets associated with a present will complete
+            // before the DxgKrnl PresentInfo event is fired.  For blit presents in
+            // this case, we have no way to differentiate between fullscreen and
+            // windowed blits, so we defer the completion of this present until
+            // we've also seen the Dxgk Present_Info event.
+            if (pEvent->SeenDxgkPresent || pEvent->PresentMode != PresentMode::Hardware_Legacy_Copy_To_Front_Buffer) {
+                CompletePresent(pEvent);
             }
         }
     }
@@ -481,27 +737,15 @@ void PMTraceConsumer::HandleDxgkQueueComplete(uint64_t timestamp, uint64_t hCont
 // events that reference submit sequence id don't include the queue context,
 // it's possible (though rare) that there are multiple presents in flight with
 // the same submit sequence id.  If that is the case, we pick the oldest one.
-std::shared_ptr<PresentEvent> PMTraceConsumer::FindPresentBySubmitSequence(uint32_t submitSequence)
-{
-    auto ii = mPresentBySubmitSequence.find(submitSequence);
-    if (ii != mPresentBySubmitSequence.end()) {
-        auto presentsBySubmitSequence = &ii->second;
-
-        auto jj = presentsBySubmitSequence->begin();
-        auto je = presentsBySubmitSequence->end();
-        DebugAssert(jj != je);
-        if (jj != je) {
-            auto present = jj->second;
-            for (++jj; jj != je; ++jj) {
-                if (present->PresentStartTime > jj->second->PresentStartTime) {
-                    present = jj->second;
-                }
-            }
-            return present;
+PresentEventPtr PMTraceConsumer::FindPresentBySubmitSequence(uint32_t submitSequence)
+{
+    PresentEvent* present = nullptr;
+    mPresentBySubmitSequence.ForEachWithSequence(submitSequence, [&](uint64_t, PresentEventPtr const& p) {
+        if (present == nullptr || present->PresentStartTime > p->PresentStartTime) {
+            present = p.get();
         }
-    }
-
-    return std::shared_ptr<PresentEvent>();
+    });
+    return PresentEventPtr(present);
 }
 
 // An MMIOFlip event is emitted when an MMIOFlip packet is dequeued.  All GPU
@@ -565,7 +809,7 @@ void PMTraceConsumer::HandleDxgkSyncDPC(uint64_t timestamp, uint32_t submitSeque
 // while DWM is on and gives us a token we can use to match with the
 // Microsoft_Windows_DxgKrnl::PresentHistory_Info event.
 void PMTraceConsumer::HandleDxgkPresentHistory(
-    EVENT_HEADER const& hdr,
+    PMEventHeader const& hdr,
     uint64_t token,
     uint64_t tokenData,
     Microsoft_Windows_DxgKrnl::PresentModel presentModel)
@@ -573,7 +817,7 @@ void PMTraceConsumer::HandleDxgkPresentHistory(
     // Lookup the in-progress present.  It should not have a known
     // DxgkPresentHistoryToken yet, so if it does we assume we looked up a
     // present whose tracking was lost.
-    std::shared_ptr<PresentEvent> presentEvent;
+    PresentEventPtr presentEvent;
     for (;;) {
         presentEvent = FindOrCreatePresent(hdr);
         if (presentEvent == nullptr) {
@@ -633,8 +877,7 @@ void PMTraceConsumer::HandleDxgkPresentHistory(
     case PresentMode::Composed_Copy_CPU_GDI:
         if (tokenData == 0) {
             // This is the best we can do, we won't be able to tell how many frames are actually displayed.
-            mPresentsWaitingForDWM.emplace_back(presentEvent);
-            presentEvent->PresentInDwmWaitingStruct = true;
+            AddPresentWaitingForDWM(presentEvent);
         } else {
             DebugAssert(mPresentByDxgkPresentHistoryTokenData.find(tokenData) == mPresentByDxgkPresentHistoryTokenData.end());
             mPresentByDxgkPresentHistoryTokenData[tokenData] = presentEvent;
@@ -652,7 +895,7 @@ void PMTraceConsumer::HandleDxgkPresentHistory(
 
 // This event is emitted when a token is being handed off to DWM, and is a good
 // way to indicate a ready state.
-void PMTraceConsumer::HandleDxgkPresentHistoryInfo(EVENT_HEADER const& hdr, uint64_t token)
+void PMTraceConsumer::HandleDxgkPresentHistoryInfo(PMEventHeader const& hdr, uint64_t token)
 {
     auto eventIter = mPresentByDxgkPresentHistoryToken.find(token);
     if (eventIter == mPresentByDxgkPresentHistoryToken.end()) {
@@ -672,8 +915,7 @@ void PMTraceConsumer::HandleDxgkPresentHistoryInfo(EVENT_HEADER const& hdr, uint
     // Composed presents are currently ignored.
     if (//eventIter->second->PresentMode == PresentMode::Composed_Composition_Atlas ||
         (eventIter->second->PresentMode == PresentMode::Composed_Flip && !eventIter->second->SeenWin32KEvents)) {
-        mPresentsWaitingForDWM.emplace_back(eventIter->second);
-        eventIter->second->PresentInDwmWaitingStruct = true;
+        AddPresentWaitingForDWM(eventIter->second);
     }
 
     if (eventIter->second->PresentMode == PresentMode::Composed_Copy_GPU_GDI) {
@@ -686,7 +928,7 @@ void PMTraceConsumer::HandleDxgkPresentHistoryInfo(EVENT_HEADER const& hdr, uint
     mPresentByDxgkPresentHistoryToken.erase(eventIter);
 }
 
-void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleDXGKEvent(PMEventRecord* pEventRecord)
 {
     auto const& hdr = pEventRecord->EventHeader;
 
@@ -756,73 +998,46 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
         // QueuPacket_Start_3 are used for monitor signal packets
         case Microsoft_Windows_DxgKrnl::QueuePacket_Start::Id:
         {
-            EventDataDesc desc[] = {
-                { L"PacketType" },
-                { L"SubmitSequence" },
-                { L"hContext" },
-                { L"bPresent" },
-            };
-            mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-            auto PacketType     = desc[0].GetData<uint32_t>();
-            auto SubmitSequence = desc[1].GetData<uint32_t>();
-            auto hContext       = desc[2].GetData<uint64_t>();
-            auto bPresent       = desc[3].GetData<BOOL>() != 0;
+            Microsoft_Windows_DxgKrnl::QueuePacket_Start_View e;
+            mMetadata.GetEventView(pEventRecord, &mDxgkViewLayouts.QueuePacket_Start, &e);
 
-            HandleDxgkQueueSubmit(hdr, hContext, SubmitSequence, PacketType, bPresent, false);
+            HandleDxgkQueueSubmit(hdr, e.hContext, e.SubmitSequence, e.PacketType, e.bPresent != 0, false);
             return;
         }
         case Microsoft_Windows_DxgKrnl::QueuePacket_Start_2::Id:
         {
-            EventDataDesc desc[] = {
-                { L"hContext" },
-                { L"SubmitSequence" },
-            };
-            mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-            auto hContext       = desc[0].GetData<uint64_t>();
-            auto SubmitSequence = desc[1].GetData<uint32_t>();
+            Microsoft_Windows_DxgKrnl::QueuePacket_View e;
+            mMetadata.GetEventView(pEventRecord, &mDxgkViewLayouts.QueuePacket_Start_2, &e);
 
             uint32_t PacketType = (uint32_t) Microsoft_Windows_DxgKrnl::QueuePacketType::DXGKETW_WAIT_COMMAND_BUFFER;
             bool bPresent = false;
-            HandleDxgkQueueSubmit(hdr, hContext, SubmitSequence, PacketType, bPresent, false);
+            HandleDxgkQueueSubmit(hdr, e.hContext, e.SubmitSequence, PacketType, bPresent, false);
             return;
         }
         case Microsoft_Windows_DxgKrnl::QueuePacket_Stop::Id:
         {
-            EventDataDesc desc[] = {
-                { L"hContext" },
-                { L"SubmitSequence" },
-            };
-            mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-            auto hContext       = desc[0].GetData<uint64_t>();
-            auto SubmitSequence = desc[1].GetData<uint32_t>();
+            Microsoft_Windows_DxgKrnl::QueuePacket_View e;
+            mMetadata.GetEventView(pEventRecord, &mDxgkViewLayouts.QueuePacket_Stop, &e);
 
             TRACK_PRESENT_PATH_GENERATE_ID();
-            HandleDxgkQueueComplete(hdr.TimeStamp.QuadPart, hContext, SubmitSequence);
+            HandleDxgkQueueComplete(hdr.TimeStamp.QuadPart, e.hContext, e.SubmitSequence);
             return;
         }
         case Microsoft_Windows_DxgKrnl::MMIOFlip_Info::Id:
         {
-            EventDataDesc desc[] = {
-                { L"FlipSubmitSequence" },
-                { L"Flags" },
-            };
-            mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-            auto FlipSubmitSequence = desc[0].GetData<uint32_t>();
-            auto Flags              = desc[1].GetData<uint32_t>();
+            Microsoft_Windows_DxgKrnl::MMIOFlip_Info_View e;
+            mMetadata.GetEventView(pEventRecord, &mDxgkViewLayouts.MMIOFlip_Info, &e);
 
             TRACK_PRESENT_PATH_GENERATE_ID();
-            HandleDxgkMMIOFlip(hdr.TimeStamp.QuadPart, FlipSubmitSequence, Flags);
+            HandleDxgkMMIOFlip(hdr.TimeStamp.QuadPart, e.FlipSubmitSequence, e.Flags);
             return;
         }
         case Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info::Id:
         {
             auto flipEntryStatusAfterFlipValid = hdr.EventDescriptor.Version >= 2;
-            EventDataDesc desc[] = {
-                { L"FlipSubmitSequence" },
-                { L"FlipEntryStatusAfterFlip" }, // optional
-            };
-            mMetadata.GetEventData(pEventRecord, desc, _countof(desc) - (flipEntryStatusAfterFlipValid ? 0 : 1));
-            auto FlipSubmitSequence = desc[0].GetData<uint64_t>();
+            Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay_Info_View e;
+            mMetadata.GetEventView(pEventRecord, &mDxgkViewLayouts.MMIOFlipMultiPlaneOverlay_Info, &e);
+            auto FlipSubmitSequence = e.FlipSubmitSequence;
 
             auto submitSequence = (uint32_t) (FlipSubmitSequence >> 32u);
             auto present = FindPresentBySubmitSequence(submitSequence);
@@ -838,7 +1053,7 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
 
                 // Check and handle the post-flip status if available.
                 if (flipEntryStatusAfterFlipValid) {
-                    auto FlipEntryStatusAfterFlip = desc[1].GetData<uint32_t>();
+                    auto FlipEntryStatusAfterFlip = e.FlipEntryStatusAfterFlip;
 
                     // Nothing to do for FlipWaitVSync other than wait for the VSync events.
                     if (FlipEntryStatusAfterFlip != (uint32_t) Microsoft_Windows_DxgKrnl::FlipEntryStatus::FlipWaitVSync) {
@@ -885,9 +1100,10 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
         {
             TRACK_PRESENT_PATH_GENERATE_ID();
 
-            auto FlipFenceId = mMetadata.GetEventData<uint64_t>(pEventRecord, L"FlipFenceId");
-            if (FlipFenceId != 0) {
-                HandleDxgkSyncDPC(hdr.TimeStamp.QuadPart, (uint32_t)(FlipFenceId >> 32u));
+            Microsoft_Windows_DxgKrnl::VSyncDPC_Info_View e;
+            mMetadata.GetEventView(pEventRecord, &mDxgkViewLayouts.VSyncDPC_Info, &e);
+            if (e.FlipFenceId != 0) {
+                HandleDxgkSyncDPC(hdr.TimeStamp.QuadPart, (uint32_t)(e.FlipFenceId >> 32u));
             }
             return;
         }
@@ -1107,11 +1323,11 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
                 ? 0
                 : hdr.ProcessId;
 
-            mGpuTrace.RegisterContext(hContext, hDevice, NodeOrdinal, processId);
+            mGpuTrace.RegisterContext(hContext, hDevice, NodeOrdinal, processId, hdr.TimeStamp.QuadPart);
             return;
         }
         case Microsoft_Windows_DxgKrnl::Context_Stop::Id:
-            mGpuTrace.UnregisterContext(mMetadata.GetEventData<uint64_t>(pEventRecord, L"hContext"));
+            mGpuTrace.UnregisterContext(mMetadata.GetEventData<uint64_t>(pEventRecord, L"hContext"), hdr.TimeStamp.QuadPart);
             return;
 
         case Microsoft_Windows_DxgKrnl::HwQueue_DCStart::Id:
@@ -1125,7 +1341,7 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
             auto hContext        = desc[0].GetData<uint64_t>();
             auto hHwQueueContext = desc[1].GetData<uint64_t>();
 
-            mGpuTrace.RegisterHwQueueContext(hContext, hHwQueueContext);
+            mGpuTrace.RegisterHwQueueContext(hContext, hHwQueueContext, hdr.TimeStamp.QuadPart);
             return;
         }
 
@@ -1141,7 +1357,7 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
             auto NodeOrdinal = desc[1].GetData<uint32_t>();
             auto EngineType  = desc[2].GetData<Microsoft_Windows_DxgKrnl::DXGK_ENGINE>();
 
-            mGpuTrace.SetEngineType(pDxgAdapter, NodeOrdinal, EngineType);
+            mGpuTrace.SetEngineType(pDxgAdapter, NodeOrdinal, EngineType, hdr.TimeStamp.QuadPart);
             return;
         }
 
@@ -1153,16 +1369,11 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
         // DmaBuffer will be null).
         case Microsoft_Windows_DxgKrnl::DmaPacket_Start::Id:
         {
-            EventDataDesc desc[] = {
-                { L"hContext" },
-                { L"ulQueueSubmitSequence" },
-            };
-            mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-            auto hContext   = desc[0].GetData<uint64_t>();
-            auto SequenceId = desc[1].GetData<uint32_t>();
+            Microsoft_Windows_DxgKrnl::DmaPacket_View e;
+            mMetadata.GetEventView(pEventRecord, &mDxgkViewLayouts.DmaPacket_Start, &e);
 
-            if (SequenceId != 0) {
-                mGpuTrace.EnqueueDmaPacket(hContext, SequenceId, hdr.TimeStamp.QuadPart);
+            if (e.ulQueueSubmitSequence != 0) {
+                mGpuTrace.EnqueueDmaPacket(e.hContext, e.ulQueueSubmitSequence, hdr.TimeStamp.QuadPart);
             }
             return;
         }
@@ -1172,16 +1383,11 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
         // bound.
         case Microsoft_Windows_DxgKrnl::DmaPacket_Info::Id:
         {
-            EventDataDesc desc[] = {
-                { L"hContext" },
-                { L"ulQueueSubmitSequence" },
-            };
-            mMetadata.GetEventData(pEventRecord, desc, _countof(desc));
-            auto hContext   = desc[0].GetData<uint64_t>();
-            auto SequenceId = desc[1].GetData<uint32_t>();
+            Microsoft_Windows_DxgKrnl::DmaPacket_View e;
+            mMetadata.GetEventView(pEventRecord, &mDxgkViewLayouts.DmaPacket_Info, &e);
 
-            if (SequenceId != 0) {
-                mGpuTrace.CompleteDmaPacket(hContext, SequenceId, hdr.TimeStamp.QuadPart);
+            if (e.ulQueueSubmitSequence != 0) {
+                mGpuTrace.CompleteDmaPacket(e.hContext, e.ulQueueSubmitSequence, hdr.TimeStamp.QuadPart);
             }
             return;
         }
@@ -1264,7 +1470,7 @@ void PMTraceConsumer::HandleDXGKEvent(EVENT_RECORD* pEventRecord)
     assert(!mFilteredEvents); // Assert that filtering is working if expected
 }
 
-void PMTraceConsumer::HandleWin7DxgkBlt(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleWin7DxgkBlt(PMEventRecord* pEventRecord)
 {
     using namespace Microsoft_Windows_DxgKrnl::Win7;
 
@@ -1277,7 +1483,7 @@ void PMTraceConsumer::HandleWin7DxgkBlt(EVENT_RECORD* pEventRecord)
         pBltEvent->bRedirectedPresent != 0);
 }
 
-void PMTraceConsumer::HandleWin7DxgkFlip(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleWin7DxgkFlip(PMEventRecord* pEventRecord)
 {
     using namespace Microsoft_Windows_DxgKrnl::Win7;
 
@@ -1291,7 +1497,7 @@ void PMTraceConsumer::HandleWin7DxgkFlip(EVENT_RECORD* pEventRecord)
         false);
 }
 
-void PMTraceConsumer::HandleWin7DxgkPresentHistory(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleWin7DxgkPresentHistory(PMEventRecord* pEventRecord)
 {
     using namespace Microsoft_Windows_DxgKrnl::Win7;
 
@@ -1309,7 +1515,7 @@ void PMTraceConsumer::HandleWin7DxgkPresentHistory(EVENT_RECORD* pEventRecord)
     }
 }
 
-void PMTraceConsumer::HandleWin7DxgkQueuePacket(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleWin7DxgkQueuePacket(PMEventRecord* pEventRecord)
 {
     using namespace Microsoft_Windows_DxgKrnl::Win7;
 
@@ -1332,7 +1538,7 @@ void PMTraceConsumer::HandleWin7DxgkQueuePacket(EVENT_RECORD* pEventRecord)
     }
 }
 
-void PMTraceConsumer::HandleWin7DxgkVSyncDPC(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleWin7DxgkVSyncDPC(PMEventRecord* pEventRecord)
 {
     using namespace Microsoft_Windows_DxgKrnl::Win7;
 
@@ -1344,7 +1550,7 @@ void PMTraceConsumer::HandleWin7DxgkVSyncDPC(EVENT_RECORD* pEventRecord)
     HandleDxgkSyncDPC(pEventRecord->EventHeader.TimeStamp.QuadPart, (uint32_t)(pVSyncDPCEvent->FlipFenceId.QuadPart >> 32u));
 }
 
-void PMTraceConsumer::HandleWin7DxgkMMIOFlip(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleWin7DxgkMMIOFlip(PMEventRecord* pEventRecord)
 {
     using namespace Microsoft_Windows_DxgKrnl::Win7;
 
@@ -1376,7 +1582,12 @@ std::size_t PMTraceConsumer::Win32KPresentHistoryTokenHash::operator()(PMTraceCo
     return std::hash<uint64_t>::operator()(h64);
 }
 
-void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
+std::size_t PMTraceConsumer::SwapChainKeyHash::operator()(PMTraceConsumer::SwapChainKey const& v) const noexcept
+{
+    return std::hash<uint64_t>::operator()(((uint64_t) v.first << 32) ^ v.second);
+}
+
+void PMTraceConsumer::HandleWin32kEvent(PMEventRecord* pEventRecord)
 {
     auto const& hdr = pEventRecord->EventHeader;
 
@@ -1399,7 +1610,7 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
             // Lookup the in-progress present.  It should not have seen any Win32K
             // events yet, so if it has we assume we looked up a present whose
             // tracking was lost.
-            std::shared_ptr<PresentEvent> present;
+            PresentEventPtr present;
             for (;;) {
                 present = FindOrCreatePresent(hdr);
                 if (present == nullptr) {
@@ -1583,7 +1794,7 @@ void PMTraceConsumer::HandleWin32kEvent(EVENT_RECORD* pEventRecord)
     assert(!mFilteredEvents); // Assert that filtering is working if expected
 }
 
-void PMTraceConsumer::HandleDWMEvent(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleDWMEvent(PMEventRecord* pEventRecord)
 {
     auto const& hdr = pEventRecord->EventHeader;
     switch (hdr.EventDescriptor.Id) {
@@ -1597,8 +1808,7 @@ void PMTraceConsumer::HandleDWMEvent(EVENT_RECORD* pEventRecord)
                 present->PresentMode == PresentMode::Composed_Copy_CPU_GDI) {
                 TRACK_PRESENT_PATH(present);
                 VerboseTraceBeforeModifyingPresent(present.get());
-                mPresentsWaitingForDWM.emplace_back(present);
-                present->PresentInDwmWaitingStruct = true;
+                AddPresentWaitingForDWM(present);
             }
         }
         mLastPresentByWindow.clear();
@@ -1682,8 +1892,7 @@ void PMTraceConsumer::HandleDWMEvent(EVENT_RECORD* pEventRecord)
         if (eventIter != mPresentByWin32KPresentHistoryToken.end() && eventIter->second->SeenInFrameEvent) {
             TRACK_PRESENT_PATH(eventIter->second);
             VerboseTraceBeforeModifyingPresent(eventIter->second.get());
-            mPresentsWaitingForDWM.emplace_back(eventIter->second);
-            eventIter->second->PresentInDwmWaitingStruct = true;
+            AddPresentWaitingForDWM(eventIter->second);
         }
         break;
     }
@@ -1694,29 +1903,10 @@ void PMTraceConsumer::HandleDWMEvent(EVENT_RECORD* pEventRecord)
     }
 }
 
-void PMTraceConsumer::RemovePresentFromSubmitSequenceIdTracking(std::shared_ptr<PresentEvent> const& present)
+void PMTraceConsumer::RemovePresentFromSubmitSequenceIdTracking(PresentEventPtr const& present)
 {
     if (present->QueueSubmitSequence != 0) {
-        auto ii = mPresentBySubmitSequence.find(present->QueueSubmitSequence);
-        if (ii != mPresentBySubmitSequence.end()) {
-            auto presentsBySubmitSequence = &ii->second;
-
-            // Do a linear search for present here.  We could do a find() but that
-            // would require storing the queue context in PresentEvent and since
-            // presentsBySubmitSequence is expected to be small (typically one element)
-            // this should be faster.
-            if (presentsBySubmitSequence->size() == 1) {
-                DebugAssert(presentsBySubmitSequence->begin()->second == present);
-                mPresentBySubmitSequence.erase(ii);
-            } else {
-                for (auto jj = presentsBySubmitSequence->begin(), je = presentsBySubmitSequence->end(); jj != je; ++jj) {
-                    if (jj->second == present) {
-                        presentsBySubmitSequence->erase(jj);
-                        break;
-                    }
-                }
-            }
-        }
+        mPresentBySubmitSequence.Erase(present->QueueSubmitSequence, present);
 
         // Don't report clearing of key in verbose trace
         VerboseTraceBeforeModifyingPresent(nullptr);
@@ -1725,7 +1915,7 @@ void PMTraceConsumer::RemovePresentFromSubmitSequenceIdTracking(std::shared_ptr<
 }
 
 // Remove the present from all temporary tracking structures.
-void PMTraceConsumer::StopTrackingPresent(std::shared_ptr<PresentEvent> const& p)
+void PMTraceConsumer::StopTrackingPresent(PresentEventPtr const& p)
 {
     // Don't report changes to the tracking members.
     VerboseTraceBeforeModifyingPresent(nullptr);
@@ -1757,7 +1947,7 @@ void PMTraceConsumer::StopTrackingPresent(std::shared_ptr<PresentEvent> const& p
     }
 
     // mOrderedPresentsByProcessId
-    mOrderedPresentsByProcessId[p->ProcessId].erase(p->PresentStartTime);
+    mOrderedPresentsByProcessId[p->ProcessId].Erase(p->PresentStartTime);
 
     // mPresentBySubmitSequence
     RemovePresentFromSubmitSequenceIdTracking(p);
@@ -1829,24 +2019,33 @@ void PMTraceConsumer::StopTrackingPresent(std::shared_ptr<PresentEvent> const& p
 
     // mPresentsWaitingForDWM
     if (p->PresentInDwmWaitingStruct) {
-        for (auto presentIter = mPresentsWaitingForDWM.begin(); presentIter != mPresentsWaitingForDWM.end(); presentIter++) {
-            if (p == *presentIter) {
-                mPresentsWaitingForDWM.erase(presentIter);
-                break;
-            }
-        }
+        mPresentsWaitingForDWM.Remove(p.get());
         p->PresentInDwmWaitingStruct = false;
     }
 }
 
-void PMTraceConsumer::RemoveLostPresent(std::shared_ptr<PresentEvent> p)
+void PMTraceConsumer::AddPresentWaitingForDWM(PresentEventPtr const& present)
+{
+    // A present can only be in one DependentPresentList.  If it is already waiting for DWM, or has
+    // already been made dependent on a DWM present (which will complete it first), leave it there.
+    if (present->DependentPresentLink.mLinked) {
+        return;
+    }
+
+    mPresentsWaitingForDWM.PushBack(present);
+    present->PresentInDwmWaitingStruct = true;
+}
+
+void PMTraceConsumer::RemoveLostPresent(PresentEventPtr p)
 {
+    mLostPresentCount.fetch_add(1, std::memory_order_relaxed);
+
     VerboseTraceBeforeModifyingPresent(p.get());
     p->IsLost = true;
     CompletePresent(p);
 }
 
-void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> const& p)
+void PMTraceConsumer::CompletePresent(PresentEventPtr const& p)
 {
     // We use the first completed present to indicate that all necessary
     // providers are running and able to successfully track/complete presents.
@@ -1863,7 +2062,7 @@ void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> const& p)
     if (!mHasCompletedAPresent && !p->IsLost) {
         for (auto const& pr : mOrderedPresentsByProcessId) {
             for (auto orderedPresents = &pr.second; !orderedPresents->empty(); ) {
-                RemoveLostPresent(orderedPresents->begin()->second);
+                RemoveLostPresent((*orderedPresents)[0]);
             }
         }
 
@@ -1885,6 +2084,8 @@ void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> const& p)
     VerboseTraceBeforeModifyingPresent(p.get());
     p->IsCompleted = true;
 
+    RecordPresentTransition(p->IsLost ? FLIGHT_RECORD_PRESENT_LOST : FLIGHT_RECORD_PRESENT_COMPLETE, *p);
+
     // If this is a DWM present, complete any other present that contributed to
     // it.  A DWM present only completes each HWND's most-recent Composed_Flip
     // PresentEvent, so we mark any others as discarded.
@@ -1892,43 +2093,51 @@ void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> const& p)
     // PresentEvents that become lost are not removed from DependentPresents
     // tracking, so we need to protect against lost events (but they have
     // already been added to mCompletedPresents etc.).
-    if (!p->DependentPresents.empty()) {
-        std::unordered_set<uint64_t> completedComposedFlipHwnds;
-        for (auto ii = p->DependentPresents.rbegin(), ie = p->DependentPresents.rend(); ii != ie; ++ii) {
-            auto p2 = *ii;
+    if (!p->DependentPresents.IsEmpty()) {
+        DependentPresentList dependentPresents;
+        p->DependentPresents.MoveTo(&dependentPresents);
+
+        mCompletedComposedFlipHwnds.clear();
+        for (auto p2 = dependentPresents.mTail; p2 != nullptr; p2 = p2->DependentPresentLink.mPrev) {
             if (!p2->IsCompleted) {
-                if (p2->PresentMode == PresentMode::Composed_Flip && !completedComposedFlipHwnds.emplace(p2->Hwnd).second) {
-                    VerboseTraceBeforeModifyingPresent(p2.get());
+                auto hwndAlreadyCompleted = false;
+                if (p2->PresentMode == PresentMode::Composed_Flip) {
+                    auto ii = std::find(mCompletedComposedFlipHwnds.begin(), mCompletedComposedFlipHwnds.end(), p2->Hwnd);
+                    if (ii == mCompletedComposedFlipHwnds.end()) {
+                        mCompletedComposedFlipHwnds.push_back(p2->Hwnd);
+                    } else {
+                        hwndAlreadyCompleted = true;
+                    }
+                }
+
+                if (hwndAlreadyCompleted) {
+                    VerboseTraceBeforeModifyingPresent(p2);
                     p2->FinalState = PresentResult::Discarded;
                 } else if (p2->FinalState != PresentResult::Discarded) {
-                    VerboseTraceBeforeModifyingPresent(p2.get());
+                    VerboseTraceBeforeModifyingPresent(p2);
                     p2->FinalState = p->FinalState;
                     p2->ScreenTime = p->ScreenTime;
                 }
 
                 if (p->IsLost) {
-                    VerboseTraceBeforeModifyingPresent(p2.get());
+                    VerboseTraceBeforeModifyingPresent(p2);
                     p2->IsLost = true;
                 }
             }
         }
-        for (auto p2 : p->DependentPresents) {
+        for (auto p2 = dependentPresents.mHead; p2 != nullptr; p2 = p2->DependentPresentLink.mNext) {
             if (!p2->IsCompleted) {
                 CompletePresent(p2);
             }
         }
-        p->DependentPresents.clear();
-        p->DependentPresents.shrink_to_fit();
     }
 
     // If presented, remove any earlier presents made on the same swap chain.
     if (p->FinalState == PresentResult::Presented) {
         auto presentsByThisProcess = &mOrderedPresentsByProcessId[p->ProcessId];
-        for (auto ii = presentsByThisProcess->begin(), ie = presentsByThisProcess->end(); ii != ie; ) {
-            auto p2 = ii->second;
+        for (size_t i = 0; i < presentsByThisProcess->size(); ) {
+            auto p2 = (*presentsByThisProcess)[i];
             if (p2->PresentStartTime >= p->PresentStartTime) break;
-            ++ii; // Increment the iterator first since below calls may remove it from
-                  // presentsByThisProcess.
 
             if (p2->SwapChainAddress == p->SwapChainAddress) {
                 if (p->IsLost) {
@@ -1942,6 +2151,10 @@ void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> const& p)
                     CompletePresent(p2);
                 }
             }
+
+            // The calls above may have removed presents from presentsByThisProcess, so continue
+            // from the first present after p2.
+            i = presentsByThisProcess->LowerBound(p2->PresentStartTime + 1);
         }
     }
 
@@ -1982,74 +2195,248 @@ void PMTraceConsumer::CompletePresent(std::shared_ptr<PresentEvent> const& p)
     AddPresentToCompletedList(p);
 }
 
-void PMTraceConsumer::AddPresentToCompletedList(std::shared_ptr<PresentEvent> const& present)
+void PMTraceConsumer::AddPresentToCompletedList(PresentEventPtr const& present)
 {
-    {
-        std::lock_guard<std::mutex> lock(mPresentEventMutex);
+    // If the completed list is full and can't grow, throw away the oldest completed present, if it
+    // IsLost; or this present, if it IsLost; or the oldest completed present.
+    uint32_t index;
+    DequeuedPresentPtr dropped;
+    if (mCompletedCount == mCompletedPresents.size() && !GrowCompletedPresents()) {
+        mDroppedPresentCount.fetch_add(1, std::memory_order_relaxed);
+        if (!mCompletedPresents[mCompletedIndex]->IsLost && present->IsLost) {
+            return;
+        }
 
-        // If the completed list is full, throw away the oldest completed present, if it IsLost; or this
-        // present, if it IsLost; or the oldest completed present.
-        uint32_t index;
-        if (mCompletedCount == PRESENTEVENT_CIRCULAR_BUFFER_SIZE) {
-            if (!mCompletedPresents[mCompletedIndex]->IsLost && present->IsLost) {
-                return;
-            }
+        index = mCompletedIndex;
+        dropped = std::move(mCompletedPresents[index]);
+        mCompletedIndex = GetCompletedIndex(mCompletedIndex + 1);
+    } else {
+        index = GetCompletedIndex(mCompletedIndex + mCompletedCount);
+        mCompletedCount++;
+    }
+
+    mCompletedPresents[index] = DequeuedPresentPtr(present.get());
 
-            index = mCompletedIndex;
-            mCompletedIndex = GetRingIndex(mCompletedIndex + 1);
-            if (mReadyCount > 0) {
-                mReadyCount--;
+    auto swapChain = std::make_pair(present->ProcessId, present->SwapChainAddress);
+    if (present->DeferredReason != DeferredReason_None) {
+        mBlockedSwapChains.insert(swapChain);
+        AddDeferredPresent(present);
+    }
+
+    // If there is no deferral time limit, deferred presents instead expire once a present that
+    // started after them is completed.  This is done before publishing this present, so that it
+    // isn't dequeued ahead of the presents that it expires.
+    if (mDeferralTimeLimit == 0) {
+        ExpireDeferredPresents(present->PresentStartTime);
+    }
+
+    // A present from a swap chain without a deferred present can be published right away (unless
+    // presents are already being held back for room in mReadyPresents).  It is the newest present
+    // in the ring, unless expiring deferred presents above already published it.
+    if (present->DeferredReason == DeferredReason_None) {
+        if (mReadyPresentsFull) {
+            RetryPublishCompletedPresents();
+        } else if (mCompletedCount > 0 && mBlockedSwapChains.find(swapChain) == mBlockedSwapChains.end()) {
+            auto& newest = mCompletedPresents[GetCompletedIndex(mCompletedIndex + mCompletedCount - 1)];
+            if (newest.get() == present.get()) {
+                if (mReadyPresents.TryPush(std::move(newest))) {
+                    mCompletedCount -= 1;
+                    mDequeueEventCount.Notify();
+                } else {
+                    mReadyPresentsFull = true;
+                    mNextTimedWorkTime = 0;
+                }
             }
-        } else {
-            index = GetRingIndex(mCompletedIndex + mCompletedCount);
-            mCompletedCount++;
         }
+    }
 
-        mCompletedPresents[index] = present;
+    // Dropping a deferred present may have unblocked the rest of its swap chain.
+    if (dropped && dropped->DeferredReason != DeferredReason_None) {
+        PublishSwapChainPresents(std::make_pair(dropped->ProcessId, dropped->SwapChainAddress));
+    }
+}
 
-        if (present->DeferredReason == DeferredReason_None && index == GetRingIndex(mCompletedIndex + mReadyCount)) {
-            mReadyCount++;
-        }
+// It's possible for a deferred condition to never be cleared.  e.g., a process' last present doesn't
+// get a Present_Stop event.  So deferred presents are also put into mDeferredPresents, which clears
+// the deferral if it is still set once the present gets too old.
+void PMTraceConsumer::AddDeferredPresent(PresentEventPtr const& present)
+{
+    if (mDeferredPresents.empty()) {
+        mDeferredPresents.SetTickShift(GetDeferralTickShift(mDeferralTimeLimit));
     }
+    auto deadline = present->PresentStartTime + mDeferralTimeLimit + 1;
+    mDeferredPresents.Insert(deadline, present);
+    if (mDeferralTimeLimit != 0) {
+        mNextTimedWorkTime = std::min(mNextTimedWorkTime, deadline);
+    }
+}
 
-    // It's possible for a deferred condition to never be cleared.  e.g., a process' last present
-    // doesn't get a Present_Stop event.  When this happens the deferred present will prevent all
-    // subsequent presents from other processes from being dequeued until the ring buffer wraps and
-    // forces it out, which is likely longer than we want to wait.  So we check here if there is 
-    // a stuck deferred present and clear the deferral if it gets too old.
-    if (mReadyCount == 0) {
-        auto const& deferredPresent = mCompletedPresents[mCompletedIndex];
-        if (present->PresentStartTime >= deferredPresent->PresentStartTime &&
-            present->PresentStartTime - deferredPresent->PresentStartTime > mDeferralTimeLimit) {
-            VerboseTraceBeforeModifyingPresent(deferredPresent.get());
-            deferredPresent->IsLost = true;
-            ClearDeferredReason(deferredPresent, deferredPresent->DeferredReason);
+void PMTraceConsumer::ExpireDeferredPresents(uint64_t timestamp)
+{
+    mDeferredPresents.Advance(timestamp, [this](PresentEventPtr const& present) {
+        if (present->DeferredReason != DeferredReason_None) {
+            VerboseTraceBeforeModifyingPresent(present.get());
+            present->IsLost = true;
+            ClearDeferredReason(present, present->DeferredReason);
+        }
+    });
+}
+
+// Expire deferred presents, sweep a slice of the tracking state, complete any finished engine
+// utilization intervals, and hand off any completed presents that are waiting for room in
+// mReadyPresents.  This is called for an event only once its timestamp reaches
+// mNextTimedWorkTime, which is then set to the earliest time that any of them has work to do.
+void PMTraceConsumer::ServiceTimedWork(uint64_t timestamp)
+{
+    auto next = UINT64_MAX;
+
+    if (mDeferralTimeLimit != 0) {
+        ExpireDeferredPresents(timestamp);
+        if (!mDeferredPresents.empty()) {
+            // Deadlines are rounded up to a tick, so nothing can expire before the next one.
+            auto tickShift = GetDeferralTickShift(mDeferralTimeLimit);
+            next = std::min(next, ((timestamp >> tickShift) + 1) << tickShift);
         }
     }
+
+    if (mSweepIdleHorizon != 0) {
+        SweepTrackedState(timestamp);
+        next = std::min(next, mSweepInProgress ? timestamp : mNextSweepTime);
+    }
+
+    if (mEngineUtilizationInterval != 0 && mTrackGPU) {
+        mGpuTrace.SampleEngineUtilization(timestamp);
+        next = std::min(next, mGpuTrace.GetEngineIntervalEndTime());
+    }
+
+    RetryPublishCompletedPresents();
+    if (mReadyPresentsFull) {
+        next = 0;
+    }
+
+    mNextTimedWorkTime = next;
 }
 
-void PMTraceConsumer::ClearDeferredReason(std::shared_ptr<PresentEvent> const& present, uint32_t deferredReason)
+void PMTraceConsumer::ClearDeferredReason(PresentEventPtr const& present, uint32_t deferredReason)
 {
-    // Remove the deferred reason
+    // Remove the deferred reason.  Once there is no reason left, the present (and any presents
+    // from the same swap chain that were waiting on it) can be handed off to the dequeuing thread,
+    // which is done only after it is no longer being tracked.
     if (present->DeferredReason != DeferredReason_None) {
         VerboseTraceBeforeModifyingPresent(present.get());
+
         present->DeferredReason &= ~deferredReason;
 
         StopTrackingPresent(present);
 
         if (present->DeferredReason == DeferredReason_None) {
-            std::lock_guard<std::mutex> lock(mPresentEventMutex);
+            PublishSwapChainPresents(std::make_pair(present->ProcessId, present->SwapChainAddress));
+        }
+    }
+}
 
-            uint32_t nextIndex = GetRingIndex(mCompletedIndex + mReadyCount);
-            while (mReadyCount < mCompletedCount && mCompletedPresents[nextIndex]->DeferredReason == DeferredReason_None) {
-                mReadyCount++;
-                nextIndex = GetRingIndex(mCompletedIndex + mReadyCount);
+void PMTraceConsumer::PublishCompletedPresents()
+{
+    // Move every present that isn't deferred into mReadyPresents, except those from a swap chain
+    // with an earlier deferred present so that each swap chain's presents stay in order.  The
+    // remaining presents are moved up to the front of the ring, and mBlockedSwapChains is rebuilt.
+    //
+    // If mReadyPresents is full, the rest of the presents are kept until the next call so that they
+    // are only dropped if mCompletedPresents also fills up.
+    mBlockedSwapChains.clear();
+
+    uint32_t publishedCount = 0;
+    uint32_t keepCount = 0;
+    bool readyPresentsFull = false;
+    for (uint32_t i = 0; i < mCompletedCount; ++i) {
+        auto& present = mCompletedPresents[GetCompletedIndex(mCompletedIndex + i)];
+
+        bool keep = true;
+        auto swapChain = std::make_pair(present->ProcessId, present->SwapChainAddress);
+        if (present->DeferredReason != DeferredReason_None) {
+            mBlockedSwapChains.insert(swapChain);
+        } else if (!readyPresentsFull && mBlockedSwapChains.find(swapChain) == mBlockedSwapChains.end()) {
+            if (mReadyPresents.TryPush(std::move(present))) {
+                publishedCount++;
+                keep = false;
+            } else {
+                readyPresentsFull = true;
+            }
+        }
+
+        if (keep) {
+            if (keepCount != i) {
+                std::swap(mCompletedPresents[GetCompletedIndex(mCompletedIndex + keepCount)], present);
             }
+            keepCount++;
         }
     }
+
+    mCompletedCount = keepCount;
+    mReadyPresentsFull = readyPresentsFull;
+    if (readyPresentsFull) {
+        mNextTimedWorkTime = 0;
+    }
+
+    if (publishedCount > 0) {
+        mDequeueEventCount.Notify();
+    }
 }
 
-void PMTraceConsumer::SetThreadPresent(uint32_t threadId, std::shared_ptr<PresentEvent> const& present)
+// Called when a deferred present from swapChain is no longer deferred, or has been dropped, to
+// publish the swap chain's presents up to its next deferred present.  Presents from other swap
+// chains are left where they are, so this only scans as far as the first present that it
+// publishes and then moves the rest of the ring up behind it.
+void PMTraceConsumer::PublishSwapChainPresents(SwapChainKey const& swapChain)
+{
+    if (mReadyPresentsFull) {
+        PublishCompletedPresents();
+        return;
+    }
+
+    uint32_t publishedCount = 0;
+    uint32_t keepCount = 0;
+    bool blocked = false;
+    for (uint32_t i = 0; i < mCompletedCount; ++i) {
+        auto& present = mCompletedPresents[GetCompletedIndex(mCompletedIndex + i)];
+
+        bool keep = true;
+        if (!blocked && present->ProcessId == swapChain.first && present->SwapChainAddress == swapChain.second) {
+            if (present->DeferredReason != DeferredReason_None) {
+                blocked = true;
+            } else if (mReadyPresents.TryPush(std::move(present))) {
+                publishedCount++;
+                keep = false;
+            } else {
+                mReadyPresentsFull = true;
+                mNextTimedWorkTime = 0;
+                blocked = true;
+            }
+        }
+
+        if (keep) {
+            if (blocked && publishedCount == 0) {
+                // Nothing has been published, so the rest of the ring stays where it is.
+                return;
+            }
+            if (keepCount != i) {
+                std::swap(mCompletedPresents[GetCompletedIndex(mCompletedIndex + keepCount)], present);
+            }
+            keepCount++;
+        }
+    }
+
+    mCompletedCount = keepCount;
+    if (!blocked) {
+        mBlockedSwapChains.erase(swapChain);
+    }
+
+    if (publishedCount > 0) {
+        mDequeueEventCount.Notify();
+    }
+}
+
+void PMTraceConsumer::SetThreadPresent(uint32_t threadId, PresentEventPtr const& present)
 {
     // If there is an in-flight present on this thread already, then something
     // has gone wrong with it's tracking so consider it lost.
@@ -2061,13 +2448,13 @@ void PMTraceConsumer::SetThreadPresent(uint32_t threadId, std::shared_ptr<Presen
     mPresentByThreadId.emplace(threadId, present);
 }
 
-std::shared_ptr<PresentEvent> PMTraceConsumer::FindThreadPresent(uint32_t threadId)
+PresentEventPtr PMTraceConsumer::FindThreadPresent(uint32_t threadId)
 {
     auto ii = mPresentByThreadId.find(threadId);
-    return ii == mPresentByThreadId.end() ? std::shared_ptr<PresentEvent>() : ii->second;
+    return ii == mPresentByThreadId.end() ? PresentEventPtr() : ii->second;
 }
 
-std::shared_ptr<PresentEvent> PMTraceConsumer::FindOrCreatePresent(EVENT_HEADER const& hdr)
+PresentEventPtr PMTraceConsumer::FindOrCreatePresent(PMEventHeader const& hdr)
 {
     // First, we check if there is an in-progress present that was last
     // operated on from this same thread.
@@ -2081,8 +2468,8 @@ std::shared_ptr<PresentEvent> PMTraceConsumer::FindOrCreatePresent(EVENT_HEADER
     // presents should have only seen present start/stop events so should not
     // have a known PresentMode, etc. yet.
     auto presentsByThisProcess = &mOrderedPresentsByProcessId[hdr.ProcessId];
-    for (auto const& pr : *presentsByThisProcess) {
-        present = pr.second;
+    for (size_t i = 0, n = presentsByThisProcess->size(); i < n; ++i) {
+        present = (*presentsByThisProcess)[i];
         if (present->DriverThreadId == 0 &&
             present->SeenDxgkPresent == false &&
             present->SeenWin32KEvents == false &&
@@ -2109,7 +2496,7 @@ std::shared_ptr<PresentEvent> PMTraceConsumer::FindOrCreatePresent(EVENT_HEADER
     // D3D9) in which case a DxgKrnl event will be the first present-related
     // event we ever see.
     if (IsProcessTrackedForFiltering(hdr.ProcessId)) {
-        present = std::make_shared<PresentEvent>();
+        present = mPresentEventPool->Allocate();
 
         VerboseTraceBeforeModifyingPresent(present.get());
         present->PresentStartTime = *(uint64_t*) &hdr.TimeStamp;
@@ -2127,25 +2514,40 @@ std::shared_ptr<PresentEvent> PMTraceConsumer::FindOrCreatePresent(EVENT_HEADER
 }
 
 void PMTraceConsumer::TrackPresent(
-    std::shared_ptr<PresentEvent> present,
+    PresentEventPtr present,
     OrderedPresents* presentsByThisProcess)
 {
     // If there is an existing present that hasn't completed by the time the
-    // circular buffer has come around, consider it lost.
-    if (mTrackedPresents[mNextFreeRingIndex] != nullptr) {
-        RemoveLostPresent(mTrackedPresents[mNextFreeRingIndex]);
+    // circular buffer has come around, grow the buffer if possible or else
+    // consider the present lost.
+    if (mTrackedPresents.empty()) {
+        uint32_t size = 2;
+        while (size < mTrackedPresentRingSize && size < 0x80000000u) {
+            size <<= 1;
+        }
+        mTrackedPresents.resize(size);
+        mTrackedPresentCapacity.store(size, std::memory_order_relaxed);
+    } else if (mTrackedPresents[mNextFreeRingIndex] != nullptr && !GrowTrackedPresents()) {
+        auto const& evictedPresent = mTrackedPresents[mNextFreeRingIndex];
+        mEvictedPresentCount.fetch_add(1, std::memory_order_relaxed);
+        RecordPresentTransition(FLIGHT_RECORD_PRESENT_EVICTED, *evictedPresent);
+        VerboseTraceBeforeModifyingPresent(evictedPresent.get());
+        evictedPresent->IsLost = true;
+        CompletePresent(PresentEventPtr(evictedPresent));
     }
 
     // Add the present into the initial tracking data structures
     VerboseTraceBeforeModifyingPresent(present.get());
     present->RingIndex = mNextFreeRingIndex;
     mTrackedPresents[mNextFreeRingIndex] = present;
-    mNextFreeRingIndex = GetRingIndex(mNextFreeRingIndex + 1);
+    mNextFreeRingIndex = (mNextFreeRingIndex + 1) & (uint32_t) (mTrackedPresents.size() - 1);
 
-    presentsByThisProcess->emplace(present->PresentStartTime, present);
+    presentsByThisProcess->Insert(present);
 
     SetThreadPresent(present->ThreadId, present);
 
+    RecordPresentTransition(FLIGHT_RECORD_PRESENT_START, *present);
+
     // Assign any pending retrieved input to this frame
     if (mTrackInput) {
         auto ii = mRetrievedInput.find(present->ProcessId);
@@ -2157,7 +2559,105 @@ void PMTraceConsumer::TrackPresent(
     }
 }
 
-void PMTraceConsumer::RuntimePresentStart(Runtime runtime, EVENT_HEADER const& hdr, uint64_t swapchainAddr,
+// Double the size of mTrackedPresents, if the presents it can hold fit within
+// mTrackedPresentMemoryLimit.  The presents are moved oldest-first into the
+// start of the new buffer, so they are still considered lost in the same order.
+bool PMTraceConsumer::GrowTrackedPresents()
+{
+    auto size = (uint32_t) mTrackedPresents.size();
+    if (size >= 0x80000000u || 2ull * size * TRACKED_PRESENT_SIZE > mTrackedPresentMemoryLimit) {
+        return false;
+    }
+
+    std::vector<PresentEventPtr> trackedPresents(2 * size);
+    for (uint32_t i = 0; i < size; ++i) {
+        auto& present = mTrackedPresents[(mNextFreeRingIndex + i) & (size - 1)];
+        if (present != nullptr) {
+            present->RingIndex = i;
+            trackedPresents[i] = std::move(present);
+        }
+    }
+
+    mTrackedPresents.swap(trackedPresents);
+    mNextFreeRingIndex = size;
+    mTrackedPresentCapacity.store(2 * size, std::memory_order_relaxed);
+    return true;
+}
+
+// Double the size of mCompletedPresents, if the presents it can hold fit within
+// mTrackedPresentMemoryLimit.  The completed presents are moved, in order, to
+// the start of the new buffer.
+bool PMTraceConsumer::GrowCompletedPresents()
+{
+    auto size = (uint32_t) mCompletedPresents.size();
+    if (size >= 0x80000000u || 2ull * size * TRACKED_PRESENT_SIZE > mTrackedPresentMemoryLimit) {
+        return false;
+    }
+
+    std::vector<DequeuedPresentPtr> completedPresents(2 * size);
+    for (uint32_t i = 0; i < mCompletedCount; ++i) {
+        completedPresents[i] = std::move(mCompletedPresents[GetCompletedIndex(mCompletedIndex + i)]);
+    }
+
+    mCompletedPresents.swap(completedPresents);
+    mCompletedIndex = 0;
+    return true;
+}
+
+// Add a record of the present's state to the flight recorder.  If the present
+// is being completed as lost (once presents are being tracked), this also
+// submits a flight recording if there is a writer, so long as the ring has
+// mostly turned over since the last one.
+void PMTraceConsumer::RecordPresentTransition(uint8_t kind, PresentEvent const& present)
+{
+    FlightPresentInfo info = {};
+    info.kind_           = kind;
+    info.runtime_        = (uint8_t) present.Runtime;
+    info.presentMode_    = (uint8_t) present.PresentMode;
+    info.finalState_     = (uint8_t) present.FinalState;
+    info.deferredReason_ = (uint8_t) present.DeferredReason;
+    info.frameType_      = (uint8_t) present.FrameType;
+    info.frameId_        = present.FrameId;
+    info.flags_          = (uint16_t) ((present.SupportsTearing           ? FLIGHT_PRESENT_SUPPORTS_TEARING      : 0) |
+                                       (present.WaitForFlipEvent          ? FLIGHT_PRESENT_WAIT_FOR_FLIP         : 0) |
+                                       (present.WaitForMPOFlipEvent       ? FLIGHT_PRESENT_WAIT_FOR_MPO_FLIP     : 0) |
+                                       (present.SeenDxgkPresent           ? FLIGHT_PRESENT_SEEN_DXGK_PRESENT     : 0) |
+                                       (present.SeenWin32KEvents          ? FLIGHT_PRESENT_SEEN_WIN32K_EVENTS    : 0) |
+                                       (present.SeenInFrameEvent          ? FLIGHT_PRESENT_SEEN_IN_FRAME_EVENT   : 0) |
+                                       (present.GpuFrameCompleted         ? FLIGHT_PRESENT_GPU_FRAME_COMPLETED   : 0) |
+                                       (present.IsCompleted               ? FLIGHT_PRESENT_IS_COMPLETED          : 0) |
+                                       (present.IsLost                    ? FLIGHT_PRESENT_IS_LOST               : 0) |
+                                       (present.PresentFailed             ? FLIGHT_PRESENT_FAILED                : 0) |
+                                       (present.PresentInDwmWaitingStruct ? FLIGHT_PRESENT_IN_DWM_WAITING_STRUCT : 0));
+    mFlightRecorder.RecordPresent(present.ProcessId, present.ThreadId, info);
+
+    if (kind == FLIGHT_RECORD_PRESENT_LOST &&
+        mFlightRecordingWriter != nullptr &&
+        mHasCompletedAPresent &&
+        (mFlightRecordingLastCount == 0 || mFlightRecorder.RecordCount() - mFlightRecordingLastCount >= mFlightRecorder.Capacity() / 2)) {
+        // If the writer is still busy with the previous recording, don't
+        // retry until the ring has turned over either.
+        mFlightRecordingWriter->Submit(&mFlightRecorder, FLIGHT_RECORDING_LOST_PRESENT, present.FrameId);
+        mFlightRecordingLastCount = mFlightRecorder.RecordCount();
+    }
+}
+
+// If the writer is still busy with a previous recording, the request is left
+// set and retried on the next event.
+void PMTraceConsumer::ServiceFlightRecordingRequest()
+{
+    if (mFlightRecordingWriter != nullptr && mFlightRecordingWriter->IsBusy()) {
+        return;
+    }
+
+    if (mFlightRecordingRequested.exchange(false, std::memory_order_relaxed) &&
+        mFlightRecordingWriter != nullptr &&
+        mFlightRecordingWriter->Submit(&mFlightRecorder, FLIGHT_RECORDING_ON_DEMAND, 0)) {
+        mFlightRecordingLastCount = mFlightRecorder.RecordCount();
+    }
+}
+
+void PMTraceConsumer::RuntimePresentStart(Runtime runtime, PMEventHeader const& hdr, uint64_t swapchainAddr,
                                           uint32_t dxgiPresentFlags, int32_t syncInterval)
 {
     // Ignore PRESENT_TEST as it doesn't present, it's used to check if you're
@@ -2166,7 +2666,7 @@ void PMTraceConsumer::RuntimePresentStart(Runtime runtime, EVENT_HEADER const& h
         return;
     }
 
-    auto present = std::make_shared<PresentEvent>();
+    auto present = mPresentEventPool->Allocate();
 
     VerboseTraceBeforeModifyingPresent(present.get());
     present->PresentStartTime = *(uint64_t*) &hdr.TimeStamp;
@@ -2187,7 +2687,7 @@ void PMTraceConsumer::RuntimePresentStart(Runtime runtime, EVENT_HEADER const& h
 // No TRACK_PRESENT instrumentation here because each runtime Present::Start
 // event is instrumented and we assume we'll see the corresponding Stop event
 // for any completed present.
-void PMTraceConsumer::RuntimePresentStop(Runtime runtime, EVENT_HEADER const& hdr, uint32_t result)
+void PMTraceConsumer::RuntimePresentStop(Runtime runtime, PMEventHeader const& hdr, uint32_t result)
 {
     // Present_Start and Present_Stop happen on the same thread, so Lookup the PresentEvent
     // most-recently operated on by the same thread.  If there is none, ignore this event.
@@ -2217,7 +2717,7 @@ void PMTraceConsumer::RuntimePresentStop(Runtime runtime, EVENT_HEADER const& hd
         DebugAssert(present->IsCompleted     == false);
         DebugAssert(present->IsLost          == false);
         DebugAssert(present->DeferredReason  == 0);
-        DebugAssert(present->DependentPresents.empty());
+        DebugAssert(present->DependentPresents.IsEmpty());
 
         present->PresentFailed = true;
         CompletePresent(present);
@@ -2260,7 +2760,7 @@ void PMTraceConsumer::RuntimePresentStop(Runtime runtime, EVENT_HEADER const& hd
     mPresentByThreadId.erase(eventIter);
 }
 
-void PMTraceConsumer::HandleProcessEvent(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleProcessEvent(PMEventRecord* pEventRecord)
 {
     auto const& hdr = pEventRecord->EventHeader;
 
@@ -2324,11 +2824,32 @@ void PMTraceConsumer::HandleProcessEvent(EVENT_RECORD* pEventRecord)
         }
     }
 
-    std::lock_guard<std::mutex> lock(mProcessEventMutex);
-    mProcessEvents.emplace_back(event);
+    // Note which processes have exited so that the sweep can reclaim their state.
+    if (mSweepIdleHorizon != 0) {
+        if (event.IsStartEvent) {
+            mExitedProcesses.erase(event.ProcessId);
+        } else {
+            mExitedProcesses[event.ProcessId] = event.QpcTime;
+        }
+    }
+
+    if (mProcessEvents.TryPush(std::move(event))) {
+        mDequeueEventCount.Notify();
+    } else {
+        mDroppedProcessEventCount.fetch_add(1, std::memory_order_relaxed);
+    }
 }
 
-void PMTraceConsumer::HandleIntelPresentMonEvent(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::EnqueueEngineUtilizationSample(EngineUtilizationSample const& sample)
+{
+    if (mEngineUtilizationSamples.TryPush(EngineUtilizationSample(sample))) {
+        mDequeueEventCount.Notify();
+    } else {
+        mDroppedEngineUtilizationSampleCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void PMTraceConsumer::HandleIntelPresentMonEvent(PMEventRecord* pEventRecord)
 {
     if (mTrackFrameType) {
         switch (pEventRecord->EventHeader.EventDescriptor.Id) {
@@ -2394,13 +2915,13 @@ void PMTraceConsumer::DeferFlipFrameType(
 }
 
 void PMTraceConsumer::ApplyFlipFrameType(
-    std::shared_ptr<PresentEvent> const& present,
+    PresentEventPtr const& present,
     uint64_t timestamp,
     FrameType frameType)
 {
     // Create a copy of the present for this flip to add to the complete list, and mark the base
     // present as lost.
-    auto copy = std::make_shared<PresentEvent>();
+    auto copy = mPresentEventPool->Allocate();
     *copy = *present;
     copy->IsLost = false;
     copy->DeferredReason &= ~DeferredReason_WaitingForFlipFrameType;
@@ -2417,7 +2938,7 @@ void PMTraceConsumer::ApplyFlipFrameType(
 }
 
 void PMTraceConsumer::ApplyPresentFrameType(
-    std::shared_ptr<PresentEvent> const& present)
+    PresentEventPtr const& present)
 {
     auto ii = mPendingPresentFrameTypeEvents.find(present->ThreadId);
     if (ii != mPendingPresentFrameTypeEvents.end()) {
@@ -2427,24 +2948,19 @@ void PMTraceConsumer::ApplyPresentFrameType(
     }
 }
 
-void PMTraceConsumer::HandleMetadataEvent(EVENT_RECORD* pEventRecord)
+void PMTraceConsumer::HandleMetadataEvent(PMEventRecord* pEventRecord)
 {
     mMetadata.AddMetadata(pEventRecord);
 }
 
 void PMTraceConsumer::AddTrackedProcessForFiltering(uint32_t processID)
 {
-    std::unique_lock<std::shared_mutex> lock(mTrackedProcessFilterMutex);
-    mTrackedProcessFilter.insert(processID);
+    mTrackedProcessFilter.Add(processID);
 }
 
 void PMTraceConsumer::RemoveTrackedProcessForFiltering(uint32_t processID)
 {
-    std::unique_lock<std::shared_mutex> lock(mTrackedProcessFilterMutex);
-    auto iterator = mTrackedProcessFilter.find(processID);
-    if (iterator != mTrackedProcessFilter.end()) {
-        mTrackedProcessFilter.erase(iterator);
-    }
+    mTrackedProcessFilter.Remove(processID);
 
     // Completion events will remove any currently tracked events for this process
     // from data structures, so we don't need to proactively remove them now.
@@ -2456,32 +2972,72 @@ bool PMTraceConsumer::IsProcessTrackedForFiltering(uint32_t processID)
         return true;
     }
 
-    std::shared_lock<std::shared_mutex> lock(mTrackedProcessFilterMutex);
-    auto iterator = mTrackedProcessFilter.find(processID);
-    return (iterator != mTrackedProcessFilter.end());
+    return mTrackedProcessFilter.Contains(processID);
+}
+
+// Check whether an event can be dropped before it is decoded, because it is from a process that
+// isn't tracked.  This is only used for DXGI, D3D9, and DxgKrnl events.
+//
+// DXGI and D3D9 events are only used to track presents from the process that emitted them, so
+// they can always be dropped.  Many DxgKrnl events are emitted from the kernel or DWM on behalf of
+// other processes, or complete presents that are already being tracked, so only the DxgKrnl events
+// that start tracking a present on the presenting thread are dropped; their handlers only create
+// a present if the process is tracked.
+bool PMTraceConsumer::IsEventFromUntrackedProcess(PMEventHeader const& hdr, bool isDxgKrnlEvent)
+{
+    if (IsProcessTrackedForFiltering(hdr.ProcessId)) {
+        return false;
+    }
+
+    if (!isDxgKrnlEvent) {
+        return true;
+    }
+
+    switch (hdr.EventDescriptor.Id) {
+    case Microsoft_Windows_DxgKrnl::Blit_Info::Id:
+    case Microsoft_Windows_DxgKrnl::Flip_Info::Id:
+    case Microsoft_Windows_DxgKrnl::FlipMultiPlaneOverlay_Info::Id:
+    case Microsoft_Windows_DxgKrnl::PresentHistory_Start::Id:
+    case Microsoft_Windows_DxgKrnl::PresentHistoryDetailed_Start::Id:
+        return true;
+    default:
+        return false;
+    }
 }
 
 void PMTraceConsumer::DequeueProcessEvents(std::vector<ProcessEvent>& outProcessEvents)
 {
-    std::lock_guard<std::mutex> lock(mProcessEventMutex);
-    outProcessEvents.swap(mProcessEvents);
+    outProcessEvents.clear();
+    mProcessEvents.PopAll(&outProcessEvents);
 }
 
-void PMTraceConsumer::DequeuePresentEvents(std::vector<std::shared_ptr<PresentEvent>>& outPresentEvents)
+void PMTraceConsumer::DequeuePresentEvents(std::vector<DequeuedPresentPtr>& outPresentEvents)
 {
     outPresentEvents.clear();
-    if (mReadyCount > 0) {
-        std::lock_guard<std::mutex> lock(mPresentEventMutex);
+    mReadyPresents.PopAll(&outPresentEvents);
+}
 
-        outPresentEvents.resize(mReadyCount, nullptr);
-        for (uint32_t i = 0; i < mReadyCount; ++i) {
-            std::swap(outPresentEvents[i], mCompletedPresents[mCompletedIndex]);
-            mCompletedIndex = GetRingIndex(mCompletedIndex + 1);
-        }
+size_t PMTraceConsumer::DequeuePresentEvents(DequeuedPresentPtr* outPresentEvents, size_t maxCount)
+{
+    return mReadyPresents.PopBatch(outPresentEvents, maxCount);
+}
 
-        mCompletedCount -= mReadyCount;
-        mReadyCount = 0;
+void PMTraceConsumer::DequeueEngineUtilizationSamples(std::vector<EngineUtilizationSample>& outSamples)
+{
+    outSamples.clear();
+    mEngineUtilizationSamples.PopAll(&outSamples);
+}
+
+bool PMTraceConsumer::WaitForDequeueableEvents(uint32_t timeoutMilliseconds)
+{
+    auto key = mDequeueEventCount.PrepareWait();
+    if (!mReadyPresents.empty() || !mProcessEvents.empty() || !mEngineUtilizationSamples.empty()) {
+        mDequeueEventCount.CancelWait();
+        return true;
     }
+
+    mDequeueEventCount.Wait(key, timeoutMilliseconds);
+    return !mReadyPresents.empty() || !mProcessEvents.empty() || !mEngineUtilizationSamples.empty();
 }
 
 #ifdef TRACK_PRESENT_PATHS
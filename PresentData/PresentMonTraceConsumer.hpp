@@ -6,6 +6,7 @@
 #define NOMINMAX
 #endif
 
+#include <atomic>
 #include <deque>
 #include <map>
 #include <memory>
@@ -15,13 +16,20 @@
 #include <string>
 #include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <set>
-#include <windows.h>
-#include <evntcons.h> // must include after windows.h
 
 #include "Debug.hpp"
+#include "DxgKrnlEventViews.hpp"
+#include "FlightRecorder.hpp"
+#include "GpuTimeline.hpp"
 #include "GpuTrace.hpp"
+#include "ProcessIdFilter.hpp"
+#include "SmallFlatMap.hpp"
+#include "SpscRing.hpp"
+#include "SubmitSequenceTable.hpp"
+#include "TimingWheel.hpp"
 #include "TraceConsumer.hpp"
 
 // PresentMode represents the different paths a present can take on windows.
@@ -138,13 +146,13 @@ struct InputEvent {
 
 struct PresentFrameTypeEvent {
     uint32_t FrameId;
-    FrameType FrameType;
+    ::FrameType FrameType;
 };
 
 struct FlipFrameTypeEvent {
     uint64_t PresentId;
     uint64_t Timestamp;
-    FrameType FrameType;
+    ::FrameType FrameType;
 };
 
 // A ProcessEvent occurs whenever a Process starts or stops.
@@ -155,7 +163,119 @@ struct ProcessEvent {
     bool IsStartEvent;          // Whether this is a start event (true) or a stop event (false).
 };
 
-struct PresentEvent {
+// An EngineUtilizationSample reports how long any node of one engine type, on one adapter, was
+// executing GPU work during one sampling interval.  Hardware queues are counted under the engine
+// type of the node they were created from.
+struct EngineUtilizationSample {
+    uint64_t pDxgAdapter;       // The adapter the engine belongs to.
+    uint64_t StartTime;         // QPC time of the start of the interval.
+    uint64_t Duration;          // QPC duration of the interval.
+    uint64_t BusyTime;          // QPC duration during the interval while at least one node was running a packet.
+    Microsoft_Windows_DxgKrnl::DXGK_ENGINE EngineType;
+};
+
+// PresentEvents are allocated from the PMTraceConsumer's PresentEventPool and are referenced
+// through intrusive reference counts, rather than through std::shared_ptr.
+//
+// PresentEventPtr references are only used on the consumer thread, so their count is not atomic.
+// When a present is completed it is handed off, through mReadyPresents, to the thread calling
+// DequeuePresentEvents() which uses DequeuedPresentPtr references.  DequeuedPresentPtr counts are
+// not atomic either, so all the DequeuedPresentPtrs for a present must be used by one thread at a
+// time.  mOwners tracks which of the two sides still reference the present, and the present is
+// returned to the pool once neither does; the handoff and return are the only atomic operations.
+struct PresentEvent;
+struct PresentEventPool;
+
+struct PresentEventRefCount {
+    enum : uint32_t {
+        OWNER_CONSUMER = 1 << 0,
+        OWNER_DEQUEUED = 1 << 1,
+    };
+
+    PresentEventPool* mPool = nullptr;
+    uint32_t mConsumerRefCount = 0;
+    uint32_t mDequeuedRefCount = 0;
+    std::atomic<uint32_t> mOwners{ 0 };
+
+    // The reference counts belong to the object rather than its value, so they are not copied.
+    PresentEventRefCount() {}
+    PresentEventRefCount(PresentEventRefCount const&) {}
+    PresentEventRefCount& operator=(PresentEventRefCount const&) { return *this; }
+};
+
+template<uint32_t OWNER>
+class PresentEventRef {
+public:
+    PresentEventRef() : mPresent(nullptr) {}
+    PresentEventRef(std::nullptr_t) : mPresent(nullptr) {}
+    explicit PresentEventRef(PresentEvent* present) : mPresent(present) { if (mPresent != nullptr) AddRef(); }
+    PresentEventRef(PresentEventRef const& other) : mPresent(other.mPresent) { if (mPresent != nullptr) AddRef(); }
+    PresentEventRef(PresentEventRef&& other) noexcept : mPresent(other.mPresent) { other.mPresent = nullptr; }
+    ~PresentEventRef() { if (mPresent != nullptr) Release(); }
+
+    PresentEventRef& operator=(PresentEventRef const& other) { PresentEventRef(other).swap(*this); return *this; }
+    PresentEventRef& operator=(PresentEventRef&& other) noexcept { PresentEventRef(std::move(other)).swap(*this); return *this; }
+    PresentEventRef& operator=(std::nullptr_t) { reset(); return *this; }
+
+    void reset() { PresentEventRef().swap(*this); }
+    void swap(PresentEventRef& other) noexcept { auto p = mPresent; mPresent = other.mPresent; other.mPresent = p; }
+
+    PresentEvent* get() const { return mPresent; }
+    PresentEvent* operator->() const { return mPresent; }
+    PresentEvent& operator*() const { return *mPresent; }
+    explicit operator bool() const { return mPresent != nullptr; }
+
+    friend bool operator==(PresentEventRef const& a, PresentEventRef const& b) { return a.mPresent == b.mPresent; }
+    friend bool operator!=(PresentEventRef const& a, PresentEventRef const& b) { return a.mPresent != b.mPresent; }
+    friend bool operator==(PresentEventRef const& a, std::nullptr_t) { return a.mPresent == nullptr; }
+    friend bool operator!=(PresentEventRef const& a, std::nullptr_t) { return a.mPresent != nullptr; }
+
+private:
+    void AddRef();
+    void Release();
+
+    PresentEvent* mPresent;
+};
+
+using PresentEventPtr    = PresentEventRef<PresentEventRefCount::OWNER_CONSUMER>;
+using DequeuedPresentPtr = PresentEventRef<PresentEventRefCount::OWNER_DEQUEUED>;
+
+// DependentPresentList is an intrusive, doubly-linked list of presents, used for
+// PMTraceConsumer::mPresentsWaitingForDWM and PresentEvent::DependentPresents.  The links are
+// stored in each PresentEvent's DependentPresentLink, so a present can be in at most one list at a
+// time; adding, removing, and moving all of a list's presents to another list don't allocate.
+//
+// The list holds a reference to each of its presents through the previous present's mNext (or
+// mHead).  List membership belongs to the present object rather than its value, so copying a
+// PresentEvent does not copy its links or its DependentPresents.
+struct DependentPresentLink {
+    PresentEventPtr mNext;
+    PresentEvent* mPrev = nullptr;
+    bool mLinked = false;
+
+    DependentPresentLink() {}
+    DependentPresentLink(DependentPresentLink const&) {}
+    DependentPresentLink& operator=(DependentPresentLink const&) { return *this; }
+};
+
+struct DependentPresentList {
+    PresentEventPtr mHead;
+    PresentEvent* mTail = nullptr;
+
+    DependentPresentList() {}
+    DependentPresentList(DependentPresentList const&) {}
+    DependentPresentList& operator=(DependentPresentList const&) { return *this; }
+    ~DependentPresentList() { Clear(); }
+
+    bool IsEmpty() const { return mHead == nullptr; }
+
+    void PushBack(PresentEventPtr const& present);
+    void Remove(PresentEvent* present);
+    void MoveTo(DependentPresentList* dst); // Append all presents to dst
+    void Clear();
+};
+
+struct PresentEvent : PresentEventRefCount {
     uint64_t PresentStartTime;  // QPC value of the first event related to the Present (D3D9, DXGI, or DXGK Present_Start)
     uint32_t ProcessId;         // ID of the process that presented
     uint32_t ThreadId;          // ID of the thread that presented
@@ -183,11 +303,11 @@ struct PresentEvent {
     uint64_t Hwnd;                        // mLastPresentByWindow
     uint32_t QueueSubmitSequence;         // mPresentBySubmitSequence
     uint32_t RingIndex;                   // mTrackedPresents and mCompletedPresents
-    std::unordered_map<uint64_t, uint64_t> PresentIds; // mPresentByVidPnLayerId
+    SmallFlatMap<uint64_t, uint64_t, 4> PresentIds; // mPresentByVidPnLayerId (VidPnLayerId -> PresentId, usually only a few planes)
     // Note: the following index tracking structures as well but are defined elsewhere:
     //       ProcessId                 -> mOrderedPresentsByProcessId
     //       ThreadId, DriverThreadId  -> mPresentByThreadId
-    //       PresentInDwmWaitingStruct -> mPresentsWaitingForDWM
+    //       PresentInDwmWaitingStruct -> mPresentsWaitingForDWM (linked through DependentPresentLink)
 
     // Properties deduced by watching events through present pipeline
     uint32_t DestWidth;
@@ -197,11 +317,11 @@ struct PresentEvent {
 
     uint32_t FrameId;           // ID for the logical frame that this Present is associated with.
 
-    Runtime Runtime;            // Whether PresentStart originated from D3D9, DXGI, or DXGK.
-    PresentMode PresentMode;
+    ::Runtime Runtime;          // Whether PresentStart originated from D3D9, DXGI, or DXGK.
+    ::PresentMode PresentMode;
     PresentResult FinalState;
     InputDeviceType InputType;
-    FrameType FrameType;
+    ::FrameType FrameType;
     bool SupportsTearing;
     bool WaitForFlipEvent;
     bool WaitForMPOFlipEvent;
@@ -218,7 +338,8 @@ struct PresentEvent {
                                     // PMTraceConsumer::mPresentsWaitingForDWM
 
     // Additional transient tracking state
-    std::deque<std::shared_ptr<PresentEvent>> DependentPresents;
+    DependentPresentList DependentPresents;     // For DWM presents, the presents that are displayed when this present is.
+    ::DependentPresentLink DependentPresentLink; // This present's links in mPresentsWaitingForDWM or a DWM present's DependentPresents.
 
     uint32_t DeferredReason;    // The reason(s) this present is being deferred (see DeferredReason enum).
 
@@ -233,6 +354,87 @@ private:
     PresentEvent(PresentEvent const& copy); // dne
 };
 
+// PresentEventPool allocates PresentEvents from slabs, and keeps released presents in free lists
+// for reuse so that steady-state analysis doesn't need to allocate them.
+//
+// Presents released on the consumer thread are put directly into mFreeList.  Presents released by
+// the dequeuing thread are pushed onto mReturnedList, which the consumer takes in its entirety when
+// mFreeList is empty.  Since mReturnedList is only pushed to or emptied, it doesn't suffer from
+// ABA.
+//
+// FrameIds are assigned from mNextFrameId as presents are allocated, so each consumer numbers its
+// frames independently of any other consumers in the process.
+//
+// The pool is deleted once the consumer has detached and all dequeued presents have been
+// released; mOwnerCount counts the consumer and the presents that have DequeuedPresentPtrs.
+struct PresentEventPool {
+    enum { SLAB_SIZE = 256 };
+
+    struct FreeNode {
+        FreeNode* mNext;
+    };
+
+    struct alignas(PresentEvent) Storage {
+        uint8_t mBytes[sizeof(PresentEvent)];
+    };
+
+    std::vector<std::unique_ptr<Storage[]>> mSlabs;
+    FreeNode* mFreeList = nullptr;
+    std::atomic<FreeNode*> mReturnedList{ nullptr };
+    std::atomic<uint32_t> mOwnerCount{ 1 };
+    uint32_t mNextFrameId = 1;
+
+    // Detacher releases the consumer's ownership of the pool, for use with std::unique_ptr.
+    struct Detacher {
+        void operator()(PresentEventPool* pool) const { pool->Detach(); }
+    };
+
+    ~PresentEventPool();
+
+    PresentEventPtr Allocate();
+    size_t GetCapacity() const { return mSlabs.size() * SLAB_SIZE; }
+
+    void Detach();
+    void AddConsumerOwner(PresentEvent* present);
+    void AddDequeuedOwner(PresentEvent* present);
+    void ReleaseConsumerOwner(PresentEvent* present);
+    void ReleaseDequeuedOwner(PresentEvent* present);
+    void ReleaseOwnerCount();
+};
+
+#pragma warning(push)
+#pragma warning(disable: 4984) // c++17 extension
+
+template<uint32_t OWNER>
+inline void PresentEventRef<OWNER>::AddRef()
+{
+    if constexpr (OWNER == PresentEventRefCount::OWNER_CONSUMER) {
+        if (mPresent->mConsumerRefCount++ == 0) {
+            mPresent->mPool->AddConsumerOwner(mPresent);
+        }
+    } else {
+        if (mPresent->mDequeuedRefCount++ == 0) {
+            mPresent->mPool->AddDequeuedOwner(mPresent);
+        }
+    }
+}
+
+template<uint32_t OWNER>
+inline void PresentEventRef<OWNER>::Release()
+{
+    if constexpr (OWNER == PresentEventRefCount::OWNER_CONSUMER) {
+        if (--mPresent->mConsumerRefCount == 0) {
+            mPresent->mPool->ReleaseConsumerOwner(mPresent);
+        }
+    } else {
+        if (--mPresent->mDequeuedRefCount == 0) {
+            mPresent->mPool->ReleaseDequeuedOwner(mPresent);
+        }
+    }
+}
+
+#pragma warning(pop)
+
 struct PMTraceConsumer
 {
     // -------------------------------------------------------------------------------------------
@@ -250,57 +452,220 @@ struct PMTraceConsumer
     bool mTrackFrameType = false; // ... the frame type communicated through the Intel-PresentMon provider.
 
     // When PresentEvents are missing data that may still arrive later, they get put into a deferred
-    // state until the data arrives.  This time limit specifies how long a PresentEvent can be
-    // deferred before being considered lost.  The default of 0 means that no PresentEvents will be
-    // deferred, potentially leading to dequeued events that are missing data.
+    // state until the data arrives.  This time limit specifies how long after its PresentStartTime
+    // a PresentEvent can be deferred before being considered lost; the limit is enforced as trace
+    // time advances, even if no further presents are completed.  Deferred PresentEvents only hold
+    // back later PresentEvents from the same swap chain.
+    //
+    // The default of 0 means that a deferred PresentEvent is considered lost as soon as a
+    // PresentEvent that started after it is completed, potentially leading to dequeued events that
+    // are missing data.
     uint64_t mDeferralTimeLimit = 0; // QPC duration
 
+    // In-progress presents are tracked in a ring of mTrackedPresentRingSize entries (rounded up to
+    // a power of two).  When creating a present would evict one that is still in progress, the
+    // ring doubles in size instead as long as that many presents fit within
+    // mTrackedPresentMemoryLimit bytes; otherwise the oldest present is evicted and counted in
+    // mEvictedPresentCount.  The ring of completed presents waiting to be dequeued grows within the
+    // same limit.
+    uint32_t mTrackedPresentRingSize = 1024;
+    uint64_t mTrackedPresentMemoryLimit = 16 * 1024 * 1024;
+
+    // If set, the flight recorder (see FlightRecorder.hpp) is passed to mFlightRecordingWriter
+    // when a present is lost, or when a recording is requested.  Recordings of lost presents are
+    // only made once the ring has at least half turned over since the previous recording.
+    FlightRecordingWriter* mFlightRecordingWriter = nullptr;
+
+    // If non-zero, the consumer periodically sweeps its tracking state (see StateSweep.cpp) to
+    // reclaim the entries of processes that exited more than mSweepIdleHorizon ago, and completes
+    // as lost any in-progress present that started more than mSweepIdleHorizon ago.  The sweep is
+    // incremental: at most mSweepSliceSize entries are examined per event, and a new pass starts
+    // a quarter of the horizon after the previous one finished.
+    uint64_t mSweepIdleHorizon = 0; // QPC duration
+    uint32_t mSweepSliceSize = 64;
+
+    // If non-zero and mTrackGPU is set, the consumer accumulates how long each engine type of each
+    // adapter is busy, and completes an EngineUtilizationSample for each of them every
+    // mEngineUtilizationInterval of trace time, starting from the first event handled.
+    uint64_t mEngineUtilizationInterval = 0; // QPC duration
+
+    // If set (and mTrackGPU is set), the enqueue, start, and completion of each GPU packet and the
+    // completion of each frame's GPU work are recorded to the writer, which must be opened before
+    // the consumer starts and closed after it stops.  The caller owns the writer.
+    GpuTimelineWriter* mGpuTimelineWriter = nullptr;
+
 
     // -------------------------------------------------------------------------------------------
     // These functions can be used to filter PresentEvents by process from within the consumer.
+    // They can be called from any thread, and adding or removing a process never blocks the
+    // consumer thread.
+    //
+    // When filtering, IsEventFromUntrackedProcess() is used to drop events before they are decoded
+    // if they are only used to track presents from the process that emitted them, and that process
+    // isn't tracked.
 
     void AddTrackedProcessForFiltering(uint32_t processID);
     void RemoveTrackedProcessForFiltering(uint32_t processID);
     bool IsProcessTrackedForFiltering(uint32_t processID);
+    bool IsEventFromUntrackedProcess(PMEventHeader const& hdr, bool isDxgKrnlEvent);
 
 
     // -------------------------------------------------------------------------------------------
     // Once the session is started the consumer will consume and analyze ETW data to produce
     // completed process and present events.  Call Dequeue*Events() to periodically to remove these
-    // completed events.  If the functions are not called quick enough, the consumer's internal ring
-    // buffer may wrap and cause completed events to be lost.
+    // completed events.  The events are handed off through fixed-size lock-free queues, so only
+    // one thread can dequeue them.  If the functions are not called quick enough, the queues fill
+    // up and completed events are dropped; these are counted in mDropped*Count.
+    //
+    // The vector versions replace the contents of the vector, reusing its allocation.  The array
+    // version dequeues up to maxCount PresentEvents and returns the number dequeued.
+    //
+    // WaitForDequeueableEvents() can be used instead of polling; it returns true once there are
+    // events to dequeue, or false if the timeout expires first.
     //
     // PresentEvents from each swapchain are ordered by their PresentStart time, but presents from
     // separate swapchains may appear out of order.
 
     void DequeueProcessEvents(std::vector<ProcessEvent>& outProcessEvents);
-    void DequeuePresentEvents(std::vector<std::shared_ptr<PresentEvent>>& outPresentEvents);
+    void DequeuePresentEvents(std::vector<DequeuedPresentPtr>& outPresentEvents);
+    size_t DequeuePresentEvents(DequeuedPresentPtr* outPresentEvents, size_t maxCount);
+    void DequeueEngineUtilizationSamples(std::vector<EngineUtilizationSample>& outSamples);
+    bool WaitForDequeueableEvents(uint32_t timeoutMilliseconds);
+
+    // The number of completed events that were dropped because they weren't dequeued in time.
+    // (Dropped presents are counted in mDroppedPresentCount, below.)
+    std::atomic<uint64_t> mDroppedProcessEventCount{ 0 };
+    std::atomic<uint64_t> mDroppedEngineUtilizationSampleCount{ 0 };
+
+    static wchar_t const* GetEngineTypeName(Microsoft_Windows_DxgKrnl::DXGK_ENGINE engineType);
+
+    // The number of presents that were completed as lost: mEvictedPresentCount counts those that
+    // were still in progress when the tracked present ring wrapped, and mLostPresentCount those
+    // lost for any other reason (e.g., missing events).  mTrackedPresentCapacity is the current
+    // size of the ring.
+    //
+    // mDroppedPresentCount counts the completed presents that were dropped because they weren't
+    // dequeued before mCompletedPresents filled up and couldn't grow any further.
+    std::atomic<uint64_t> mDroppedPresentCount{ 0 };
+    std::atomic<uint64_t> mEvictedPresentCount{ 0 };
+    std::atomic<uint64_t> mLostPresentCount{ 0 };
+    std::atomic<uint32_t> mTrackedPresentCapacity{ 0 };
+
+
+    // -------------------------------------------------------------------------------------------
+    // The analysis state can be saved into a snapshot, from which a new consumer can continue the
+    // analysis (see AnalysisSnapshot.hpp).
+    //
+    // SaveSnapshot() appends the snapshot to the vector, and must be called on the consumer thread
+    // between events.  RestoreSnapshot() must be called on a new consumer, configured the same
+    // way, before it handles any events.  It returns false if the snapshot is invalid or the
+    // tracking options differ, in which case the consumer should not be used.
+
+    void SaveSnapshot(std::vector<uint8_t>* snapshot) const;
+    bool RestoreSnapshot(uint8_t const* snapshot, size_t size);
+
+
+    // -------------------------------------------------------------------------------------------
+    // The last events handled by the consumer, and the presents they created and completed, are
+    // kept in mFlightRecorder.  RequestFlightRecording() may be called from any thread to have
+    // them passed to mFlightRecordingWriter, which writes them to a file that can be rendered with
+    // pm_flight_decode.  The request is serviced before the next event is handled, or, once the
+    // trace session has stopped processing events, by calling ServiceFlightRecordingRequest().
+
+    void RequestFlightRecording() { mFlightRecordingRequested.store(true, std::memory_order_relaxed); }
+    void ServiceFlightRecordingRequest();
+
+    std::atomic<bool> mFlightRecordingRequested{ false };
+
+
+    // -------------------------------------------------------------------------------------------
+    // When mSweepIdleHorizon is set, the number of entries in each of the consumer's long-lived
+    // tracking structures, and an estimate of the memory they use, are published into
+    // mStateGauges at the end of each sweep pass.  They can be read from any thread.
+    // mSweptEntryCount is the number of entries reclaimed by the sweep.
+
+    enum StateGauge {
+        STATE_TRACKED_PRESENTS,
+        STATE_PRESENT_BY_THREAD_ID,
+        STATE_ORDERED_PRESENTS_BY_PROCESS_ID,
+        STATE_LAST_PRESENT_BY_WINDOW,
+        STATE_RETRIEVED_INPUT,
+        STATE_EXITED_PROCESSES,
+        STATE_GPU_CONTEXTS,
+        STATE_GPU_PROCESS_FRAME_INFO,
+        STATE_GPU_PAGING_SEQUENCE_IDS,
+        STATE_GAUGE_COUNT
+    };
+
+    struct StateGaugeValue {
+        std::atomic<uint64_t> mEntryCount{ 0 };
+        std::atomic<uint64_t> mByteCount{ 0 };
+    };
+
+    StateGaugeValue mStateGauges[STATE_GAUGE_COUNT];
+    std::atomic<uint64_t> mSweptEntryCount{ 0 };
+
+    static wchar_t const* GetStateGaugeName(StateGauge gauge);
 
 
     // -------------------------------------------------------------------------------------------
     // The rest of this structure are internal data and functions for analysing the collected ETW
     // data.
 
-    // Storage for process and present events:
-    std::vector<ProcessEvent> mProcessEvents;
-    std::vector<std::shared_ptr<PresentEvent>> mTrackedPresents;
-    std::vector<std::shared_ptr<PresentEvent>> mCompletedPresents;
+    // The pool that PresentEvents are allocated from.  This must be declared before any members
+    // that reference PresentEvents, so that those references are released before the consumer
+    // detaches from the pool.
+    std::unique_ptr<PresentEventPool, PresentEventPool::Detacher> mPresentEventPool;
+
+    // Storage for process and present events.
+    //
+    // mCompletedPresents is only used by the consumer thread.  It holds completed presents that
+    // can't be dequeued yet: deferred presents, later presents from the same swap chain, and any
+    // presents that didn't fit into mReadyPresents.  PublishCompletedPresents() moves the rest
+    // into mReadyPresents, from which they are dequeued.
+    std::vector<PresentEventPtr> mTrackedPresents;
+    std::vector<DequeuedPresentPtr> mCompletedPresents;
     uint32_t mNextFreeRingIndex = 0;    // The index of mTrackedPresents to use when creating the next present.
     uint32_t mCompletedIndex = 0;       // The index of mCompletedPresents of the oldest completed present.
     uint32_t mCompletedCount = 0;       // The total number of presents in mCompletedPresents.
-    uint32_t mReadyCount = 0;           // The number of presents in mCompletedPresents, starting at mCompletedIndex, that are ready to be dequeued.
 
-    // Mutexs to protect consumer/dequeue access from different threads:
-    std::mutex mProcessEventMutex;
-    std::mutex mPresentEventMutex;
+    // Single-producer/single-consumer queues from the consumer thread to the dequeuing thread,
+    // and the EventCount used to wake the dequeuing thread when they become non-empty.
+    SpscRing<DequeuedPresentPtr> mReadyPresents;
+    SpscRing<ProcessEvent> mProcessEvents;
+    SpscRing<EngineUtilizationSample> mEngineUtilizationSamples;
+    EventCount mDequeueEventCount;
+    bool mReadyPresentsFull = false;    // Whether PublishCompletedPresents() held back presents because mReadyPresents was full.
+
+    // The earliest event timestamp at which ServiceTimedWork() has anything to do: the next tick of
+    // mDeferredPresents, the next sweep pass, or the end of the current engine utilization
+    // interval.  It is 0 while presents are held back because mReadyPresents was full, so that they
+    // are retried on every event.
+    uint64_t mNextTimedWorkTime = 0;
+
+    // Deferred presents in mCompletedPresents, by the time that their deferral expires.  A present
+    // stays in the wheel until then even if its deferral is cleared sooner.
+    TimingWheel<PresentEventPtr> mDeferredPresents;
+
+    // The (ProcessId, SwapChainAddress) of each swap chain with a deferred present in
+    // mCompletedPresents.  Unless mReadyPresentsFull is set, every present in mCompletedPresents is
+    // either deferred or from one of these swap chains, so a completed present from any other swap
+    // chain can be published immediately, and clearing a deferral only affects its own swap chain.
+    typedef std::pair<uint32_t, uint64_t> SwapChainKey;
+    struct SwapChainKeyHash : private std::hash<uint64_t> {
+        std::size_t operator()(SwapChainKey const& v) const noexcept;
+    };
+    std::unordered_set<SwapChainKey, SwapChainKeyHash> mBlockedSwapChains;
 
 
     // EventMetadata stores the structure of ETW events to optimize subsequent property retrieval.
     EventMetadata mMetadata;
 
+    // The validated layouts used to decode the most frequent DxgKrnl events.
+    Microsoft_Windows_DxgKrnl::EventViewLayouts mDxgkViewLayouts;
+
     // Limit tracking to specified processes
-    std::set<uint32_t> mTrackedProcessFilter;
-    std::shared_mutex mTrackedProcessFilterMutex;
+    ProcessIdFilter mTrackedProcessFilter;
 
     // Whether we've completed any presents yet.  This is used to indicate that all the necessary
     // providers have started and it's safe to start tracking presents.
@@ -312,10 +677,14 @@ struct PMTraceConsumer
     //
     // mPresentsWaitingForDWM stores all in-progress presents that have been handed off to DWM.
     // Once the next DWM present is detected, they are added as its' DependentPresents.
-    std::deque<std::shared_ptr<PresentEvent>> mPresentsWaitingForDWM;
+    DependentPresentList mPresentsWaitingForDWM;
     uint32_t DwmProcessId = 0;
     uint32_t DwmPresentThreadId = 0;
 
+    // Scratch storage used by CompletePresent() to find each window's most-recent Composed_Flip
+    // present in a DWM present's DependentPresents.
+    std::vector<uint64_t> mCompletedComposedFlipHwnds;
+
     // Storage for passing present path tracking id to Handle...() functions.
     #ifdef TRACK_PRESENT_PATHS
     uint32_t mAnalysisPathID;
@@ -323,13 +692,17 @@ struct PMTraceConsumer
 
     // These data structures store in-progress presents that are being processed by PMTraceConsumer.
     //
-    // mTrackedPresents is a circular buffer storage for all in-progress presents.  Presents that
-    // are still in-progress when the buffer wraps are considered lost due to age.  mNextFreeIndex
-    // is the index of the element to use when creating the next present.
+    // mTrackedPresents is a circular buffer storage for all in-progress presents.  It is allocated
+    // when the first present is created, and grows (see mTrackedPresentMemoryLimit) rather than
+    // wrapping onto in-progress presents; presents that are still in-progress when it can't grow
+    // any further are considered lost due to age.  mNextFreeRingIndex is the index of the element
+    // to use when creating the next present.
     //
     // Once presents are completed, they are moved into the mCompletedPresents ring buffer.
-    // mCompletedIndex and mCompletedCount specify a list of presents are ready to be dequeued by
-    // the user.
+    // mCompletedIndex and mCompletedCount specify the list of completed presents, which are dequeued
+    // by the user once they are no longer deferred.  The ring grows within the same
+    // mTrackedPresentMemoryLimit as mTrackedPresents; once it can't, completed presents are
+    // dropped and counted in mDroppedPresentCount.
     //
     // mPresentByThreadId stores the in-progress present that was last operated on by each thread.
     // This is used to look up the right present for event sequences that are known to execute on
@@ -343,7 +716,9 @@ struct PMTraceConsumer
     // mPresentBySubmitSequence stores presents who have had a present packet submitted on to a
     // queue until they are completed or discarded.  It's used to associate those presents to
     // various DXGK events (such as MMIOFlip, IndependentFlip and *SyncDPC) which reference the
-    // submit sequence id.
+    // submit sequence id.  Packet completion is looked up by (submit sequence id, queue context),
+    // but the flip/sync events only have the submit sequence id so all presents with that id are
+    // also found through the same table (see SubmitSequenceTable.hpp).
     //
     // mPresentByWin32KPresentHistoryToken stores the in-progress present associated with each
     // Win32KPresentHistoryToken, which is a unique key used to identify all flip model presents,
@@ -366,28 +741,56 @@ struct PMTraceConsumer
     // Discarded transition.  The present is either overwritten, or removed when DWM confirms the
     // present.
 
-    using OrderedPresents = std::map<uint64_t, std::shared_ptr<PresentEvent>>;
+    // OrderedPresents stores a process' presents sorted by PresentStartTime in a ring buffer.
+    // Presents are almost always created in PresentStartTime order, and mostly complete in that
+    // order too, so Insert() is usually an append and Erase() usually removes the oldest present;
+    // both are O(1) in those cases.  Out-of-order inserts and erases shift the presents after
+    // them.  Like a std::map keyed by PresentStartTime, there is at most one present per
+    // PresentStartTime and Erase() is by PresentStartTime.
+    //
+    // Presents are accessed by index, from oldest (0) to newest.  Insert() and Erase() change the
+    // indices, so code that may modify the presents while walking them should use LowerBound() to
+    // find its place again.
+    struct OrderedPresents {
+        std::vector<PresentEventPtr> mRing;     // Size is 0 or a power of two
+        size_t mFirst = 0;
+        size_t mCount = 0;
+
+        bool empty() const { return mCount == 0; }
+        size_t size() const { return mCount; }
+        PresentEventPtr const& operator[](size_t index) const { return mRing[(mFirst + index) & (mRing.size() - 1)]; }
+        PresentEventPtr& At(size_t index) { return mRing[(mFirst + index) & (mRing.size() - 1)]; }
+
+        bool Insert(PresentEventPtr const& present);    // Returns false if there is already a present with the same PresentStartTime
+        void Erase(uint64_t presentStartTime);
+        size_t LowerBound(uint64_t presentStartTime) const; // Index of the first present with PresentStartTime >= presentStartTime
+    };
 
     using Win32KPresentHistoryToken = std::tuple<uint64_t, uint64_t, uint64_t>; // (composition surface pointer, present count, bind id)
     struct Win32KPresentHistoryTokenHash : private std::hash<uint64_t> {
         std::size_t operator()(Win32KPresentHistoryToken const& v) const noexcept;
     };
 
-    std::unordered_map<uint32_t, std::shared_ptr<PresentEvent>> mPresentByThreadId;                     // ThreadId -> PresentEvent
+    std::unordered_map<uint32_t, PresentEventPtr>               mPresentByThreadId;                     // ThreadId -> PresentEvent
     std::unordered_map<uint32_t, OrderedPresents>               mOrderedPresentsByProcessId;            // ProcessId -> ordered PresentStartTime -> PresentEvent
-    std::unordered_map<uint32_t, std::unordered_map<uint64_t, std::shared_ptr<PresentEvent>>>
-                                                                mPresentBySubmitSequence;               // SubmitSequenceId -> hContext -> PresentEvent
-    std::unordered_map<Win32KPresentHistoryToken, std::shared_ptr<PresentEvent>,
+    SubmitSequenceTable<PresentEventPtr>                        mPresentBySubmitSequence;               // (SubmitSequenceId, hContext) -> PresentEvent
+    std::unordered_map<Win32KPresentHistoryToken, PresentEventPtr,
                        Win32KPresentHistoryTokenHash>           mPresentByWin32KPresentHistoryToken;    // Win32KPresentHistoryToken -> PresentEvent
-    std::unordered_map<uint64_t, std::shared_ptr<PresentEvent>> mPresentByDxgkPresentHistoryToken;      // DxgkPresentHistoryToken -> PresentEvent
-    std::unordered_map<uint64_t, std::shared_ptr<PresentEvent>> mPresentByDxgkPresentHistoryTokenData;  // DxgkPresentHistoryTokenData -> PresentEvent
-    std::unordered_map<uint64_t, std::shared_ptr<PresentEvent>> mPresentByDxgkContext;                  // DxgkContex -> PresentEvent
-    std::unordered_map<uint64_t, std::shared_ptr<PresentEvent>> mPresentByVidPnLayerId;                 // VidPnLayerId -> PresentEvent
-    std::unordered_map<uint64_t, std::shared_ptr<PresentEvent>> mLastPresentByWindow;                   // HWND -> PresentEvent
+    std::unordered_map<uint64_t, PresentEventPtr>               mPresentByDxgkPresentHistoryToken;      // DxgkPresentHistoryToken -> PresentEvent
+    std::unordered_map<uint64_t, PresentEventPtr>               mPresentByDxgkPresentHistoryTokenData;  // DxgkPresentHistoryTokenData -> PresentEvent
+    std::unordered_map<uint64_t, PresentEventPtr>               mPresentByDxgkContext;                  // DxgkContex -> PresentEvent
+    std::unordered_map<uint64_t, PresentEventPtr>               mPresentByVidPnLayerId;                 // VidPnLayerId -> PresentEvent
+    std::unordered_map<uint64_t, PresentEventPtr>               mLastPresentByWindow;                   // HWND -> PresentEvent
 
     // mGpuTrace tracks work executed on the GPU.
     GpuTrace mGpuTrace;
 
+    // mFlightRecorder is filled by PMTraceSession as events are dispatched, and by
+    // RecordPresentTransition().  mFlightRecordingLastCount is mFlightRecorder.RecordCount() when
+    // the last recording was submitted.
+    FlightRecorder mFlightRecorder;
+    uint64_t mFlightRecordingLastCount = 0;
+
     // PresentFrameTypeEvents are stored into mPendingPresentFrameTypeEvents and then looked-up and
     // attached to the PresentEvent in Present_Start.
     //
@@ -414,56 +817,95 @@ struct PMTraceConsumer
 
     std::unordered_map<uint32_t, std::pair<uint64_t, InputDeviceType>> mRetrievedInput; // ProcessID -> <InputTime, InputType>
 
+    // State for sweeping the tracking state (see mSweepIdleHorizon)
+    //
+    // mExitedProcesses stores the time that each process was seen to exit.  A process is removed
+    // if it is seen to start again, or any new GPU work is attributed to it, in case the process id
+    // has been reused.
+    //
+    // A sweep pass visits each structure in turn (mSweepPhase), mSweepBucket buckets at a time.
+    // mSweepKeys is scratch storage for the keys to remove from the current slice.
+    std::unordered_map<uint32_t, uint64_t> mExitedProcesses;    // ProcessId -> ProcessStop time
+    std::vector<uint64_t> mSweepKeys;
+    uint64_t mSweepPassTime = 0;
+    uint64_t mNextSweepTime = 0;
+    size_t mSweepBucket = 0;
+    uint32_t mSweepPhase = 0;
+    bool mSweepInProgress = false;
+
 
     // -------------------------------------------------------------------------------------------
     // Functions for decoding ETW and analysing process and present events.
 
     PMTraceConsumer();
 
-    void HandleDxgkBlt(EVENT_HEADER const& hdr, uint64_t hwnd, bool redirectedPresent);
-    void HandleDxgkFlip(EVENT_HEADER const& hdr, int32_t flipInterval, bool isMMIOFlip, bool isMPOFlip);
-    void HandleDxgkQueueSubmit(EVENT_HEADER const& hdr, uint64_t hContext, uint32_t submitSequence, uint32_t packetType, bool isPresentPacket, bool isWin7);
+    void HandleDxgkBlt(PMEventHeader const& hdr, uint64_t hwnd, bool redirectedPresent);
+    void HandleDxgkFlip(PMEventHeader const& hdr, int32_t flipInterval, bool isMMIOFlip, bool isMPOFlip);
+    void HandleDxgkQueueSubmit(PMEventHeader const& hdr, uint64_t hContext, uint32_t submitSequence, uint32_t packetType, bool isPresentPacket, bool isWin7);
     void HandleDxgkQueueComplete(uint64_t timestamp, uint64_t hContext, uint32_t submitSequence);
     void HandleDxgkMMIOFlip(uint64_t timestamp, uint32_t submitSequence, uint32_t flags);
     void HandleDxgkSyncDPC(uint64_t timestamp, uint32_t submitSequence);
-    void HandleDxgkPresentHistory(EVENT_HEADER const& hdr, uint64_t token, uint64_t tokenData, Microsoft_Windows_DxgKrnl::PresentModel presentModel);
-    void HandleDxgkPresentHistoryInfo(EVENT_HEADER const& hdr, uint64_t token);
-
-    void HandleProcessEvent(EVENT_RECORD* pEventRecord);
-    void HandleDXGIEvent(EVENT_RECORD* pEventRecord);
-    void HandleD3D9Event(EVENT_RECORD* pEventRecord);
-    void HandleDXGKEvent(EVENT_RECORD* pEventRecord);
-    void HandleWin32kEvent(EVENT_RECORD* pEventRecord);
-    void HandleDWMEvent(EVENT_RECORD* pEventRecord);
-    void HandleMetadataEvent(EVENT_RECORD* pEventRecord);
-    void HandleIntelPresentMonEvent(EVENT_RECORD* pEventRecord);
-
-    void HandleWin7DxgkBlt(EVENT_RECORD* pEventRecord);
-    void HandleWin7DxgkFlip(EVENT_RECORD* pEventRecord);
-    void HandleWin7DxgkPresentHistory(EVENT_RECORD* pEventRecord);
-    void HandleWin7DxgkQueuePacket(EVENT_RECORD* pEventRecord);
-    void HandleWin7DxgkVSyncDPC(EVENT_RECORD* pEventRecord);
-    void HandleWin7DxgkMMIOFlip(EVENT_RECORD* pEventRecord);
-
-
-    void SetThreadPresent(uint32_t threadId, std::shared_ptr<PresentEvent> const& present);
-    std::shared_ptr<PresentEvent> FindThreadPresent(uint32_t threadId);
-    std::shared_ptr<PresentEvent> FindOrCreatePresent(EVENT_HEADER const& hdr);
-    std::shared_ptr<PresentEvent> FindPresentBySubmitSequence(uint32_t submitSequence);
-
-    void TrackPresent(std::shared_ptr<PresentEvent> present, OrderedPresents* presentsByThisProcess);
-    void StopTrackingPresent(std::shared_ptr<PresentEvent> const& present);
-    void RemovePresentFromSubmitSequenceIdTracking(std::shared_ptr<PresentEvent> const& present);
-
-    void RuntimePresentStart(Runtime runtime, EVENT_HEADER const& hdr, uint64_t swapchainAddr, uint32_t dxgiPresentFlags, int32_t syncInterval);
-    void RuntimePresentStop(Runtime runtime, EVENT_HEADER const& hdr, uint32_t result);
-    void CompletePresent(std::shared_ptr<PresentEvent> const& p);
-    void RemoveLostPresent(std::shared_ptr<PresentEvent> present);
-
-    void AddPresentToCompletedList(std::shared_ptr<PresentEvent> const& present);
-    void ClearDeferredReason(std::shared_ptr<PresentEvent> const& present, uint32_t deferredReason);
+    void HandleDxgkPresentHistory(PMEventHeader const& hdr, uint64_t token, uint64_t tokenData, Microsoft_Windows_DxgKrnl::PresentModel presentModel);
+    void HandleDxgkPresentHistoryInfo(PMEventHeader const& hdr, uint64_t token);
+
+    void HandleProcessEvent(PMEventRecord* pEventRecord);
+    void HandleDXGIEvent(PMEventRecord* pEventRecord);
+    void HandleD3D9Event(PMEventRecord* pEventRecord);
+    void HandleDXGKEvent(PMEventRecord* pEventRecord);
+    void HandleWin32kEvent(PMEventRecord* pEventRecord);
+    void HandleDWMEvent(PMEventRecord* pEventRecord);
+    void HandleMetadataEvent(PMEventRecord* pEventRecord);
+    void HandleIntelPresentMonEvent(PMEventRecord* pEventRecord);
+
+    void HandleWin7DxgkBlt(PMEventRecord* pEventRecord);
+    void HandleWin7DxgkFlip(PMEventRecord* pEventRecord);
+    void HandleWin7DxgkPresentHistory(PMEventRecord* pEventRecord);
+    void HandleWin7DxgkQueuePacket(PMEventRecord* pEventRecord);
+    void HandleWin7DxgkVSyncDPC(PMEventRecord* pEventRecord);
+    void HandleWin7DxgkMMIOFlip(PMEventRecord* pEventRecord);
+
+
+    void SetThreadPresent(uint32_t threadId, PresentEventPtr const& present);
+    PresentEventPtr FindThreadPresent(uint32_t threadId);
+    PresentEventPtr FindOrCreatePresent(PMEventHeader const& hdr);
+    PresentEventPtr FindPresentBySubmitSequence(uint32_t submitSequence);
+
+    void TrackPresent(PresentEventPtr present, OrderedPresents* presentsByThisProcess);
+    void StopTrackingPresent(PresentEventPtr const& present);
+    void AddPresentWaitingForDWM(PresentEventPtr const& present);
+    void RemovePresentFromSubmitSequenceIdTracking(PresentEventPtr const& present);
+
+    void RuntimePresentStart(Runtime runtime, PMEventHeader const& hdr, uint64_t swapchainAddr, uint32_t dxgiPresentFlags, int32_t syncInterval);
+    void RuntimePresentStop(Runtime runtime, PMEventHeader const& hdr, uint32_t result);
+    void CompletePresent(PresentEventPtr const& p);
+    void RemoveLostPresent(PresentEventPtr present);
+    bool GrowTrackedPresents();
+    bool GrowCompletedPresents();
+    uint32_t GetCompletedIndex(uint32_t index) const { return index & ((uint32_t) mCompletedPresents.size() - 1); }
+    void RecordPresentTransition(uint8_t kind, PresentEvent const& present);
+
+    void AddPresentToCompletedList(PresentEventPtr const& present);
+    void AddDeferredPresent(PresentEventPtr const& present);
+    void ExpireDeferredPresents(uint64_t timestamp);
+    void SweepTrackedState(uint64_t timestamp);
+    void ServiceTimedWork(uint64_t timestamp);
+    bool IsProcessExpired(uint32_t processId) const;
+    void UpdateStateGauges();
+    void ClearDeferredReason(PresentEventPtr const& present, uint32_t deferredReason);
+    void PublishCompletedPresents();
+    void PublishSwapChainPresents(SwapChainKey const& swapChain);
+    void EnqueueEngineUtilizationSample(EngineUtilizationSample const& sample);
+
+    // Called by ServiceTimedWork() to hand off any completed presents that were held back because
+    // mReadyPresents was full, once there is room.
+    void RetryPublishCompletedPresents()
+    {
+        if (mReadyPresentsFull && !mReadyPresents.full()) {
+            PublishCompletedPresents();
+        }
+    }
 
     void DeferFlipFrameType(uint64_t vidPnLayerId, uint64_t presentId, uint64_t timestamp, FrameType frameType);
-    void ApplyFlipFrameType(std::shared_ptr<PresentEvent> const& present, uint64_t timestamp, FrameType frameType);
-    void ApplyPresentFrameType(std::shared_ptr<PresentEvent> const& present);
+    void ApplyFlipFrameType(PresentEventPtr const& present, uint64_t timestamp, FrameType frameType);
+    void ApplyPresentFrameType(PresentEventPtr const& present);
 };
@@ -4,6 +4,8 @@
 #include "Debug.hpp"
 #include "PresentMonTraceConsumer.hpp"
 #include "PresentMonTraceSession.hpp"
+#include "RawEventContainer.hpp"
+#include "RawEventStream.hpp"
 
 #include "ETW/Microsoft_Windows_D3D9.h"
 #include "ETW/Microsoft_Windows_Dwm_Core.h"
@@ -194,41 +196,98 @@ struct FilteredProvider {
     }
 };
 
+// We can't use helpers like IsWindows8Point1OrGreater() since they return
+// FALSE if the application isn't built with a manifest.
+bool GetOSVersion(RTL_OSVERSIONINFOW* info)
+{
+    auto ok = false;
+    auto hmodule = LoadLibraryExA("ntdll.dll", NULL, LOAD_LIBRARY_SEARCH_SYSTEM32);
+    if (hmodule != NULL) {
+        auto pRtlGetVersion = (LONG (WINAPI*)(RTL_OSVERSIONINFOW*)) GetProcAddress(hmodule, "RtlGetVersion");
+        if (pRtlGetVersion != nullptr) {
+            *info = {};
+            info->dwOSVersionInfoSize = sizeof(*info);
+            ok = (*pRtlGetVersion)(info) == 0 /* STATUS_SUCCESS */;
+        }
+        FreeLibrary(hmodule);
+    }
+    return ok;
+}
+
+// Without EVENT_TRACE_USE_MS_FLUSH_TIMER the flush timer is in seconds, so
+// round up to at least one second.
+void SetFlushTimer(EVENT_TRACE_PROPERTIES* props, uint32_t flushTimerMs, bool useMilliseconds)
+{
+    if (useMilliseconds) {
+        props->LogFileMode |= EVENT_TRACE_USE_MS_FLUSH_TIMER;
+        props->FlushTimer = flushTimerMs;
+    } else {
+        props->LogFileMode &= ~(ULONG) EVENT_TRACE_USE_MS_FLUSH_TIMER;
+        props->FlushTimer = (flushTimerMs + 999) / 1000;
+    }
+}
+
+// The groups of events that a consumer's configuration needs enabled.  A
+// session enables the union of its consumers' event sets.
+enum {
+    EVENT_SET_DISPLAY       = 1 << 0,
+    EVENT_SET_INPUT         = 1 << 1,
+    EVENT_SET_GPU           = 1 << 2,
+    EVENT_SET_NODE_METADATA = 1 << 3,
+    EVENT_SET_FRAME_TYPE    = 1 << 4,
+};
+
+uint32_t GetEventSets(PMTraceConsumer const* pmConsumer)
+{
+    uint32_t eventSets = 0;
+    if (pmConsumer->mTrackDisplay)   eventSets |= EVENT_SET_DISPLAY;
+    if (pmConsumer->mTrackInput)     eventSets |= EVENT_SET_INPUT;
+    if (pmConsumer->mTrackGPU)       eventSets |= EVENT_SET_GPU;
+    if (pmConsumer->mTrackFrameType) eventSets |= EVENT_SET_FRAME_TYPE;
+    if (pmConsumer->mTrackGPUVideo || (pmConsumer->mTrackGPU && pmConsumer->mEngineUtilizationInterval != 0)) {
+        eventSets |= EVENT_SET_NODE_METADATA;
+    }
+    return eventSets;
+}
+
+uint32_t GetEventSets(std::vector<PMTraceSession::ConsumerDispatch> const& consumers)
+{
+    uint32_t eventSets = 0;
+    for (auto const& consumer : consumers) {
+        eventSets |= GetEventSets(consumer.mConsumer);
+    }
+    return eventSets;
+}
+
 ULONG EnableProviders(
     TRACEHANDLE sessionHandle,
     GUID const& sessionGuid,
-    PMTraceConsumer* pmConsumer)
+    std::vector<PMTraceSession::ConsumerDispatch> const& consumers)
 {
     ULONG status = 0;
+    auto eventSets = GetEventSets(consumers);
 
     // Lookup what OS we're running on
-    //
-    // We can't use helpers like IsWindows8Point1OrGreater() since they FALSE
-    // if the application isn't built with a manifest.
     bool isWin81OrGreater = false;
     bool isWin11OrGreater = false;
     {
-        auto hmodule = LoadLibraryExA("ntdll.dll", NULL, LOAD_LIBRARY_SEARCH_SYSTEM32);
-        if (hmodule != NULL) {
-            auto pRtlGetVersion = (LONG (WINAPI*)(RTL_OSVERSIONINFOW*)) GetProcAddress(hmodule, "RtlGetVersion");
-            if (pRtlGetVersion != nullptr) {
-                RTL_OSVERSIONINFOW info = {};
-                info.dwOSVersionInfoSize = sizeof(info);
-                status = (*pRtlGetVersion)(&info);
-                if (status == 0 /* STATUS_SUCCESS */) {
-                    // win8.1 = version 6.3
-                    // win11  = version 10.0 build >= 22000
-                    isWin81OrGreater = info.dwMajorVersion >  6 || (info.dwMajorVersion ==  6 && info.dwMinorVersion >= 3);
-                    isWin11OrGreater = info.dwMajorVersion > 10 || (info.dwMajorVersion == 10 && info.dwBuildNumber  >= 22000);
-                }
-            }
-            FreeLibrary(hmodule);
+        RTL_OSVERSIONINFOW info;
+        if (GetOSVersion(&info)) {
+            // win8.1 = version 6.3
+            // win11  = version 10.0 build >= 22000
+            isWin81OrGreater = info.dwMajorVersion >  6 || (info.dwMajorVersion ==  6 && info.dwMinorVersion >= 3);
+            isWin11OrGreater = info.dwMajorVersion > 10 || (info.dwMajorVersion == 10 && info.dwBuildNumber  >= 22000);
         }
     }
 
     // Scope filtering based on event ID only works on Win8.1 or greater.
+    //
+    // If the consumers need different events, some are sent events they
+    // didn't ask for, which they handle the same as when analyzing an ETL.
     bool filterEventIds = isWin81OrGreater;
-    pmConsumer->mFilteredEvents = filterEventIds;
+    for (auto const& consumer : consumers) {
+        consumer.mConsumer->mFilteredEvents = filterEventIds && GetEventSets(consumer.mConsumer) == eventSets;
+    }
 
     // Start backend providers first to reduce Presents being queued up before
     // we can track them.
@@ -240,7 +299,7 @@ ULONG EnableProviders(
     // above).
     provider.ClearFilter();
     provider.AddEvent<Microsoft_Windows_DxgKrnl::PresentHistory_Start>();
-    if (pmConsumer->mTrackDisplay) {
+    if (eventSets & EVENT_SET_DISPLAY) {
         provider.AddEvent<Microsoft_Windows_DxgKrnl::Blit_Info>();
         provider.AddEvent<Microsoft_Windows_DxgKrnl::BlitCancel_Info>();
         provider.AddEvent<Microsoft_Windows_DxgKrnl::Flip_Info>();
@@ -258,7 +317,7 @@ ULONG EnableProviders(
         provider.AddEvent<Microsoft_Windows_DxgKrnl::QueuePacket_Stop>();
         provider.AddEvent<Microsoft_Windows_DxgKrnl::VSyncDPC_Info>();
     }
-    if (pmConsumer->mTrackGPU) {
+    if (eventSets & EVENT_SET_GPU) {
         provider.AddEvent<Microsoft_Windows_DxgKrnl::Context_DCStart>();
         provider.AddEvent<Microsoft_Windows_DxgKrnl::Context_Start>();
         provider.AddEvent<Microsoft_Windows_DxgKrnl::Context_Stop>();
@@ -270,16 +329,16 @@ ULONG EnableProviders(
         provider.AddEvent<Microsoft_Windows_DxgKrnl::DmaPacket_Info>();
         provider.AddEvent<Microsoft_Windows_DxgKrnl::DmaPacket_Start>();
     }
-    if (pmConsumer->mTrackGPUVideo) {
+    if (eventSets & EVENT_SET_NODE_METADATA) {
         provider.AddEvent<Microsoft_Windows_DxgKrnl::NodeMetadata_Info>();
     }
-    if (pmConsumer->mTrackFrameType) {
+    if (eventSets & EVENT_SET_FRAME_TYPE) {
         provider.AddEvent<Microsoft_Windows_DxgKrnl::MMIOFlipMultiPlaneOverlay3_Info>();
     }
     status = provider.Enable(sessionHandle, Microsoft_Windows_DxgKrnl::GUID);
     if (status != ERROR_SUCCESS) return status;
 
-    if (pmConsumer->mTrackGPU) {
+    if (eventSets & EVENT_SET_GPU) {
         provider.ClearFilter();
         provider.AddEvent<Microsoft_Windows_DxgKrnl::Context_DCStart>();
         provider.AddEvent<Microsoft_Windows_DxgKrnl::Device_DCStart>();
@@ -291,14 +350,14 @@ ULONG EnableProviders(
                             TRACE_LEVEL_INFORMATION, 0, 0, 0, nullptr);
     if (status != ERROR_SUCCESS) return status;
 
-    if (pmConsumer->mTrackDisplay || pmConsumer->mTrackInput) {
+    if (eventSets & (EVENT_SET_DISPLAY | EVENT_SET_INPUT)) {
         // Microsoft_Windows_Win32k
         provider.ClearFilter();
-        if (pmConsumer->mTrackDisplay) {
+        if (eventSets & EVENT_SET_DISPLAY) {
             provider.AddEvent<Microsoft_Windows_Win32k::TokenCompositionSurfaceObject_Info>();
             provider.AddEvent<Microsoft_Windows_Win32k::TokenStateChanged_Info>();
         }
-        if (pmConsumer->mTrackInput) {
+        if (eventSets & EVENT_SET_INPUT) {
             provider.AddEvent<Microsoft_Windows_Win32k::InputDeviceRead_Stop>();
             provider.AddEvent<Microsoft_Windows_Win32k::RetrieveInputMessage_Info>();
         }
@@ -307,7 +366,7 @@ ULONG EnableProviders(
     }
 
     // Microsoft_Windows_Dwm_Core
-    if (pmConsumer->mTrackDisplay) {
+    if (eventSets & EVENT_SET_DISPLAY) {
         provider.ClearFilter();
         provider.AddEvent<Microsoft_Windows_Dwm_Core::MILEVENT_MEDIA_UCE_PROCESSPRESENTHISTORY_GetPresentHistory_Info>();
         provider.AddEvent<Microsoft_Windows_Dwm_Core::SCHEDULE_PRESENT_Start>();
@@ -347,7 +406,7 @@ ULONG EnableProviders(
     if (status != ERROR_SUCCESS) return status;
 
     // Intel_PresentMon
-    if (pmConsumer->mTrackFrameType) {
+    if (eventSets & EVENT_SET_FRAME_TYPE) {
         provider.ClearFilter();
         provider.AddEvent<Intel_PresentMon::PresentFrameType_Info>();
         provider.AddEvent<Intel_PresentMon::FlipFrameType_Info>();
@@ -372,100 +431,278 @@ void DisableProviders(TRACEHANDLE sessionHandle)
     status = EnableTraceEx2(sessionHandle, &Microsoft_Windows_Win32k::GUID,         EVENT_CONTROL_CODE_DISABLE_PROVIDER, 0, 0, 0, 0, nullptr);
 }
 
+// Events are dispatched to their PMTraceConsumer handler using a perfect hash
+// table keyed on the last 8 bytes of the provider GUID (GUID::Data4), which
+// are unique across the providers we handle.  The table is built once for
+// each TRACK_* configuration, and only includes the providers that the
+// configuration handles.
+typedef void (PMTraceConsumer::*ProviderHandler)(PMEventRecord*);
+
+struct ProviderDispatch {
+    uint64_t guid_[2];
+    ProviderHandler handler_;       // nullptr if the slot is empty
+    PMTraceSession::Provider provider_;
+    bool prefilterByProcessId_;     // Whether to check IsEventFromUntrackedProcess() before dispatching
+};
+
+void SplitGuid(GUID const& guid, uint64_t* u)
+{
+    static_assert(sizeof(GUID) == 2 * sizeof(uint64_t), "Unexpected GUID size");
+    memcpy(u, &guid, sizeof(GUID));
+}
+
+template<
+    bool TRACK_DISPLAY,
+    bool TRACK_INPUT,
+    bool TRACK_PRESENTMON>
+struct ProviderDispatchTable {
+    enum { SLOT_BITS = 6, SLOT_COUNT = 1 << SLOT_BITS };
+
+    ProviderDispatch slots_[SLOT_COUNT];
+    uint64_t multiplier_;
+
+    uint32_t GetSlotIndex(uint64_t key) const
+    {
+        return (uint32_t) ((key * multiplier_) >> (64 - SLOT_BITS));
+    }
+
+    ProviderDispatch const& Find(GUID const& providerId) const
+    {
+        uint64_t guid[2];
+        SplitGuid(providerId, guid);
+        return slots_[GetSlotIndex(guid[1])];
+    }
+
+    ProviderDispatchTable()
+    {
+        ProviderDispatch providers[PMTraceSession::PROVIDER_UNHANDLED];
+        uint32_t providerCount = 0;
+        auto add = [&](GUID const& guid, ProviderHandler handler, PMTraceSession::Provider provider) {
+            SplitGuid(guid, providers[providerCount].guid_);
+            providers[providerCount].handler_ = handler;
+            providers[providerCount].provider_ = provider;
+            providers[providerCount].prefilterByProcessId_ = provider == PMTraceSession::PROVIDER_DXGKRNL ||
+                                                             provider == PMTraceSession::PROVIDER_DXGI ||
+                                                             provider == PMTraceSession::PROVIDER_D3D9;
+            providerCount += 1;
+        };
+
+        #pragma warning(push)
+        #pragma warning(disable: 4984) // c++17 extension
+
+        add(Microsoft_Windows_DxgKrnl::GUID,         &PMTraceConsumer::HandleDXGKEvent,    PMTraceSession::PROVIDER_DXGKRNL);
+        add(Microsoft_Windows_DXGI::GUID,            &PMTraceConsumer::HandleDXGIEvent,    PMTraceSession::PROVIDER_DXGI);
+        add(Microsoft_Windows_D3D9::GUID,            &PMTraceConsumer::HandleD3D9Event,    PMTraceSession::PROVIDER_D3D9);
+        add(Microsoft_Windows_Kernel_Process::GUID,  &PMTraceConsumer::HandleProcessEvent, PMTraceSession::PROVIDER_KERNEL_PROCESS);
+        add(NT_Process::GUID,                        &PMTraceConsumer::HandleProcessEvent, PMTraceSession::PROVIDER_NT_PROCESS);
+        add(Microsoft_Windows_EventMetadata::GUID,   &PMTraceConsumer::HandleMetadataEvent, PMTraceSession::PROVIDER_EVENT_METADATA);
+        add(Microsoft_Windows_DxgKrnl::Win7::PRESENTHISTORY_GUID, &PMTraceConsumer::HandleWin7DxgkPresentHistory, PMTraceSession::PROVIDER_DXGKRNL_WIN7_PRESENTHISTORY);
+        if constexpr (TRACK_DISPLAY || TRACK_INPUT) {
+            add(Microsoft_Windows_Win32k::GUID,      &PMTraceConsumer::HandleWin32kEvent,  PMTraceSession::PROVIDER_WIN32K);
+        }
+        if constexpr (TRACK_DISPLAY) {
+            add(Microsoft_Windows_Dwm_Core::GUID,                  &PMTraceConsumer::HandleDWMEvent,            PMTraceSession::PROVIDER_DWM_CORE);
+            add(Microsoft_Windows_Dwm_Core::Win7::GUID,            &PMTraceConsumer::HandleDWMEvent,            PMTraceSession::PROVIDER_DWM_CORE_WIN7);
+            add(Microsoft_Windows_DxgKrnl::Win7::BLT_GUID,         &PMTraceConsumer::HandleWin7DxgkBlt,         PMTraceSession::PROVIDER_DXGKRNL_WIN7_BLT);
+            add(Microsoft_Windows_DxgKrnl::Win7::FLIP_GUID,        &PMTraceConsumer::HandleWin7DxgkFlip,        PMTraceSession::PROVIDER_DXGKRNL_WIN7_FLIP);
+            add(Microsoft_Windows_DxgKrnl::Win7::QUEUEPACKET_GUID, &PMTraceConsumer::HandleWin7DxgkQueuePacket, PMTraceSession::PROVIDER_DXGKRNL_WIN7_QUEUEPACKET);
+            add(Microsoft_Windows_DxgKrnl::Win7::VSYNCDPC_GUID,    &PMTraceConsumer::HandleWin7DxgkVSyncDPC,    PMTraceSession::PROVIDER_DXGKRNL_WIN7_VSYNCDPC);
+            add(Microsoft_Windows_DxgKrnl::Win7::MMIOFLIP_GUID,    &PMTraceConsumer::HandleWin7DxgkMMIOFlip,    PMTraceSession::PROVIDER_DXGKRNL_WIN7_MMIOFLIP);
+        }
+        if constexpr (TRACK_PRESENTMON) {
+            add(Intel_PresentMon::GUID,              &PMTraceConsumer::HandleIntelPresentMonEvent, PMTraceSession::PROVIDER_INTEL_PRESENTMON);
+        }
+
+        #pragma warning(pop)
+
+        // Search for a multiplier that maps each provider to a different slot.
+        // This requires each provider's GUID::Data4 to be unique.
+        for (multiplier_ = 0x9E3779B97F4A7C15ull; ; multiplier_ += 2) {
+            for (auto& slot : slots_) {
+                slot = ProviderDispatch{ { 0, 0 }, nullptr, PMTraceSession::PROVIDER_UNHANDLED, false };
+            }
+
+            uint32_t i = 0;
+            for ( ; i < providerCount; ++i) {
+                auto slot = &slots_[GetSlotIndex(providers[i].guid_[1])];
+                if (slot->handler_ != nullptr) {
+                    break;
+                }
+                *slot = providers[i];
+            }
+            if (i == providerCount) {
+                break;
+            }
+        }
+    }
+};
+
+template<
+    bool TRACK_DISPLAY,
+    bool TRACK_INPUT,
+    bool TRACK_PRESENTMON>
+ProviderDispatchTable<TRACK_DISPLAY, TRACK_INPUT, TRACK_PRESENTMON> const& GetProviderDispatchTable()
+{
+    static ProviderDispatchTable<TRACK_DISPLAY, TRACK_INPUT, TRACK_PRESENTMON> const dispatchTable;
+    return dispatchTable;
+}
+
+// Returns the dispatch entry for the event's provider, or nullptr if the
+// provider isn't handled.
+template<
+    bool TRACK_DISPLAY,
+    bool TRACK_INPUT,
+    bool TRACK_PRESENTMON>
+ProviderDispatch const* FindProviderDispatch(GUID const& providerId)
+{
+    // The slot may be for a different provider (or empty), so compare the
+    // whole GUID.
+    auto const& dispatch = GetProviderDispatchTable<TRACK_DISPLAY, TRACK_INPUT, TRACK_PRESENTMON>().Find(providerId);
+    uint64_t guid[2];
+    SplitGuid(providerId, guid);
+    return dispatch.guid_[0] == guid[0] && dispatch.guid_[1] == guid[1] && dispatch.handler_ != nullptr ? &dispatch : nullptr;
+}
+
+// Returns a bit for each Provider that a TRACK_* configuration handles.
+template<
+    bool TRACK_DISPLAY,
+    bool TRACK_INPUT,
+    bool TRACK_PRESENTMON>
+uint32_t ProviderMask()
+{
+    static_assert(PMTraceSession::PROVIDER_COUNT <= 32, "Provider mask is too small");
+
+    uint32_t mask = 0;
+    for (auto const& slot : GetProviderDispatchTable<TRACK_DISPLAY, TRACK_INPUT, TRACK_PRESENTMON>().slots_) {
+        if (slot.handler_ != nullptr) {
+            mask |= 1u << slot.provider_;
+        }
+    }
+    return mask;
+}
+
+// Returns the metadata of the first consumer that handles a provider, or
+// mPMConsumer's if none do.
+EventMetadata* GetProviderMetadata(PMTraceSession* session, uint32_t providerBit)
+{
+    for (auto const& consumer : session->mConsumers) {
+        if ((consumer.mProviderMask & providerBit) != 0) {
+            return &consumer.mConsumer->mMetadata;
+        }
+    }
+    return &session->mPMConsumer->mMetadata;
+}
+
 template<
     bool IS_REALTIME_SESSION,
     bool TRACK_DISPLAY,
     bool TRACK_INPUT,
     bool TRACK_PRESENTMON>
-void CALLBACK EventRecordCallback(EVENT_RECORD* pEventRecord)
+void HandleEvent(PMTraceSession* session, PMEventRecord* pEventRecord)
 {
-    auto session = (PMTraceSession*) pEventRecord->UserContext;
     auto const& hdr = pEventRecord->EventHeader;
 
     #pragma warning(push)
     #pragma warning(disable: 4984) // c++17 extension
 
-    if constexpr (!IS_REALTIME_SESSION) {
+    if constexpr (IS_REALTIME_SESSION) {
+        session->mLastEventTimestamp.store((uint64_t) hdr.TimeStamp.QuadPart, std::memory_order_relaxed);
+    } else {
         if (session->mStartTimestamp.QuadPart == 0) {
             session->mStartTimestamp = hdr.TimeStamp;
+            for (auto const& consumer : session->mConsumers) {
+                consumer.mConsumer->mFlightRecorder.SetTimestampInfo(session->mStartTimestamp.QuadPart, session->mTimestampFrequency.QuadPart);
+            }
         }
     }
 
-    VerboseTraceEvent(session->mPMConsumer, pEventRecord, &session->mPMConsumer->mMetadata);
+    #pragma warning(pop)
 
-    if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::GUID) {
-        session->mPMConsumer->HandleDXGKEvent(pEventRecord);
-        return;
-    }
-    if (hdr.ProviderId == Microsoft_Windows_DXGI::GUID) {
-        session->mPMConsumer->HandleDXGIEvent(pEventRecord);
-        return;
-    }
-    if constexpr (TRACK_DISPLAY || TRACK_INPUT) {
-        if (hdr.ProviderId == Microsoft_Windows_Win32k::GUID) {
-            session->mPMConsumer->HandleWin32kEvent(pEventRecord);
-            return;
-        }
-    }
-    if constexpr (TRACK_DISPLAY) {
-        if (hdr.ProviderId == Microsoft_Windows_Dwm_Core::GUID) {
-            session->mPMConsumer->HandleDWMEvent(pEventRecord);
-            return;
-        }
-    }
-    if (hdr.ProviderId == Microsoft_Windows_D3D9::GUID) {
-        session->mPMConsumer->HandleD3D9Event(pEventRecord);
-        return;
-    }
-    if (hdr.ProviderId == Microsoft_Windows_Kernel_Process::GUID ||
-        hdr.ProviderId == NT_Process::GUID) {
-        session->mPMConsumer->HandleProcessEvent(pEventRecord);
-        return;
-    }
-    if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::PRESENTHISTORY_GUID) {
-        session->mPMConsumer->HandleWin7DxgkPresentHistory(pEventRecord);
-        return;
+    // The provider is looked up once, for the union of the consumers'
+    // configurations, and then each consumer is only passed the event if its
+    // own configuration handles the provider.
+    auto dispatch = FindProviderDispatch<TRACK_DISPLAY, TRACK_INPUT, TRACK_PRESENTMON>(hdr.ProviderId);
+    auto providerBit = 0u;
+    if (dispatch != nullptr) {
+        session->mDispatchCount[dispatch->provider_] += 1;
+        providerBit = 1u << dispatch->provider_;
+    } else {
+        session->mDispatchCount[PMTraceSession::PROVIDER_UNHANDLED] += 1;
     }
-    if (hdr.ProviderId == Microsoft_Windows_EventMetadata::GUID) {
-        session->mPMConsumer->HandleMetadataEvent(pEventRecord);
-        return;
+
+    // The event's metadata is in the tables of the consumers that handle its
+    // provider, so the verbose trace and raw event stream use one of those
+    // (preferring one that decoded the event) rather than mPMConsumer's.
+    EventMetadata* metadata = nullptr;
+    if (IsVerboseTraceEnabled()) {
+        metadata = GetProviderMetadata(session, providerBit);
     }
 
-    if constexpr (TRACK_DISPLAY) {
-        if (hdr.ProviderId == Microsoft_Windows_Dwm_Core::Win7::GUID) {
-            session->mPMConsumer->HandleDWMEvent(pEventRecord);
-            return;
-        }
-        if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::BLT_GUID) {
-            session->mPMConsumer->HandleWin7DxgkBlt(pEventRecord);
-            return;
-        }
-        if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::FLIP_GUID) {
-            session->mPMConsumer->HandleWin7DxgkFlip(pEventRecord);
-            return;
-        }
-        if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::QUEUEPACKET_GUID) {
-            session->mPMConsumer->HandleWin7DxgkQueuePacket(pEventRecord);
-            return;
+    VerboseTraceEvent(session->mPMConsumer, pEventRecord, metadata);
+
+    for (auto const& consumer : session->mConsumers) {
+        auto pmConsumer = consumer.mConsumer;
+
+        // Do any time-driven work (deferral expiry, state sweeping, engine
+        // utilization sampling, and retrying held-back presents) that is due,
+        // even if the event isn't handled.
+        if ((uint64_t) hdr.TimeStamp.QuadPart >= pmConsumer->mNextTimedWorkTime) {
+            pmConsumer->ServiceTimedWork(hdr.TimeStamp.QuadPart);
         }
-        if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::VSYNCDPC_GUID) {
-            session->mPMConsumer->HandleWin7DxgkVSyncDPC(pEventRecord);
-            return;
+
+        if (pmConsumer->mFlightRecordingRequested.load(std::memory_order_relaxed)) {
+            pmConsumer->ServiceFlightRecordingRequest();
         }
-        if (hdr.ProviderId == Microsoft_Windows_DxgKrnl::Win7::MMIOFLIP_GUID) {
-            session->mPMConsumer->HandleWin7DxgkMMIOFlip(pEventRecord);
-            return;
+
+        if ((consumer.mProviderMask & providerBit) != 0) {
+            pmConsumer->mFlightRecorder.RecordEvent((uint8_t) dispatch->provider_, pEventRecord);
+
+            // When filtering by process, drop events from untracked processes
+            // before they are decoded where possible.
+            if (dispatch->prefilterByProcessId_ &&
+                pmConsumer->mFilteredProcessIds &&
+                pmConsumer->IsEventFromUntrackedProcess(hdr, dispatch->provider_ == PMTraceSession::PROVIDER_DXGKRNL)) {
+                session->mNumEventsFilteredByProcess += 1;
+            } else {
+                (pmConsumer->*dispatch->handler_)(pEventRecord);
+                metadata = &pmConsumer->mMetadata;
+            }
         }
     }
 
-    if constexpr (TRACK_PRESENTMON) {
-        if (hdr.ProviderId == Intel_PresentMon::GUID) {
-            session->mPMConsumer->HandleIntelPresentMonEvent(pEventRecord);
-            return;
+    if (dispatch != nullptr && session->mRawEventStreamWriter != nullptr) {
+        if (metadata == nullptr) {
+            metadata = GetProviderMetadata(session, providerBit);
         }
+        session->mRawEventStreamWriter->WriteEvent(pEventRecord, metadata);
     }
+}
 
-    #pragma warning(pop)
+// The ETW callback copies the parts of the EVENT_RECORD that the analysis uses
+// into a PMEventRecord.  Raw event streams are replayed by calling
+// HandleEvent() directly.
+template<
+    bool IS_REALTIME_SESSION,
+    bool TRACK_DISPLAY,
+    bool TRACK_INPUT,
+    bool TRACK_PRESENTMON>
+void CALLBACK EventRecordCallback(EVENT_RECORD* pEventRecord)
+{
+    auto const& hdr = pEventRecord->EventHeader;
+
+    PMEventRecord eventRecord;
+    eventRecord.EventHeader.ProviderId      = hdr.ProviderId;
+    eventRecord.EventHeader.EventDescriptor = hdr.EventDescriptor;
+    eventRecord.EventHeader.TimeStamp       = hdr.TimeStamp;
+    eventRecord.EventHeader.ProcessId       = hdr.ProcessId;
+    eventRecord.EventHeader.ThreadId        = hdr.ThreadId;
+    eventRecord.EventHeader.Flags           = hdr.Flags;
+    eventRecord.UserData                    = pEventRecord->UserData;
+    eventRecord.UserDataLength              = pEventRecord->UserDataLength;
+    eventRecord.EtwEventRecord              = pEventRecord;
+
+    HandleEvent<IS_REALTIME_SESSION, TRACK_DISPLAY, TRACK_INPUT, TRACK_PRESENTMON>(
+        (PMTraceSession*) pEventRecord->UserContext, &eventRecord);
 }
 
 template<bool... Ts>
@@ -496,6 +733,57 @@ PEVENT_RECORD_CALLBACK GetEventRecordCallback(bool t1, bool t2, bool t3, bool t4
               : GetEventRecordCallback<Ts..., false>(t2, t3, t4);
 }
 
+typedef void (*EventHandler)(PMTraceSession*, PMEventRecord*);
+
+template<bool... Ts>
+EventHandler GetEventHandler(bool t1)
+{
+    return t1 ? &HandleEvent<Ts..., true>
+              : &HandleEvent<Ts..., false>;
+}
+
+template<bool... Ts>
+EventHandler GetEventHandler(bool t1, bool t2)
+{
+    return t1 ? GetEventHandler<Ts..., true>(t2)
+              : GetEventHandler<Ts..., false>(t2);
+}
+
+template<bool... Ts>
+EventHandler GetEventHandler(bool t1, bool t2, bool t3)
+{
+    return t1 ? GetEventHandler<Ts..., true>(t2, t3)
+              : GetEventHandler<Ts..., false>(t2, t3);
+}
+
+template<bool... Ts>
+EventHandler GetEventHandler(bool t1, bool t2, bool t3, bool t4)
+{
+    return t1 ? GetEventHandler<Ts..., true>(t2, t3, t4)
+              : GetEventHandler<Ts..., false>(t2, t3, t4);
+}
+
+template<bool... Ts>
+uint32_t GetProviderMask(bool t1)
+{
+    return t1 ? ProviderMask<Ts..., true>()
+              : ProviderMask<Ts..., false>();
+}
+
+template<bool... Ts>
+uint32_t GetProviderMask(bool t1, bool t2)
+{
+    return t1 ? GetProviderMask<Ts..., true>(t2)
+              : GetProviderMask<Ts..., false>(t2);
+}
+
+template<bool... Ts>
+uint32_t GetProviderMask(bool t1, bool t2, bool t3)
+{
+    return t1 ? GetProviderMask<Ts..., true>(t2, t3)
+              : GetProviderMask<Ts..., false>(t2, t3);
+}
+
 ULONG CALLBACK BufferCallback(EVENT_TRACE_LOGFILE* pLogFile)
 {
     auto session = (PMTraceSession*) pLogFile->Context;
@@ -513,17 +801,38 @@ ULONG PMTraceSession::Start(
     assert(mTraceHandle == INVALID_PROCESSTRACE_HANDLE);
     mStartTimestamp.QuadPart = 0;
     mContinueProcessingBuffers = TRUE;
+    memset(mDispatchCount, 0, sizeof(mDispatchCount));
+    mNumEventsFilteredByProcess = 0;
     mIsRealtimeSession = etlPath == nullptr;
+    InitializeConsumers();
+
+    // The session handles the events needed by any of its consumers.
+    auto eventSets = GetEventSets(mConsumers);
+    auto trackDisplay    = (eventSets & EVENT_SET_DISPLAY) != 0;
+    auto trackInput      = (eventSets & EVENT_SET_INPUT) != 0;
+    auto trackPresentMon = (eventSets & EVENT_SET_FRAME_TYPE) != 0;
 
     // If we're not reading an ETL, start a realtime trace session with the
     // required providers enabled.
     if (mIsRealtimeSession) {
+        // The flush timer can be specified in milliseconds on Win8 or greater
+        // (version 6.2).
+        {
+            RTL_OSVERSIONINFOW info;
+            mUseMillisecondFlushTimer = GetOSVersion(&info) &&
+                (info.dwMajorVersion > 6 || (info.dwMajorVersion == 6 && info.dwMinorVersion >= 2));
+        }
+
         TraceProperties sessionProps = {};
         sessionProps.Wnode.BufferSize = (ULONG) sizeof(TraceProperties);
         sessionProps.Wnode.ClientContext = mTimestampType;          // Clock resolution to use when logging the timestamp for each event
         sessionProps.Wnode.Flags = WNODE_FLAG_TRACED_GUID;
         sessionProps.LogFileMode = EVENT_TRACE_REAL_TIME_MODE;      // We have a realtime consumer, not writing to a log file
         sessionProps.LoggerNameOffset = offsetof(TraceProperties, mSessionName);  // Location of session name; will be written by StartTrace()
+        sessionProps.BufferSize = mBufferSettings.bufferSizeKB_;
+        sessionProps.MinimumBuffers = mBufferSettings.minimumBuffers_;
+        sessionProps.MaximumBuffers = mBufferSettings.maximumBuffers_;
+        SetFlushTimer(&sessionProps, mBufferSettings.flushTimerMs_, mUseMillisecondFlushTimer);
 
         auto status = StartTraceW(&mSessionHandle, sessionName, &sessionProps);
         if (status != ERROR_SUCCESS) {
@@ -531,11 +840,18 @@ ULONG PMTraceSession::Start(
             return status;
         }
 
-        status = EnableProviders(mSessionHandle, sessionProps.Wnode.Guid, mPMConsumer);
+        wcsncpy_s(mSessionName, sessionName, _TRUNCATE);
+        mLastEventTimestamp.store(0, std::memory_order_relaxed);
+        mLagSampleEventTimestamp = 0;
+
+        status = EnableProviders(mSessionHandle, sessionProps.Wnode.Guid, mConsumers);
         if (status != ERROR_SUCCESS) {
             Stop();
             return status;
         }
+
+        // Record the settings ETW chose for any that were left as 0.
+        QueryBufferStats(&mBufferSettings, nullptr);
     }
 
     // Open a trace to collect the session events
@@ -556,10 +872,10 @@ ULONG PMTraceSession::Start(
     }
 
     traceProps.EventRecordCallback = GetEventRecordCallback(
-        mIsRealtimeSession,            // IS_REALTIME_SESSION
-        mPMConsumer->mTrackDisplay,    // TRACK_DISPLAY
-        mPMConsumer->mTrackInput,      // TRACK_INPUT
-        mPMConsumer->mTrackFrameType); // TRACK_PRESENTMON
+        mIsRealtimeSession, // IS_REALTIME_SESSION
+        trackDisplay,       // TRACK_DISPLAY
+        trackInput,         // TRACK_INPUT
+        trackPresentMon);   // TRACK_PRESENTMON
 
     mTraceHandle = OpenTraceW(&traceProps);
     if (mTraceHandle == INVALID_PROCESSTRACE_HANDLE) {
@@ -611,10 +927,134 @@ ULONG PMTraceSession::Start(
     }
 
     InitializeTimestampInfo(&mStartTimestamp, mTimestampFrequency);
+    for (auto const& consumer : mConsumers) {
+        consumer.mConsumer->mFlightRecorder.SetTimestampInfo(mStartTimestamp.QuadPart, mTimestampFrequency.QuadPart);
+    }
 
     return ERROR_SUCCESS;
 }
 
+void PMTraceSession::StartRawEventStream(RawEventStreamHeader const& header)
+{
+    assert(mPMConsumer != nullptr);
+    assert(mSessionHandle == 0);
+    assert(mTraceHandle == INVALID_PROCESSTRACE_HANDLE);
+
+    mStartTimestamp.QuadPart = (LONGLONG) header.startTimestamp_;
+    mTimestampFrequency.QuadPart = (LONGLONG) header.timestampFrequency_;
+    mStartFileTime = header.startFileTime_;
+    mTimestampType = (TimestampType) header.timestampType_;
+    mContinueProcessingBuffers = TRUE;
+    mIsRealtimeSession = false;
+    memset(mDispatchCount, 0, sizeof(mDispatchCount));
+    mNumEventsFilteredByProcess = 0;
+    InitializeConsumers();
+
+    // Default to systemtime frequency if the frequency didn't load correctly.
+    if (mTimestampFrequency.QuadPart == 0) {
+        mTimestampFrequency.QuadPart = 10000000ull;
+    }
+
+    InitializeTimestampInfo(&mStartTimestamp, mTimestampFrequency);
+    for (auto const& consumer : mConsumers) {
+        consumer.mConsumer->mFlightRecorder.SetTimestampInfo(mStartTimestamp.QuadPart, mTimestampFrequency.QuadPart);
+    }
+}
+
+void PMTraceSession::InitializeConsumers()
+{
+    mConsumers.clear();
+    mConsumers.reserve(1 + mAdditionalConsumers.size());
+
+    auto addConsumer = [this](PMTraceConsumer* pmConsumer) {
+        ConsumerDispatch consumer;
+        consumer.mConsumer = pmConsumer;
+        consumer.mProviderMask = GetProviderMask(
+            pmConsumer->mTrackDisplay,      // TRACK_DISPLAY
+            pmConsumer->mTrackInput,        // TRACK_INPUT
+            pmConsumer->mTrackFrameType);   // TRACK_PRESENTMON
+        mConsumers.push_back(consumer);
+    };
+
+    addConsumer(mPMConsumer);
+    for (auto pmConsumer : mAdditionalConsumers) {
+        assert(pmConsumer != nullptr && pmConsumer != mPMConsumer);
+        addConsumer(pmConsumer);
+    }
+}
+
+namespace {
+
+template<typename Reader>
+bool ProcessRawEvents(PMTraceSession* session, Reader* reader)
+{
+    // As for Start(), the events needed by any of the consumers are handled,
+    // and the stream's metadata is added to every consumer's table.
+    auto eventSets = GetEventSets(session->mConsumers);
+    auto handler = GetEventHandler(
+        false,                                      // IS_REALTIME_SESSION
+        (eventSets & EVENT_SET_DISPLAY) != 0,       // TRACK_DISPLAY
+        (eventSets & EVENT_SET_INPUT) != 0,         // TRACK_INPUT
+        (eventSets & EVENT_SET_FRAME_TYPE) != 0);   // TRACK_PRESENTMON
+
+    std::vector<EventMetadata*> metadata;
+    metadata.reserve(session->mConsumers.size());
+    for (auto const& consumer : session->mConsumers) {
+        metadata.push_back(&consumer.mConsumer->mMetadata);
+    }
+
+    while (session->mContinueProcessingBuffers) {
+        PMEventRecord* eventRecord = nullptr;
+        switch (reader->ReadNextEvent(metadata.data(), metadata.size(), &eventRecord)) {
+        case RawEventStreamReader::READ_EVENT:
+            (*handler)(session, eventRecord);
+            break;
+        case RawEventStreamReader::READ_END:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}
+
+bool PMTraceSession::ProcessRawEventStream(RawEventStreamReader* reader)
+{
+    return ProcessRawEvents(this, reader);
+}
+
+bool PMTraceSession::ProcessRawEventStream(RawEventContainerReader* reader)
+{
+    return ProcessRawEvents(this, reader);
+}
+
+wchar_t const* PMTraceSession::GetProviderName(Provider provider)
+{
+    switch (provider) {
+    case PROVIDER_DXGKRNL:                      return L"Microsoft-Windows-DxgKrnl";
+    case PROVIDER_DXGI:                         return L"Microsoft-Windows-DXGI";
+    case PROVIDER_D3D9:                         return L"Microsoft-Windows-D3D9";
+    case PROVIDER_DWM_CORE:                     return L"Microsoft-Windows-Dwm-Core";
+    case PROVIDER_WIN32K:                       return L"Microsoft-Windows-Win32k";
+    case PROVIDER_KERNEL_PROCESS:               return L"Microsoft-Windows-Kernel-Process";
+    case PROVIDER_NT_PROCESS:                   return L"NT Process";
+    case PROVIDER_EVENT_METADATA:               return L"EventMetadata";
+    case PROVIDER_INTEL_PRESENTMON:             return L"Intel-PresentMon";
+    case PROVIDER_DWM_CORE_WIN7:                return L"Microsoft-Windows-Dwm-Core (Win7)";
+    case PROVIDER_DXGKRNL_WIN7_BLT:             return L"Microsoft-Windows-DxgKrnl Blt (Win7)";
+    case PROVIDER_DXGKRNL_WIN7_FLIP:            return L"Microsoft-Windows-DxgKrnl Flip (Win7)";
+    case PROVIDER_DXGKRNL_WIN7_PRESENTHISTORY:  return L"Microsoft-Windows-DxgKrnl PresentHistory (Win7)";
+    case PROVIDER_DXGKRNL_WIN7_QUEUEPACKET:     return L"Microsoft-Windows-DxgKrnl QueuePacket (Win7)";
+    case PROVIDER_DXGKRNL_WIN7_VSYNCDPC:        return L"Microsoft-Windows-DxgKrnl VSyncDPC (Win7)";
+    case PROVIDER_DXGKRNL_WIN7_MMIOFLIP:        return L"Microsoft-Windows-DxgKrnl MMIOFlip (Win7)";
+    case PROVIDER_UNHANDLED:                    return L"Unhandled";
+    }
+    return L"Unknown";
+}
+
 void PMTraceSession::Stop()
 {
     ULONG status = 0;
@@ -654,6 +1094,71 @@ void PMTraceSession::Stop()
     }
 }
 
+bool PMTraceSession::QueryBufferStats(EtwBufferSettings* settings, EtwSessionSample* sample)
+{
+    TraceProperties sessionProps = {};
+    sessionProps.Wnode.BufferSize = (ULONG) sizeof(TraceProperties);
+    sessionProps.LoggerNameOffset = offsetof(TraceProperties, mSessionName);
+    if (mSessionName[0] == L'\0' ||
+        ControlTraceW((TRACEHANDLE) 0, mSessionName, &sessionProps, EVENT_TRACE_CONTROL_QUERY) != ERROR_SUCCESS) {
+        return false;
+    }
+
+    if (settings != nullptr) {
+        settings->bufferSizeKB_   = sessionProps.BufferSize;
+        settings->minimumBuffers_ = sessionProps.MinimumBuffers;
+        settings->maximumBuffers_ = sessionProps.MaximumBuffers;
+        settings->flushTimerMs_   = (sessionProps.LogFileMode & EVENT_TRACE_USE_MS_FLUSH_TIMER) != 0
+            ? sessionProps.FlushTimer
+            : sessionProps.FlushTimer * 1000;
+    }
+
+    if (sample != nullptr) {
+        LARGE_INTEGER qpc = {};
+        QueryPerformanceCounter(&qpc);
+
+        // If no events were handled since the last sample, the consumer is
+        // idle rather than behind.  Event timestamps can only be compared to
+        // the current time if they are QPC values.
+        auto lastEventTimestamp = mLastEventTimestamp.load(std::memory_order_relaxed);
+        auto now = (uint64_t) qpc.QuadPart;
+        sample->time_ = now;
+        sample->consumerLag_ = mTimestampType == TIMESTAMP_TYPE_QPC &&
+                               lastEventTimestamp != mLagSampleEventTimestamp &&
+                               lastEventTimestamp < now ? now - lastEventTimestamp : 0;
+        sample->buffersWritten_  = sessionProps.BuffersWritten;
+        sample->eventsLost_      = sessionProps.EventsLost;
+        sample->buffersLost_     = sessionProps.LogBuffersLost + sessionProps.RealTimeBuffersLost;
+        sample->numberOfBuffers_ = sessionProps.NumberOfBuffers;
+        sample->freeBuffers_     = sessionProps.FreeBuffers;
+        mLagSampleEventTimestamp = lastEventTimestamp;
+    }
+
+    return true;
+}
+
+ULONG PMTraceSession::UpdateBufferSettings(EtwBufferSettings const& settings)
+{
+    // An update sets all the properties that can be updated, so start from
+    // the session's current properties.
+    TraceProperties sessionProps = {};
+    sessionProps.Wnode.BufferSize = (ULONG) sizeof(TraceProperties);
+    sessionProps.LoggerNameOffset = offsetof(TraceProperties, mSessionName);
+    if (mSessionName[0] == L'\0') {
+        return ERROR_INVALID_HANDLE;
+    }
+
+    auto status = ControlTraceW((TRACEHANDLE) 0, mSessionName, &sessionProps, EVENT_TRACE_CONTROL_QUERY);
+    if (status != ERROR_SUCCESS) {
+        return status;
+    }
+
+    sessionProps.LogFileNameOffset = 0;
+    sessionProps.MaximumBuffers = settings.maximumBuffers_;
+    SetFlushTimer(&sessionProps, settings.flushTimerMs_, (sessionProps.LogFileMode & EVENT_TRACE_USE_MS_FLUSH_TIMER) != 0);
+    return ControlTraceW((TRACEHANDLE) 0, mSessionName, &sessionProps, EVENT_TRACE_CONTROL_UPDATE);
+}
+
 ULONG StopNamedTraceSession(wchar_t const* sessionName)
 {
     TraceProperties sessionProps = {};
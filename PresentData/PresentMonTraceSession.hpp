@@ -1,7 +1,16 @@
 // Copyright (C) 2017-2024 Intel Corporation
 // SPDX-License-Identifier: MIT
 
+#include <atomic>
+#include <vector>
+
+#include "EtwBufferPolicy.hpp"
+
 struct PMTraceConsumer;
+struct RawEventContainerReader;
+struct RawEventStreamHeader;
+struct RawEventStreamReader;
+struct RawEventStreamWriter;
 
 struct PMTraceSession {
     enum TimestampType {
@@ -12,6 +21,24 @@ struct PMTraceSession {
 
     PMTraceConsumer* mPMConsumer = nullptr; // Required PMTraceConsumer instance
 
+    // Optional consumers that are also sent this session's events, so that
+    // consumers with different configurations (mTrack* flags, process
+    // filters) can share one ETW session.  The session enables the events
+    // that any consumer needs and looks up each event's provider once, then
+    // passes the event to each consumer that handles that provider and isn't
+    // filtering out the event's process.
+    //
+    // Only the dispatch is shared: each consumer's handlers still decode the
+    // event themselves, through the consumer's own mMetadata table, so every
+    // consumer looks up (and on first use, fetches) the metadata of the
+    // events it handles.  Metadata read from a raw event stream is likewise
+    // copied into every consumer's table, and the verbose trace and
+    // mRawEventStreamWriter use the metadata of a consumer that handles the
+    // event.
+    //
+    // These must be set before Start() or StartRawEventStream().
+    std::vector<PMTraceConsumer*> mAdditionalConsumers;
+
     LARGE_INTEGER mStartTimestamp = {};
     LARGE_INTEGER mTimestampFrequency = {};
     uint64_t mStartFileTime = 0;
@@ -25,12 +52,91 @@ struct PMTraceSession {
     ULONG mNumEventsLost = 0;
     ULONG mNumBuffersLost = 0;
 
+    // The buffer settings for a realtime session.  Start() uses these, with 0
+    // meaning ETW's default, and then updates them to the settings the
+    // session actually uses.  UpdateBufferSettings() changes the running
+    // session's maximumBuffers_ and flushTimerMs_ (but not mBufferSettings);
+    // the other settings only change when the session is restarted.
+    //
+    // QueryBufferStats() and UpdateBufferSettings() refer to the session by
+    // name, so can be called by one thread other than the one calling Start()
+    // and Stop().  They fail if the session isn't running.
+    EtwBufferSettings mBufferSettings = {};
+    bool QueryBufferStats(EtwBufferSettings* settings, EtwSessionSample* sample);
+    ULONG UpdateBufferSettings(EtwBufferSettings const& settings);
+
+    // The timestamp of the newest event handled from a realtime session, used
+    // by QueryBufferStats() to tell how far the consumer is behind.
+    std::atomic<uint64_t> mLastEventTimestamp{ 0 };
+    uint64_t mLagSampleEventTimestamp = 0;
+    bool mUseMillisecondFlushTimer = false;
+    wchar_t mSessionName[MAX_PATH] = {};
+
+    // The number of events dispatched to PMTraceConsumer from each provider.
+    // PROVIDER_UNHANDLED counts events from providers that weren't dispatched
+    // (e.g., from other providers in an ETL, or providers that are disabled by
+    // the consumer's configuration).  These are updated by the thread calling
+    // ProcessTrace(), so should only be read once it has finished.
+    enum Provider {
+        PROVIDER_DXGKRNL,
+        PROVIDER_DXGI,
+        PROVIDER_D3D9,
+        PROVIDER_DWM_CORE,
+        PROVIDER_WIN32K,
+        PROVIDER_KERNEL_PROCESS,
+        PROVIDER_NT_PROCESS,
+        PROVIDER_EVENT_METADATA,
+        PROVIDER_INTEL_PRESENTMON,
+        PROVIDER_DWM_CORE_WIN7,
+        PROVIDER_DXGKRNL_WIN7_BLT,
+        PROVIDER_DXGKRNL_WIN7_FLIP,
+        PROVIDER_DXGKRNL_WIN7_PRESENTHISTORY,
+        PROVIDER_DXGKRNL_WIN7_QUEUEPACKET,
+        PROVIDER_DXGKRNL_WIN7_VSYNCDPC,
+        PROVIDER_DXGKRNL_WIN7_MMIOFLIP,
+        PROVIDER_UNHANDLED,
+        PROVIDER_COUNT
+    };
+
+    uint64_t mDispatchCount[PROVIDER_COUNT] = {};
+
+    // The number of dispatched events that were dropped before being decoded
+    // because they were from a process that isn't tracked (see
+    // PMTraceConsumer::IsEventFromUntrackedProcess()).  An event is counted
+    // once for each consumer that drops it.
+    uint64_t mNumEventsFilteredByProcess = 0;
+
+    static wchar_t const* GetProviderName(Provider provider);
+
     bool mIsRealtimeSession = false;
 
+    // The consumers that events are dispatched to (mPMConsumer first, then
+    // mAdditionalConsumers), each with a bit per Provider that its
+    // configuration handles.  Set by Start() and StartRawEventStream().
+    struct ConsumerDispatch {
+        PMTraceConsumer* mConsumer;
+        uint32_t mProviderMask;
+    };
+    std::vector<ConsumerDispatch> mConsumers;
+    void InitializeConsumers();
+
+    // If set, each event handled by any of the consumers is also written to
+    // this raw event stream.
+    RawEventStreamWriter* mRawEventStreamWriter = nullptr;
+
     ULONG Start(wchar_t const* etlPath,      // If nullptr, start a live/realtime tracing session
                 wchar_t const* sessionName); // Required session name
     void Stop();
 
+    // Process the events in a raw event stream or container, instead of an
+    // ETW session, on the calling thread.  StartRawEventStream() must be
+    // called first, with the reader's header_, to initialize the session's
+    // timestamp information.  ProcessRawEventStream() returns false if the
+    // input is invalid.
+    void StartRawEventStream(RawEventStreamHeader const& header);
+    bool ProcessRawEventStream(RawEventStreamReader* reader);
+    bool ProcessRawEventStream(RawEventContainerReader* reader);
+
     double TimestampDeltaToMilliSeconds(uint64_t timestampDelta) const;
     double TimestampDeltaToMilliSeconds(uint64_t timestampFrom, uint64_t timestampTo) const;
     double TimestampDeltaToUnsignedMilliSeconds(uint64_t timestampFrom, uint64_t timestampTo) const;
@@ -0,0 +1,145 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// ProcessIdFilter is a set of process ids stored as a dense bitmap indexed by
+// process id, so that the consumer thread can check whether a process is in
+// the set with one load and without taking a lock.
+//
+// Add() and Remove() can be called from any thread.  They are serialized with
+// each other by a mutex that Contains() never takes, and they set or clear the
+// bit in place with an atomic operation.  When a process id is beyond the end
+// of the current bitmap, a bitmap at least twice as large is filled in and then
+// published by swapping an atomic pointer.  A reader may still be using the
+// old bitmap, so it is kept until the filter is destroyed; since each bitmap is
+// at least twice the size of the previous one, the retired bitmaps never take
+// more memory than the current one.
+//
+// Process ids are normally small, but the bitmap is limited to MAX_BITMAP_ID so
+// that an unexpectedly large id can't make it huge.  Larger ids are kept in a
+// sorted array instead, which is copied and republished on every change.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class ProcessIdFilter {
+public:
+    ProcessIdFilter() = default;
+    ProcessIdFilter(ProcessIdFilter const&) = delete;
+    ProcessIdFilter& operator=(ProcessIdFilter const&) = delete;
+
+    enum : uint32_t { MAX_BITMAP_ID = (1u << 24) - 1 };
+
+    bool Contains(uint32_t processId) const
+    {
+        if (processId > MAX_BITMAP_ID) {
+            auto largeIds = largeIds_.load(std::memory_order_acquire);
+            return largeIds != nullptr && std::binary_search(largeIds->begin(), largeIds->end(), processId);
+        }
+
+        auto bitmap = current_.load(std::memory_order_acquire);
+        auto wordIndex = (size_t) (processId >> 6);
+        return bitmap != nullptr &&
+               wordIndex < bitmap->size() &&
+               ((*bitmap)[wordIndex].load(std::memory_order_relaxed) & (1ull << (processId & 63))) != 0;
+    }
+
+    void Add(uint32_t processId)
+    {
+        std::lock_guard<std::mutex> lock(writerMutex_);
+
+        if (processId > MAX_BITMAP_ID) {
+            auto largeIds = CopyLargeIds();
+            auto ii = std::lower_bound(largeIds->begin(), largeIds->end(), processId);
+            if (ii == largeIds->end() || *ii != processId) {
+                largeIds->insert(ii, processId);
+                PublishLargeIds(std::move(largeIds));
+            }
+            return;
+        }
+
+        auto wordIndex = (size_t) (processId >> 6);
+        auto bitmap = current_.load(std::memory_order_relaxed);
+        if (bitmap == nullptr || wordIndex >= bitmap->size()) {
+            bitmap = Grow(wordIndex + 1);
+        }
+
+        (*bitmap)[wordIndex].fetch_or(1ull << (processId & 63), std::memory_order_relaxed);
+    }
+
+    void Remove(uint32_t processId)
+    {
+        std::lock_guard<std::mutex> lock(writerMutex_);
+
+        if (processId > MAX_BITMAP_ID) {
+            auto largeIds = CopyLargeIds();
+            auto ii = std::lower_bound(largeIds->begin(), largeIds->end(), processId);
+            if (ii != largeIds->end() && *ii == processId) {
+                largeIds->erase(ii);
+                PublishLargeIds(std::move(largeIds));
+            }
+            return;
+        }
+
+        auto wordIndex = (size_t) (processId >> 6);
+        auto bitmap = current_.load(std::memory_order_relaxed);
+        if (bitmap != nullptr && wordIndex < bitmap->size()) {
+            (*bitmap)[wordIndex].fetch_and(~(1ull << (processId & 63)), std::memory_order_relaxed);
+        }
+    }
+
+private:
+    typedef std::vector<std::atomic<uint64_t>> Bitmap;
+
+    enum { INITIAL_WORD_COUNT = 256 };  // Process ids up to 16383
+
+    // Called while holding writerMutex_.
+    Bitmap* Grow(size_t minWordCount)
+    {
+        auto oldBitmap = current_.load(std::memory_order_relaxed);
+
+        auto wordCount = oldBitmap == nullptr ? (size_t) INITIAL_WORD_COUNT : 2 * oldBitmap->size();
+        while (wordCount < minWordCount) {
+            wordCount *= 2;
+        }
+
+        std::unique_ptr<Bitmap> bitmap(new Bitmap(wordCount));
+        if (oldBitmap != nullptr) {
+            for (size_t i = 0, n = oldBitmap->size(); i < n; ++i) {
+                (*bitmap)[i].store((*oldBitmap)[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+        }
+
+        current_.store(bitmap.get(), std::memory_order_release);
+        bitmaps_.emplace_back(std::move(bitmap));
+        return bitmaps_.back().get();
+    }
+
+    // Called while holding writerMutex_.
+    std::unique_ptr<std::vector<uint32_t>> CopyLargeIds() const
+    {
+        auto largeIds = largeIds_.load(std::memory_order_relaxed);
+        return std::unique_ptr<std::vector<uint32_t>>(largeIds == nullptr
+            ? new std::vector<uint32_t>()
+            : new std::vector<uint32_t>(*largeIds));
+    }
+
+    // Called while holding writerMutex_.
+    void PublishLargeIds(std::unique_ptr<std::vector<uint32_t>>&& largeIds)
+    {
+        largeIds_.store(largeIds.get(), std::memory_order_release);
+        largeIdArrays_.emplace_back(std::move(largeIds));
+    }
+
+    std::atomic<Bitmap*> current_{ nullptr };
+    std::vector<std::unique_ptr<Bitmap>> bitmaps_;  // Every bitmap published, including current_
+
+    std::atomic<std::vector<uint32_t> const*> largeIds_{ nullptr };
+    std::vector<std::unique_ptr<std::vector<uint32_t>>> largeIdArrays_; // Every array published, including largeIds_
+    std::mutex writerMutex_;
+};
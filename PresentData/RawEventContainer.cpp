@@ -0,0 +1,330 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include "RawEventContainer.hpp"
+
+namespace {
+
+template<typename T>
+bool ReadArray(FILE* fp, std::vector<T>* v)
+{
+    return v->empty() || fread(v->data(), sizeof(T), v->size(), fp) == v->size();
+}
+
+}
+
+RawEventContainerReader::~RawEventContainerReader()
+{
+    Close();
+}
+
+bool RawEventContainerReader::Open(FILE* fp)
+{
+    assert(fp_ == nullptr);
+
+    fp_ = fp;
+
+    RawEventContainerTrailer trailer = {};
+    if (fread(&header_, sizeof(header_), 1, fp_) != 1 ||
+        header_.magic_ != RAW_EVENT_CONTAINER_MAGIC ||
+        header_.version_ != RAW_EVENT_CONTAINER_VERSION ||
+        _fseeki64(fp_, -(int64_t) sizeof(trailer), SEEK_END) != 0 ||
+        fread(&trailer, sizeof(trailer), 1, fp_) != 1 ||
+        trailer.magic_ != RAW_EVENT_CONTAINER_MAGIC) {
+        Close();
+        return false;
+    }
+
+    // Make sure the index exactly fills the space before the trailer before
+    // allocating anything based on it.
+    auto fileSize = (uint64_t) _ftelli64(fp_);
+    auto indexSize = (uint64_t) trailer.providerCount_ * sizeof(RawEventContainerProvider) +
+                     (uint64_t) trailer.chunkCount_    * sizeof(RawEventContainerChunk) +
+                     (uint64_t) trailer.chunkCount_    * trailer.providerCount_ * sizeof(uint32_t);
+    if (trailer.indexOffset_ < sizeof(header_) ||
+        trailer.indexOffset_ + indexSize + sizeof(trailer) != fileSize) {
+        Close();
+        return false;
+    }
+
+    providers_.resize(trailer.providerCount_);
+    chunks_.resize(trailer.chunkCount_);
+    providerEventCounts_.resize((size_t) trailer.chunkCount_ * trailer.providerCount_);
+    if (_fseeki64(fp_, (int64_t) trailer.indexOffset_, SEEK_SET) != 0 ||
+        !ReadArray(fp_, &providers_) ||
+        !ReadArray(fp_, &chunks_) ||
+        !ReadArray(fp_, &providerEventCounts_)) {
+        Close();
+        return false;
+    }
+
+    for (auto const& chunk : chunks_) {
+        if (chunk.uncompressedSize_ == 0 ||
+            chunk.compressedSize_ == 0 ||
+            chunk.compressedSize_ > chunk.uncompressedSize_ ||
+            chunk.fileOffset_ < sizeof(header_) ||
+            chunk.fileOffset_ + chunk.compressedSize_ > trailer.indexOffset_) {
+            Close();
+            return false;
+        }
+    }
+
+    // If the recording started with its first event, resolve the start
+    // timestamp now since any time window may skip that event.
+    if (header_.startTimestamp_ == 0) {
+        for (auto const& chunk : chunks_) {
+            if (header_.startTimestamp_ == 0 || header_.startTimestamp_ > chunk.firstTimestamp_) {
+                header_.startTimestamp_ = chunk.firstTimestamp_;
+            }
+        }
+    }
+
+    startTimestamp_ = 0;
+    endTimestamp_ = UINT64_MAX;
+    firstChunk_ = 0;
+    endChunk_ = chunks_.size();
+
+    return true;
+}
+
+void RawEventContainerReader::Close()
+{
+    StopWorkers();
+
+    if (fp_ != nullptr) {
+        fclose(fp_);
+        fp_ = nullptr;
+    }
+
+    slots_.clear();
+    currentSlot_ = nullptr;
+}
+
+void RawEventContainerReader::SetTimeWindow(uint64_t startTimestamp, uint64_t endTimestamp)
+{
+    assert(slots_.empty());
+
+    startTimestamp_ = startTimestamp;
+    endTimestamp_ = endTimestamp;
+
+    // Events within a chunk, and chunks themselves, can be slightly out of
+    // order so include every chunk from the first that ends after the window
+    // starts to the last that starts before the window ends.
+    auto chunkCount = chunks_.size();
+    for (firstChunk_ = 0; firstChunk_ < chunkCount; ++firstChunk_) {
+        if (chunks_[firstChunk_].lastTimestamp_ >= startTimestamp) {
+            break;
+        }
+    }
+
+    endChunk_ = firstChunk_;
+    for (auto i = firstChunk_; i < chunkCount; ++i) {
+        if (chunks_[i].firstTimestamp_ <= endTimestamp) {
+            endChunk_ = i + 1;
+        }
+    }
+}
+
+void RawEventContainerReader::StartWorkers()
+{
+    // Use the cores that aren't running the consumer, but leave at least one
+    // worker to overlap decoding with consumption.  Each worker gets two slots
+    // so it can start on another chunk while the consumer catches up.
+    size_t workerCount = std::thread::hardware_concurrency();
+    workerCount = workerCount <= 2 ? 1 : workerCount - 1;
+    if (workerCount > MAX_WORKER_COUNT) {
+        workerCount = MAX_WORKER_COUNT;
+    }
+    if (workerCount > endChunk_ - firstChunk_) {
+        workerCount = endChunk_ - firstChunk_;
+    }
+
+    slots_.resize(2 * workerCount + 1);
+    for (auto& slot : slots_) {
+        slot.chunkIndex_ = SIZE_MAX;
+        slot.valid_ = false;
+    }
+
+    nextChunk_ = firstChunk_;
+    consumeChunk_ = firstChunk_;
+    stopWorkers_ = false;
+    currentSlot_ = nullptr;
+
+    for (size_t i = 0; i < workerCount; ++i) {
+        workers_.emplace_back(&RawEventContainerReader::WorkerThread, this);
+    }
+}
+
+void RawEventContainerReader::StopWorkers()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopWorkers_ = true;
+    }
+    workerCondition_.notify_all();
+
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+}
+
+void RawEventContainerReader::WorkerThread()
+{
+    auto slotCount = slots_.size();
+    for (;;) {
+        // Claim the next chunk, once its slot has been consumed.
+        size_t chunkIndex = 0;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            workerCondition_.wait(lock, [&]() {
+                return stopWorkers_ || nextChunk_ == endChunk_ || nextChunk_ < consumeChunk_ + slotCount;
+            });
+            if (stopWorkers_ || nextChunk_ == endChunk_) {
+                return;
+            }
+            chunkIndex = nextChunk_++;
+        }
+
+        auto slot = &slots_[chunkIndex % slotCount];
+        auto valid = DecodeChunk(chunkIndex, slot);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slot->chunkIndex_ = chunkIndex;
+            slot->valid_ = valid;
+        }
+        consumerCondition_.notify_one();
+    }
+}
+
+bool RawEventContainerReader::DecodeChunk(size_t chunkIndex, Slot* slot)
+{
+    auto const& chunk = chunks_[chunkIndex];
+    auto stored = chunk.compressedSize_ == chunk.uncompressedSize_;
+
+    slot->items_.clear();
+    slot->data_.resize(chunk.uncompressedSize_);
+    if (!stored) {
+        slot->compressed_.resize(chunk.compressedSize_);
+    }
+
+    auto readBuffer = stored ? slot->data_.data() : slot->compressed_.data();
+    {
+        std::lock_guard<std::mutex> lock(fileMutex_);
+        if (_fseeki64(fp_, (int64_t) chunk.fileOffset_, SEEK_SET) != 0 ||
+            fread(readBuffer, chunk.compressedSize_, 1, fp_) != 1) {
+            return false;
+        }
+    }
+
+    if (!stored && !DecompressRawEventChunk(slot->compressed_.data(), chunk.compressedSize_,
+                                            slot->data_.data(), chunk.uncompressedSize_)) {
+        return false;
+    }
+
+    // Pre-decode the records.  Events outside of the time window are dropped
+    // here, but all metadata is kept since later events may need it.
+    auto data = slot->data_.data();
+    size_t size = chunk.uncompressedSize_;
+    for (size_t offset = 0; offset < size; ) {
+        RawEventStreamRecord record;
+        if (size - offset < sizeof(record)) {
+            return false;
+        }
+        memcpy(&record, data + offset, sizeof(record));
+        offset += sizeof(record);
+        if (record.dataSize_ > size - offset) {
+            return false;
+        }
+
+        Item item = {};
+        switch (record.type_) {
+        case RAW_RECORD_METADATA:
+            if (record.dataSize_ < sizeof(EventMetadataKey) + sizeof(TRACE_EVENT_INFO)) {
+                return false;
+            }
+            item.metadataOffset_ = (uint32_t) offset;
+            item.metadataSize_ = record.dataSize_;
+            slot->items_.push_back(item);
+            break;
+
+        case RAW_RECORD_EVENT: {
+            if (!DecodeRawEventRecord(record, data + offset, &item.eventRecord_)) {
+                return false;
+            }
+            auto timestamp = (uint64_t) item.eventRecord_.EventHeader.TimeStamp.QuadPart;
+            if (timestamp >= startTimestamp_ && timestamp <= endTimestamp_) {
+                slot->items_.push_back(item);
+            }
+            break;
+        }
+        }
+
+        offset += record.dataSize_;
+    }
+
+    return true;
+}
+
+RawEventContainerReader::Result RawEventContainerReader::ReadNextEvent(EventMetadata* metadata, PMEventRecord** eventRecord)
+{
+    return ReadNextEvent(&metadata, 1, eventRecord);
+}
+
+RawEventContainerReader::Result RawEventContainerReader::ReadNextEvent(EventMetadata* const* metadata, size_t metadataCount, PMEventRecord** eventRecord)
+{
+    if (fp_ == nullptr) {
+        return RawEventStreamReader::READ_ERROR;
+    }
+
+    if (slots_.empty()) {
+        StartWorkers();
+    }
+
+    for (;;) {
+        if (currentSlot_ == nullptr) {
+            if (consumeChunk_ == endChunk_) {
+                return RawEventStreamReader::READ_END;
+            }
+
+            auto slot = &slots_[consumeChunk_ % slots_.size()];
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                consumerCondition_.wait(lock, [&]() { return slot->chunkIndex_ == consumeChunk_; });
+            }
+            if (!slot->valid_) {
+                return RawEventStreamReader::READ_ERROR;
+            }
+
+            currentSlot_ = slot;
+            currentItem_ = 0;
+        }
+
+        auto data = currentSlot_->data_.data();
+        while (currentItem_ < currentSlot_->items_.size()) {
+            auto item = &currentSlot_->items_[currentItem_];
+            currentItem_ += 1;
+
+            if (item->metadataSize_ == 0) {
+                *eventRecord = &item->eventRecord_;
+                return RawEventStreamReader::READ_EVENT;
+            }
+
+            EventMetadataKey key;
+            memcpy(&key, data + item->metadataOffset_, sizeof(key));
+            for (size_t i = 0; i < metadataCount; ++i) {
+                metadata[i]->AddEventInfo(key, data + item->metadataOffset_ + sizeof(key),
+                                          item->metadataSize_ - (uint32_t) sizeof(key));
+            }
+        }
+
+        // Release the slot to the workers and move on to the next chunk.
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            consumeChunk_ += 1;
+        }
+        workerCondition_.notify_all();
+        currentSlot_ = nullptr;
+    }
+}
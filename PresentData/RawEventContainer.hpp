@@ -0,0 +1,92 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// RawEventContainerReader reads the raw event containers written by
+// RawEventStreamWriter::OpenContainer() (see RawEventStream.hpp for the
+// format).
+//
+// The container index is read when the container is opened, so the reader
+// can be limited to a time window without decoding the chunks before it.
+// Upcoming chunks are read, decompressed, and pre-decoded into PMEventRecords
+// by worker threads while the caller handles the events in the current chunk.
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "RawEventStream.hpp"
+
+struct RawEventContainerReader {
+    typedef RawEventStreamReader::Result Result;
+
+    enum { MAX_WORKER_COUNT = 4 };
+
+    // A decoded record in a chunk.  Metadata records are stored as the offset
+    // and size of the EventMetadataKey and TRACE_EVENT_INFO in the chunk data,
+    // since they have to be added to the EventMetadata in order.
+    struct Item {
+        PMEventRecord eventRecord_;
+        uint32_t metadataOffset_;
+        uint32_t metadataSize_;     // 0 for RAW_RECORD_EVENT items
+    };
+
+    // A chunk being decoded or consumed.  Chunk i uses slot i % slots_.size().
+    struct Slot {
+        std::vector<uint8_t> compressed_;
+        std::vector<uint8_t> data_;
+        std::vector<Item> items_;
+        size_t chunkIndex_;         // SIZE_MAX until a chunk has been decoded into the slot
+        bool valid_;
+    };
+
+    FILE* fp_ = nullptr;
+    RawEventStreamHeader header_ = {};  // startTimestamp_ is resolved to the first event if it was 0
+    std::vector<RawEventContainerProvider> providers_;
+    std::vector<RawEventContainerChunk> chunks_;
+    std::vector<uint32_t> providerEventCounts_;     // [chunk * providers_.size() + provider]
+
+    // The time window to read, and the range of chunks that overlap it.
+    uint64_t startTimestamp_ = 0;
+    uint64_t endTimestamp_ = UINT64_MAX;
+    size_t firstChunk_ = 0;
+    size_t endChunk_ = 0;
+
+    // Prefetch state.  nextChunk_ is the next chunk for a worker to decode
+    // and consumeChunk_ is the chunk being consumed; they are protected by
+    // mutex_.  Reads from fp_ by the workers are serialized by fileMutex_.
+    std::vector<Slot> slots_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::mutex fileMutex_;
+    std::condition_variable workerCondition_;
+    std::condition_variable consumerCondition_;
+    size_t nextChunk_ = 0;
+    size_t consumeChunk_ = 0;
+    bool stopWorkers_ = false;
+    Slot* currentSlot_ = nullptr;
+    size_t currentItem_ = 0;
+
+    ~RawEventContainerReader();
+
+    // The reader takes ownership of fp, which must be opened for binary
+    // reading.  Returns false if fp isn't a supported raw event container.
+    bool Open(FILE* fp);
+    void Close();
+
+    // Only read events with timestamps in [startTimestamp, endTimestamp].
+    // Must be called before the first ReadNextEvent().
+    void SetTimeWindow(uint64_t startTimestamp, uint64_t endTimestamp);
+
+    // Read the next event, adding any metadata records before it to
+    // metadata (or to each of metadataCount tables).  On READ_EVENT,
+    // *eventRecord points to a PMEventRecord that is valid until the next
+    // call.
+    Result ReadNextEvent(EventMetadata* metadata, PMEventRecord** eventRecord);
+    Result ReadNextEvent(EventMetadata* const* metadata, size_t metadataCount, PMEventRecord** eventRecord);
+
+    void StartWorkers();
+    void StopWorkers();
+    void WorkerThread();
+    bool DecodeChunk(size_t chunkIndex, Slot* slot);
+};
@@ -0,0 +1,481 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include "RawEventStream.hpp"
+
+namespace {
+
+// Chunks are compressed with a simple byte-oriented LZ77 scheme (similar to
+// the LZ4 block format), which decompresses quickly and does well on the
+// repetitive headers of consecutive events.  The compressed data is a
+// sequence of:
+//
+//     uint8_t token          literal count (high 4 bits), match length - 4 (low 4 bits)
+//     [literal count bytes]  if the literal count in the token is 15
+//     literals
+//     uint16_t offset        distance back to the start of the match
+//     [match length bytes]   if the match length in the token is 15
+//
+// where the last sequence ends after its literals.  A count of 15 in the token
+// is continued with bytes that are added to it, up to the first one that isn't
+// 255.
+
+enum {
+    LZ_HASH_BITS  = 14,
+    LZ_MIN_MATCH  = 4,
+    LZ_MAX_OFFSET = 0xffff,
+};
+
+uint32_t LzRead32(uint8_t const* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void LzWriteCount(std::vector<uint8_t>* dst, size_t count)
+{
+    for (count -= 15; count >= 255; count -= 255) {
+        dst->push_back(255);
+    }
+    dst->push_back((uint8_t) count);
+}
+
+bool LzReadCount(uint8_t const* src, size_t srcSize, size_t* ip, size_t* count)
+{
+    for (;;) {
+        if (*ip == srcSize) {
+            return false;
+        }
+        auto b = src[*ip];
+        *ip += 1;
+        *count += b;
+        if (b != 255) {
+            return true;
+        }
+    }
+}
+
+// matchLength == 0 writes the final, literal-only, sequence.
+void LzWriteSequence(std::vector<uint8_t>* dst, uint8_t const* literals, size_t literalCount, size_t offset, size_t matchLength)
+{
+    size_t matchCount = matchLength == 0 ? 0 : matchLength - LZ_MIN_MATCH;
+    dst->push_back((uint8_t) (((literalCount < 15 ? literalCount : 15) << 4) |
+                               (matchCount   < 15 ? matchCount   : 15)));
+    if (literalCount >= 15) {
+        LzWriteCount(dst, literalCount);
+    }
+    dst->insert(dst->end(), literals, literals + literalCount);
+
+    if (matchLength != 0) {
+        dst->push_back((uint8_t) offset);
+        dst->push_back((uint8_t) (offset >> 8));
+        if (matchCount >= 15) {
+            LzWriteCount(dst, matchCount);
+        }
+    }
+}
+
+}
+
+void CompressRawEventChunk(uint8_t const* src, size_t srcSize, std::vector<uint8_t>* dst)
+{
+    dst->clear();
+    dst->reserve(srcSize + srcSize / 255 + 16);
+
+    // The position of the last occurrence of each hashed 4-byte sequence.
+    std::vector<uint32_t> table((size_t) 1 << LZ_HASH_BITS, UINT32_MAX);
+
+    size_t anchor = 0;
+    size_t i = 0;
+    size_t matchEnd = srcSize < LZ_MIN_MATCH ? 0 : srcSize - LZ_MIN_MATCH;
+    while (i < matchEnd) {
+        auto v = LzRead32(src + i);
+        auto h = (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+        auto candidate = table[h];
+        table[h] = (uint32_t) i;
+
+        if (candidate == UINT32_MAX || i - candidate > LZ_MAX_OFFSET || LzRead32(src + candidate) != v) {
+            i += 1;
+            continue;
+        }
+
+        size_t length = LZ_MIN_MATCH;
+        while (i + length < srcSize && src[candidate + length] == src[i + length]) {
+            length += 1;
+        }
+
+        LzWriteSequence(dst, src + anchor, i - anchor, i - candidate, length);
+        i += length;
+        anchor = i;
+    }
+
+    LzWriteSequence(dst, src + anchor, srcSize - anchor, 0, 0);
+}
+
+bool DecompressRawEventChunk(uint8_t const* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+{
+    size_t ip = 0;
+    size_t op = 0;
+    for (;;) {
+        if (ip == srcSize) {
+            return false;
+        }
+        auto token = src[ip];
+        ip += 1;
+
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !LzReadCount(src, srcSize, &ip, &literalCount)) {
+            return false;
+        }
+        if (literalCount > srcSize - ip || literalCount > dstSize - op) {
+            return false;
+        }
+        memcpy(dst + op, src + ip, literalCount);
+        ip += literalCount;
+        op += literalCount;
+
+        if (ip == srcSize) {
+            return op == dstSize;
+        }
+
+        if (srcSize - ip < 2) {
+            return false;
+        }
+        size_t offset = src[ip] | ((size_t) src[ip + 1] << 8);
+        ip += 2;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !LzReadCount(src, srcSize, &ip, &matchLength)) {
+            return false;
+        }
+        matchLength += LZ_MIN_MATCH;
+        if (offset == 0 || offset > op || matchLength > dstSize - op) {
+            return false;
+        }
+
+        // A match can overlap the output it is copied to (e.g., for runs), in
+        // which case it has to be copied forwards one byte at a time.
+        auto match = dst + op - offset;
+        if (offset >= matchLength) {
+            memcpy(dst + op, match, matchLength);
+        } else {
+            for (size_t j = 0; j < matchLength; ++j) {
+                dst[op + j] = match[j];
+            }
+        }
+        op += matchLength;
+    }
+}
+
+bool DecodeRawEventRecord(RawEventStreamRecord const& record, uint8_t* data, PMEventRecord* eventRecord)
+{
+    if (record.dataSize_ < sizeof(RawEventStreamEvent) ||
+        record.dataSize_ - sizeof(RawEventStreamEvent) > UINT16_MAX) {
+        return false;
+    }
+
+    RawEventStreamEvent event;
+    memcpy(&event, data, sizeof(event));
+
+    *eventRecord = {};
+    eventRecord->EventHeader.Flags = record.flags_;
+    eventRecord->EventHeader.ProviderId = event.providerId_;
+    eventRecord->EventHeader.EventDescriptor = event.descriptor_;
+    eventRecord->EventHeader.TimeStamp.QuadPart = (int64_t) event.timestamp_;
+    eventRecord->EventHeader.ProcessId = event.processId_;
+    eventRecord->EventHeader.ThreadId = event.threadId_;
+    eventRecord->UserDataLength = (uint16_t) (record.dataSize_ - sizeof(RawEventStreamEvent));
+    eventRecord->UserData = data + sizeof(RawEventStreamEvent);
+    return true;
+}
+
+bool RawEventStreamWriter::Open(FILE* fp, RawEventStreamHeader const& header)
+{
+    assert(fp_ == nullptr);
+
+    fp_ = fp;
+    buffer_.clear();
+    writtenMetadata_.clear();
+    eventCount_ = 0;
+    metadataCount_ = 0;
+    error_ = false;
+    container_ = false;
+    fileOffset_ = 0;
+
+    RawEventStreamHeader h = header;
+    h.magic_ = RAW_EVENT_STREAM_MAGIC;
+    h.version_ = RAW_EVENT_STREAM_VERSION;
+    h.reserved_ = 0;
+    Write(&h, sizeof(h));
+
+    return !error_;
+}
+
+bool RawEventStreamWriter::OpenContainer(FILE* fp, RawEventStreamHeader const& header, uint32_t chunkSize)
+{
+    assert(fp_ == nullptr);
+    assert(chunkSize > 0);
+
+    fp_ = fp;
+    buffer_.clear();
+    writtenMetadata_.clear();
+    eventCount_ = 0;
+    metadataCount_ = 0;
+    error_ = false;
+    container_ = true;
+    chunkSize_ = chunkSize;
+    fileOffset_ = 0;
+    chunk_ = {};
+    chunks_.clear();
+    providers_.clear();
+    providerEventCounts_.clear();
+    providerEventCounts_.emplace_back();
+
+    RawEventStreamHeader h = header;
+    h.magic_ = RAW_EVENT_CONTAINER_MAGIC;
+    h.version_ = RAW_EVENT_CONTAINER_VERSION;
+    h.reserved_ = 0;
+    Write(&h, sizeof(h));
+
+    return !error_;
+}
+
+void RawEventStreamWriter::Close()
+{
+    if (fp_ != nullptr) {
+        if (container_) {
+            if (chunk_.eventCount_ > 0) {
+                WriteChunk();
+            }
+            providerEventCounts_.pop_back();
+            WriteContainerIndex();
+        } else {
+            Flush();
+        }
+
+        error_ |= fclose(fp_) != 0;
+        fp_ = nullptr;
+    }
+}
+
+void RawEventStreamWriter::Append(void const* data, size_t size)
+{
+    buffer_.insert(buffer_.end(), (uint8_t const*) data, (uint8_t const*) data + size);
+}
+
+void RawEventStreamWriter::Write(void const* data, size_t size)
+{
+    if (!error_ && size > 0 && fwrite(data, 1, size, fp_) != size) {
+        error_ = true;
+    }
+    fileOffset_ += size;
+}
+
+void RawEventStreamWriter::Flush()
+{
+    Write(buffer_.data(), buffer_.size());
+    buffer_.clear();
+}
+
+void RawEventStreamWriter::WriteChunk()
+{
+    CompressRawEventChunk(buffer_.data(), buffer_.size(), &compressed_);
+
+    chunk_.fileOffset_ = fileOffset_;
+    chunk_.uncompressedSize_ = (uint32_t) buffer_.size();
+    if (compressed_.size() < buffer_.size()) {
+        chunk_.compressedSize_ = (uint32_t) compressed_.size();
+        Write(compressed_.data(), compressed_.size());
+    } else {
+        chunk_.compressedSize_ = chunk_.uncompressedSize_;
+        Write(buffer_.data(), buffer_.size());
+    }
+    chunks_.push_back(chunk_);
+
+    // Start the next chunk, which gets its own copy of any metadata it uses.
+    chunk_ = {};
+    buffer_.clear();
+    writtenMetadata_.clear();
+    providerEventCounts_.emplace_back();
+}
+
+void RawEventStreamWriter::WriteContainerIndex()
+{
+    RawEventContainerTrailer trailer = {};
+    trailer.indexOffset_ = fileOffset_;
+    trailer.chunkCount_ = (uint32_t) chunks_.size();
+    trailer.providerCount_ = (uint32_t) providers_.size();
+    trailer.magic_ = RAW_EVENT_CONTAINER_MAGIC;
+
+    Write(providers_.data(), providers_.size() * sizeof(RawEventContainerProvider));
+    Write(chunks_.data(), chunks_.size() * sizeof(RawEventContainerChunk));
+    for (auto& counts : providerEventCounts_) {
+        counts.resize(providers_.size(), 0);
+        Write(counts.data(), counts.size() * sizeof(uint32_t));
+    }
+    Write(&trailer, sizeof(trailer));
+}
+
+void RawEventStreamWriter::WriteEvent(PMEventRecord const* eventRecord, EventMetadata* metadata)
+{
+    if (fp_ == nullptr) {
+        return;
+    }
+
+    auto const& hdr = eventRecord->EventHeader;
+
+    // Write the metadata the first time it's available.  Metadata embedded in
+    // an ETL is also recorded as EventMetadata events, which recreate it (and
+    // any replacements) when replayed.
+    EventMetadataKey key;
+    key.guid_ = hdr.ProviderId;
+    key.desc_ = hdr.EventDescriptor;
+    uint32_t teiSize = 0;
+    auto tei = metadata->metadata_.Find(key, &teiSize);
+    if (tei != nullptr && writtenMetadata_.insert(key).second) {
+        RawEventStreamRecord record;
+        record.type_ = RAW_RECORD_METADATA;
+        record.flags_ = 0;
+        record.dataSize_ = (uint32_t) sizeof(key) + teiSize;
+        Append(&record, sizeof(record));
+        Append(&key, sizeof(key));
+        Append(tei, teiSize);
+        metadataCount_ += 1;
+    }
+
+    RawEventStreamRecord record;
+    record.type_ = RAW_RECORD_EVENT;
+    record.flags_ = hdr.Flags;
+    record.dataSize_ = (uint32_t) sizeof(RawEventStreamEvent) + eventRecord->UserDataLength;
+
+    RawEventStreamEvent event;
+    event.providerId_ = hdr.ProviderId;
+    event.descriptor_ = hdr.EventDescriptor;
+    event.timestamp_ = (uint64_t) hdr.TimeStamp.QuadPart;
+    event.processId_ = hdr.ProcessId;
+    event.threadId_ = hdr.ThreadId;
+
+    Append(&record, sizeof(record));
+    Append(&event, sizeof(event));
+    Append(eventRecord->UserData, eventRecord->UserDataLength);
+    eventCount_ += 1;
+
+    // Events are small, so buffer them to keep the number of writes made on
+    // the consumer thread down.
+    if (!container_) {
+        if (buffer_.size() >= DEFAULT_CHUNK_SIZE) {
+            Flush();
+        }
+        return;
+    }
+
+    // Update the chunk's index entry.  There are only a handful of providers,
+    // so they are found with a linear search.
+    if (chunk_.eventCount_ == 0 || chunk_.firstTimestamp_ > event.timestamp_) {
+        chunk_.firstTimestamp_ = event.timestamp_;
+    }
+    if (chunk_.eventCount_ == 0 || chunk_.lastTimestamp_ < event.timestamp_) {
+        chunk_.lastTimestamp_ = event.timestamp_;
+    }
+    chunk_.eventCount_ += 1;
+
+    size_t providerIndex = 0;
+    for (size_t n = providers_.size(); providerIndex < n; ++providerIndex) {
+        if (providers_[providerIndex].providerId_ == hdr.ProviderId) {
+            break;
+        }
+    }
+    if (providerIndex == providers_.size()) {
+        providers_.push_back({ hdr.ProviderId, 0 });
+    }
+    providers_[providerIndex].eventCount_ += 1;
+
+    auto& counts = providerEventCounts_.back();
+    if (counts.size() <= providerIndex) {
+        counts.resize(providerIndex + 1, 0);
+    }
+    counts[providerIndex] += 1;
+
+    // Chunks only end on event boundaries.
+    if (buffer_.size() >= chunkSize_) {
+        WriteChunk();
+    }
+}
+
+bool RawEventStreamReader::Open(FILE* fp)
+{
+    assert(fp_ == nullptr);
+
+    fp_ = fp;
+    if (fread(&header_, sizeof(header_), 1, fp_) != 1 ||
+        header_.magic_ != RAW_EVENT_STREAM_MAGIC ||
+        header_.version_ != RAW_EVENT_STREAM_VERSION) {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void RawEventStreamReader::Close()
+{
+    if (fp_ != nullptr) {
+        fclose(fp_);
+        fp_ = nullptr;
+    }
+}
+
+RawEventStreamReader::Result RawEventStreamReader::ReadNextEvent(EventMetadata* metadata, PMEventRecord** eventRecord)
+{
+    return ReadNextEvent(&metadata, 1, eventRecord);
+}
+
+RawEventStreamReader::Result RawEventStreamReader::ReadNextEvent(EventMetadata* const* metadata, size_t metadataCount, PMEventRecord** eventRecord)
+{
+    if (fp_ == nullptr) {
+        return READ_ERROR;
+    }
+
+    for (;;) {
+        RawEventStreamRecord record;
+        auto n = fread(&record, 1, sizeof(record), fp_);
+        if (n == 0 && feof(fp_)) {
+            return READ_END;
+        }
+        if (n != sizeof(record)) {
+            return READ_ERROR;
+        }
+
+        data_.resize(record.dataSize_);
+        if (record.dataSize_ > 0 && fread(data_.data(), record.dataSize_, 1, fp_) != 1) {
+            return READ_ERROR;
+        }
+
+        switch (record.type_) {
+        case RAW_RECORD_METADATA: {
+            if (record.dataSize_ < sizeof(EventMetadataKey) + sizeof(TRACE_EVENT_INFO)) {
+                return READ_ERROR;
+            }
+            EventMetadataKey key;
+            memcpy(&key, data_.data(), sizeof(key));
+            for (size_t i = 0; i < metadataCount; ++i) {
+                metadata[i]->AddEventInfo(key, data_.data() + sizeof(key), record.dataSize_ - (uint32_t) sizeof(key));
+            }
+            break;
+        }
+
+        case RAW_RECORD_EVENT:
+            if (!DecodeRawEventRecord(record, data_.data(), &eventRecord_)) {
+                return READ_ERROR;
+            }
+            *eventRecord = &eventRecord_;
+            return READ_EVENT;
+
+        default:
+            // Skip unknown records so that new record types can be added
+            // without breaking older readers.
+            break;
+        }
+    }
+}
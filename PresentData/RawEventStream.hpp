@@ -0,0 +1,185 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// A raw event stream is a compact binary recording of the events handled by
+// PMTraceConsumer, along with the metadata needed to decode them.  It allows
+// the analysis to be replayed (e.g., for profiling or regression testing)
+// without ETW or TDH.
+//
+// The stream is a RawEventStreamHeader followed by a sequence of records.
+// Each record is a RawEventStreamRecord followed by dataSize_ bytes of data:
+//
+//     RAW_RECORD_EVENT:    RawEventStreamEvent followed by the event's user data
+//     RAW_RECORD_METADATA: EventMetadataKey followed by the event's TRACE_EVENT_INFO
+//
+// Metadata for an event is written before the first event that uses it.
+// All values are little-endian.
+//
+// A raw event container stores the same records in independently compressed
+// chunks, followed by an index of the chunks so that a reader can decode
+// chunks in parallel or seek to a time range:
+//
+//     RawEventStreamHeader (with magic_ == RAW_EVENT_CONTAINER_MAGIC)
+//     compressed chunk[chunkCount]
+//     RawEventContainerProvider[providerCount]
+//     RawEventContainerChunk[chunkCount]
+//     uint32_t providerEventCount[chunkCount][providerCount]
+//     RawEventContainerTrailer
+//
+// Each chunk starts over with the metadata, so that every chunk can be
+// decoded on its own.
+//
+// The writer runs on the thread processing the ETW session.  The readers only
+// use the C runtime; they reconstruct each PMEventRecord, and add the recorded
+// metadata to an EventMetadata, so that events can be passed directly to the
+// PMTraceConsumer handlers.  RawEventContainerReader is in
+// RawEventContainer.hpp.
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <unordered_set>
+#include <vector>
+
+#include "TraceConsumer.hpp"
+
+enum : uint32_t {
+    RAW_EVENT_STREAM_MAGIC      = 0x53524d50, // "PMRS"
+    RAW_EVENT_CONTAINER_MAGIC   = 0x43524d50, // "PMRC"
+    RAW_EVENT_STREAM_VERSION    = 1,
+    RAW_EVENT_CONTAINER_VERSION = 1,
+};
+
+struct RawEventStreamHeader {
+    uint32_t magic_;
+    uint32_t version_;
+    uint64_t timestampFrequency_;
+    uint64_t startTimestamp_;       // 0 if the session started with the first event
+    uint64_t startFileTime_;        // Local FILETIME of startTimestamp_
+    uint32_t timestampType_;        // PMTraceSession::TimestampType
+    uint32_t reserved_;
+};
+
+enum RawEventStreamRecordType : uint16_t {
+    RAW_RECORD_EVENT    = 1,
+    RAW_RECORD_METADATA = 2,
+};
+
+struct RawEventStreamRecord {
+    uint16_t type_;                 // RawEventStreamRecordType
+    uint16_t flags_;                // EVENT_HEADER::Flags for RAW_RECORD_EVENT
+    uint32_t dataSize_;
+};
+
+struct RawEventStreamEvent {
+    GUID providerId_;
+    EVENT_DESCRIPTOR descriptor_;
+    uint64_t timestamp_;
+    uint32_t processId_;
+    uint32_t threadId_;
+};
+
+struct RawEventContainerChunk {
+    uint64_t fileOffset_;
+    uint32_t compressedSize_;       // == uncompressedSize_ if the chunk is stored uncompressed
+    uint32_t uncompressedSize_;
+    uint64_t firstTimestamp_;       // Range of the event timestamps in the chunk
+    uint64_t lastTimestamp_;
+    uint32_t eventCount_;
+    uint32_t reserved_;
+};
+
+struct RawEventContainerProvider {
+    GUID providerId_;
+    uint64_t eventCount_;
+};
+
+struct RawEventContainerTrailer {
+    uint64_t indexOffset_;          // File offset of the RawEventContainerProvider array
+    uint32_t chunkCount_;
+    uint32_t providerCount_;
+    uint32_t magic_;
+    uint32_t reserved_;
+};
+
+static_assert(sizeof(RawEventStreamHeader)      == 40, "Unexpected RawEventStreamHeader size");
+static_assert(sizeof(RawEventStreamRecord)      == 8,  "Unexpected RawEventStreamRecord size");
+static_assert(sizeof(RawEventStreamEvent)       == 48, "Unexpected RawEventStreamEvent size");
+static_assert(sizeof(RawEventContainerChunk)    == 40, "Unexpected RawEventContainerChunk size");
+static_assert(sizeof(RawEventContainerProvider) == 24, "Unexpected RawEventContainerProvider size");
+static_assert(sizeof(RawEventContainerTrailer)  == 24, "Unexpected RawEventContainerTrailer size");
+
+// Chunk compression.  CompressRawEventChunk() always succeeds (though the
+// result may be larger than the input); DecompressRawEventChunk() returns
+// false if src isn't a valid compressed chunk of exactly dstSize bytes.
+void CompressRawEventChunk(uint8_t const* src, size_t srcSize, std::vector<uint8_t>* dst);
+bool DecompressRawEventChunk(uint8_t const* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+
+// Fill in eventRecord from a RAW_RECORD_EVENT record.  eventRecord->UserData
+// points into data.  Returns false if the record is invalid.
+bool DecodeRawEventRecord(RawEventStreamRecord const& record, uint8_t* data, PMEventRecord* eventRecord);
+
+struct RawEventStreamWriter {
+    enum { DEFAULT_CHUNK_SIZE = 1024 * 1024 };
+
+    FILE* fp_ = nullptr;
+    std::vector<uint8_t> buffer_;   // Records that haven't been written to fp_ yet
+    std::unordered_set<EventMetadataKey, EventMetadataKeyHash, EventMetadataKeyEqual> writtenMetadata_;
+    uint64_t eventCount_ = 0;
+    uint64_t metadataCount_ = 0;
+    bool error_ = false;
+
+    // Container state
+    bool container_ = false;
+    uint32_t chunkSize_ = 0;
+    uint64_t fileOffset_ = 0;
+    RawEventContainerChunk chunk_ = {};
+    std::vector<RawEventContainerChunk> chunks_;
+    std::vector<RawEventContainerProvider> providers_;
+    std::vector<std::vector<uint32_t>> providerEventCounts_;   // [chunk][provider]
+    std::vector<uint8_t> compressed_;
+
+    // The writer takes ownership of fp, which must be opened for binary
+    // writing.  Open() writes a raw event stream, OpenContainer() writes a raw
+    // event container.  Returns false on error.
+    bool Open(FILE* fp, RawEventStreamHeader const& header);
+    bool OpenContainer(FILE* fp, RawEventStreamHeader const& header, uint32_t chunkSize=DEFAULT_CHUNK_SIZE);
+    void Close();
+
+    // Write the event, preceded by its metadata if it is in metadata and
+    // hasn't been written yet.  Events are expected to be written after
+    // PMTraceConsumer handles them, so that any metadata the handler needed
+    // is available.
+    void WriteEvent(PMEventRecord const* eventRecord, EventMetadata* metadata);
+
+    void Append(void const* data, size_t size);
+    void Write(void const* data, size_t size);
+    void Flush();
+    void WriteChunk();
+    void WriteContainerIndex();
+};
+
+struct RawEventStreamReader {
+    enum Result {
+        READ_EVENT,
+        READ_END,
+        READ_ERROR,
+    };
+
+    FILE* fp_ = nullptr;
+    RawEventStreamHeader header_ = {};
+    std::vector<uint8_t> data_;
+    PMEventRecord eventRecord_ = {};
+
+    // The reader takes ownership of fp, which must be opened for binary
+    // reading.  Returns false if fp isn't a supported raw event stream.
+    bool Open(FILE* fp);
+    void Close();
+
+    // Read the next event, adding any metadata records before it to
+    // metadata (or to each of metadataCount tables).  On READ_EVENT,
+    // *eventRecord points to a PMEventRecord that is valid until the next
+    // call.
+    Result ReadNextEvent(EventMetadata* metadata, PMEventRecord** eventRecord);
+    Result ReadNextEvent(EventMetadata* const* metadata, size_t metadataCount, PMEventRecord** eventRecord);
+};
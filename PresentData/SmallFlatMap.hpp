@@ -0,0 +1,100 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// SmallFlatMap is an unordered map for a small number of entries.  The first
+// InlineCount entries are stored inside the map itself and searched linearly;
+// only when more entries are added are they moved into a heap allocation.
+//
+// Entries are stored contiguously, so iterators and references are
+// invalidated by emplace() and clear().
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+template<typename Key, typename Value, uint32_t InlineCount>
+class SmallFlatMap {
+public:
+    typedef std::pair<Key, Value> value_type;
+    typedef value_type* iterator;
+    typedef value_type const* const_iterator;
+
+    bool empty() const { return size() == 0; }
+    size_t size() const { return spill_.empty() ? inlineSize_ : spill_.size(); }
+
+    iterator begin() { return spill_.empty() ? inline_ : spill_.data(); }
+    iterator end() { return begin() + size(); }
+    const_iterator begin() const { return spill_.empty() ? inline_ : spill_.data(); }
+    const_iterator end() const { return begin() + size(); }
+
+    iterator find(Key const& key)
+    {
+        auto e = end();
+        for (auto i = begin(); i != e; ++i) {
+            if (i->first == key) {
+                return i;
+            }
+        }
+        return e;
+    }
+
+    const_iterator find(Key const& key) const
+    {
+        return const_cast<SmallFlatMap*>(this)->find(key);
+    }
+
+    // As with std::unordered_map, the value is not changed if key is already
+    // in the map.
+    std::pair<iterator, bool> emplace(Key const& key, Value const& value)
+    {
+        auto ii = find(key);
+        if (ii != end()) {
+            return std::make_pair(ii, false);
+        }
+
+        if (spill_.empty()) {
+            if (inlineSize_ < InlineCount) {
+                inline_[inlineSize_] = value_type(key, value);
+                inlineSize_ += 1;
+                return std::make_pair(&inline_[inlineSize_ - 1], true);
+            }
+
+            spill_.reserve(2 * InlineCount);
+            spill_.assign(inline_, inline_ + InlineCount);
+            inlineSize_ = 0;
+        }
+
+        spill_.emplace_back(key, value);
+        return std::make_pair(&spill_.back(), true);
+    }
+
+    void clear()
+    {
+        inlineSize_ = 0;
+        spill_.clear();
+    }
+
+    // Maps are equal if they contain the same entries, regardless of order.
+    friend bool operator==(SmallFlatMap const& a, SmallFlatMap const& b)
+    {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (auto const& pr : a) {
+            auto ii = b.find(pr.first);
+            if (ii == b.end() || ii->second != pr.second) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    friend bool operator!=(SmallFlatMap const& a, SmallFlatMap const& b) { return !(a == b); }
+
+private:
+    value_type inline_[InlineCount];
+    uint32_t inlineSize_ = 0;
+    std::vector<value_type> spill_;     // All entries, once there are more than InlineCount
+};
@@ -0,0 +1,163 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// SpscRing is a bounded, lock-free queue between one producer thread and one
+// consumer thread.  The producer only writes tail_ and the consumer only
+// writes head_; each keeps a cached copy of the other's index so that it only
+// reads the other thread's cache line when the ring looks full (or empty).
+//
+// Values are moved into and out of preallocated slots, so neither side
+// allocates once the ring is constructed.
+#pragma once
+
+#include <assert.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+template<typename T>
+class SpscRing {
+public:
+    enum { CACHE_LINE_SIZE = 64 };
+
+    // capacity must be a power of two.
+    explicit SpscRing(uint32_t capacity)
+        : slots_(capacity)
+        , mask_(capacity - 1)
+    {
+        assert(capacity != 0 && (capacity & (capacity - 1)) == 0);
+    }
+
+    SpscRing(SpscRing const&) = delete;
+    SpscRing& operator=(SpscRing const&) = delete;
+
+    uint32_t capacity() const { return mask_ + 1; }
+
+    // Either thread can check whether the ring is empty, though the result
+    // may be stale by the time it's used.
+    bool empty() const { return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire); }
+
+    // Producer: check whether the ring is full.
+    bool full() const { return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_acquire) == capacity(); }
+
+    // Producer: move value into the ring.  If the ring is full, value is left
+    // unchanged and false is returned.
+    bool TryPush(T&& value)
+    {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - producerHead_ == capacity()) {
+            producerHead_ = head_.load(std::memory_order_acquire);
+            if (tail - producerHead_ == capacity()) {
+                return false;
+            }
+        }
+
+        slots_[tail & mask_] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: move up to maxCount values into out, and return the number
+    // moved.
+    size_t PopBatch(T* out, size_t maxCount)
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto count = (size_t) (tail_.load(std::memory_order_acquire) - head);
+        if (count > maxCount) {
+            count = maxCount;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = std::move(slots_[(head + (uint32_t) i) & mask_]);
+        }
+
+        head_.store(head + (uint32_t) count, std::memory_order_release);
+        return count;
+    }
+
+    // Consumer: move all available values onto the end of out, and return the
+    // number moved.
+    size_t PopAll(std::vector<T>* out)
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto count = tail_.load(std::memory_order_acquire) - head;
+
+        for (uint32_t i = 0; i < count; ++i) {
+            out->emplace_back(std::move(slots_[(head + i) & mask_]));
+        }
+
+        head_.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    std::vector<T> slots_;
+    uint32_t mask_;
+
+    // head_ and tail_ are kept on separate cache lines, each with the copy of
+    // the other index cached by the thread that writes it.
+    char pad0_[CACHE_LINE_SIZE];
+    std::atomic<uint32_t> head_{ 0 };    // Written by the consumer
+    char pad1_[CACHE_LINE_SIZE - sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t> tail_{ 0 };    // Written by the producer
+    uint32_t producerHead_ = 0;          // The producer's last read of head_
+    char pad2_[CACHE_LINE_SIZE - 2 * sizeof(uint32_t)];
+};
+
+// EventCount lets a thread wait for a condition that another thread makes
+// true without locking, such as an SpscRing becoming non-empty.  Notify() is
+// only a fence and a load unless a thread is waiting, so producers can call it
+// after every change.
+//
+// A waiting thread calls PrepareWait(), checks the condition, and then either
+// calls CancelWait() if it's already true or Wait() with the returned key.
+class EventCount {
+public:
+    uint32_t PrepareWait()
+    {
+        waiterCount_.fetch_add(1, std::memory_order_seq_cst);
+        return epoch_.load(std::memory_order_seq_cst);
+    }
+
+    void CancelWait()
+    {
+        waiterCount_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Returns false if the wait timed out without a Notify().
+    bool Wait(uint32_t key, uint32_t timeoutMilliseconds)
+    {
+        bool notified;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            notified = condition_.wait_for(lock, std::chrono::milliseconds(timeoutMilliseconds), [&]() {
+                return epoch_.load(std::memory_order_relaxed) != key;
+            });
+        }
+        waiterCount_.fetch_sub(1, std::memory_order_relaxed);
+        return notified;
+    }
+
+    void Notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiterCount_.load(std::memory_order_relaxed) != 0) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                epoch_.fetch_add(1, std::memory_order_relaxed);
+            }
+            condition_.notify_all();
+        }
+    }
+
+private:
+    std::atomic<uint32_t> epoch_{ 0 };
+    std::atomic<uint32_t> waiterCount_{ 0 };
+    std::mutex mutex_;
+    std::condition_variable condition_;
+};
@@ -0,0 +1,364 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// The consumer's tracking state is normally cleaned up by the events that end
+// each object's lifetime (Present_Stop, Context_Stop, etc.).  When those
+// events are missed the entries are kept until the consumer is destroyed,
+// which for a long-running session (e.g., the PresentMon service) grows
+// without bound.
+//
+// When PMTraceConsumer::mSweepIdleHorizon is set, SweepTrackedState() walks
+// the long-lived structures in passes, a bounded slice per event, and
+// reclaims the entries that belong to processes that exited more than the
+// horizon ago, or that have been idle for longer than the horizon.  Each
+// phase of a pass first collects the keys to reclaim from the current slice of
+// buckets and then removes them by key, since completing a present can modify
+// the structure being walked.  If a structure is rehashed during a pass, some
+// of its entries may be skipped until the next pass.
+//
+// mPendingPresentFrameTypeEvents and mPendingFlipFrameTypeEvents are not
+// swept, as their entries don't record a time or process.
+
+#include "PresentMonTraceConsumer.hpp"
+
+#include <algorithm>
+
+namespace {
+
+enum : uint32_t {
+    SWEEP_ORDERED_PRESENTS,
+    SWEEP_PRESENT_BY_THREAD_ID,
+    SWEEP_LAST_PRESENT_BY_WINDOW,
+    SWEEP_RETRIEVED_INPUT,
+    SWEEP_GPU_CONTEXTS,
+    SWEEP_GPU_PROCESS_FRAME_INFO,
+    SWEEP_GPU_PAGING_SEQUENCE_IDS,
+    SWEEP_EXITED_PROCESSES,
+};
+
+// An estimate of the memory used by a std::unordered_map, excluding anything
+// its values own: a node per entry and a pointer per bucket.
+template<typename Map>
+uint64_t ApproximateMapBytes(Map const& map)
+{
+    return map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*)) +
+           map.bucket_count() * sizeof(void*);
+}
+
+// Add the keys of expired entries in the buckets starting at *bucket to keys,
+// until *budget is used up; each bucket costs one plus its entry count.
+// isExpired() is passed each (key, value) pair.  Returns true once all
+// buckets have been visited.
+template<typename Map, typename IsExpired>
+bool CollectSweepKeys(Map const& map, size_t* bucket, uint32_t* budget, std::vector<uint64_t>* keys, IsExpired isExpired)
+{
+    auto bucketCount = map.bucket_count();
+    for (; *bucket < bucketCount && *budget > 0; *bucket += 1) {
+        auto cost = (uint32_t) map.bucket_size(*bucket) + 1;
+        *budget = cost < *budget ? *budget - cost : 0;
+
+        for (auto ii = map.begin(*bucket), ie = map.end(*bucket); ii != ie; ++ii) {
+            if (isExpired(*ii)) {
+                keys->push_back((uint64_t) ii->first);
+            }
+        }
+    }
+    return *bucket >= bucketCount;
+}
+
+}
+
+wchar_t const* PMTraceConsumer::GetStateGaugeName(StateGauge gauge)
+{
+    switch (gauge) {
+    case STATE_TRACKED_PRESENTS:                return L"TrackedPresents";
+    case STATE_PRESENT_BY_THREAD_ID:            return L"PresentByThreadId";
+    case STATE_ORDERED_PRESENTS_BY_PROCESS_ID:  return L"OrderedPresentsByProcessId";
+    case STATE_LAST_PRESENT_BY_WINDOW:          return L"LastPresentByWindow";
+    case STATE_RETRIEVED_INPUT:                 return L"RetrievedInput";
+    case STATE_EXITED_PROCESSES:                return L"ExitedProcesses";
+    case STATE_GPU_CONTEXTS:                    return L"GpuContexts";
+    case STATE_GPU_PROCESS_FRAME_INFO:          return L"GpuProcessFrameInfo";
+    case STATE_GPU_PAGING_SEQUENCE_IDS:         return L"GpuPagingSequenceIds";
+    case STATE_GAUGE_COUNT:                     break;
+    }
+    return L"Unknown";
+}
+
+bool PMTraceConsumer::IsProcessExpired(uint32_t processId) const
+{
+    auto ii = mExitedProcesses.find(processId);
+    return ii != mExitedProcesses.end() &&
+           ii->second <= mSweepPassTime &&
+           mSweepPassTime - ii->second > mSweepIdleHorizon;
+}
+
+void PMTraceConsumer::SweepTrackedState(uint64_t timestamp)
+{
+    if (!mSweepInProgress) {
+        if (timestamp < mNextSweepTime) {
+            return;
+        }
+        mSweepInProgress = true;
+        mSweepPassTime = timestamp;
+        mSweepPhase = SWEEP_ORDERED_PRESENTS;
+        mSweepBucket = 0;
+    }
+
+    auto isIdle = [this](uint64_t time) {
+        return time <= mSweepPassTime && mSweepPassTime - time > mSweepIdleHorizon;
+    };
+    auto isPresentExpired = [&](PresentEventPtr const& present) {
+        return IsProcessExpired(present->ProcessId) || isIdle(present->PresentStartTime);
+    };
+
+    // Presents referenced by mPresentByThreadId and mLastPresentByWindow are
+    // completed as lost if they are still in progress, and then unreferenced.
+    auto removePresentKeys = [&](auto* map) {
+        using Key = typename std::remove_pointer<decltype(map)>::type::key_type;
+        for (auto key : mSweepKeys) {
+            auto ii = map->find((Key) key);
+            if (ii == map->end()) {
+                continue;
+            }
+
+            auto present = ii->second;
+            if (!present->IsCompleted) {
+                RemoveLostPresent(present);
+                ii = map->find((Key) key);
+            }
+
+            if (ii != map->end() && ii->second == present) {
+                map->erase(ii);
+            }
+            mSweptEntryCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    uint32_t budget = std::max(mSweepSliceSize, 1u);
+    while (budget > 0) {
+        mSweepKeys.clear();
+
+        bool phaseDone = true;
+        switch (mSweepPhase) {
+        case SWEEP_ORDERED_PRESENTS:
+            phaseDone = CollectSweepKeys(mOrderedPresentsByProcessId, &mSweepBucket, &budget, &mSweepKeys,
+                [&](std::pair<uint32_t const, OrderedPresents> const& pr) {
+                    return pr.second.empty() || isPresentExpired(pr.second[0]);
+                });
+
+            // Presents are ordered by PresentStartTime so the idle ones are at
+            // the front, unless the process has expired in which case they
+            // are all removed.  Completing a present can insert into
+            // mOrderedPresentsByProcessId, so it is looked up each time.
+            for (auto key : mSweepKeys) {
+                auto processId = (uint32_t) key;
+                auto processExpired = IsProcessExpired(processId);
+                PresentEventPtr lastRemoved;
+                for (;;) {
+                    auto ii = mOrderedPresentsByProcessId.find(processId);
+                    if (ii == mOrderedPresentsByProcessId.end()) {
+                        break;
+                    }
+                    if (ii->second.empty()) {
+                        mOrderedPresentsByProcessId.erase(ii);
+                        mSweptEntryCount.fetch_add(1, std::memory_order_relaxed);
+                        break;
+                    }
+                    auto present = ii->second[0];
+                    if (present == lastRemoved || (!processExpired && !isIdle(present->PresentStartTime))) {
+                        break;
+                    }
+                    RemoveLostPresent(present);
+                    mSweptEntryCount.fetch_add(1, std::memory_order_relaxed);
+                    lastRemoved = present;
+                }
+            }
+            break;
+
+        case SWEEP_PRESENT_BY_THREAD_ID:
+            phaseDone = CollectSweepKeys(mPresentByThreadId, &mSweepBucket, &budget, &mSweepKeys,
+                [&](std::pair<uint32_t const, PresentEventPtr> const& pr) { return isPresentExpired(pr.second); });
+            removePresentKeys(&mPresentByThreadId);
+            break;
+
+        case SWEEP_LAST_PRESENT_BY_WINDOW:
+            phaseDone = CollectSweepKeys(mLastPresentByWindow, &mSweepBucket, &budget, &mSweepKeys,
+                [&](std::pair<uint64_t const, PresentEventPtr> const& pr) { return isPresentExpired(pr.second); });
+            removePresentKeys(&mLastPresentByWindow);
+            break;
+
+        case SWEEP_RETRIEVED_INPUT:
+            // An idle entry of a running process is kept if it holds the
+            // most-recent input, so that the input isn't retrieved again by a
+            // later present.
+            phaseDone = CollectSweepKeys(mRetrievedInput, &mSweepBucket, &budget, &mSweepKeys,
+                [&](std::pair<uint32_t const, std::pair<uint64_t, InputDeviceType>> const& pr) {
+                    return IsProcessExpired(pr.first) ||
+                           (isIdle(pr.second.first) && pr.second.first != mLastInputDeviceReadTime);
+                });
+            for (auto key : mSweepKeys) {
+                mSweptEntryCount.fetch_add(mRetrievedInput.erase((uint32_t) key), std::memory_order_relaxed);
+            }
+            break;
+
+        case SWEEP_GPU_CONTEXTS:
+            phaseDone = mGpuTrace.SweepContexts(&mSweepBucket, &budget);
+            break;
+
+        case SWEEP_GPU_PROCESS_FRAME_INFO:
+            phaseDone = mGpuTrace.SweepProcessFrameInfo(&mSweepBucket, &budget, &mSweepKeys);
+            break;
+
+        case SWEEP_GPU_PAGING_SEQUENCE_IDS:
+            phaseDone = mGpuTrace.SweepPagingSequenceIds(&mSweepBucket, &budget, &mSweepKeys);
+            break;
+
+        case SWEEP_EXITED_PROCESSES:
+            // Processes whose GPU state couldn't be reclaimed yet are kept so
+            // that the next pass can try again.
+            phaseDone = CollectSweepKeys(mExitedProcesses, &mSweepBucket, &budget, &mSweepKeys,
+                [&](std::pair<uint32_t const, uint64_t> const& pr) { return isIdle(pr.second); });
+            for (auto key : mSweepKeys) {
+                if (!mGpuTrace.HasProcessState((uint32_t) key)) {
+                    mExitedProcesses.erase((uint32_t) key);
+                }
+            }
+            break;
+
+        default:
+            UpdateStateGauges();
+            mSweepInProgress = false;
+            mNextSweepTime = timestamp + mSweepIdleHorizon / 4;
+            return;
+        }
+
+        if (phaseDone) {
+            mSweepPhase += 1;
+            mSweepBucket = 0;
+        }
+    }
+}
+
+void PMTraceConsumer::UpdateStateGauges()
+{
+    auto setGauge = [this](StateGauge gauge, uint64_t entryCount, uint64_t byteCount) {
+        mStateGauges[gauge].mEntryCount.store(entryCount, std::memory_order_relaxed);
+        mStateGauges[gauge].mByteCount.store(byteCount, std::memory_order_relaxed);
+    };
+
+    // Each ring entry of mTrackedPresents reserves room for a PresentEvent
+    // (see mTrackedPresentMemoryLimit).
+    setGauge(STATE_TRACKED_PRESENTS, mTrackedPresents.size(),
+             mTrackedPresents.size() * (sizeof(PresentEvent) + sizeof(PresentEventPtr)));
+
+    uint64_t orderedPresentsBytes = ApproximateMapBytes(mOrderedPresentsByProcessId);
+    for (auto const& pr : mOrderedPresentsByProcessId) {
+        orderedPresentsBytes += pr.second.mRing.capacity() * sizeof(PresentEventPtr);
+    }
+
+    setGauge(STATE_PRESENT_BY_THREAD_ID, mPresentByThreadId.size(), ApproximateMapBytes(mPresentByThreadId));
+    setGauge(STATE_ORDERED_PRESENTS_BY_PROCESS_ID, mOrderedPresentsByProcessId.size(), orderedPresentsBytes);
+    setGauge(STATE_LAST_PRESENT_BY_WINDOW, mLastPresentByWindow.size(), ApproximateMapBytes(mLastPresentByWindow));
+    setGauge(STATE_RETRIEVED_INPUT, mRetrievedInput.size(), ApproximateMapBytes(mRetrievedInput));
+    setGauge(STATE_EXITED_PROCESSES, mExitedProcesses.size(), ApproximateMapBytes(mExitedProcesses));
+
+    mGpuTrace.UpdateStateGauges();
+}
+
+bool GpuTrace::HasProcessState(uint32_t processId) const
+{
+    return mProcessFrameInfo.find(processId) != mProcessFrameInfo.end();
+}
+
+bool GpuTrace::SweepContexts(size_t* contextIndex, uint32_t* budget)
+{
+    // A HwQueue context owns its node, which can't be freed while it still
+    // has queued packets; those are left for the next pass, and the process'
+    // ProcessFrameInfo is kept until then.  Freeing a context doesn't move
+    // the others, so they can be freed while walking mContexts.
+    auto contextCount = mContexts.size();
+    for (; *contextIndex < contextCount && *budget > 0; *contextIndex += 1, *budget -= 1) {
+        auto const& context = mContexts[*contextIndex];
+        if (!context.mIsAllocated ||
+            context.mPacketTrace == nullptr ||
+            !mPMConsumer->IsProcessExpired(context.mProcessId)) {
+            continue;
+        }
+        if (context.mIsHwQueue && mNodes[context.mNodeIndex].mQueueCount > 0) {
+            mSweepBusyProcessIds.push_back(context.mProcessId);
+            continue;
+        }
+        FreeContext((uint32_t) *contextIndex, mPMConsumer->mSweepPassTime);
+        mPMConsumer->mSweptEntryCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    return *contextIndex >= contextCount;
+}
+
+bool GpuTrace::SweepProcessFrameInfo(size_t* bucket, uint32_t* budget, std::vector<uint64_t>* keys)
+{
+    auto done = CollectSweepKeys(mProcessFrameInfo, bucket, budget, keys, [this](std::pair<uint32_t const, ProcessFrameInfo> const& pr) {
+        return pr.second.mVideoEngines.mRunningPacketCount == 0 &&
+               pr.second.mOtherEngines.mRunningPacketCount == 0 &&
+               mPMConsumer->IsProcessExpired(pr.first);
+    });
+
+    for (auto key : *keys) {
+        auto processId = (uint32_t) key;
+        if (std::find(mSweepBusyProcessIds.begin(), mSweepBusyProcessIds.end(), processId) != mSweepBusyProcessIds.end()) {
+            continue;
+        }
+
+        // The packets queued to each node reference the PacketTrace
+        // directly, so it must be kept until they have completed.
+        auto ii = mProcessFrameInfo.find(processId);
+        auto isReferenced = false;
+        for (auto const& node : mNodes) {
+            for (uint32_t i = 0; i < node.mQueueCount && !isReferenced; ++i) {
+                auto packetTrace = node.mQueue[(node.mQueueIndex + i) & ((uint32_t) node.mQueue.size() - 1)].mPacketTrace;
+                isReferenced = packetTrace == &ii->second.mVideoEngines ||
+                               packetTrace == &ii->second.mOtherEngines;
+            }
+        }
+        if (!isReferenced) {
+            mProcessFrameInfo.erase(ii);
+            mPMConsumer->mSweptEntryCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (done) {
+        mSweepBusyProcessIds.clear();
+    }
+    return done;
+}
+
+bool GpuTrace::SweepPagingSequenceIds(size_t* bucket, uint32_t* budget, std::vector<uint64_t>* keys)
+{
+    auto done = CollectSweepKeys(mPagingSequenceIds, bucket, budget, keys, [this](std::pair<uint64_t const, uint32_t> const& pr) {
+        return mPMConsumer->IsProcessExpired(pr.second);
+    });
+
+    for (auto key : *keys) {
+        mPMConsumer->mSweptEntryCount.fetch_add(mPagingSequenceIds.erase(key), std::memory_order_relaxed);
+    }
+    return done;
+}
+
+void GpuTrace::UpdateStateGauges() const
+{
+    // The contexts' gauge includes the nodes and their queues.
+    uint64_t contextBytes = mContexts.capacity() * sizeof(Context) +
+                            mContextIndices.capacity() * 2 * sizeof(uint64_t) +
+                            mNodes.capacity() * sizeof(Node);
+    for (auto const& node : mNodes) {
+        contextBytes += node.mQueue.capacity() * sizeof(Node::EnqueuedPacket);
+    }
+
+    auto gauges = mPMConsumer->mStateGauges;
+    gauges[PMTraceConsumer::STATE_GPU_CONTEXTS].mEntryCount.store(mContexts.size() - mFreeContextIndices.size(), std::memory_order_relaxed);
+    gauges[PMTraceConsumer::STATE_GPU_CONTEXTS].mByteCount.store(contextBytes, std::memory_order_relaxed);
+    gauges[PMTraceConsumer::STATE_GPU_PROCESS_FRAME_INFO].mEntryCount.store(mProcessFrameInfo.size(), std::memory_order_relaxed);
+    gauges[PMTraceConsumer::STATE_GPU_PROCESS_FRAME_INFO].mByteCount.store(ApproximateMapBytes(mProcessFrameInfo), std::memory_order_relaxed);
+    gauges[PMTraceConsumer::STATE_GPU_PAGING_SEQUENCE_IDS].mEntryCount.store(mPagingSequenceIds.size(), std::memory_order_relaxed);
+    gauges[PMTraceConsumer::STATE_GPU_PAGING_SEQUENCE_IDS].mByteCount.store(ApproximateMapBytes(mPagingSequenceIds), std::memory_order_relaxed);
+}
@@ -0,0 +1,179 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// SubmitSequenceTable maps a (submit sequence, queue context) pair to a value
+// using a single open-addressing table with linear probing.  It replaces a map
+// of maps: DxgKrnl packet events identify a packet by both its sequence and its
+// context, but some flip and sync events only include the sequence.
+//
+// Entries are hashed by sequence only, so all entries with the same sequence
+// are in the probe run that starts at that sequence's home slot.  This lets
+// ForEachWithSequence() find them without a secondary index; since sequences
+// are almost always unique across contexts, the run is typically one entry.
+//
+// Erase() uses backward-shift deletion, so there are no tombstones and erasing
+// never allocates.  Values must be non-null, since a null value marks an empty
+// slot, and references into the table are invalidated by Insert().
+#pragma once
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+template<typename Value>
+class SubmitSequenceTable {
+public:
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    Value* Find(uint32_t sequence, uint64_t hContext)
+    {
+        if (size_ != 0) {
+            auto mask = entries_.size() - 1;
+            for (auto i = Home(sequence); entries_[i].value_ != nullptr; i = (i + 1) & mask) {
+                if (entries_[i].sequence_ == sequence && entries_[i].hContext_ == hContext) {
+                    return &entries_[i].value_;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    // Replaces the value if (sequence, hContext) is already in the table.
+    void Insert(uint32_t sequence, uint64_t hContext, Value const& value)
+    {
+        assert(value != nullptr);
+
+        if (2 * (size_ + 1) > entries_.size()) {
+            Grow();
+        }
+
+        auto mask = entries_.size() - 1;
+        auto i = Home(sequence);
+        for (; entries_[i].value_ != nullptr; i = (i + 1) & mask) {
+            if (entries_[i].sequence_ == sequence && entries_[i].hContext_ == hContext) {
+                entries_[i].value_ = value;
+                return;
+            }
+        }
+
+        entries_[i].sequence_ = sequence;
+        entries_[i].hContext_ = hContext;
+        entries_[i].value_ = value;
+        size_ += 1;
+    }
+
+    // Calls f(hContext, value) for each entry with the given sequence.  f must
+    // not modify the table.
+    template<typename F>
+    void ForEachWithSequence(uint32_t sequence, F f) const
+    {
+        if (size_ != 0) {
+            auto mask = entries_.size() - 1;
+            for (auto i = Home(sequence); entries_[i].value_ != nullptr; i = (i + 1) & mask) {
+                if (entries_[i].sequence_ == sequence) {
+                    f(entries_[i].hContext_, entries_[i].value_);
+                }
+            }
+        }
+    }
+
+    // Calls f(sequence, hContext, value) for each entry, in no particular
+    // order.  f must not modify the table.
+    template<typename F>
+    void ForEach(F f) const
+    {
+        for (auto const& e : entries_) {
+            if (e.value_ != nullptr) {
+                f(e.sequence_, e.hContext_, e.value_);
+            }
+        }
+    }
+
+    // Erases the entry with the given sequence and value, if there is one.
+    bool Erase(uint32_t sequence, Value const& value)
+    {
+        if (size_ == 0) {
+            return false;
+        }
+
+        auto mask = entries_.size() - 1;
+        for (auto i = Home(sequence); entries_[i].value_ != nullptr; i = (i + 1) & mask) {
+            if (entries_[i].sequence_ == sequence && entries_[i].value_ == value) {
+                // Release the erased value only once the table is consistent
+                // again, in case its destructor has side effects.
+                Value erased = nullptr;
+                std::swap(erased, entries_[i].value_);
+                EraseSlot(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void clear()
+    {
+        entries_.clear();
+        size_ = 0;
+    }
+
+private:
+    struct Entry {
+        uint32_t sequence_ = 0;
+        uint64_t hContext_ = 0;
+        Value value_ = nullptr;     // nullptr if the slot is empty
+    };
+
+    enum { INITIAL_CAPACITY = 16 };
+
+    size_t Home(uint32_t sequence) const
+    {
+        // Fibonacci hashing; submit sequences are usually consecutive so the
+        // high bits of the product are used.
+        auto h = (uint64_t) sequence * 0x9E3779B97F4A7C15ull;
+        return (size_t) (h >> 32) & (entries_.size() - 1);
+    }
+
+    // Shift any following entries in the probe run back into the empty slot
+    // at i, so that every entry remains reachable from its home slot.
+    void EraseSlot(size_t i)
+    {
+        auto mask = entries_.size() - 1;
+        for (auto j = (i + 1) & mask; entries_[j].value_ != nullptr; j = (j + 1) & mask) {
+            auto home = Home(entries_[j].sequence_);
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                entries_[i].sequence_ = entries_[j].sequence_;
+                entries_[i].hContext_ = entries_[j].hContext_;
+                entries_[i].value_ = std::move(entries_[j].value_);
+                i = j;
+            }
+        }
+        entries_[i].value_ = nullptr;
+        size_ -= 1;
+    }
+
+    void Grow()
+    {
+        std::vector<Entry> old;
+        old.swap(entries_);
+        entries_.resize(old.empty() ? (size_t) INITIAL_CAPACITY : 2 * old.size());
+
+        auto mask = entries_.size() - 1;
+        for (auto& e : old) {
+            if (e.value_ != nullptr) {
+                auto i = Home(e.sequence_);
+                while (entries_[i].value_ != nullptr) {
+                    i = (i + 1) & mask;
+                }
+                entries_[i].sequence_ = e.sequence_;
+                entries_[i].hContext_ = e.hContext_;
+                entries_[i].value_ = std::move(e.value_);
+            }
+        }
+    }
+
+    std::vector<Entry> entries_;    // Size is 0 or a power of two
+    size_t size_ = 0;
+};
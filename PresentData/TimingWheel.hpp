@@ -0,0 +1,193 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// TimingWheel is a hierarchical timing wheel that holds values until a
+// deadline.  Time is measured in ticks of 2^tickShift timestamp units; each
+// level has SLOT_COUNT slots, each covering SLOT_COUNT times as many ticks as
+// a slot of the level below it.  A value is put in the lowest level whose
+// range covers its deadline, and is moved down a level each time the wheel
+// reaches its slot, so inserting a value and advancing the wheel by a tick are
+// both O(1).
+//
+// Deadlines are rounded up to a tick, so values expire no earlier than their
+// deadline and at most one tick later.  Values expire in tick order; the order
+// of values with the same tick is unspecified.
+//
+// Ticks where the wheel has nothing to expire are skipped, so advancing over
+// a long idle period only costs one step for each higher-level slot reached.
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+template<typename Value>
+class TimingWheel {
+public:
+    enum {
+        LEVEL_BITS = 6,
+        LEVEL_COUNT = 4,
+        SLOT_COUNT = 1 << LEVEL_BITS,
+    };
+
+    bool empty() const { return size_ == 0; }
+    size_t size() const { return size_; }
+
+    // Change the tick size.  This can only be done while the wheel is empty.
+    void SetTickShift(uint32_t tickShift)
+    {
+        if (size_ == 0) {
+            tickShift_ = tickShift;
+            now_ = lastTimestamp_ >> tickShift_;
+        }
+    }
+
+    void Insert(uint64_t deadline, Value const& value)
+    {
+        auto tick = (deadline >> tickShift_) + ((deadline & ((1ull << tickShift_) - 1)) == 0 ? 0 : 1);
+        Place(Entry{ tick, value });
+        size_ += 1;
+    }
+
+    // Move the wheel to timestamp and call f(value) for each value whose
+    // deadline is at or before timestamp.  f may insert new values; any that
+    // are already due expire on the next call.
+    template<typename F>
+    void Advance(uint64_t timestamp, F f)
+    {
+        if (timestamp > lastTimestamp_) {
+            lastTimestamp_ = timestamp;
+        }
+
+        auto target = lastTimestamp_ >> tickShift_;
+        if (size_ == 0) {
+            now_ = target;
+            return;
+        }
+
+        Expire(&overdue_, f);
+
+        while (now_ < target && size_ > 0) {
+            // If there is nothing at level 0, jump to the tick before the
+            // next slot that is non-empty at a higher level will cascade.
+            if (levelSize_[0] == 0) {
+                auto skipTo = now_ | (SLOT_COUNT - 1);
+                for (uint32_t level = 1; level + 1 < LEVEL_COUNT && levelSize_[level] == 0; ++level) {
+                    skipTo |= (1ull << ((level + 1) * LEVEL_BITS)) - 1;
+                }
+                if (skipTo >= target) {
+                    break;
+                }
+                now_ = skipTo;
+            }
+
+            now_ += 1;
+            Cascade();
+            Expire(&slots_[0][(size_t) (now_ & (SLOT_COUNT - 1))], f);
+            Expire(&overdue_, f);
+        }
+
+        now_ = target;
+    }
+
+    void clear()
+    {
+        for (auto& level : slots_) {
+            for (auto& slot : level) {
+                slot.clear();
+            }
+        }
+        for (auto& levelSize : levelSize_) {
+            levelSize = 0;
+        }
+        overdue_.clear();
+        size_ = 0;
+    }
+
+private:
+    struct Entry {
+        uint64_t tick_;
+        Value value_;
+    };
+
+    void Place(Entry&& entry)
+    {
+        if (entry.tick_ <= now_) {
+            overdue_.emplace_back(std::move(entry));
+            return;
+        }
+
+        // Use the lowest level that covers the deadline.  Deadlines beyond the
+        // last level are put in its farthest slot, and placed again when the
+        // wheel reaches it.
+        auto delta = entry.tick_ - now_;
+        uint32_t level = 0;
+        while (level + 1 < LEVEL_COUNT && delta >= (1ull << ((level + 1) * LEVEL_BITS))) {
+            level += 1;
+        }
+
+        auto shift = level * LEVEL_BITS;
+        auto slot = (size_t) (delta >= (1ull << ((level + 1) * LEVEL_BITS))
+            ? ((now_ >> shift) + SLOT_COUNT - 1) & (SLOT_COUNT - 1)
+            : (entry.tick_ >> shift) & (SLOT_COUNT - 1));
+        slots_[level][slot].emplace_back(std::move(entry));
+        levelSize_[level] += 1;
+    }
+
+    // When now_ reaches the start of a higher-level slot, move that slot's
+    // values down.  Higher levels go first since their values may move into
+    // the slot being cascaded at the next level down.
+    void Cascade()
+    {
+        uint32_t topLevel = 0;
+        while (topLevel + 1 < LEVEL_COUNT && (now_ & ((1ull << ((topLevel + 1) * LEVEL_BITS)) - 1)) == 0) {
+            topLevel += 1;
+        }
+
+        for (auto level = topLevel; level > 0; --level) {
+            auto slot = &slots_[level][(size_t) ((now_ >> (level * LEVEL_BITS)) & (SLOT_COUNT - 1))];
+            if (!slot->empty()) {
+                levelSize_[level] -= slot->size();
+                scratch_.swap(*slot);
+                for (auto& entry : scratch_) {
+                    Place(std::move(entry));
+                }
+                scratch_.clear();
+            }
+        }
+    }
+
+    template<typename F>
+    void Expire(std::vector<Entry>* slot, F f)
+    {
+        if (slot->empty()) {
+            return;
+        }
+
+        if (slot != &overdue_) {
+            levelSize_[0] -= slot->size();
+        }
+        size_ -= slot->size();
+
+        // Swap the values out first so f can insert into the wheel.
+        std::vector<Entry> expired;
+        expired.swap(expired_);
+        expired.swap(*slot);
+        for (auto& entry : expired) {
+            f(entry.value_);
+        }
+        expired.clear();
+        expired.swap(expired_);
+    }
+
+    std::vector<Entry> slots_[LEVEL_COUNT][SLOT_COUNT];
+    size_t levelSize_[LEVEL_COUNT] = {};
+    std::vector<Entry> overdue_;    // Values whose deadline had already passed when they were placed
+    std::vector<Entry> scratch_;
+    std::vector<Entry> expired_;
+    uint64_t now_ = 0;              // The current tick
+    uint64_t lastTimestamp_ = 0;
+    uint32_t tickShift_ = 0;
+    size_t size_ = 0;
+};
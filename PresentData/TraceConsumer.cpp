@@ -13,7 +13,20 @@ struct PropertyInfo
     uint32_t status_;
 };
 
-uint32_t GetPropertyDataOffset(TRACE_EVENT_INFO const& tei, EVENT_RECORD const& eventRecord, uint32_t index);
+uint32_t GetPropertyDataOffset(TRACE_EVENT_INFO const& tei, PMEventRecord const& eventRecord, uint32_t index);
+
+uint32_t GetCountValue(uint32_t inType, uintptr_t addr)
+{
+    switch (inType) {
+    case TDH_INTYPE_INT8:   return *(int8_t const*) addr;
+    case TDH_INTYPE_UINT8:  return *(uint8_t const*) addr;
+    case TDH_INTYPE_INT16:  return *(int16_t const*) addr;
+    case TDH_INTYPE_UINT16: return *(uint16_t const*) addr;
+    case TDH_INTYPE_INT32:  return *(int32_t const*) addr;
+    case TDH_INTYPE_UINT32: return *(uint32_t const*) addr;
+    default: assert(!"INTYPE not yet implemented for count."); return 0;
+    }
+}
 
 // If ((epi.Flags & PropertyParamLength) != 0), the epi.lengthPropertyIndex
 // field contains the index of the property that contains the number of
@@ -30,7 +43,7 @@ uint32_t GetPropertyDataOffset(TRACE_EVENT_INFO const& tei, EVENT_RECORD const&
 // invalid.
 
 template<typename T>
-void GetStringPropertyInfo(TRACE_EVENT_INFO const& tei, EVENT_RECORD const& eventRecord, uint32_t index, uint32_t offset,
+void GetStringPropertyInfo(TRACE_EVENT_INFO const& tei, PMEventRecord const& eventRecord, uint32_t index, uint32_t offset,
                            PropertyInfo* info)
 {
     auto const& epi = tei.EventPropertyInfoArray[index];
@@ -61,7 +74,42 @@ void GetStringPropertyInfo(TRACE_EVENT_INFO const& tei, EVENT_RECORD const& even
     }
 }
 
-PropertyInfo GetPropertyInfo(TRACE_EVENT_INFO const& tei, EVENT_RECORD const& eventRecord, uint32_t index, uint32_t offset)
+// Size a SID property without TDH (i.e., for replayed events).  A SID is a
+// revision, a sub-authority count, a 6-byte identifier authority, and then the
+// 4-byte sub-authorities.  A WBEMSID is a TOKEN_USER (two pointer-size
+// members) followed by a SID, or a 4-byte zero if there is no SID.
+void GetSidPropertyInfo(TRACE_EVENT_INFO const& tei, PMEventRecord const& eventRecord, uint32_t index, uint32_t offset,
+                        PropertyInfo* info)
+{
+    if (offset == UINT32_MAX) {
+        offset = GetPropertyDataOffset(tei, eventRecord, index);
+    }
+
+    auto userData = (uint8_t const*) eventRecord.UserData;
+    uint32_t sidOffset = 0;
+    if (tei.EventPropertyInfoArray[index].nonStructType.InType == TDH_INTYPE_WBEMSID) {
+        uint32_t token = 0;
+        if (offset + sizeof(token) <= eventRecord.UserDataLength) {
+            memcpy(&token, userData + offset, sizeof(token));
+        }
+        if (token == 0) {
+            info->size_ = sizeof(token);
+            return;
+        }
+        sidOffset = (eventRecord.EventHeader.Flags & EVENT_HEADER_FLAG_64_BIT_HEADER) ? 16 : 8;
+    }
+
+    // Leave the size 0 if the SID is cut off.
+    info->size_ = 0;
+    if (offset + sidOffset + 8 <= eventRecord.UserDataLength) {
+        auto sidSize = sidOffset + 8 + 4 * (uint32_t) userData[offset + sidOffset + 1];
+        if (offset + sidSize <= eventRecord.UserDataLength) {
+            info->size_ = sidSize;
+        }
+    }
+}
+
+PropertyInfo GetPropertyInfo(TRACE_EVENT_INFO const& tei, PMEventRecord const& eventRecord, uint32_t index, uint32_t offset)
 {
     // We don't handle all flags yet, these are the ones we do:
     auto const& epi = tei.EventPropertyInfoArray[index];
@@ -84,7 +132,7 @@ PropertyInfo GetPropertyInfo(TRACE_EVENT_INFO const& tei, EVENT_RECORD const& ev
         switch (epi.nonStructType.InType) {
         case TDH_INTYPE_UNICODESTRING:
             info.status_ |= PROP_STATUS_WCHAR_STRING;
-            GetStringPropertyInfo<wchar_t>(tei, eventRecord, index, offset, &info);
+            GetStringPropertyInfo<WCHAR>(tei, eventRecord, index, offset, &info);
             break;
         case TDH_INTYPE_ANSISTRING:
             info.status_ |= PROP_STATUS_CHAR_STRING;
@@ -99,14 +147,17 @@ PropertyInfo GetPropertyInfo(TRACE_EVENT_INFO const& tei, EVENT_RECORD const& ev
 
         case TDH_INTYPE_SID:
         case TDH_INTYPE_WBEMSID:
-            // TODO: can't figure out how to decode these... so reverting to TDH for now
-            {
+#ifdef _WIN32
+            if (eventRecord.EtwEventRecord != nullptr) {
                 PROPERTY_DATA_DESCRIPTOR descriptor{};
                 descriptor.PropertyName = (ULONGLONG) &tei + epi.NameOffset;
                 descriptor.ArrayIndex = UINT32_MAX;
-                auto status = TdhGetPropertySize((EVENT_RECORD*) &eventRecord, 0, nullptr, 1, &descriptor, (ULONG*) &info.size_);
+                auto status = TdhGetPropertySize(eventRecord.EtwEventRecord, 0, nullptr, 1, &descriptor, (ULONG*) &info.size_);
                 (void) status;
+                break;
             }
+#endif
+            GetSidPropertyInfo(tei, eventRecord, index, offset, &info);
             break;
         }
     }
@@ -116,15 +167,7 @@ PropertyInfo GetPropertyInfo(TRACE_EVENT_INFO const& tei, EVENT_RECORD const& ev
         auto addr = (uintptr_t) eventRecord.UserData + GetPropertyDataOffset(tei, eventRecord, countIdx);
 
         assert(tei.EventPropertyInfoArray[countIdx].Flags == 0);
-        switch (tei.EventPropertyInfoArray[countIdx].nonStructType.InType) {
-        case TDH_INTYPE_INT8:   info.count_ = *(int8_t const*) addr; break;
-        case TDH_INTYPE_UINT8:  info.count_ = *(uint8_t const*) addr; break;
-        case TDH_INTYPE_INT16:  info.count_ = *(int16_t const*) addr; break;
-        case TDH_INTYPE_UINT16: info.count_ = *(uint16_t const*) addr; break;
-        case TDH_INTYPE_INT32:  info.count_ = *(int32_t const*) addr; break;
-        case TDH_INTYPE_UINT32: info.count_ = *(uint32_t const*) addr; break;
-        default: assert(!"INTYPE not yet implemented for count.");
-        }
+        info.count_ = GetCountValue(tei.EventPropertyInfoArray[countIdx].nonStructType.InType, addr);
     }
 
     // Note:
@@ -134,7 +177,7 @@ PropertyInfo GetPropertyInfo(TRACE_EVENT_INFO const& tei, EVENT_RECORD const& ev
     return info;
 }
 
-uint32_t GetPropertyDataOffset(TRACE_EVENT_INFO const& tei, EVENT_RECORD const& eventRecord, uint32_t index)
+uint32_t GetPropertyDataOffset(TRACE_EVENT_INFO const& tei, PMEventRecord const& eventRecord, uint32_t index)
 {
     assert(index < tei.TopLevelPropertyCount);
     uint32_t offset = 0;
@@ -145,25 +188,287 @@ uint32_t GetPropertyDataOffset(TRACE_EVENT_INFO const& tei, EVENT_RECORD const&
     return offset;
 }
 
+// Property names in the metadata are UTF-16, which is only wchar_t on Windows.
+bool IsPropertyName(WCHAR const* propName, wchar_t const* name)
+{
+    for (; (wchar_t) *propName == *name; ++propName, ++name) {
+        if (*name == L'\0') {
+            return true;
+        }
+    }
+    return false;
 }
 
-size_t EventMetadataKeyHash::operator()(EventMetadataKey const& key) const
+// Returns true if the size of one element of the property can be determined
+// from the metadata alone (i.e., without looking at the event data).  Pointer
+// and size_t properties depend on the event header, which is part of the plan
+// key.
+bool HasFixedElementSize(TRACE_EVENT_INFO const& tei, uint32_t index);
+
+bool HasFixedSize(TRACE_EVENT_INFO const& tei, uint32_t index)
+{
+    return (tei.EventPropertyInfoArray[index].Flags & PropertyParamCount) == 0 &&
+           HasFixedElementSize(tei, index);
+}
+
+bool HasFixedElementSize(TRACE_EVENT_INFO const& tei, uint32_t index)
+{
+    auto const& epi = tei.EventPropertyInfoArray[index];
+
+    if (epi.Flags & PropertyStruct) {
+        for (USHORT i = 0; i < epi.structType.NumOfStructMembers; ++i) {
+            if (!HasFixedSize(tei, epi.structType.StructStartIndex + i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    switch (epi.nonStructType.InType) {
+    case TDH_INTYPE_UNICODESTRING:
+    case TDH_INTYPE_ANSISTRING:
+        return (epi.Flags & PropertyParamLength) == 0 && epi.length != 0;
+    case TDH_INTYPE_SID:
+    case TDH_INTYPE_WBEMSID:
+        return false;
+    }
+
+    return true;
+}
+
+void BuildEventDataPlan(TRACE_EVENT_INFO const* tei, PMEventRecord const& eventRecord, EventDataDesc const* desc, uint32_t descCount,
+                        EventDataPlan* plan)
+{
+    plan->tei_ = tei;
+    plan->names_.resize(descCount);
+    plan->fields_.clear();
+    plan->steps_.clear();
+    plan->foundCount_ = 0;
+    plan->compiled_ = false;
+
+    // Find the top-level property index for each requested name.
+    std::vector<uint32_t> descPropIndex(descCount, UINT32_MAX);
+    uint32_t propEnd = 0;
+    for (uint32_t j = 0; j < descCount; ++j) {
+        plan->names_[j] = desc[j].name_;
+        for (uint32_t i = 0; i < tei->TopLevelPropertyCount; ++i) {
+            auto propName = TEI_PROPERTY_NAME(tei, &tei->EventPropertyInfoArray[i]);
+            if (propName != nullptr && IsPropertyName(propName, desc[j].name_)) {
+                descPropIndex[j] = i;
+                if (propEnd < i + 1) {
+                    propEnd = i + 1;
+                }
+                plan->foundCount_ += 1;
+                break;
+            }
+        }
+    }
+
+    // Walk the properties up to the last requested one, tracking each
+    // property's location relative to the most recent variable-size property.
+    std::vector<EventDataPlan::Location> propLocation(propEnd);
+    EventDataPlan::Location location = { 0, 0 };
+    for (uint32_t i = 0; i < propEnd; ++i) {
+        auto const& epi = tei->EventPropertyInfoArray[i];
+        propLocation[i] = location;
+
+        if (HasFixedSize(*tei, i)) {
+            auto info = GetPropertyInfo(*tei, eventRecord, i, UINT32_MAX);
+            for (uint32_t j = 0; j < descCount; ++j) {
+                if (descPropIndex[j] == i) {
+                    plan->fields_.push_back({ j, location, info.size_, info.count_, info.status_ | PROP_STATUS_FOUND });
+                }
+            }
+            location.offset_ += info.size_ * info.count_;
+            continue;
+        }
+
+        if (plan->steps_.size() == EventDataPlan::MAX_STEP_COUNT) {
+            return;
+        }
+
+        EventDataPlan::Step step = {};
+        step.propIndex_ = i;
+        step.descIndex_ = UINT32_MAX;
+        step.offset_ = location.offset_;
+        step.countLocation_.step_ = UINT32_MAX;
+
+        for (uint32_t j = 0; j < descCount; ++j) {
+            if (descPropIndex[j] == i) {
+                if (step.descIndex_ != UINT32_MAX) {
+                    return; // Same variable-size property requested more than once
+                }
+                step.descIndex_ = j;
+            }
+        }
+
+        // Arrays of fixed-size elements whose count is a preceding fixed-size
+        // property can be sized without searching the metadata.
+        if ((epi.Flags & PropertyParamCount) != 0 &&
+            epi.countPropertyIndex < i &&
+            HasFixedSize(*tei, epi.countPropertyIndex) &&
+            HasFixedElementSize(*tei, i)) {
+            auto info = GetPropertyInfo(*tei, eventRecord, i, UINT32_MAX);
+            step.size_ = info.size_;
+            step.status_ = info.status_;
+            step.countLocation_ = propLocation[epi.countPropertyIndex];
+            step.countInType_ = tei->EventPropertyInfoArray[epi.countPropertyIndex].nonStructType.InType;
+        }
+
+        plan->steps_.push_back(step);
+        location.step_ = (uint32_t) plan->steps_.size();
+        location.offset_ = 0;
+    }
+
+    plan->compiled_ = true;
+}
+
+// Mix each 64-bit word of a key into the hash, so that equal or swapped words
+// don't cancel out.
+uint64_t HashWords(void const* data, size_t size)
+{
+    assert((size % sizeof(uint64_t)) == 0);
+    uint64_t h = 0;
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t p;
+        memcpy(&p, (uint8_t const*) data + i, sizeof(p));
+        h = (h ^ p) * 0x9E3779B97F4A7C15ull;
+    }
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t HashPropertyNames(EventDataDesc const* desc, uint32_t descCount)
 {
-    static_assert((sizeof(key) % sizeof(size_t)) == 0, "sizeof(EventMetadataKey) must be multiple of sizeof(size_t)");
-    auto p = (size_t const*) &key;
-    auto h = (size_t) 0;
-    for (size_t i = 0; i < sizeof(key) / sizeof(size_t); ++i) {
-        h ^= p[i];
+    uint64_t h = 14695981039346656037ull;
+    for (uint32_t i = 0; i < descCount; ++i) {
+        h = (h ^ (uint64_t) (uintptr_t) desc[i].name_) * 1099511628211ull;
     }
     return h;
 }
 
+}
+
+// The low bits of the hash are used to index EventMetadataTable, so mix all of
+// the key's bits into them.
+size_t EventMetadataKeyHash::operator()(EventMetadataKey const& key) const
+{
+    static_assert((sizeof(key) % sizeof(uint64_t)) == 0, "sizeof(EventMetadataKey) must be multiple of sizeof(uint64_t)");
+    return (size_t) HashWords(&key, sizeof(key));
+}
+
 bool EventMetadataKeyEqual::operator()(EventMetadataKey const& lhs, EventMetadataKey const& rhs) const
 {
     return memcmp(&lhs, &rhs, sizeof(EventMetadataKey)) == 0;
 }
 
-void EventMetadata::AddMetadata(EVENT_RECORD* eventRecord)
+size_t EventDataPlanKeyHash::operator()(EventDataPlanKey const& key) const
+{
+    static_assert((sizeof(key) % sizeof(uint64_t)) == 0, "sizeof(EventDataPlanKey) must be multiple of sizeof(uint64_t)");
+    return (size_t) HashWords(&key, sizeof(key));
+}
+
+bool EventDataPlanKeyEqual::operator()(EventDataPlanKey const& lhs, EventDataPlanKey const& rhs) const
+{
+    return memcmp(&lhs, &rhs, sizeof(EventDataPlanKey)) == 0;
+}
+
+EventMetadataTable::Slot* EventMetadataTable::FindSlot(EventMetadataKey const& key)
+{
+    auto mask = slots_.size() - 1;
+    for (auto i = EventMetadataKeyHash()(key) & mask; ; i = (i + 1) & mask) {
+        auto slot = &slots_[i];
+        if (slot->tei_ == nullptr || EventMetadataKeyEqual()(slot->key_, key)) {
+            return slot;
+        }
+    }
+}
+
+TRACE_EVENT_INFO* EventMetadataTable::Find(EventMetadataKey const& key, uint32_t* size /*=nullptr*/)
+{
+    Slot* slot = nullptr;
+    if (lastHit_ != SIZE_MAX && EventMetadataKeyEqual()(slots_[lastHit_].key_, key)) {
+        slot = &slots_[lastHit_];
+    } else {
+        if (count_ == 0) {
+            return nullptr;
+        }
+
+        slot = FindSlot(key);
+        if (slot->tei_ == nullptr) {
+            return nullptr;
+        }
+
+        lastHit_ = (size_t) (slot - slots_.data());
+    }
+
+    if (size != nullptr) {
+        *size = slot->teiSize_;
+    }
+    return slot->tei_;
+}
+
+TRACE_EVENT_INFO* EventMetadataTable::Insert(EventMetadataKey const& key, uint32_t size, bool* replaced)
+{
+    // Keep the load factor at or below 1/2 so probe sequences stay short.
+    if (2 * (count_ + 1) > slots_.size()) {
+        Grow();
+    }
+
+    auto slot = FindSlot(key);
+    *replaced = slot->tei_ != nullptr;
+    if (!*replaced) {
+        slot->key_ = key;
+        count_ += 1;
+    }
+
+    // Reuse the existing storage if the new metadata fits.
+    if (!*replaced || slot->teiCapacity_ < size) {
+        slot->tei_ = (TRACE_EVENT_INFO*) Allocate(size);
+        slot->teiCapacity_ = size;
+    }
+    slot->teiSize_ = size;
+    memset(slot->tei_, 0, size);
+
+    lastHit_ = (size_t) (slot - slots_.data());
+    return slot->tei_;
+}
+
+void EventMetadataTable::Grow()
+{
+    std::vector<Slot> oldSlots(slots_.empty() ? (size_t) INITIAL_SLOT_COUNT : 2 * slots_.size(), Slot{});
+    oldSlots.swap(slots_);
+    for (auto const& oldSlot : oldSlots) {
+        if (oldSlot.tei_ != nullptr) {
+            *FindSlot(oldSlot.key_) = oldSlot;
+        }
+    }
+    lastHit_ = SIZE_MAX;
+}
+
+// Allocations are 8-byte aligned.  Metadata larger than a quarter block gets
+// its own block so that it doesn't waste the remainder of the current one.
+uint8_t* EventMetadataTable::Allocate(uint32_t size)
+{
+    size_t alignedSize = ((size_t) size + 7) & ~(size_t) 7;
+    if (alignedSize > ARENA_BLOCK_SIZE / 4) {
+        arenaBlocks_.emplace_back(new uint8_t[alignedSize]);
+        return arenaBlocks_.back().get();
+    }
+
+    if (alignedSize > arenaRemaining_) {
+        arenaBlocks_.emplace_back(new uint8_t[ARENA_BLOCK_SIZE]);
+        arenaNext_ = arenaBlocks_.back().get();
+        arenaRemaining_ = ARENA_BLOCK_SIZE;
+    }
+
+    auto p = arenaNext_;
+    arenaNext_ += alignedSize;
+    arenaRemaining_ -= alignedSize;
+    return p;
+}
+
+void EventMetadata::AddMetadata(PMEventRecord* eventRecord)
 {
     if (eventRecord->EventHeader.EventDescriptor.Opcode == Microsoft_Windows_EventMetadata::EventInfo::Opcode) {
         auto userData = (uint8_t const*) eventRecord->UserData;
@@ -173,47 +478,242 @@ void EventMetadata::AddMetadata(EVENT_RECORD* eventRecord)
             return; // Don't store tracelogging metadata
         }
 
-        // Store metadata (overwriting any previous)
         EventMetadataKey key;
         key.guid_ = tei->ProviderGuid;
         key.desc_ = tei->EventDescriptor;
-        metadata_[key].assign(userData, userData + eventRecord->UserDataLength);
+        AddEventInfo(key, userData, eventRecord->UserDataLength);
+    }
+}
+
+// Store metadata (overwriting any previous).  Plans reference the stored
+// metadata, so discard them if it is replaced, and advance generation_ so that
+// view layouts are validated against the new metadata.  Recorded streams
+// repeat the metadata (e.g., at the start of every container chunk), so
+// identical metadata is left as is.
+void EventMetadata::AddEventInfo(EventMetadataKey const& key, void const* tei, uint32_t size)
+{
+    uint32_t storedSize = 0;
+    auto existingTei = metadata_.Find(key, &storedSize);
+    if (existingTei != nullptr && storedSize == size && memcmp(existingTei, tei, size) == 0) {
+        return;
+    }
+
+    bool replaced = false;
+    auto storedTei = metadata_.Insert(key, size, &replaced);
+    if (replaced) {
+        plans_.clear();
+        generation_ += 1;
     }
+    memcpy(storedTei, tei, size);
 }
 
-// Look up metadata for this provider/event and use it to look up the property.
-// If the metadata isn't found look it up using TDH.  Then, look up each
-// property in the metadata to obtain it's data pointer and size.
-void EventMetadata::GetEventData(EVENT_RECORD* eventRecord, EventDataDesc* desc, uint32_t descCount, uint32_t optionalCount /*=0*/)
+// Look up metadata for this provider/event.  If the metadata isn't found and
+// the event came from ETW, look it up using TDH and cache it for future events.
+TRACE_EVENT_INFO const* EventMetadata::GetEventInfo(PMEventRecord* eventRecord)
 {
-    // Look up stored metadata.  If not found, look up metadata using TDH and
-    // cache it for future events.
     EventMetadataKey key;
     key.guid_ = eventRecord->EventHeader.ProviderId;
     key.desc_ = eventRecord->EventHeader.EventDescriptor;
-    auto ii = metadata_.find(key);
-    if (ii == metadata_.end()) {
-        ULONG bufferSize = 0;
-        auto status = TdhGetEventInformation(eventRecord, 0, nullptr, nullptr, &bufferSize);
-        if (status == ERROR_INSUFFICIENT_BUFFER) {
-            ii = metadata_.emplace(key, std::vector<uint8_t>(bufferSize, 0)).first;
-
-            status = TdhGetEventInformation(eventRecord, 0, nullptr, (TRACE_EVENT_INFO*) ii->second.data(), &bufferSize);
-            assert(status == ERROR_SUCCESS);
+    auto tei = metadata_.Find(key);
+    if (tei == nullptr) {
+        bool replaced = false;
+#ifdef _WIN32
+        if (eventRecord->EtwEventRecord != nullptr) {
+            ULONG bufferSize = 0;
+            auto status = TdhGetEventInformation(eventRecord->EtwEventRecord, 0, nullptr, nullptr, &bufferSize);
+            if (status == ERROR_INSUFFICIENT_BUFFER) {
+                tei = metadata_.Insert(key, bufferSize, &replaced);
+
+                status = TdhGetEventInformation(eventRecord->EtwEventRecord, 0, nullptr, tei, &bufferSize);
+                assert(status == ERROR_SUCCESS);
+                return tei;
+            }
+        }
+#endif
+
+        // No schema registered with system, nor ETL-embedded or recorded
+        // metadata.
+        tei = metadata_.Insert(key, sizeof(TRACE_EVENT_INFO), &replaced);
+        assert(false);
+    }
+
+    return tei;
+}
+
+// Look up the plan for this event kind and set of property names, creating it
+// if this is the first time they've been requested together.  Then use the
+// plan to obtain each property's data pointer and size.
+void EventMetadata::GetEventData(PMEventRecord* eventRecord, EventDataDesc* desc, uint32_t descCount, uint32_t optionalCount /*=0*/)
+{
+    auto const& hdr = eventRecord->EventHeader;
+
+    EventDataPlanKey key = {};
+    key.guid_        = hdr.ProviderId;
+    key.desc_        = hdr.EventDescriptor;
+    key.namesHash_   = HashPropertyNames(desc, descCount);
+    key.descCount_   = descCount;
+    key.pointerSize_ = (uint8_t) ((hdr.Flags & EVENT_HEADER_FLAG_64_BIT_HEADER) ? 8 : 4);
+
+    auto ii = plans_.find(key);
+    if (ii == plans_.end()) {
+        ii = plans_.emplace(key, EventDataPlan()).first;
+        BuildEventDataPlan(GetEventInfo(eventRecord), *eventRecord, desc, descCount, &ii->second);
+    }
+
+    auto const& plan = ii->second;
+    if (!plan.compiled_) {
+        ScanEventData(eventRecord, desc, descCount, optionalCount);
+        return;
+    }
+
+    // Names are keyed by hash, so make sure they actually match.
+    for (uint32_t j = 0; j < descCount; ++j) {
+        if (plan.names_[j] != desc[j].name_) {
+            ScanEventData(eventRecord, desc, descCount, optionalCount);
+            return;
+        }
+    }
+
+    auto userData = (uintptr_t) eventRecord->UserData;
+
+    // Run the steps to size each variable-size property, recording the offset
+    // at the end of each one.
+    uint32_t stepEnd[EventDataPlan::MAX_STEP_COUNT + 1];
+    stepEnd[0] = 0;
+    for (uint32_t k = 0, n = (uint32_t) plan.steps_.size(); k < n; ++k) {
+        auto const& step = plan.steps_[k];
+        auto offset = stepEnd[k] + step.offset_;
+
+        PropertyInfo info;
+        if (step.countLocation_.step_ != UINT32_MAX) {
+            info.size_   = step.size_;
+            info.status_ = step.status_;
+            info.count_  = GetCountValue(step.countInType_, userData + stepEnd[step.countLocation_.step_] + step.countLocation_.offset_);
         } else {
-            // No schema registered with system, nor ETL-embedded metadata.
-            ii = metadata_.emplace(key, std::vector<uint8_t>(sizeof(TRACE_EVENT_INFO), 0)).first;
-            assert(false);
+            info = GetPropertyInfo(*plan.tei_, *eventRecord, step.propIndex_, offset);
+        }
+
+        if (step.descIndex_ != UINT32_MAX) {
+            auto d = &desc[step.descIndex_];
+            d->data_   = (void*) (userData + offset);
+            d->size_   = info.size_;
+            d->count_  = info.count_;
+            d->status_ = info.status_ | PROP_STATUS_FOUND;
+        }
+
+        stepEnd[k + 1] = offset + info.size_ * info.count_;
+    }
+
+    for (auto const& field : plan.fields_) {
+        auto d = &desc[field.descIndex_];
+        d->data_   = (void*) (userData + stepEnd[field.location_.step_] + field.location_.offset_);
+        d->size_   = field.size_;
+        d->count_  = field.count_;
+        d->status_ = field.status_;
+    }
+
+    assert(plan.foundCount_ >= descCount - optionalCount);
+    (void) optionalCount;
+}
+
+// Check that each of the view's properties is at a fixed offset in the event
+// and has a size compatible with its view member (pointer-size properties from
+// 32-bit events may be stored in 64-bit members).
+void EventMetadata::ValidateEventViewLayout(PMEventRecord* eventRecord, EventViewField const* fields, uint32_t fieldCount, EventViewLayout* layout)
+{
+    assert(fieldCount <= EventViewLayout::MAX_FIELD_COUNT);
+
+    auto const& hdr = eventRecord->EventHeader;
+    layout->state_ = EventViewLayout::GENERIC;
+    layout->version_ = hdr.EventDescriptor.Version;
+    layout->pointerSize_ = (uint8_t) ((hdr.Flags & EVENT_HEADER_FLAG_64_BIT_HEADER) ? 8 : 4);
+    layout->generation_ = generation_;
+    layout->minUserDataLength_ = 0;
+
+    EventDataDesc desc[EventViewLayout::MAX_FIELD_COUNT] = {};
+    for (uint32_t i = 0; i < fieldCount; ++i) {
+        desc[i].name_ = fields[i].name_;
+    }
+
+    EventDataPlan plan;
+    BuildEventDataPlan(GetEventInfo(eventRecord), *eventRecord, desc, fieldCount, &plan);
+    if (!plan.compiled_) {
+        return;
+    }
+
+    uint32_t dataOffset[EventViewLayout::MAX_FIELD_COUNT] = {};
+    uint32_t dataSize[EventViewLayout::MAX_FIELD_COUNT] = {};
+    for (auto const& field : plan.fields_) {
+        auto const& viewField = fields[field.descIndex_];
+        if (field.location_.step_ != 0 ||
+            field.count_ != 1 ||
+            field.size_ > viewField.viewSize_ ||
+            (field.size_ != viewField.viewSize_ && (field.status_ & PROP_STATUS_POINTER_SIZE) == 0)) {
+            return;
+        }
+        dataOffset[field.descIndex_] = field.location_.offset_;
+        dataSize[field.descIndex_] = field.size_;
+    }
+
+    // Any property not resolved to a fixed offset must be optional and not in
+    // the event (variable-size properties are plan steps, not fields).
+    uint32_t minUserDataLength = 0;
+    for (uint32_t i = 0; i < fieldCount; ++i) {
+        if (dataSize[i] == 0) {
+            for (auto const& step : plan.steps_) {
+                if (step.descIndex_ == i) {
+                    return;
+                }
+            }
+            if (!fields[i].optional_) {
+                return;
+            }
+        }
+        if (minUserDataLength < dataOffset[i] + dataSize[i]) {
+            minUserDataLength = dataOffset[i] + dataSize[i];
+        }
+    }
+
+    memcpy(layout->dataOffset_, dataOffset, sizeof(dataOffset));
+    memcpy(layout->dataSize_, dataSize, sizeof(dataSize));
+    layout->minUserDataLength_ = minUserDataLength;
+    layout->state_ = EventViewLayout::FIXED;
+}
+
+// Fill in a view using the generic GetEventData() path.
+void EventMetadata::GetEventViewData(PMEventRecord* eventRecord, EventViewField const* fields, uint32_t fieldCount, void* view)
+{
+    assert(fieldCount <= EventViewLayout::MAX_FIELD_COUNT);
+
+    EventDataDesc desc[EventViewLayout::MAX_FIELD_COUNT] = {};
+    uint32_t optionalCount = 0;
+    for (uint32_t i = 0; i < fieldCount; ++i) {
+        desc[i].name_ = fields[i].name_;
+        optionalCount += fields[i].optional_ ? 1 : 0;
+    }
+
+    GetEventData(eventRecord, desc, fieldCount, optionalCount);
+
+    for (uint32_t i = 0; i < fieldCount; ++i) {
+        if (desc[i].status_ & PROP_STATUS_FOUND) {
+            assert(desc[i].size_ == fields[i].viewSize_ ||
+                   ((desc[i].status_ & PROP_STATUS_POINTER_SIZE) != 0 && desc[i].size_ == 4 && fields[i].viewSize_ == 8));
+            memcpy((uint8_t*) view + fields[i].viewOffset_, desc[i].data_, desc[i].size_ < fields[i].viewSize_ ? desc[i].size_ : fields[i].viewSize_);
         }
     }
+}
 
-    auto tei = (TRACE_EVENT_INFO*) ii->second.data();
+// Look up each property in the metadata by name to obtain it's data pointer
+// and size.
+void EventMetadata::ScanEventData(PMEventRecord* eventRecord, EventDataDesc* desc, uint32_t descCount, uint32_t optionalCount /*=0*/)
+{
+    auto tei = GetEventInfo(eventRecord);
 
     // Lookup properties in metadata
     uint32_t foundCount = 0;
 
 #if 0 /* Helper to see all property names while debugging */
-    std::vector<wchar_t const*> props(tei->TopLevelPropertyCount, nullptr);
+    std::vector<WCHAR const*> props(tei->TopLevelPropertyCount, nullptr);
     for (uint32_t i = 0; i < tei->TopLevelPropertyCount; ++i) {
         props[i] = TEI_PROPERTY_NAME(tei, &tei->EventPropertyInfoArray[i]);
     }
@@ -225,7 +725,7 @@ void EventMetadata::GetEventData(EVENT_RECORD* eventRecord, EventDataDesc* desc,
         auto propName = TEI_PROPERTY_NAME(tei, &tei->EventPropertyInfoArray[i]);
         if (propName != nullptr) {
             for (uint32_t j = 0; j < descCount; ++j) {
-                if (desc[j].status_ == PROP_STATUS_NOT_FOUND && wcscmp(propName, desc[j].name_) == 0) {
+                if (desc[j].status_ == PROP_STATUS_NOT_FOUND && IsPropertyName(propName, desc[j].name_)) {
                     desc[j].data_   = (void*) ((uintptr_t) eventRecord->UserData + offset);
                     desc[j].size_   = info.size_;
                     desc[j].count_  = info.count_;
@@ -248,16 +748,18 @@ void EventMetadata::GetEventData(EVENT_RECORD* eventRecord, EventDataDesc* desc,
 
 namespace {
 
-template <typename T>
+// Event strings are CHAR or UTF-16 WCHAR; wide strings are widened to wchar_t
+// where it is larger.
+template <typename T, typename EventChar>
 T GetEventString(EventDataDesc const& desc)
 {
     assert(desc.status_ & PROP_STATUS_FOUND);
-    assert(desc.status_ & (std::is_same<char, typename T::value_type>::value ? PROP_STATUS_CHAR_STRING : PROP_STATUS_WCHAR_STRING));
+    assert(desc.status_ & (std::is_same<char, EventChar>::value ? PROP_STATUS_CHAR_STRING : PROP_STATUS_WCHAR_STRING));
     assert(desc.status_ & PROP_STATUS_NULL_TERMINATED);
-    assert((desc.size_ % sizeof(typename T::value_type)) == 0);
+    assert((desc.size_ % sizeof(EventChar)) == 0);
 
-    auto start = (typename T::value_type*) desc.data_;
-    auto end   = (typename T::value_type*) ((uintptr_t) desc.data_ + desc.size_);
+    auto start = (EventChar const*) desc.data_;
+    auto end   = (EventChar const*) ((uintptr_t) desc.data_ + desc.size_);
 
     // Don't include null termination character
     if (desc.status_ & PROP_STATUS_NULL_TERMINATED) {
@@ -273,11 +775,11 @@ T GetEventString(EventDataDesc const& desc)
 template <>
 std::string EventDataDesc::GetData<std::string>() const
 {
-    return GetEventString<std::string>(*this);
+    return GetEventString<std::string, char>(*this);
 }
 
 template <>
 std::wstring EventDataDesc::GetData<std::wstring>() const
 {
-    return GetEventString<std::wstring>(*this);
+    return GetEventString<std::wstring, WCHAR>(*this);
 }
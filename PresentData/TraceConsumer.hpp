@@ -3,13 +3,15 @@
 
 #pragma once
 #include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
-#include <windows.h>
-#include <tdh.h> // Must include after windows.h
+
+#include "EventRecord.hpp"
 
 struct EventMetadataKey {
     GUID guid_;
@@ -19,6 +21,24 @@ struct EventMetadataKey {
 struct EventMetadataKeyHash { size_t operator()(EventMetadataKey const& k) const; }; 
 struct EventMetadataKeyEqual { bool operator()(EventMetadataKey const& lhs, EventMetadataKey const& rhs) const; };
 
+// An EventDataPlan is keyed by the event kind (provider, event descriptor, and
+// pointer size) and the set of requested property names.  The whole descriptor
+// is used, as for EventMetadataKey, since classic events of the same provider
+// all have Id 0 and are only distinguished by their Opcode.  Property names are
+// identified by their address, so they are expected to be string literals (as
+// all current callers use).
+struct EventDataPlanKey {
+    GUID guid_;
+    EVENT_DESCRIPTOR desc_;
+    uint64_t namesHash_;
+    uint32_t descCount_;
+    uint8_t pointerSize_;
+    uint8_t reserved_[3];       // Must be zero
+};
+
+struct EventDataPlanKeyHash { size_t operator()(EventDataPlanKey const& k) const; };
+struct EventDataPlanKeyEqual { bool operator()(EventDataPlanKey const& lhs, EventDataPlanKey const& rhs) const; };
+
 enum PropertyStatus {
     PROP_STATUS_NOT_FOUND       = 0,
     PROP_STATUS_FOUND           = 1 << 0,
@@ -64,13 +84,167 @@ struct EventDataDesc {
 template<> std::string EventDataDesc::GetData<std::string>() const;
 template<> std::wstring EventDataDesc::GetData<std::wstring>() const;
 
+// A compiled description of where a set of requested properties are located in
+// an event's user data.  Properties that follow only fixed-size properties are
+// resolved to constant offsets.  Each variable-size property (e.g., a
+// null-terminated string or an array whose count is another property) that
+// precedes or is a requested property becomes a step in a short recipe, and
+// later properties are located relative to the end of the previous step.
+struct EventDataPlan {
+    enum { MAX_STEP_COUNT = 8 };
+
+    struct Location {
+        uint32_t step_;         // Number of steps that must be run before the offset is known
+        uint32_t offset_;       // Offset relative to the end of that step
+    };
+
+    struct Field {
+        uint32_t descIndex_;
+        Location location_;
+        uint32_t size_;
+        uint32_t count_;
+        uint32_t status_;
+    };
+
+    struct Step {
+        uint32_t propIndex_;
+        uint32_t descIndex_;    // UINT32_MAX if this property was not requested
+        uint32_t offset_;       // Offset relative to the end of the previous step
+        uint32_t size_;         // Element size and status, if this is a counted array
+        uint32_t status_;
+        Location countLocation_;// Location of the count property, or step_ == UINT32_MAX if not a counted array
+        uint32_t countInType_;
+    };
+
+    TRACE_EVENT_INFO const* tei_;
+    std::vector<wchar_t const*> names_;
+    std::vector<Field> fields_;
+    std::vector<Step> steps_;
+    uint32_t foundCount_;
+    bool compiled_;             // false if the event can't be planned; use ScanEventData() instead
+};
+
+// A view is a struct whose members are copied from event properties of the
+// same name.  Each view provides a static Fields() function that describes its
+// members using EVENT_VIEW_FIELD().
+struct EventViewField {
+    wchar_t const* name_;   // Property name
+    uint32_t viewOffset_;   // Offset of the member in the view
+    uint32_t viewSize_;     // Size of the member in the view
+    bool optional_;         // Whether the property may not be in the event
+};
+
+#define EVENT_VIEW_FIELD(_View, _Member)          { L ## #_Member, (uint32_t) offsetof(_View, _Member), (uint32_t) sizeof(_View::_Member), false }
+#define EVENT_VIEW_OPTIONAL_FIELD(_View, _Member) { L ## #_Member, (uint32_t) offsetof(_View, _Member), (uint32_t) sizeof(_View::_Member), true }
+
+// Where each of a view's properties is located in an event's user data.  The
+// layout is validated against the event metadata for one event version and
+// pointer size, and is FIXED if every property is at a constant offset with a
+// size compatible with its view member.  Otherwise, it is GENERIC and the view
+// is filled using GetEventData().  The layout is validated again if any of the
+// metadata has been replaced since (see EventMetadata::generation_).
+struct EventViewLayout {
+    enum { MAX_FIELD_COUNT = 8 };
+    enum State : uint8_t { UNCHECKED, FIXED, GENERIC };
+
+    State state_ = UNCHECKED;
+    uint8_t version_ = 0;
+    uint8_t pointerSize_ = 0;
+    uint32_t generation_ = 0;
+    uint32_t minUserDataLength_ = 0;
+    uint32_t dataOffset_[MAX_FIELD_COUNT] = {};
+    uint32_t dataSize_[MAX_FIELD_COUNT] = {};   // 0 if an optional property is not in the event
+};
+
+// A flat, open-addressing (linear probing) hash table of each event's
+// TRACE_EVENT_INFO.  The TRACE_EVENT_INFO data is allocated from an arena of
+// large blocks so it never moves once stored (EventDataPlans point into it),
+// and the slot of the last successful lookup is checked first since events
+// of the same kind tend to arrive in bursts.  Entries are never removed.
+struct EventMetadataTable {
+    enum { INITIAL_SLOT_COUNT = 64 };           // Must be a power of two
+    enum { ARENA_BLOCK_SIZE = 64 * 1024 };
+
+    struct Slot {
+        EventMetadataKey key_;
+        TRACE_EVENT_INFO* tei_;                 // nullptr if the slot is empty
+        uint32_t teiSize_;                      // Size of the stored metadata
+        uint32_t teiCapacity_;                  // Size of the storage at tei_
+    };
+
+    std::vector<Slot> slots_;
+    size_t count_ = 0;
+    size_t lastHit_ = SIZE_MAX;                 // Index of the last slot found, or SIZE_MAX
+
+    std::vector<std::unique_ptr<uint8_t[]>> arenaBlocks_;
+    uint8_t* arenaNext_ = nullptr;
+    size_t arenaRemaining_ = 0;
+
+    // Find() returns nullptr if the key is not in the table.  Insert() returns
+    // zero-initialized storage of the requested size for the key's metadata,
+    // replacing any existing entry.
+    TRACE_EVENT_INFO* Find(EventMetadataKey const& key, uint32_t* size=nullptr);
+    TRACE_EVENT_INFO* Insert(EventMetadataKey const& key, uint32_t size, bool* replaced);
+    size_t Size() const { return count_; }
+
+    Slot* FindSlot(EventMetadataKey const& key);
+    void Grow();
+    uint8_t* Allocate(uint32_t size);
+};
+
 struct EventMetadata {
-    std::unordered_map<EventMetadataKey, std::vector<uint8_t>, EventMetadataKeyHash, EventMetadataKeyEqual> metadata_;
+    EventMetadataTable metadata_;
+    std::unordered_map<EventDataPlanKey, EventDataPlan, EventDataPlanKeyHash, EventDataPlanKeyEqual> plans_;
+
+    // Incremented whenever stored metadata is replaced with different
+    // metadata (e.g., by a new EventInfo event part way through an ETL or raw
+    // event stream), so that EventViewLayouts validated against the old
+    // metadata are validated again.
+    uint32_t generation_ = 0;
+
+    void AddMetadata(PMEventRecord* eventRecord);
+    void AddEventInfo(EventMetadataKey const& key, void const* tei, uint32_t size);
+    TRACE_EVENT_INFO const* GetEventInfo(PMEventRecord* eventRecord);
+
+    // GetEventData() looks up (or creates) a plan for the requested properties
+    // and uses it to locate the data.  ScanEventData() searches the metadata
+    // by name on every call; it is the reference implementation that plans are
+    // built from, and is used when a plan can't be created.
+    void GetEventData(PMEventRecord* eventRecord, EventDataDesc* desc, uint32_t descCount, uint32_t optionalCount=0);
+    void ScanEventData(PMEventRecord* eventRecord, EventDataDesc* desc, uint32_t descCount, uint32_t optionalCount=0);
+
+    // GetEventView() fills in a view from the event's properties, copying
+    // directly from the validated fixed offsets in layout when possible.
+    template<typename View> void GetEventView(PMEventRecord* eventRecord, EventViewLayout* layout, View* view)
+    {
+        uint32_t fieldCount = 0;
+        auto fields = View::Fields(&fieldCount);
+
+        auto const& hdr = eventRecord->EventHeader;
+        auto pointerSize = (uint8_t) ((hdr.Flags & EVENT_HEADER_FLAG_64_BIT_HEADER) ? 8 : 4);
+        if (layout->state_ == EventViewLayout::UNCHECKED ||
+            layout->version_ != hdr.EventDescriptor.Version ||
+            layout->pointerSize_ != pointerSize ||
+            layout->generation_ != generation_) {
+            ValidateEventViewLayout(eventRecord, fields, fieldCount, layout);
+        }
+
+        *view = {};
+        if (layout->state_ == EventViewLayout::FIXED && eventRecord->UserDataLength >= layout->minUserDataLength_) {
+            for (uint32_t i = 0; i < fieldCount; ++i) {
+                memcpy((uint8_t*) view + fields[i].viewOffset_,
+                       (uint8_t const*) eventRecord->UserData + layout->dataOffset_[i],
+                       layout->dataSize_[i]);
+            }
+        } else {
+            GetEventViewData(eventRecord, fields, fieldCount, view);
+        }
+    }
 
-    void AddMetadata(EVENT_RECORD* eventRecord);
-    void GetEventData(EVENT_RECORD* eventRecord, EventDataDesc* desc, uint32_t descCount, uint32_t optionalCount=0);
+    void ValidateEventViewLayout(PMEventRecord* eventRecord, EventViewField const* fields, uint32_t fieldCount, EventViewLayout* layout);
+    void GetEventViewData(PMEventRecord* eventRecord, EventViewField const* fields, uint32_t fieldCount, void* view);
 
-    template<typename T> T GetEventData(EVENT_RECORD* eventRecord, wchar_t const* name)
+    template<typename T> T GetEventData(PMEventRecord* eventRecord, wchar_t const* name)
     {
         EventDataDesc desc = { name };
         GetEventData(eventRecord, &desc, 1);
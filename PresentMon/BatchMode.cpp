@@ -0,0 +1,396 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+// Batch mode (--etl_batch) analyzes many ETL files, several at a time.  Each
+// file is analyzed by its own PMTraceConsumer and PMTraceSession, and written
+// to its own CSV next to the ETL.  A worker thread per job takes the next file
+// from the list, runs ProcessTrace() on a separate thread, and outputs the
+// analyzed presents itself, so the number of jobs bounds both the CPU usage
+// and the number of files whose analysis state is in memory at once.
+//
+// Once all the files are analyzed, a summary of each file's results is
+// written to a CSV.
+
+#include "PresentMon.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+namespace {
+
+struct BatchFile {
+    std::wstring mEtlPath;
+    std::wstring mCsvPath;
+    uint64_t mFileSize = 0;
+
+    bool mAnalyzed = false;
+    ULONG mStatus = ERROR_SUCCESS;
+    uint64_t mEventCount = 0;
+    uint64_t mPresentCount = 0;
+    uint64_t mCsvRowCount = 0;
+    uint64_t mDroppedPresentCount = 0;
+    uint64_t mEvictedPresentCount = 0;
+    uint64_t mLostPresentCount = 0;
+    double mAnalysisSeconds = 0.0;
+};
+
+std::atomic<bool> gBatchQuit{ false };
+
+// The sessions that are currently being analyzed, so that the Ctrl handler can
+// stop them.  A session is removed before its worker stops it, so Stop() is
+// never called on a session by both threads.
+std::mutex gActiveSessionsMutex;
+std::vector<PMTraceSession*> gActiveSessions;
+
+std::mutex gPrintMutex;
+
+BOOL CALLBACK HandleBatchCtrlEvent(DWORD ctrlType)
+{
+    (void) ctrlType;
+
+    gBatchQuit = true;
+
+    std::lock_guard<std::mutex> lock(gActiveSessionsMutex);
+    for (auto pmSession : gActiveSessions) {
+        pmSession->Stop();
+    }
+    return TRUE; // The signal was handled, don't call any other handlers
+}
+
+// Trim leading and trailing whitespace (including the newline left by
+// fgetws()).
+std::wstring TrimLine(wchar_t const* line)
+{
+    auto begin = line;
+    while (*begin == L' ' || *begin == L'\t') {
+        ++begin;
+    }
+
+    auto end = begin + wcslen(begin);
+    while (end > begin && (end[-1] == L' ' || end[-1] == L'\t' || end[-1] == L'\r' || end[-1] == L'\n')) {
+        --end;
+    }
+
+    return std::wstring(begin, end);
+}
+
+// --etl_batch is either a directory, in which case every .etl file in it is
+// analyzed, or a text file listing one ETL path per line.  Blank lines and
+// lines starting with '#' are ignored.
+bool GetBatchFileList(wchar_t const* batchPath, std::vector<std::wstring>* etlPaths)
+{
+    auto attributes = GetFileAttributesW(batchPath);
+    if (attributes == INVALID_FILE_ATTRIBUTES) {
+        PrintError(L"error: --etl_batch path not found: %s\n", batchPath);
+        return false;
+    }
+
+    if (attributes & FILE_ATTRIBUTE_DIRECTORY) {
+        std::wstring dir(batchPath);
+        if (!dir.empty() && dir.back() != L'\\' && dir.back() != L'/') {
+            dir += L'\\';
+        }
+
+        WIN32_FIND_DATAW findData = {};
+        auto h = FindFirstFileW((dir + L"*.etl").c_str(), &findData);
+        if (h != INVALID_HANDLE_VALUE) {
+            do {
+                if ((findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0) {
+                    etlPaths->emplace_back(dir + findData.cFileName);
+                }
+            } while (FindNextFileW(h, &findData));
+            FindClose(h);
+        }
+
+        std::sort(etlPaths->begin(), etlPaths->end());
+    } else {
+        FILE* fp = nullptr;
+        if (_wfopen_s(&fp, batchPath, L"r,ccs=UTF-8") != 0) {
+            PrintError(L"error: failed to open --etl_batch file: %s\n", batchPath);
+            return false;
+        }
+
+        wchar_t line[MAX_PATH + 64];
+        while (fgetws(line, _countof(line), fp) != nullptr) {
+            auto path = TrimLine(line);
+            if (!path.empty() && path[0] != L'#') {
+                etlPaths->emplace_back(std::move(path));
+            }
+        }
+
+        fclose(fp);
+    }
+
+    if (etlPaths->empty()) {
+        PrintError(L"error: no ETL files found in --etl_batch: %s\n", batchPath);
+        return false;
+    }
+
+    return true;
+}
+
+void ConsumeBatchFile(TRACEHANDLE traceHandle, std::atomic<bool>* done)
+{
+    SetThreadDescription(GetCurrentThread(), L"PresentMon Batch Consumer Thread");
+
+    // ProcessTrace() returns once the whole file has been delivered, or once
+    // the session is stopped by the Ctrl handler.
+    auto status = ProcessTrace(&traceHandle, 1, NULL, NULL);
+    (void) status;
+
+    *done = true;
+}
+
+void AnalyzeFile(BatchFile* file)
+{
+    auto const& args = GetCommandLineArgs();
+
+    LARGE_INTEGER startTime = {};
+    QueryPerformanceCounter(&startTime);
+
+    PMTraceConsumer pmConsumer;
+    ConfigureConsumer(&pmConsumer);
+
+    PMTraceSession pmSession;
+    pmSession.mPMConsumer = &pmConsumer;
+
+    file->mAnalyzed = true;
+    file->mStatus = pmSession.Start(file->mEtlPath.c_str(), args.mSessionName);
+    if (file->mStatus != ERROR_SUCCESS) {
+        return;
+    }
+
+    // Set deferral time limit to 2 seconds
+    if (pmConsumer.mDeferralTimeLimit == 0) {
+        pmConsumer.mDeferralTimeLimit = pmSession.mTimestampFrequency.QuadPart * 2;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(gActiveSessionsMutex);
+        gActiveSessions.push_back(&pmSession);
+        if (gBatchQuit) {
+            pmSession.Stop();
+        }
+    }
+
+    OutputState state;
+    state.mOutputCsvFileName = file->mCsvPath.c_str();
+    state.mIsRealtime = false;
+
+    std::atomic<bool> done{ false };
+    std::thread consumerThread(ConsumeBatchFile, pmSession.mTraceHandle, &done);
+
+    // Output the presents as they are analyzed.  Read done before dequeuing so
+    // that the events are dequeued at least once after the analysis finished.
+    std::vector<ProcessEvent> processEvents;
+    std::vector<DequeuedPresentPtr> presentEvents;
+    for (;;) {
+        auto finished = done.load();
+
+        UpdateOutput(&state, pmSession, &processEvents, &presentEvents);
+
+        if (finished) {
+            break;
+        }
+
+        pmConsumer.WaitForDequeueableEvents(100);
+    }
+
+    consumerThread.join();
+
+    // If the Ctrl handler stopped the session, the file was only partially
+    // analyzed.
+    bool cancelled = false;
+    {
+        std::lock_guard<std::mutex> lock(gActiveSessionsMutex);
+        gActiveSessions.erase(std::find(gActiveSessions.begin(), gActiveSessions.end(), &pmSession));
+        cancelled = pmSession.mContinueProcessingBuffers == FALSE;
+    }
+
+    pmSession.Stop();
+    CloseOutput(&state);
+
+    LARGE_INTEGER endTime = {};
+    QueryPerformanceCounter(&endTime);
+
+    LARGE_INTEGER frequency = {};
+    QueryPerformanceFrequency(&frequency);
+
+    for (auto count : pmSession.mDispatchCount) {
+        file->mEventCount += count;
+    }
+    file->mStatus = cancelled ? ERROR_CANCELLED : ERROR_SUCCESS;
+    file->mPresentCount = state.mPresentCount;
+    file->mCsvRowCount = state.mCsvRowCount;
+    file->mDroppedPresentCount = pmConsumer.mDroppedPresentCount.load();
+    file->mEvictedPresentCount = pmConsumer.mEvictedPresentCount.load();
+    file->mLostPresentCount = pmConsumer.mLostPresentCount.load();
+    file->mAnalysisSeconds = (double) (endTime.QuadPart - startTime.QuadPart) / (double) frequency.QuadPart;
+}
+
+wchar_t const* GetStatusString(BatchFile const& file)
+{
+    if (!file.mAnalyzed) {
+        return L"Skipped";
+    }
+
+    switch (file.mStatus) {
+    case ERROR_SUCCESS:        return L"OK";
+    case ERROR_CANCELLED:      return L"Cancelled";
+    case ERROR_FILE_NOT_FOUND: return L"FileNotFound";
+    case ERROR_PATH_NOT_FOUND: return L"PathNotFound";
+    case ERROR_ACCESS_DENIED:  return L"AccessDenied";
+    case ERROR_FILE_CORRUPT:   return L"InvalidETL";
+    default:                   return L"Error";
+    }
+}
+
+void BatchWorker(std::vector<BatchFile>* files, std::atomic<size_t>* nextIndex, std::atomic<size_t>* completedCount)
+{
+    SetThreadDescription(GetCurrentThread(), L"PresentMon Batch Thread");
+
+    auto const& args = GetCommandLineArgs();
+
+    while (!gBatchQuit) {
+        auto index = nextIndex->fetch_add(1);
+        if (index >= files->size()) {
+            break;
+        }
+
+        auto file = &(*files)[index];
+        AnalyzeFile(file);
+
+        auto completed = completedCount->fetch_add(1) + 1;
+        if (args.mConsoleOutput != ConsoleOutput::None) {
+            std::lock_guard<std::mutex> lock(gPrintMutex);
+            if (file->mStatus == ERROR_SUCCESS) {
+                wprintf(L"[%zu/%zu] %s: %llu presents (%.1f s)\n", completed, files->size(), file->mEtlPath.c_str(),
+                        file->mPresentCount, file->mAnalysisSeconds);
+            } else {
+                wprintf(L"[%zu/%zu] %s: %s (%lu)\n", completed, files->size(), file->mEtlPath.c_str(),
+                        GetStatusString(*file), file->mStatus);
+            }
+        }
+    }
+}
+
+bool WriteBatchSummary(wchar_t const* path, std::vector<BatchFile> const& files)
+{
+    FILE* fp = nullptr;
+    if (_wfopen_s(&fp, path, L"w,ccs=UTF-8") != 0) {
+        return false;
+    }
+
+    fwprintf(fp, L"File,Status,Events,Presents,CsvRows,DroppedPresents,EvictedPresents,LostPresents,AnalysisSeconds\n");
+    for (auto const& file : files) {
+        fwprintf(fp, L"\"%s\",%s,%llu,%llu,%llu,%llu,%llu,%llu,%.3lf\n",
+                 file.mEtlPath.c_str(),
+                 GetStatusString(file),
+                 file.mEventCount,
+                 file.mPresentCount,
+                 file.mCsvRowCount,
+                 file.mDroppedPresentCount,
+                 file.mEvictedPresentCount,
+                 file.mLostPresentCount,
+                 file.mAnalysisSeconds);
+    }
+
+    fclose(fp);
+    return true;
+}
+
+}
+
+int RunBatchMode()
+{
+    auto const& args = GetCommandLineArgs();
+
+    std::vector<std::wstring> etlPaths;
+    if (!GetBatchFileList(args.mEtlBatchPath, &etlPaths)) {
+        return 2;
+    }
+
+    // Each CSV is written next to its ETL, with the same name.
+    std::vector<BatchFile> files(etlPaths.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+        auto file = &files[i];
+        file->mEtlPath = std::move(etlPaths[i]);
+
+        wchar_t drive[_MAX_DRIVE];
+        wchar_t dir[_MAX_DIR];
+        wchar_t name[_MAX_FNAME];
+        _wsplitpath_s(file->mEtlPath.c_str(), drive, dir, name, nullptr, 0);
+        file->mCsvPath = std::wstring(drive) + dir + name + L".csv";
+
+        WIN32_FILE_ATTRIBUTE_DATA attributes = {};
+        if (GetFileAttributesExW(file->mEtlPath.c_str(), GetFileExInfoStandard, &attributes)) {
+            file->mFileSize = ((uint64_t) attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+        }
+    }
+
+    size_t jobCount = args.mBatchJobs != 0 ? args.mBatchJobs : std::thread::hardware_concurrency();
+    jobCount = std::max<size_t>(1, std::min(jobCount, files.size()));
+
+    if (args.mConsoleOutput != ConsoleOutput::None) {
+        wprintf(L"Analyzing %zu ETL files with %zu jobs...\n", files.size(), jobCount);
+    }
+
+    SetConsoleCtrlHandler(HandleBatchCtrlEvent, TRUE);
+
+    LARGE_INTEGER startTime = {};
+    QueryPerformanceCounter(&startTime);
+
+    std::atomic<size_t> nextIndex{ 0 };
+    std::atomic<size_t> completedCount{ 0 };
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < jobCount; ++i) {
+        workers.emplace_back(BatchWorker, &files, &nextIndex, &completedCount);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    LARGE_INTEGER endTime = {};
+    QueryPerformanceCounter(&endTime);
+
+    SetConsoleCtrlHandler(HandleBatchCtrlEvent, FALSE);
+
+    LARGE_INTEGER frequency = {};
+    QueryPerformanceFrequency(&frequency);
+
+    // Summarize the results.
+    auto summaryPath = args.mOutputCsvFileName != nullptr ? args.mOutputCsvFileName : L"PresentMon-BatchSummary.csv";
+    if (!WriteBatchSummary(summaryPath, files)) {
+        PrintWarning(L"warning: failed to create batch summary file: %s\n", summaryPath);
+    }
+
+    size_t analyzedCount = 0;
+    size_t failedCount = 0;
+    uint64_t eventCount = 0;
+    uint64_t byteCount = 0;
+    for (auto const& file : files) {
+        if (file.mAnalyzed) {
+            analyzedCount += 1;
+            eventCount += file.mEventCount;
+            byteCount += file.mFileSize;
+            if (file.mStatus != ERROR_SUCCESS && file.mStatus != ERROR_CANCELLED) {
+                failedCount += 1;
+            }
+        }
+    }
+
+    if (args.mConsoleOutput != ConsoleOutput::None) {
+        auto seconds = (double) (endTime.QuadPart - startTime.QuadPart) / (double) frequency.QuadPart;
+        auto megabytes = (double) byteCount / (1024.0 * 1024.0);
+        wprintf(L"Analyzed %zu of %zu files (%llu events, %.1f MB) in %.1f s: %.1f MB/s, %.0f events/s\n",
+                analyzedCount, files.size(), eventCount, megabytes, seconds,
+                seconds > 0.0 ? megabytes / seconds : 0.0,
+                seconds > 0.0 ? (double) eventCount / seconds : 0.0);
+    }
+    if (failedCount > 0) {
+        PrintWarning(L"warning: %zu files could not be analyzed; see %s for details.\n", failedCount, summaryPath);
+    }
+
+    return failedCount > 0 ? 6 : 0;
+}
@@ -190,6 +190,21 @@ bool AssignHotkey(wchar_t* key, CommandLineArgs* args)
     return true;
 }
 
+bool AssignRawEventWindow(wchar_t const* window, CommandLineArgs* args)
+{
+    double start = 0.0;
+    double end = 0.0;
+    if (swscanf_s(window, L"%lf,%lf", &start, &end) != 2 || start < 0.0 || end <= start) {
+        PrintError(L"error: invalid --raw_event_window: %s\n", window);
+        return false;
+    }
+
+    args->mRawEventWindowStart = start;
+    args->mRawEventWindowEnd = end;
+    args->mRawEventWindow = true;
+    return true;
+}
+
 // Allow /ARG, -ARG, or --ARG
 bool ParseArgPrefix(wchar_t** arg)
 {
@@ -258,10 +273,13 @@ void PrintUsage()
     // from this formatting.  Test any changes by running Tools\generate\readme\generate.cmd
     wchar_t const* s[] = {
         LR"(--Capture Target Options)", nullptr,
-        LR"(--process_name name)", LR"(Only record processes with the specified exe name. This argument can be repeated to capture multiple processes.)",
-        LR"(--exclude name)",      LR"(Do not record processes with the specified exe name. This argument can be repeated to exclude multiple processes.)",
-        LR"(--process_id id)",     LR"(Only record the process with the specified process ID.)",
-        LR"(--etl_file path)",     LR"(Analyze an ETW trace log file instead of the actively running processes.)",
+        LR"(--process_name name)",          LR"(Only record processes with the specified exe name. This argument can be repeated to capture multiple processes.)",
+        LR"(--exclude name)",               LR"(Do not record processes with the specified exe name. This argument can be repeated to exclude multiple processes.)",
+        LR"(--process_id id)",              LR"(Only record the process with the specified process ID.)",
+        LR"(--etl_file path)",              LR"(Analyze an ETW trace log file instead of the actively running processes.)",
+        LR"(--raw_event_file path)",        LR"(Analyze a PresentMon raw event file instead of the actively running processes.)",
+        LR"(--raw_event_window start,end)", LR"(When using --raw_event_file, only analyze the events between the specified times, in seconds from the start of the recording, e.g., "60,90".)",
+        LR"(--etl_batch path)",             LR"(Analyze many ETW trace log files, several at a time, and exit. 'path' is either a directory containing the .etl files or a text file listing one .etl path per line. Each CSV is written next to its .etl file, and a summary of all the files is written to --output_file (default "PresentMon-BatchSummary.csv").)",
 
         LR"(--Output Options)", nullptr,
         LR"(--output_file path)", LR"(Write CSV output to the specified path.)",
@@ -292,9 +310,16 @@ void PrintUsage()
         LR"(--restart_as_admin)",           LR"(If not running with elevated privilege, restart and request to be run as administrator.)",
         LR"(--terminate_on_proc_exit)",     LR"(Terminate PresentMon when all the target processes have exited.)",
         LR"(--terminate_after_timed)",      LR"(When using --timed, terminate PresentMon after the timed capture completes.)",
+        LR"(--batch_jobs count)",           LR"(When using --etl_batch, the number of files to analyze at the same time. The default is the number of logical processors.)",
+        LR"(--tracked_present_memory MB)",  LR"(The memory that in-progress presents, and completed presents waiting to be processed, can use before the oldest is considered lost or dropped. The default is 16 MB.)",
 
         LR"(--Beta Options)", nullptr,
-        LR"(--track_frame_type)", LR"(Track the type of each displayed frame; requires application and/or driver instrumentation using Intel-PresentMon provider.)",
+        LR"(--track_frame_type)",    LR"(Track the type of each displayed frame; requires application and/or driver instrumentation using Intel-PresentMon provider.)",
+        LR"(--flight_recording path_prefix)", LR"(When a present is lost, and when recording stops, write the most-recent events and present states to "path_prefix-N.pmfr", which can be viewed with pm_flight_decode.)",
+        LR"(--engine_utilization_file path)", LR"(Write how busy each GPU engine type of each adapter was, while recording, to a separate CSV file.)",
+        LR"(--engine_utilization_interval ms)", LR"(When using --engine_utilization_file, the length of each utilization sample.  The default is 100 ms.)",
+        LR"(--gpu_timeline_file path)",     LR"(Write when each GPU packet was enqueued, started, and completed to a binary file, which can be converted to Chrome trace JSON with pm_gpu_timeline.)",
+        LR"(--adaptive_etw_buffers)",       LR"(Grow the realtime trace session's buffers when events are being lost, and flush them more often when the event rate is low.)",
     };
 
     // Layout
@@ -374,12 +399,23 @@ bool ParseCommandLine(int argc, wchar_t** argv)
     args->mExcludeProcessNames.clear();
     args->mOutputCsvFileName = nullptr;
     args->mEtlFileName = nullptr;
+    args->mRawEventFileName = nullptr;
+    args->mEtlBatchPath = nullptr;
+    args->mWriteRawEventFileName = nullptr;
+    args->mFlightRecordingPrefix = nullptr;
+    args->mEngineUtilizationFileName = nullptr;
+    args->mGpuTimelineFileName = nullptr;
     args->mSessionName = L"PresentMon";
     args->mTargetPid = 0;
+    args->mBatchJobs = 0;
+    args->mTrackedPresentMemoryMB = 0;
+    args->mEngineUtilizationIntervalMs = 100;
     args->mDelay = 0;
     args->mTimer = 0;
     args->mHotkeyModifiers = MOD_NOREPEAT;
     args->mHotkeyVirtualKeyCode = 0;
+    args->mRawEventWindowStart = 0.0;
+    args->mRawEventWindowEnd = 0.0;
     args->mConsoleOutput = ConsoleOutput::Statistics;
     args->mTrackDisplay = true;
     args->mTrackInput = true;
@@ -397,6 +433,8 @@ bool ParseCommandLine(int argc, wchar_t** argv)
     args->mMultiCsv = false;
     args->mUseV1Metrics = false;
     args->mStopExistingSession = false;
+    args->mRawEventWindow = false;
+    args->mAdaptiveEtwBuffers = false;
 
     bool sessionNameSet  = false;
     bool csvOutputStdout = false;
@@ -414,10 +452,13 @@ bool ParseCommandLine(int argc, wchar_t** argv)
     // to work.
     for (int i = 1; i < argc; ++i) {
         // Capture target options:
-             if (ParseArg(argv[i], L"process_name")) { if (ParseValue(argv, argc, &i, &args->mTargetProcessNames))  continue; }
-        else if (ParseArg(argv[i], L"exclude"))      { if (ParseValue(argv, argc, &i, &args->mExcludeProcessNames)) continue; }
-        else if (ParseArg(argv[i], L"process_id"))   { if (ParseValue(argv, argc, &i, &args->mTargetPid))           continue; }
-        else if (ParseArg(argv[i], L"etl_file"))     { if (ParseValue(argv, argc, &i, &args->mEtlFileName))         continue; }
+             if (ParseArg(argv[i], L"process_name"))     { if (ParseValue(argv, argc, &i, &args->mTargetProcessNames))                      continue; }
+        else if (ParseArg(argv[i], L"exclude"))          { if (ParseValue(argv, argc, &i, &args->mExcludeProcessNames))                     continue; }
+        else if (ParseArg(argv[i], L"process_id"))       { if (ParseValue(argv, argc, &i, &args->mTargetPid))                               continue; }
+        else if (ParseArg(argv[i], L"etl_file"))         { if (ParseValue(argv, argc, &i, &args->mEtlFileName))                             continue; }
+        else if (ParseArg(argv[i], L"raw_event_file"))   { if (ParseValue(argv, argc, &i, &args->mRawEventFileName))                        continue; }
+        else if (ParseArg(argv[i], L"raw_event_window")) { if (ParseValue(argv, argc, &i) && AssignRawEventWindow(argv[i], args))           continue; }
+        else if (ParseArg(argv[i], L"etl_batch"))        { if (ParseValue(argv, argc, &i, &args->mEtlBatchPath))                            continue; }
 
         // Output options:
         else if (ParseArg(argv[i], L"output_file"))      { if (ParseValue(argv, argc, &i, &args->mOutputCsvFileName)) continue; }
@@ -448,11 +489,19 @@ bool ParseCommandLine(int argc, wchar_t** argv)
         else if (ParseArg(argv[i], L"restart_as_admin"))           { args->mTryToElevate             = true; continue; }
         else if (ParseArg(argv[i], L"terminate_on_proc_exit"))     { args->mTerminateOnProcExit      = true; continue; }
         else if (ParseArg(argv[i], L"terminate_after_timed"))      { args->mTerminateAfterTimer      = true; continue; }
+        else if (ParseArg(argv[i], L"batch_jobs"))                 { if (ParseValue(argv, argc, &i, &args->mBatchJobs)) continue; }
+        else if (ParseArg(argv[i], L"tracked_present_memory"))     { if (ParseValue(argv, argc, &i, &args->mTrackedPresentMemoryMB)) continue; }
 
         // Beta options:
-        else if (ParseArg(argv[i], L"track_frame_type")) { args->mTrackFrameType = true; continue; }
+        else if (ParseArg(argv[i], L"track_frame_type"))   { args->mTrackFrameType    = true; continue; }
+        else if (ParseArg(argv[i], L"flight_recording"))   { if (ParseValue(argv, argc, &i, &args->mFlightRecordingPrefix)) continue; }
+        else if (ParseArg(argv[i], L"engine_utilization_file"))     { if (ParseValue(argv, argc, &i, &args->mEngineUtilizationFileName)) continue; }
+        else if (ParseArg(argv[i], L"engine_utilization_interval")) { if (ParseValue(argv, argc, &i, &args->mEngineUtilizationIntervalMs)) continue; }
+        else if (ParseArg(argv[i], L"gpu_timeline_file"))           { if (ParseValue(argv, argc, &i, &args->mGpuTimelineFileName)) continue; }
+        else if (ParseArg(argv[i], L"adaptive_etw_buffers"))        { args->mAdaptiveEtwBuffers = true; continue; }
 
         // Hidden options:
+        else if (ParseArg(argv[i], L"write_raw_event_file")) { if (ParseValue(argv, argc, &i, &args->mWriteRawEventFileName)) continue; }
         #if PRESENTMON_ENABLE_DEBUG_TRACE
         else if (ParseArg(argv[i], L"debug_verbose_trace")) { verboseTrace = true; continue; }
         #endif
@@ -477,6 +526,66 @@ bool ParseCommandLine(int argc, wchar_t** argv)
         return false;
     }
 
+    // Ensure only one of --etl_file --raw_event_file.
+    if (args->mEtlFileName != nullptr && args->mRawEventFileName != nullptr) {
+        PrintError(L"error: only one of --etl_file and --raw_event_file may be used.\n");
+        PrintUsage();
+        return false;
+    }
+
+    // Ensure --etl_batch isn't used with another capture target.
+    if (args->mEtlBatchPath != nullptr && (args->mEtlFileName != nullptr || args->mRawEventFileName != nullptr)) {
+        PrintError(L"error: --etl_batch cannot be used with --etl_file or --raw_event_file.\n");
+        PrintUsage();
+        return false;
+    }
+
+    // Ignore the options that don't apply to --etl_batch, which always records
+    // everything in each file and then exits.
+    if (args->mEtlBatchPath != nullptr && (csvOutputStdout ||
+                                           args->mHotkeySupport ||
+                                           args->mDelay != 0 ||
+                                           args->mStartTimer ||
+                                           args->mTerminateOnProcExit ||
+                                           args->mTerminateAfterTimer ||
+                                           args->mScrollLockIndicator ||
+                                           args->mWriteRawEventFileName != nullptr ||
+                                           args->mFlightRecordingPrefix != nullptr ||
+                                           args->mEngineUtilizationFileName != nullptr ||
+                                           args->mGpuTimelineFileName != nullptr)) {
+        PrintWarning(L"warning: ignoring options that don't apply to --etl_batch:");
+        if (csvOutputStdout)                         { csvOutputStdout             = false;   PrintWarning(L" --output_stdout"); }
+        if (args->mHotkeySupport)                    { args->mHotkeySupport        = false;   PrintWarning(L" --hotkey"); }
+        if (args->mDelay != 0)                       { args->mDelay                = 0;       PrintWarning(L" --delay"); }
+        if (args->mStartTimer)                       { args->mStartTimer           = false;   PrintWarning(L" --timed"); }
+        if (args->mTerminateOnProcExit)              { args->mTerminateOnProcExit  = false;   PrintWarning(L" --terminate_on_proc_exit"); }
+        if (args->mTerminateAfterTimer)              { args->mTerminateAfterTimer  = false;   PrintWarning(L" --terminate_after_timed"); }
+        if (args->mScrollLockIndicator)              { args->mScrollLockIndicator  = false;   PrintWarning(L" --scroll_indicator"); }
+        if (args->mWriteRawEventFileName != nullptr) { args->mWriteRawEventFileName = nullptr; PrintWarning(L" --write_raw_event_file"); }
+        if (args->mFlightRecordingPrefix != nullptr) { args->mFlightRecordingPrefix = nullptr; PrintWarning(L" --flight_recording"); }
+        if (args->mEngineUtilizationFileName != nullptr) { args->mEngineUtilizationFileName = nullptr; PrintWarning(L" --engine_utilization_file"); }
+        if (args->mGpuTimelineFileName != nullptr) { args->mGpuTimelineFileName = nullptr; PrintWarning(L" --gpu_timeline_file"); }
+        PrintWarning(L"\n");
+    }
+
+    // Ignore --batch_jobs if not using --etl_batch.
+    if (args->mBatchJobs != 0 && args->mEtlBatchPath == nullptr) {
+        PrintWarning(L"warning: ignoring --batch_jobs because --etl_batch is not used.\n");
+        args->mBatchJobs = 0;
+    }
+
+    // Ignore --raw_event_window if not reading a raw event file.
+    if (args->mRawEventWindow && args->mRawEventFileName == nullptr) {
+        PrintWarning(L"warning: ignoring --raw_event_window because --raw_event_file is not used.\n");
+        args->mRawEventWindow = false;
+    }
+
+    // Ignore --adaptive_etw_buffers if not using a realtime trace session.
+    if (args->mAdaptiveEtwBuffers && (args->mEtlFileName != nullptr || args->mRawEventFileName != nullptr || args->mEtlBatchPath != nullptr)) {
+        PrintWarning(L"warning: ignoring --adaptive_etw_buffers because a realtime trace session is not used.\n");
+        args->mAdaptiveEtwBuffers = false;
+    }
+
     // Disallow --hotkey that are known to be already in use:
     // - CTRL+C, CTRL+PAUSE, and CTRL+SCROLLLOCK already used to exit PresentMon
     // - F12 is reserved for debugger use at all times
@@ -531,6 +640,27 @@ bool ParseCommandLine(int argc, wchar_t** argv)
         args->mTrackGPUVideo = false;
     }
 
+    // Ignore --engine_utilization_file if --no_track_gpu used
+    if (args->mEngineUtilizationFileName != nullptr && !args->mTrackGPU) {
+        PrintWarning(L"warning: ignoring --engine_utilization_file due to --no_track_gpu.\n");
+        args->mEngineUtilizationFileName = nullptr;
+    }
+
+    // Ignore --gpu_timeline_file if --no_track_gpu used
+    if (args->mGpuTimelineFileName != nullptr && !args->mTrackGPU) {
+        PrintWarning(L"warning: ignoring --gpu_timeline_file due to --no_track_gpu.\n");
+        args->mGpuTimelineFileName = nullptr;
+    }
+
+    // Ignore --engine_utilization_interval if not using --engine_utilization_file, and
+    // don't allow an empty interval.
+    if (args->mEngineUtilizationFileName == nullptr) {
+        args->mEngineUtilizationIntervalMs = 0;
+    } else if (args->mEngineUtilizationIntervalMs == 0) {
+        PrintWarning(L"warning: --engine_utilization_interval must be at least 1 ms, using 100 ms.\n");
+        args->mEngineUtilizationIntervalMs = 100;
+    }
+
     // Ignore --no_track_display if required for other requested tracking
     if (!args->mTrackDisplay && args->mTrackGPU) {
         PrintWarning(L"warning: ignoring --no_track_display because display tracking is required when GPU tracking is enabled.\n");
@@ -561,6 +691,11 @@ bool ParseCommandLine(int argc, wchar_t** argv)
     }
     #endif
 
+    // --etl_batch reports each file's progress instead of the statistics.
+    if (args->mEtlBatchPath != nullptr && args->mConsoleOutput == ConsoleOutput::Statistics) {
+        args->mConsoleOutput = ConsoleOutput::Simple;
+    }
+
     // Try to initialize the console, and warn if we're not going to be able to
     // do the advanced display as requested.
     if (args->mConsoleOutput == ConsoleOutput::Statistics && !StdOutIsConsole()) {
@@ -38,11 +38,29 @@ static void Consume(TRACEHANDLE traceHandle)
     ExitMainThread();
 }
 
+static void ConsumeRawEvents(PMTraceSession* pmSession, RawEventContainerReader* rawEventReader)
+{
+    SetThreadDescription(GetCurrentThread(), L"PresentMon Consumer Thread");
+
+    // ProcessRawEventStream() returns once all the events have been processed,
+    // or when MainThread stops the session.
+    if (!pmSession->ProcessRawEventStream(rawEventReader)) {
+        PrintError(L"error: invalid --raw_event_file.\n");
+    }
+
+    ExitMainThread();
+}
+
 void StartConsumerThread(TRACEHANDLE traceHandle)
 {
     gThread = std::thread(Consume, traceHandle);
 }
 
+void StartConsumerThread(PMTraceSession* pmSession, RawEventContainerReader* rawEventReader)
+{
+    gThread = std::thread(ConsumeRawEvents, pmSession, rawEventReader);
+}
+
 void WaitForConsumerThreadToExit()
 {
     if (gThread.joinable()) {
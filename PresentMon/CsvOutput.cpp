@@ -3,12 +3,9 @@
 
 #include "PresentMon.hpp"
 
-static FILE* gGlobalOutputCsv = nullptr;
-static uint32_t gRecordingCount = 1;
-
-void IncrementRecordingCount()
+void IncrementRecordingCount(OutputState* state)
 {
-    gRecordingCount += 1;
+    state->mRecordingCount += 1;
 }
 
 const char* PresentModeToString(PresentMode mode)
@@ -75,7 +72,7 @@ with `-INDEX` appended to the file name.
 If `-include_mixed_reality` is used, a second CSV file will be generated with
 `_WMR` appended to the filename containing the WMR data.
 */
-static void GenerateFilename(wchar_t* path, std::wstring const& processName, uint32_t processId)
+static void GenerateFilename(OutputState const* state, wchar_t* path, std::wstring const& processName, uint32_t processId)
 {
     auto const& args = GetCommandLineArgs();
 
@@ -90,11 +87,11 @@ static void GenerateFilename(wchar_t* path, std::wstring const& processName, uin
     } while (0)
 
     // Generate base filename.
-    if (args.mOutputCsvFileName) {
+    if (state->mOutputCsvFileName) {
         wchar_t drive[_MAX_DRIVE];
         wchar_t dir[_MAX_DIR];
         wchar_t name[_MAX_FNAME];
-        _wsplitpath_s(args.mOutputCsvFileName, drive, dir, name, ext);
+        _wsplitpath_s(state->mOutputCsvFileName, drive, dir, name, ext);
         ADD_TO_PATH(L"%s%s%s", drive, dir, name);
     } else {
         struct tm tm;
@@ -114,7 +111,7 @@ static void GenerateFilename(wchar_t* path, std::wstring const& processName, uin
 
     // Append -INDEX if applicable.
     if (args.mHotkeySupport) {
-        ADD_TO_PATH(L"-%d", gRecordingCount);
+        ADD_TO_PATH(L"-%d", state->mRecordingCount);
     }
 
     // Append extension.
@@ -365,6 +362,7 @@ void WriteCsvRow<FrameMetrics>(
 
 template<typename FrameMetricsT>
 void UpdateCsvT(
+    OutputState* state,
     PMTraceSession const& pmSession,
     ProcessInfo* processInfo,
     PresentEvent const& p,
@@ -386,12 +384,12 @@ void UpdateCsvT(
     // Get/create file
     FILE** fp = args.mMultiCsv
         ? &processInfo->mOutputCsv
-        : &gGlobalOutputCsv;
+        : &state->mGlobalOutputCsv;
 
     if (*fp == nullptr) {
         if (args.mCSVOutput == CSVOutput::File) {
             wchar_t path[MAX_PATH];
-            GenerateFilename(path, processInfo->mModuleName, p.ProcessId);
+            GenerateFilename(state, path, processInfo->mModuleName, p.ProcessId);
             if (_wfopen_s(fp, path, L"w,ccs=UTF-8")) {
                 return;
             }
@@ -404,16 +402,73 @@ void UpdateCsvT(
 
     // Output in CSV format
     WriteCsvRow(*fp, pmSession, *processInfo, p, metrics);
+    state->mCsvRowCount += 1;
+}
+
+void UpdateCsv(OutputState* state, PMTraceSession const& pmSession, ProcessInfo* processInfo, PresentEvent const& p, FrameMetrics1 const& metrics)
+{
+    UpdateCsvT(state, pmSession, processInfo, p, metrics);
 }
 
-void UpdateCsv(PMTraceSession const& pmSession, ProcessInfo* processInfo, PresentEvent const& p, FrameMetrics1 const& metrics)
+void UpdateCsv(OutputState* state, PMTraceSession const& pmSession, ProcessInfo* processInfo, PresentEvent const& p, FrameMetrics const& metrics)
 {
-    UpdateCsvT(pmSession, processInfo, p, metrics);
+    UpdateCsvT(state, pmSession, processInfo, p, metrics);
 }
 
-void UpdateCsv(PMTraceSession const& pmSession, ProcessInfo* processInfo, PresentEvent const& p, FrameMetrics const& metrics)
+// The engine utilization CSV has one row per engine type, per adapter, per
+// --engine_utilization_interval while recording.
+void UpdateEngineUtilizationCsv(OutputState* state, PMTraceSession const& pmSession, EngineUtilizationSample const& sample)
 {
-    UpdateCsvT(pmSession, processInfo, p, metrics);
+    auto const& args = GetCommandLineArgs();
+
+    if (state->mEngineUtilizationCsv == nullptr) {
+        if (_wfopen_s(&state->mEngineUtilizationCsv, args.mEngineUtilizationFileName, L"w,ccs=UTF-8")) {
+            state->mEngineUtilizationCsv = nullptr;
+            return;
+        }
+
+        fwprintf(state->mEngineUtilizationCsv, L"Adapter"
+                                               L",Engine");
+        switch (args.mTimeUnit) {
+        case TimeUnit::MilliSeconds:    fwprintf(state->mEngineUtilizationCsv, L",StartTime"); break;
+        case TimeUnit::QPC:             fwprintf(state->mEngineUtilizationCsv, L",StartQPC"); break;
+        case TimeUnit::QPCMilliSeconds: fwprintf(state->mEngineUtilizationCsv, L",StartQPCTime"); break;
+        case TimeUnit::DateTime:        fwprintf(state->mEngineUtilizationCsv, L",StartDateTime"); break;
+        }
+        fwprintf(state->mEngineUtilizationCsv, L",Duration"
+                                               L",BusyTime"
+                                               L",Utilization\n");
+    }
+
+    auto fp = state->mEngineUtilizationCsv;
+    fwprintf(fp, L"0x%016llX,%s", sample.pDxgAdapter,
+                                  PMTraceConsumer::GetEngineTypeName(sample.EngineType));
+    switch (args.mTimeUnit) {
+    case TimeUnit::MilliSeconds:
+        fwprintf(fp, L",%.4lf", pmSession.TimestampToMilliSeconds(sample.StartTime));
+        break;
+    case TimeUnit::QPC:
+        fwprintf(fp, L",%llu", sample.StartTime);
+        break;
+    case TimeUnit::QPCMilliSeconds:
+        fwprintf(fp, L",%.4lf", pmSession.TimestampDeltaToMilliSeconds(sample.StartTime));
+        break;
+    case TimeUnit::DateTime: {
+        SYSTEMTIME st = {};
+        uint64_t ns = 0;
+        pmSession.TimestampToLocalSystemTime(sample.StartTime, &st, &ns);
+        fwprintf(fp, L",%u-%u-%u %u:%02u:%02u.%09llu", st.wYear,
+                                                       st.wMonth,
+                                                       st.wDay,
+                                                       st.wHour,
+                                                       st.wMinute,
+                                                       st.wSecond,
+                                                       ns);
+    }   break;
+    }
+    fwprintf(fp, L",%.4lf,%.4lf,%.2lf\n", pmSession.TimestampDeltaToMilliSeconds(sample.Duration),
+                                          pmSession.TimestampDeltaToMilliSeconds(sample.BusyTime),
+                                          100.0 * (double) sample.BusyTime / (double) sample.Duration);
 }
 
 static void CloseCsv(FILE** fp)
@@ -431,8 +486,12 @@ void CloseMultiCsv(ProcessInfo* processInfo)
     CloseCsv(&processInfo->mOutputCsv);
 }
 
-void CloseGlobalCsv()
+void CloseGlobalCsv(OutputState* state)
 {
-    CloseCsv(&gGlobalOutputCsv);
+    CloseCsv(&state->mGlobalOutputCsv);
 }
 
+void CloseEngineUtilizationCsv(OutputState* state)
+{
+    CloseCsv(&state->mEngineUtilizationCsv);
+}
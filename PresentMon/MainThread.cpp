@@ -9,11 +9,17 @@ enum {
     // Timer ID's must be non-zero
     DELAY_TIMER_ID = 1,
     TIMED_TIMER_ID = 2,
+    ETW_BUFFER_TIMER_ID = 3,
+
+    ETW_BUFFER_SAMPLE_MS = 1000,
 };
 
 static HWND gWnd = NULL;
 static bool gIsRecording = false;
 static uint32_t gHotkeyIgnoreCount = 0;
+static PMTraceSession* gPMSession = nullptr;
+static PMTraceConsumer* gFlightRecordingConsumer = nullptr;
+static EtwBufferPolicy gEtwBufferPolicy;
 
 static bool EnableScrollLock(bool enable)
 {
@@ -96,6 +102,12 @@ static void StopRecording()
     // Tell OutputThread to stop recording
     SetOutputRecordingState(false);
 
+    // Have the consumer thread write a flight recording of the events leading
+    // up to the stop.  This may be called from the Ctrl handler's thread.
+    if (gFlightRecordingConsumer != nullptr) {
+        gFlightRecordingConsumer->RequestFlightRecording();
+    }
+
     // Notify the user we're no longer recording
     if (args.mScrollLockIndicator) {
         EnableScrollLock(false);
@@ -105,6 +117,23 @@ static void StopRecording()
     }
 }
 
+// Sample the realtime trace session and apply any buffer settings that
+// --adaptive_etw_buffers recommends.  Settings that need the session to be
+// restarted are only reported when PresentMon exits, since restarting the
+// session would lose events.
+static void UpdateEtwBufferSettings()
+{
+    EtwSessionSample sample = {};
+    if (gPMSession->QueryBufferStats(nullptr, &sample) &&
+        gEtwBufferPolicy.Update(sample) != EtwBufferPolicy::ACTION_NONE) {
+        auto status = gPMSession->UpdateBufferSettings(gEtwBufferPolicy.Settings());
+        if (status != ERROR_SUCCESS) {
+            PrintWarning(L"warning: failed to update the trace session's buffer settings: error code %lu.\n", status);
+            KillTimer(gWnd, ETW_BUFFER_TIMER_ID);
+        }
+    }
+}
+
 // Handle Ctrl events (CTRL_C_EVENT, CTRL_BREAK_EVENT, CTRL_CLOSE_EVENT,
 // CTRL_LOGOFF_EVENT, CTRL_SHUTDOWN_EVENT) by redirecting the termination into
 // a WM_QUIT message so that the shutdown code is still executed.
@@ -144,6 +173,10 @@ static LRESULT CALLBACK HandleWindowMessage(HWND hWnd, UINT uMsg, WPARAM wParam,
                 ExitMainThread();
             }
             return 0;
+
+        case ETW_BUFFER_TIMER_ID:
+            UpdateEtwBufferSettings();
+            return 0;
         }
         break;
 
@@ -166,11 +199,62 @@ static LRESULT CALLBACK HandleWindowMessage(HWND hWnd, UINT uMsg, WPARAM wParam,
     return DefWindowProc(hWnd, uMsg, wParam, lParam);
 }
 
+static ULONG OpenRawEventFile(CommandLineArgs const& args, PMTraceSession* pmSession, RawEventContainerReader* rawEventReader)
+{
+    FILE* fp = nullptr;
+    if (_wfopen_s(&fp, args.mRawEventFileName, L"rb") != 0) {
+        return ERROR_FILE_NOT_FOUND;
+    }
+    if (!rawEventReader->Open(fp)) {
+        return ERROR_FILE_CORRUPT;
+    }
+
+    pmSession->StartRawEventStream(rawEventReader->header_);
+
+    if (args.mRawEventWindow) {
+        auto frequency = (double) pmSession->mTimestampFrequency.QuadPart;
+        auto start = (uint64_t) pmSession->mStartTimestamp.QuadPart;
+        rawEventReader->SetTimeWindow(start + (uint64_t) (args.mRawEventWindowStart * frequency),
+                                      start + (uint64_t) (args.mRawEventWindowEnd   * frequency));
+    }
+
+    return ERROR_SUCCESS;
+}
+
 void ExitMainThread()
 {
     PostMessage(gWnd, WM_QUIT, 0, 0);
 }
 
+// Configure an event consumer according to the command line arguments.
+void ConfigureConsumer(PMTraceConsumer* pmConsumer)
+{
+    auto const& args = GetCommandLineArgs();
+
+    pmConsumer->mTrackDisplay   = args.mTrackDisplay;
+    pmConsumer->mTrackGPU       = args.mTrackGPU;
+    pmConsumer->mTrackGPUVideo  = args.mTrackGPUVideo;
+    pmConsumer->mTrackInput     = args.mTrackInput;
+    pmConsumer->mTrackFrameType = args.mTrackFrameType;
+
+    if (args.mTrackedPresentMemoryMB != 0) {
+        pmConsumer->mTrackedPresentMemoryLimit = args.mTrackedPresentMemoryMB * 1024ull * 1024ull;
+    }
+
+    // The engine utilization interval is set here so that the session enables the events it
+    // needs, and converted again once the session's timestamp frequency is known.
+    if (args.mEngineUtilizationIntervalMs != 0) {
+        LARGE_INTEGER frequency = {};
+        QueryPerformanceFrequency(&frequency);
+        pmConsumer->mEngineUtilizationInterval = std::max<uint64_t>(1, (uint64_t) frequency.QuadPart * args.mEngineUtilizationIntervalMs / 1000ull);
+    }
+
+    if (args.mTargetPid != 0) {
+        pmConsumer->mFilteredProcessIds = true;
+        pmConsumer->AddTrackedProcessForFiltering(args.mTargetPid);
+    }
+}
+
 int wmain(int argc, wchar_t** argv)
 {
     // Load system DLLs
@@ -201,6 +285,14 @@ int wmain(int argc, wchar_t** argv)
         return 7;
     }
 
+    // --etl_batch analyzes the files and exits, without any of the realtime
+    // or recording control.
+    if (args.mEtlBatchPath != nullptr) {
+        auto ret = RunBatchMode();
+        FinalizeConsole();
+        return ret;
+    }
+
     // Attempt to elevate process privilege if necessary.
     //
     // If we are processing an ETL file we don't need elevated privilege, but
@@ -212,8 +304,9 @@ int wmain(int argc, wchar_t** argv)
     // 
     // RestartAsAdministrator() waits for the elevated process to complete in
     // order to report stderr and obtain it's exit code.
-    if (args.mEtlFileName == nullptr && // realtime analysis
-        !EnableDebugPrivilege()) {      // failed to enable SeDebugPrivilege
+    if (args.mEtlFileName == nullptr &&      // realtime analysis
+        args.mRawEventFileName == nullptr &&
+        !EnableDebugPrivilege()) {           // failed to enable SeDebugPrivilege
         if (args.mTryToElevate) {
             return RestartAsAdministrator(argc, argv);
         }
@@ -254,21 +347,15 @@ int wmain(int argc, wchar_t** argv)
 
     // Create event consumers
     PMTraceConsumer pmConsumer;
-    pmConsumer.mTrackDisplay   = args.mTrackDisplay;
-    pmConsumer.mTrackGPU       = args.mTrackGPU;
-    pmConsumer.mTrackGPUVideo  = args.mTrackGPUVideo;
-    pmConsumer.mTrackInput     = args.mTrackInput;
-    pmConsumer.mTrackFrameType = args.mTrackFrameType;
-
-    if (args.mTargetPid != 0) {
-        pmConsumer.mFilteredProcessIds = true;
-        pmConsumer.AddTrackedProcessForFiltering(args.mTargetPid);
-    }
+    ConfigureConsumer(&pmConsumer);
 
-    // Start the ETW trace session.
+    // Start the ETW trace session, or open the raw event file.
     PMTraceSession pmSession;
     pmSession.mPMConsumer = &pmConsumer;
-    auto status = pmSession.Start(args.mEtlFileName, args.mSessionName);
+    RawEventContainerReader rawEventReader;
+    auto status = args.mRawEventFileName != nullptr
+        ? OpenRawEventFile(args, &pmSession, &rawEventReader)
+        : pmSession.Start(args.mEtlFileName, args.mSessionName);
 
     // If a session with this same name is already running, we either exit or
     // stop it and start a new session.  This is useful if a previous process
@@ -306,7 +393,7 @@ int wmain(int argc, wchar_t** argv)
         case ERROR_PATH_NOT_FOUND: PrintError(L"path not found.\n"); break;
         case ERROR_BAD_PATHNAME:   PrintError(L"invalid --session_name.\n"); break;
         case ERROR_ACCESS_DENIED:  PrintError(L"access denied.\n"); break;
-        case ERROR_FILE_CORRUPT:   PrintError(L"invalid --etl_file.\n"); break;
+        case ERROR_FILE_CORRUPT:   PrintError(args.mRawEventFileName != nullptr ? L"invalid --raw_event_file.\n" : L"invalid --etl_file.\n"); break;
         default:                   PrintError(L"error code %lu.\n", status); break;
         }
 
@@ -327,10 +414,69 @@ int wmain(int argc, wchar_t** argv)
         pmConsumer.mDeferralTimeLimit = pmSession.mTimestampFrequency.QuadPart * 2;
     }
 
+    if (args.mEngineUtilizationIntervalMs != 0) {
+        pmConsumer.mEngineUtilizationInterval = std::max<uint64_t>(1, (uint64_t) pmSession.mTimestampFrequency.QuadPart * args.mEngineUtilizationIntervalMs / 1000ull);
+    }
+
+    // If requested, record the handled events to a raw event file.  When
+    // analyzing an ETL, the start timestamp isn't known until the first event
+    // so it is left as 0.
+    RawEventStreamWriter rawEventWriter;
+    if (args.mWriteRawEventFileName != nullptr) {
+        RawEventStreamHeader header = {};
+        header.timestampFrequency_ = (uint64_t) pmSession.mTimestampFrequency.QuadPart;
+        header.startTimestamp_ = (uint64_t) pmSession.mStartTimestamp.QuadPart;
+        header.startFileTime_ = pmSession.mStartFileTime;
+        header.timestampType_ = (uint32_t) pmSession.mTimestampType;
+
+        FILE* fp = nullptr;
+        if (_wfopen_s(&fp, args.mWriteRawEventFileName, L"wb") == 0 && rawEventWriter.OpenContainer(fp, header)) {
+            pmSession.mRawEventStreamWriter = &rawEventWriter;
+        } else {
+            if (fp != nullptr) {
+                rawEventWriter.Close();
+            }
+            PrintWarning(L"warning: failed to create raw event file: %s\n", args.mWriteRawEventFileName);
+        }
+    }
+
+    // If requested, record the GPU packet timeline.  As above, the start
+    // timestamp is 0 when analyzing an ETL.
+    GpuTimelineWriter gpuTimelineWriter;
+    if (args.mGpuTimelineFileName != nullptr) {
+        FILE* fp = nullptr;
+        if (_wfopen_s(&fp, args.mGpuTimelineFileName, L"wb") == 0 &&
+            gpuTimelineWriter.Open(fp, (uint64_t) pmSession.mStartTimestamp.QuadPart, (uint64_t) pmSession.mTimestampFrequency.QuadPart)) {
+            pmConsumer.mGpuTimelineWriter = &gpuTimelineWriter;
+        } else {
+            PrintWarning(L"warning: failed to create GPU timeline file: %s\n", args.mGpuTimelineFileName);
+        }
+    }
+
+    // If requested, write flight recordings when presents are lost and when
+    // recording stops.
+    FlightRecordingWriter flightRecordingWriter;
+    if (args.mFlightRecordingPrefix != nullptr) {
+        flightRecordingWriter.Start(args.mFlightRecordingPrefix);
+        pmConsumer.mFlightRecordingWriter = &flightRecordingWriter;
+        gFlightRecordingConsumer = &pmConsumer;
+    }
+
     // Start the consumer and output threads
-    StartConsumerThread(pmSession.mTraceHandle);
+    if (args.mRawEventFileName != nullptr) {
+        StartConsumerThread(&pmSession, &rawEventReader);
+    } else {
+        StartConsumerThread(pmSession.mTraceHandle);
+    }
     StartOutputThread(pmSession);
 
+    // If requested, start adapting the realtime session's buffer settings.
+    if (args.mAdaptiveEtwBuffers) {
+        gPMSession = &pmSession;
+        gEtwBufferPolicy.Reset(pmSession.mBufferSettings, (uint64_t) pmSession.mTimestampFrequency.QuadPart);
+        SetTimer(gWnd, ETW_BUFFER_TIMER_ID, ETW_BUFFER_SAMPLE_MS, (TIMERPROC) nullptr);
+    }
+
     // If the user wants to use the scroll lock key as an indicator of when
     // PresentMon is recording events, save the original state and set scroll
     // lock to the recording state.
@@ -366,6 +512,11 @@ int wmain(int argc, wchar_t** argv)
         EnableScrollLock(originalScrollLockEnabled);
     }
 
+    if (gPMSession != nullptr) {
+        KillTimer(gWnd, ETW_BUFFER_TIMER_ID);
+        gPMSession = nullptr;
+    }
+
     pmSession.Stop();
 
     // Wait for the consumer and output threads to end (which are using the
@@ -373,6 +524,35 @@ int wmain(int argc, wchar_t** argv)
     WaitForConsumerThreadToExit();
     StopOutputThread();
 
+    if (pmSession.mRawEventStreamWriter != nullptr) {
+        pmSession.mRawEventStreamWriter = nullptr;
+        rawEventWriter.Close();
+        if (rawEventWriter.error_) {
+            PrintWarning(L"warning: failed to write raw event file: %s\n", args.mWriteRawEventFileName);
+        }
+    }
+
+    // A recording requested after the consumer thread handled its last event
+    // (e.g., by Ctrl+C) is written once the previous one is finished.
+    if (pmConsumer.mFlightRecordingWriter != nullptr) {
+        gFlightRecordingConsumer = nullptr;
+        flightRecordingWriter.Flush();
+        pmConsumer.ServiceFlightRecordingRequest();
+        pmConsumer.mFlightRecordingWriter = nullptr;
+        flightRecordingWriter.Stop();
+    }
+
+    if (pmConsumer.mGpuTimelineWriter != nullptr) {
+        pmConsumer.mGpuTimelineWriter = nullptr;
+        gpuTimelineWriter.Close();
+        if (gpuTimelineWriter.HasWriteError()) {
+            PrintWarning(L"warning: failed to write GPU timeline file: %s\n", args.mGpuTimelineFileName);
+        } else if (gpuTimelineWriter.DroppedRecordCount() > 0) {
+            PrintWarning(L"warning: %llu GPU timeline records were dropped because they couldn't be written fast enough.\n",
+                         gpuTimelineWriter.DroppedRecordCount());
+        }
+    }
+
     // Output warning if events were lost.
     if (pmSession.mNumBuffersLost > 0) {
         PrintWarning(L"warning: %lu ETW buffers were lost.\n", pmSession.mNumBuffersLost);
@@ -380,6 +560,34 @@ int wmain(int argc, wchar_t** argv)
     if (pmSession.mNumEventsLost > 0) {
         PrintWarning(L"warning: %lu ETW events were lost.\n", pmSession.mNumEventsLost);
     }
+    if (args.mAdaptiveEtwBuffers && gEtwBufferPolicy.ChangeCount() > 0) {
+        auto const& settings = gEtwBufferPolicy.Settings();
+        auto const& restartSettings = gEtwBufferPolicy.RestartSettings();
+        PrintWarning(L"warning: the trace session's buffer settings were changed %u times, to %u buffers and a %u ms flush timer.\n",
+                     gEtwBufferPolicy.ChangeCount(), settings.maximumBuffers_, settings.flushTimerMs_);
+        if (restartSettings.bufferSizeKB_ != settings.bufferSizeKB_) {
+            PrintWarning(L"         More buffers were needed than are allowed; %u KB buffers are recommended.\n",
+                         restartSettings.bufferSizeKB_);
+        }
+    }
+    if (pmConsumer.mDroppedProcessEventCount > 0) {
+        PrintWarning(L"warning: %llu process events were dropped before they could be processed.\n", pmConsumer.mDroppedProcessEventCount.load());
+    }
+    if (pmConsumer.mDroppedEngineUtilizationSampleCount > 0) {
+        PrintWarning(L"warning: %llu engine utilization samples were dropped before they could be processed.\n", pmConsumer.mDroppedEngineUtilizationSampleCount.load());
+    }
+    if (pmConsumer.mEvictedPresentCount > 0) {
+        PrintWarning(L"warning: %llu in-progress presents were considered lost because too many presents were in progress (see --tracked_present_memory).\n", pmConsumer.mEvictedPresentCount.load());
+    }
+    if (pmConsumer.mDroppedPresentCount > 0) {
+        PrintWarning(L"warning: %llu presents were dropped because too many completed presents were waiting to be processed (see --tracked_present_memory).\n", pmConsumer.mDroppedPresentCount.load());
+    }
+    if (flightRecordingWriter.WrittenCount() > 0) {
+        PrintWarning(L"warning: %u flight recordings were written to %s-N.pmfr.\n", flightRecordingWriter.WrittenCount(), args.mFlightRecordingPrefix);
+    }
+    if (flightRecordingWriter.FailedCount() > 0) {
+        PrintWarning(L"warning: failed to write %u flight recordings to %s-N.pmfr.\n", flightRecordingWriter.FailedCount(), args.mFlightRecordingPrefix);
+    }
 
     /* We cannot remove the Ctrl handler because it is in an infinite sleep so
      * this call will never return, either hanging the application or having
@@ -37,10 +37,10 @@ void SetOutputRecordingState(bool record)
     if (gIsRecording != record) {
         gIsRecording = record;
 
-        // When capturing from an ETL file, just use the current recording state.
-        // It's not clear how best to map realtime to ETL QPC time, and there
-        // aren't any realtime cues in this case.
-        if (args.mEtlFileName == nullptr) {
+        // When capturing from an ETL or raw event file, just use the current
+        // recording state.  It's not clear how best to map realtime to ETL QPC
+        // time, and there aren't any realtime cues in this case.
+        if (args.mEtlFileName == nullptr && args.mRawEventFileName == nullptr) {
             uint64_t qpc = 0;
             QueryPerformanceCounter((LARGE_INTEGER*) &qpc);
             gRecordingToggleHistory.emplace_back(qpc);
@@ -76,9 +76,9 @@ static bool CopyRecordingToggleHistory(std::vector<uint64_t>* recordingToggleHis
 // whenever we notice an event with a new process id.  If it's a target
 // process, we obtain a handle to the process, and periodically check it to see
 // if it has exited.
-
-static std::unordered_map<uint32_t, ProcessInfo> gProcesses;
-static uint32_t gTargetProcessCount = 0;
+//
+// The active processes are tracked in an OutputState, along with the rest of
+// the capture's output state.
 
 // Removes any directory and extension, and converts the remaining name to
 // lower case.
@@ -134,6 +134,7 @@ static bool IsTargetProcess(uint32_t processId, std::wstring const& processName)
 }
 
 static void HandleTerminatedProcess(
+    OutputState* state,
     ProcessInfo* processInfo)
 {
     auto const& args = GetCommandLineArgs();
@@ -143,22 +144,23 @@ static void HandleTerminatedProcess(
         CloseMultiCsv(processInfo);
 
         // Quit if this is the last process tracked for --terminate_on_proc_exit.
-        gTargetProcessCount -= 1;
-        if (args.mTerminateOnProcExit && gTargetProcessCount == 0) {
+        state->mTargetProcessCount -= 1;
+        if (args.mTerminateOnProcExit && state->mTargetProcessCount == 0) {
             ExitMainThread();
         }
     }
 }
 
 static void ProcessProcessEvent(
+    OutputState* state,
     ProcessEvent const& processEvent)
 {
     if (processEvent.IsStartEvent) {
-        auto pr = gProcesses.emplace(processEvent.ProcessId, ProcessInfo{});
+        auto pr = state->mProcesses.emplace(processEvent.ProcessId, ProcessInfo{});
         auto info = &pr.first->second;
 
         if (!pr.second) {
-            HandleTerminatedProcess(info);
+            HandleTerminatedProcess(state, info);
         }
 
         info->mHandle          = NULL;
@@ -167,18 +169,19 @@ static void ProcessProcessEvent(
         info->mIsTargetProcess = IsTargetProcess(processEvent.ProcessId, processEvent.ImageFileName);
 
         if (info->mIsTargetProcess) {
-            gTargetProcessCount += 1;
+            state->mTargetProcessCount += 1;
         }
     } else {
-        auto ii = gProcesses.find(processEvent.ProcessId);
-        if (ii != gProcesses.end()) {
-            HandleTerminatedProcess(&ii->second);
-            gProcesses.erase(std::move(ii));
+        auto ii = state->mProcesses.find(processEvent.ProcessId);
+        if (ii != state->mProcesses.end()) {
+            HandleTerminatedProcess(state, &ii->second);
+            state->mProcesses.erase(std::move(ii));
         }
     }
 }
 
 static void UpdateProcessEvents(
+    OutputState* state,
     PMTraceConsumer* pmConsumer,
     std::vector<ProcessEvent>* processEvents)
 {
@@ -198,7 +201,7 @@ static void UpdateProcessEvents(
     // We assume that the process terminated now, which is wrong but conservative and functionally
     // ok because no other process should start with the same PID as long as we're still holding a
     // handle to it.
-    for (auto& pair : gProcesses) {
+    for (auto& pair : state->mProcesses) {
         auto processId = pair.first;
         auto processInfo = &pair.second;
 
@@ -235,7 +238,7 @@ static void UpdateAverage(float* avg, double value)
 
 static void UpdateChain(
     SwapChainData* chain,
-    std::shared_ptr<PresentEvent> const& p)
+    DequeuedPresentPtr const& p)
 {
     if (p->FinalState == PresentResult::Presented) {
         if (chain->mLastPresent != nullptr) {
@@ -249,10 +252,11 @@ static void UpdateChain(
 }
 
 static void ReportMetrics1(
+    OutputState* state,
     PMTraceSession const& pmSession,
     ProcessInfo* processInfo,
     SwapChainData* chain,
-    std::shared_ptr<PresentEvent> const& p,
+    DequeuedPresentPtr const& p,
     bool isRecording,
     bool computeAvg)
 {
@@ -270,7 +274,7 @@ static void ReportMetrics1(
     metrics.msSinceInput           = p->InputTime == 0 ? 0 : pmSession.TimestampDeltaToMilliSeconds(p->PresentStartTime - p->InputTime);
 
     if (isRecording) {
-        UpdateCsv(pmSession, processInfo, *p, metrics);
+        UpdateCsv(state, pmSession, processInfo, *p, metrics);
     }
 
     if (computeAvg) {
@@ -288,11 +292,12 @@ static void ReportMetrics1(
 }
 
 static void ReportMetrics(
+    OutputState* state,
     PMTraceSession const& pmSession,
     ProcessInfo* processInfo,
     SwapChainData* chain,
-    std::shared_ptr<PresentEvent> const& p,
-    std::shared_ptr<PresentEvent> const& nextPresent,
+    DequeuedPresentPtr const& p,
+    DequeuedPresentPtr const& nextPresent,
     PresentEvent const* nextDisplayedPresent,
     bool isRecording,
     bool computeAvg)
@@ -366,7 +371,7 @@ static void ReportMetrics(
     }
 
     if (isRecording) {
-        UpdateCsv(pmSession, processInfo, *p, metrics);
+        UpdateCsv(state, pmSession, processInfo, *p, metrics);
     }
 
     if (computeAvg) {
@@ -390,12 +395,13 @@ static void ReportMetrics(
 }
 
 static void PruneOldSwapChainData(
+    OutputState* state,
     PMTraceSession const& pmSession,
     uint64_t latestTimestamp)
 {
     auto minTimestamp = latestTimestamp - pmSession.MilliSecondsDeltaToTimestamp(4000.0);
 
-    for (auto& pair : gProcesses) {
+    for (auto& pair : state->mProcesses) {
         auto processInfo = &pair.second;
         for (auto ii = processInfo->mSwapChain.begin(), ie = processInfo->mSwapChain.end(); ii != ie; ) {
             auto chain = &ii->second;
@@ -408,15 +414,13 @@ static void PruneOldSwapChainData(
     }
 }
 
-static void QueryProcessName(uint32_t processId, ProcessInfo* info)
+static void QueryProcessName(OutputState const* state, uint32_t processId, ProcessInfo* info)
 {
-    auto const& args = GetCommandLineArgs();
-
     wchar_t path[MAX_PATH];
     wchar_t* processName = L"<unknown>";
     HANDLE handle = NULL;
 
-    if (args.mEtlFileName == nullptr) {
+    if (state->mIsRealtime) {
         handle = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processId);
         if (handle != NULL) {
             DWORD numChars = _countof(path);
@@ -436,15 +440,16 @@ static void QueryProcessName(uint32_t processId, ProcessInfo* info)
 }
 
 static bool GetPresentProcessInfo(
-    std::shared_ptr<PresentEvent> const& presentEvent,
+    OutputState* state,
+    DequeuedPresentPtr const& presentEvent,
     bool create,
     ProcessInfo** outProcessInfo,
     SwapChainData** outChain,
     uint64_t* outPresentTime)
 {
     ProcessInfo* processInfo;
-    auto ii = gProcesses.find(presentEvent->ProcessId);
-    if (ii != gProcesses.end()) {
+    auto ii = state->mProcesses.find(presentEvent->ProcessId);
+    if (ii != state->mProcesses.end()) {
         processInfo = &ii->second;
     } else {
         if (!create) {
@@ -455,14 +460,14 @@ static bool GetPresentProcessInfo(
         }
 
         ProcessInfo info;
-        QueryProcessName(presentEvent->ProcessId, &info);
+        QueryProcessName(state, presentEvent->ProcessId, &info);
         info.mOutputCsv       = nullptr;
         info.mIsTargetProcess = IsTargetProcess(presentEvent->ProcessId, info.mModuleName);
         if (info.mIsTargetProcess) {
-            gTargetProcessCount += 1;
+            state->mTargetProcessCount += 1;
         }
 
-        processInfo = &gProcesses.emplace(presentEvent->ProcessId, info).first->second;
+        processInfo = &state->mProcesses.emplace(presentEvent->ProcessId, info).first->second;
     }
 
     if (!processInfo->mIsTargetProcess) {
@@ -482,6 +487,7 @@ static bool GetPresentProcessInfo(
 }
 
 static void ProcessRecordingToggle(
+    OutputState* state,
     bool* isRecording)
 {
     auto const& args = GetCommandLineArgs();
@@ -489,14 +495,14 @@ static void ProcessRecordingToggle(
     if (*isRecording) {
         *isRecording = false;
 
-        IncrementRecordingCount();
+        IncrementRecordingCount(state);
 
         if (args.mMultiCsv) {
-            for (auto& pair : gProcesses) {
+            for (auto& pair : state->mProcesses) {
                 CloseMultiCsv(&pair.second);
             }
         } else {
-            CloseGlobalCsv();
+            CloseGlobalCsv(state);
         }
     } else {
         *isRecording = true;
@@ -504,8 +510,9 @@ static void ProcessRecordingToggle(
 }
 
 static void ProcessEvents(
+    OutputState* state,
     PMTraceSession const& pmSession,
-    std::vector<std::shared_ptr<PresentEvent>> const& presentEvents,
+    std::vector<DequeuedPresentPtr> const& presentEvents,
     std::vector<ProcessEvent>* processEvents,
     std::vector<uint64_t>* recordingToggleHistory,
     bool currentRecordingState)
@@ -538,14 +545,14 @@ static void ProcessEvents(
         // handle process events first and then check again.  
         ProcessInfo* processInfo = nullptr;
         SwapChainData* chain = nullptr;
-        if (GetPresentProcessInfo(presentEvent, false, &processInfo, &chain, &presentTime)) {
+        if (GetPresentProcessInfo(state, presentEvent, false, &processInfo, &chain, &presentTime)) {
             continue;
         }
 
         // Handle any process events that occurred before this present
         if (checkProcessTime) {
             while ((*processEvents)[processEventIndex].QpcTime < presentTime) {
-                ProcessProcessEvent((*processEvents)[processEventIndex]);
+                ProcessProcessEvent(state, (*processEvents)[processEventIndex]);
                 processEventIndex += 1;
                 if (processEventIndex == processEventCount) {
                     checkProcessTime = false;
@@ -557,7 +564,7 @@ static void ProcessEvents(
         // Handle any recording toggles that occurred before this present
         if (checkRecordingToggle) {
             while ((*recordingToggleHistory)[recordingToggleIndex] < presentTime) {
-                ProcessRecordingToggle(&isRecording);
+                ProcessRecordingToggle(state, &isRecording);
                 recordingToggleIndex += 1;
                 if (recordingToggleIndex == recordingToggleCount) {
                     checkRecordingToggle = false;
@@ -567,7 +574,7 @@ static void ProcessEvents(
         }
 
         // If we didn't get process info, try again (this time querying realtime data if needed).
-        if (processInfo == nullptr && GetPresentProcessInfo(presentEvent, true, &processInfo, &chain, &presentTime)) {
+        if (processInfo == nullptr && GetPresentProcessInfo(state, presentEvent, true, &processInfo, &chain, &presentTime)) {
             continue;
         }
 
@@ -578,20 +585,20 @@ static void ProcessEvents(
         // rest aren't.  Otherwise, there will only be one (or zero) pending presents.
         if (isRecording || computeAvg) {
             if (args.mUseV1Metrics) {
-                ReportMetrics1(pmSession, processInfo, chain, presentEvent, isRecording, computeAvg);
+                ReportMetrics1(state, pmSession, processInfo, chain, presentEvent, isRecording, computeAvg);
             } else {
                 auto numPendingPresents = chain->mPendingPresents.size();
                 if (numPendingPresents > 0) {
                     if (presentEvent->FinalState == PresentResult::Presented) {
                         size_t i = 1;
                         for ( ; i < numPendingPresents; ++i) {
-                            ReportMetrics(pmSession, processInfo, chain, chain->mPendingPresents[i - 1], chain->mPendingPresents[i], presentEvent.get(), isRecording, computeAvg);
+                            ReportMetrics(state, pmSession, processInfo, chain, chain->mPendingPresents[i - 1], chain->mPendingPresents[i], presentEvent.get(), isRecording, computeAvg);
                         }
-                        ReportMetrics(pmSession, processInfo, chain, chain->mPendingPresents[i - 1], presentEvent, presentEvent.get(), isRecording, computeAvg);
+                        ReportMetrics(state, pmSession, processInfo, chain, chain->mPendingPresents[i - 1], presentEvent, presentEvent.get(), isRecording, computeAvg);
                         chain->mPendingPresents.clear();
                     } else {
                         if (chain->mPendingPresents[0]->FinalState != PresentResult::Presented) {
-                            ReportMetrics(pmSession, processInfo, chain, chain->mPendingPresents[0], presentEvent, nullptr, isRecording, computeAvg);
+                            ReportMetrics(state, pmSession, processInfo, chain, chain->mPendingPresents[0], presentEvent, nullptr, isRecording, computeAvg);
                             chain->mPendingPresents.clear();
                         }
                     }
@@ -605,7 +612,7 @@ static void ProcessEvents(
     }
 
     // Prune any SwapChainData that hasn't seen an update for over 4 seconds.
-    PruneOldSwapChainData(pmSession, presentTime);
+    PruneOldSwapChainData(state, pmSession, presentTime);
 
     // Erase any recording toggles and process events that were processed.
     if (recordingToggleIndex > 0) {
@@ -616,6 +623,43 @@ static void ProcessEvents(
     }
 }
 
+// Dequeue and output the events that have been analyzed so far, always
+// recording.  This is used instead of the OutputThread when there is no
+// interactive recording control (i.e., in batch mode).
+void UpdateOutput(
+    OutputState* state,
+    PMTraceSession const& pmSession,
+    std::vector<ProcessEvent>* processEvents,
+    std::vector<DequeuedPresentPtr>* presentEvents)
+{
+    std::vector<uint64_t> recordingToggleHistory;
+
+    UpdateProcessEvents(state, pmSession.mPMConsumer, processEvents);
+    pmSession.mPMConsumer->DequeuePresentEvents(*presentEvents);
+
+    if (!presentEvents->empty()) {
+        state->mPresentCount += presentEvents->size();
+        ProcessEvents(state, pmSession, *presentEvents, processEvents, &recordingToggleHistory, true);
+        presentEvents->clear();
+    }
+}
+
+// Close all CSV and process handles
+void CloseOutput(OutputState* state)
+{
+    for (auto& pair : state->mProcesses) {
+        auto processInfo = &pair.second;
+        if (processInfo->mHandle != NULL) {
+            CloseHandle(processInfo->mHandle);
+        }
+        CloseMultiCsv(processInfo);
+    }
+    CloseGlobalCsv(state);
+    CloseEngineUtilizationCsv(state);
+
+    state->mProcesses.clear();
+}
+
 void Output(PMTraceSession const* pmSession)
 {
     SetThreadDescription(GetCurrentThread(), L"PresentMon Output Thread");
@@ -623,9 +667,14 @@ void Output(PMTraceSession const* pmSession)
     auto const& args = GetCommandLineArgs();
 
     // Structures to track processes and statistics from recorded events.
+    OutputState state;
+    state.mOutputCsvFileName = args.mOutputCsvFileName;
+    state.mIsRealtime = args.mEtlFileName == nullptr && args.mRawEventFileName == nullptr;
+
     std::vector<uint64_t> recordingToggleHistory;
     std::vector<ProcessEvent> processEvents;
-    std::vector<std::shared_ptr<PresentEvent>> presentEvents;
+    std::vector<DequeuedPresentPtr> presentEvents;
+    std::vector<EngineUtilizationSample> engineUtilizationSamples;
     processEvents.reserve(128);
     presentEvents.reserve(4096);
 
@@ -639,16 +688,26 @@ void Output(PMTraceSession const* pmSession)
         bool currentRecordingState = CopyRecordingToggleHistory(&recordingToggleHistory);
 
         // Copy process events, present events, and lost present events from ConsumerThread.
-        UpdateProcessEvents(pmSession->mPMConsumer, &processEvents);
+        UpdateProcessEvents(&state, pmSession->mPMConsumer, &processEvents);
         pmSession->mPMConsumer->DequeuePresentEvents(presentEvents);
 
         // Process all the collected events, and update the various tracking
         // and statistics data structures.
         if (!presentEvents.empty()) {
-            ProcessEvents(*pmSession, presentEvents, &processEvents, &recordingToggleHistory, currentRecordingState);
+            ProcessEvents(&state, *pmSession, presentEvents, &processEvents, &recordingToggleHistory, currentRecordingState);
             presentEvents.clear();
         }
 
+        // Output the engine utilization samples that completed while recording.
+        if (args.mEngineUtilizationFileName != nullptr) {
+            pmSession->mPMConsumer->DequeueEngineUtilizationSamples(engineUtilizationSamples);
+            if (currentRecordingState) {
+                for (auto const& sample : engineUtilizationSamples) {
+                    UpdateEngineUtilizationCsv(&state, *pmSession, sample);
+                }
+            }
+        }
+
         // Display information to console if requested.  If debug build and
         // simple console, print a heartbeat if recording.
         //
@@ -665,7 +724,7 @@ void Output(PMTraceSession const* pmSession)
         #endif
         case ConsoleOutput::Statistics:
             if (BeginConsoleUpdate()) {
-                for (auto const& pair : gProcesses) {
+                for (auto const& pair : state.mProcesses) {
                     UpdateConsole(pair.first, pair.second);
                 }
 
@@ -684,21 +743,17 @@ void Output(PMTraceSession const* pmSession)
             break;
         }
 
-        // Sleep to reduce overhead.
-        Sleep(100);
-    }
-
-    // Close all CSV and process handles
-    for (auto& pair : gProcesses) {
-        auto processInfo = &pair.second;
-        if (processInfo->mHandle != NULL) {
-            CloseHandle(processInfo->mHandle);
+        // Sleep to reduce overhead.  When analyzing a file the consumer thread
+        // isn't limited to realtime, so wake up as soon as there are events to
+        // dequeue instead to keep its queues from filling up.
+        if (args.mEtlFileName == nullptr && args.mRawEventFileName == nullptr) {
+            Sleep(100);
+        } else {
+            pmSession->mPMConsumer->WaitForDequeueableEvents(100);
         }
-        CloseMultiCsv(processInfo);
     }
-    CloseGlobalCsv();
 
-    gProcesses.clear();
+    CloseOutput(&state);
 
     gRecordingToggleHistory.clear();
     gRecordingToggleHistory.shrink_to_fit();
@@ -28,6 +28,8 @@ which is controlled from MainThread based on user input or timer.
 
 #include "../PresentData/PresentMonTraceConsumer.hpp"
 #include "../PresentData/PresentMonTraceSession.hpp"
+#include "../PresentData/RawEventContainer.hpp"
+#include "../PresentData/RawEventStream.hpp"
 
 #include <unordered_map>
 
@@ -58,12 +60,23 @@ struct CommandLineArgs {
     std::vector<std::wstring> mExcludeProcessNames;
     const wchar_t *mOutputCsvFileName;
     const wchar_t *mEtlFileName;
+    const wchar_t *mRawEventFileName;
+    const wchar_t *mEtlBatchPath;
+    const wchar_t *mWriteRawEventFileName;
+    const wchar_t *mFlightRecordingPrefix;
+    const wchar_t *mEngineUtilizationFileName;
+    const wchar_t *mGpuTimelineFileName;
     const wchar_t *mSessionName;
     UINT mTargetPid;
+    UINT mBatchJobs;
+    UINT mTrackedPresentMemoryMB;
+    UINT mEngineUtilizationIntervalMs;
     UINT mDelay;
     UINT mTimer;
     UINT mHotkeyModifiers;
     UINT mHotkeyVirtualKeyCode;
+    double mRawEventWindowStart;
+    double mRawEventWindowEnd;
     TimeUnit mTimeUnit;
     CSVOutput mCSVOutput;
     ConsoleOutput mConsoleOutput;
@@ -83,6 +96,8 @@ struct CommandLineArgs {
     bool mMultiCsv;
     bool mUseV1Metrics;
     bool mStopExistingSession;
+    bool mRawEventWindow;
+    bool mAdaptiveEtwBuffers;
 };
 
 // Metrics computed per-frame.  Duration and Latency metrics are in milliseconds.
@@ -119,11 +134,11 @@ struct FrameMetrics1 {
 // - exponential averages of key metrics displayed in console output.
 struct SwapChainData {
     // Pending presents waiting for the next displayed present.
-    std::vector<std::shared_ptr<PresentEvent>> mPendingPresents;
+    std::vector<DequeuedPresentPtr> mPendingPresents;
 
     // The most recent present that has been processed (e.g., output into CSV and/or used for frame
     // statistics).
-    std::shared_ptr<PresentEvent> mLastPresent;
+    DequeuedPresentPtr mLastPresent;
 
     // The CPU start and screen time for the most recent frame that was displayed
     uint64_t mLastDisplayedCPUStart = 0;
@@ -147,6 +162,25 @@ struct ProcessInfo {
     bool mIsTargetProcess;
 };
 
+// The output state for one capture.  The OutputThread uses one for the trace session, and batch
+// mode uses one for each ETL being analyzed.
+struct OutputState {
+    std::unordered_map<uint32_t, ProcessInfo> mProcesses;
+    uint32_t mTargetProcessCount = 0;
+
+    FILE* mGlobalOutputCsv = nullptr;
+    FILE* mEngineUtilizationCsv = nullptr;
+    wchar_t const* mOutputCsvFileName = nullptr;    // Base path of the CSV file(s), or nullptr to generate one
+    uint32_t mRecordingCount = 1;
+    uint64_t mPresentCount = 0;
+    uint64_t mCsvRowCount = 0;
+
+    bool mIsRealtime = true;                        // Whether the events are from a realtime session
+};
+
+// BatchMode.cpp:
+int RunBatchMode();
+
 // CommandLine.cpp:
 bool ParseCommandLine(int argc, wchar_t** argv);
 CommandLineArgs const& GetCommandLineArgs();
@@ -166,23 +200,29 @@ int PrintError(wchar_t const* format, ...);
 
 // ConsumerThread.cpp:
 void StartConsumerThread(TRACEHANDLE traceHandle);
+void StartConsumerThread(PMTraceSession* pmSession, RawEventContainerReader* rawEventReader);
 void WaitForConsumerThreadToExit();
 
 // CsvOutput.cpp:
-void IncrementRecordingCount();
+void IncrementRecordingCount(OutputState* state);
 void CloseMultiCsv(ProcessInfo* processInfo);
-void CloseGlobalCsv();
+void CloseGlobalCsv(OutputState* state);
 const char* PresentModeToString(PresentMode mode);
 const char* RuntimeToString(Runtime rt);
-void UpdateCsv(PMTraceSession const& pmSession, ProcessInfo* processInfo, PresentEvent const& p, FrameMetrics const& metrics);
-void UpdateCsv(PMTraceSession const& pmSession, ProcessInfo* processInfo, PresentEvent const& p, FrameMetrics1 const& metrics);
+void UpdateCsv(OutputState* state, PMTraceSession const& pmSession, ProcessInfo* processInfo, PresentEvent const& p, FrameMetrics const& metrics);
+void UpdateCsv(OutputState* state, PMTraceSession const& pmSession, ProcessInfo* processInfo, PresentEvent const& p, FrameMetrics1 const& metrics);
+void UpdateEngineUtilizationCsv(OutputState* state, PMTraceSession const& pmSession, EngineUtilizationSample const& sample);
+void CloseEngineUtilizationCsv(OutputState* state);
 
 // MainThread.cpp:
 void ExitMainThread();
+void ConfigureConsumer(PMTraceConsumer* pmConsumer);
 
 // OutputThread.cpp:
 void StartOutputThread(PMTraceSession const& pmSession);
 void StopOutputThread();
+void UpdateOutput(OutputState* state, PMTraceSession const& pmSession, std::vector<ProcessEvent>* processEvents, std::vector<DequeuedPresentPtr>* presentEvents);
+void CloseOutput(OutputState* state);
 void SetOutputRecordingState(bool record);
 void CanonicalizeProcessName(std::wstring* path);
 
@@ -0,0 +1,250 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <vector>
+#include "../PresentData/AnalysisSnapshot.hpp"
+#include "../PresentData/PresentMonTraceConsumer.hpp"
+
+namespace {
+
+PresentEventPtr MakePresent(PMTraceConsumer* pmConsumer, uint32_t processId, uint64_t startTime, uint32_t ringIndex)
+{
+    auto present = pmConsumer->mPresentEventPool->Allocate();
+    present->ProcessId = processId;
+    present->ThreadId = processId * 10;
+    present->PresentStartTime = startTime;
+    present->SwapChainAddress = startTime * 3;
+    present->RingIndex = ringIndex;
+    return present;
+}
+
+void ConfigureConsumer(PMTraceConsumer* pmConsumer)
+{
+    pmConsumer->mTrackGPU = true;
+    pmConsumer->mDeferralTimeLimit = 100;
+}
+
+// Put some of everything that a snapshot includes into pmConsumer: presents
+// in each of the tracking structures, a DWM dependency, a completed present
+// that hasn't been handed off, frame type and input state, metadata, and
+// GPU devices, contexts, and packets in flight.
+void PopulateConsumer(PMTraceConsumer* pmConsumer)
+{
+    auto c = pmConsumer;
+    c->mTrackedPresents.resize(1024);
+
+    PresentEventPtr presents[8];
+    for (uint32_t i = 0; i < _countof(presents); ++i) {
+        presents[i] = MakePresent(c, 1 + i % 3, 100 + i * 10, i);
+        c->mTrackedPresents[i] = presents[i];
+        c->mOrderedPresentsByProcessId[presents[i]->ProcessId].Insert(presents[i]);
+    }
+    c->mNextFreeRingIndex = _countof(presents);
+
+    presents[1]->PresentIds.emplace(5, 6);
+    presents[1]->PresentIds.emplace(2, 3);
+    c->mPresentByThreadId.emplace(presents[0]->ThreadId, presents[0]);
+    c->mPresentBySubmitSequence.Insert(7, 99, presents[2]);
+    c->mPresentBySubmitSequence.Insert(3, 98, presents[3]);
+    c->mPresentByWin32KPresentHistoryToken.emplace(std::make_tuple(1ull, 2ull, 3ull), presents[4]);
+    c->mPresentByDxgkContext.emplace(55, presents[5]);
+    c->mLastPresentByWindow.emplace(0x1234, presents[6]);
+
+    // A present that is only referenced as a DWM dependency.
+    presents[7]->DependentPresents.PushBack(MakePresent(c, 9, 50, 100));
+    c->mPresentsWaitingForDWM.PushBack(presents[6]);
+
+    auto completed = MakePresent(c, 4, 60, 101);
+    completed->IsCompleted = true;
+    completed->DeferredReason = DeferredReason_WaitingForPresentStop;
+    c->AddPresentToCompletedList(completed);
+
+    // A present that was released before the snapshot, so the next FrameId
+    // can't be derived from the presents in it.
+    MakePresent(c, 6, 10, 102);
+
+    c->DwmProcessId = 77;
+    c->mHasCompletedAPresent = true;
+    c->mPendingPresentFrameTypeEvents.emplace(3, PresentFrameTypeEvent{ 4, FrameType::Application });
+    c->mRetrievedInput.emplace(8, std::make_pair(12ull, InputDeviceType::Mouse));
+
+    // A state sweep part way through a pass.
+    c->mExitedProcesses.emplace(5, 40);
+    c->mExitedProcesses.emplace(2, 30);
+    c->mSweepPassTime = 90;
+    c->mNextSweepTime = 20;
+    c->mSweepBucket = 3;
+    c->mSweepPhase = 2;
+    c->mSweepInProgress = true;
+
+    EventMetadataKey key = {};
+    key.desc_.Id = 42;
+    uint8_t tei[sizeof(TRACE_EVENT_INFO)];
+    for (uint32_t i = 0; i < sizeof(tei); ++i) {
+        tei[i] = (uint8_t) i;
+    }
+    c->mMetadata.AddEventInfo(key, tei, sizeof(tei));
+
+    auto g = &c->mGpuTrace;
+    g->RegisterDevice(1, 1000);
+    g->RegisterContext(10, 1, 2, 1, 0);
+    g->RegisterContext(12, 1, 0, 2, 0);
+    g->RegisterHwQueueContext(11, 10, 0);
+    g->SetEngineType(1000, 2, Microsoft_Windows_DxgKrnl::DXGK_ENGINE::COPY, 0);
+    g->EnqueueDmaPacket(10, 5, 200);
+    g->EnqueueDmaPacket(10, 6, 210);
+    g->EnqueueDmaPacket(12, 1, 205);
+    g->EnqueueQueuePacket(11, 9, 1, 220, false);
+}
+
+// Continue the analysis of a restored consumer (and the original) with some
+// GPU work completing and a context going away.
+void ContinueConsumer(PMTraceConsumer* pmConsumer)
+{
+    auto g = &pmConsumer->mGpuTrace;
+    g->CompleteDmaPacket(10, 5, 300);
+    g->CompleteDmaPacket(12, 1, 305);
+    g->CompleteQueuePacket(11, 9, 310);
+    g->UnregisterContext(10, 315);
+    g->EnqueueDmaPacket(12, 2, 320);
+}
+
+}
+
+TEST(AnalysisSnapshotTests, RestoredSnapshotSavesIdentically)
+{
+    PMTraceConsumer original;
+    ConfigureConsumer(&original);
+    PopulateConsumer(&original);
+
+    std::vector<uint8_t> snapshot;
+    original.SaveSnapshot(&snapshot);
+
+    PMTraceConsumer restored;
+    ConfigureConsumer(&restored);
+    ASSERT_TRUE(restored.RestoreSnapshot(snapshot.data(), snapshot.size()));
+
+    std::vector<uint8_t> resaved;
+    restored.SaveSnapshot(&resaved);
+    EXPECT_EQ(resaved, snapshot);
+
+    EXPECT_EQ(restored.mOrderedPresentsByProcessId[1].size(), 3u);
+    EXPECT_EQ(restored.mPresentsWaitingForDWM.mHead.get(), restored.mTrackedPresents[6].get());
+    EXPECT_EQ(restored.mTrackedPresents[7]->DependentPresents.mHead->ProcessId, 9u);
+    EXPECT_EQ(restored.mTrackedPresents[1]->PresentIds.size(), 2u);
+    EXPECT_EQ(restored.DwmProcessId, 77u);
+    EXPECT_EQ(restored.mExitedProcesses, original.mExitedProcesses);
+    EXPECT_EQ(restored.mSweepPassTime, 90u);
+    EXPECT_EQ(restored.mNextSweepTime, 20u);
+    EXPECT_EQ(restored.mSweepBucket, 3u);
+    EXPECT_EQ(restored.mSweepPhase, 2u);
+    EXPECT_TRUE(restored.mSweepInProgress);
+
+    // Presents that were completed but not yet handed off aren't dequeued
+    // until the restored consumer hands them off itself.
+    std::vector<DequeuedPresentPtr> dequeued;
+    restored.DequeuePresentEvents(dequeued);
+    EXPECT_TRUE(dequeued.empty());
+
+    // The restored GPU state behaves the same as the original.
+    ContinueConsumer(&original);
+    ContinueConsumer(&restored);
+    snapshot.clear();
+    resaved.clear();
+    original.SaveSnapshot(&snapshot);
+    restored.SaveSnapshot(&resaved);
+    EXPECT_EQ(resaved, snapshot);
+
+    // Presents created after the restore continue the original's FrameIds.
+    auto originalPresent = MakePresent(&original, 5, 400, 103);
+    auto restoredPresent = MakePresent(&restored, 5, 400, 103);
+    EXPECT_EQ(restoredPresent->FrameId, originalPresent->FrameId);
+    EXPECT_NE(restoredPresent->FrameId, restored.mTrackedPresents[7]->FrameId);
+}
+
+TEST(AnalysisSnapshotTests, EmptyConsumerRoundTrips)
+{
+    PMTraceConsumer original;
+    ConfigureConsumer(&original);
+
+    std::vector<uint8_t> snapshot;
+    original.SaveSnapshot(&snapshot);
+
+    PMTraceConsumer restored;
+    ConfigureConsumer(&restored);
+    ASSERT_TRUE(restored.RestoreSnapshot(snapshot.data(), snapshot.size()));
+
+    std::vector<uint8_t> resaved;
+    restored.SaveSnapshot(&resaved);
+    EXPECT_EQ(resaved, snapshot);
+}
+
+TEST(AnalysisSnapshotTests, RestoreRejectsDifferentConfiguration)
+{
+    PMTraceConsumer original;
+    ConfigureConsumer(&original);
+    PopulateConsumer(&original);
+
+    std::vector<uint8_t> snapshot;
+    original.SaveSnapshot(&snapshot);
+
+    PMTraceConsumer restored;
+    ConfigureConsumer(&restored);
+    restored.mTrackGPU = false;
+    EXPECT_FALSE(restored.RestoreSnapshot(snapshot.data(), snapshot.size()));
+}
+
+TEST(AnalysisSnapshotTests, RestoreRejectsTruncatedSnapshot)
+{
+    PMTraceConsumer original;
+    ConfigureConsumer(&original);
+    PopulateConsumer(&original);
+
+    std::vector<uint8_t> snapshot;
+    original.SaveSnapshot(&snapshot);
+
+    for (size_t size = 0; size < snapshot.size(); ++size) {
+        PMTraceConsumer restored;
+        ConfigureConsumer(&restored);
+        EXPECT_FALSE(restored.RestoreSnapshot(snapshot.data(), size)) << size;
+    }
+
+    // Trailing data is rejected too.
+    snapshot.push_back(0);
+    PMTraceConsumer restored;
+    ConfigureConsumer(&restored);
+    EXPECT_FALSE(restored.RestoreSnapshot(snapshot.data(), snapshot.size()));
+}
+
+TEST(AnalysisSnapshotTests, RestoreToleratesCorruptSnapshot)
+{
+    PMTraceConsumer original;
+    ConfigureConsumer(&original);
+    PopulateConsumer(&original);
+
+    std::vector<uint8_t> snapshot;
+    original.SaveSnapshot(&snapshot);
+
+    // A corrupt header or trailer is always rejected.
+    for (size_t i : { (size_t) 0, (size_t) 4, snapshot.size() - 1 }) {
+        auto corrupt = snapshot;
+        corrupt[i] ^= 0xff;
+        PMTraceConsumer restored;
+        ConfigureConsumer(&restored);
+        EXPECT_FALSE(restored.RestoreSnapshot(corrupt.data(), corrupt.size())) << i;
+    }
+
+    // Other corruption may not be detectable, but must not result in
+    // out-of-bounds accesses or a consumer that can't be used or destroyed.
+    for (size_t i = sizeof(AnalysisSnapshotHeader); i < snapshot.size(); ++i) {
+        auto corrupt = snapshot;
+        corrupt[i] ^= 0xff;
+        PMTraceConsumer restored;
+        ConfigureConsumer(&restored);
+        if (restored.RestoreSnapshot(corrupt.data(), corrupt.size())) {
+            std::vector<uint8_t> resaved;
+            restored.SaveSnapshot(&resaved);
+        }
+    }
+}
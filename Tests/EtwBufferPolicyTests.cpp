@@ -0,0 +1,202 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <vector>
+#include "../PresentData/EtwBufferPolicy.hpp"
+
+namespace {
+
+uint64_t const TIMESTAMP_FREQUENCY = 10000000;
+
+// Replays a recorded trace of a realtime session into an EtwBufferPolicy.  Each
+// step advances time and the session's counters, and is sampled like the
+// console and service sample a running session.
+class SessionTrace {
+public:
+    EtwBufferPolicy policy_;
+    EtwSessionSample sample_ = {};
+    std::vector<EtwBufferPolicy::Action> actions_;
+
+    explicit SessionTrace(EtwBufferSettings const& settings)
+    {
+        sample_.time_ = 123456789;
+        sample_.numberOfBuffers_ = settings.minimumBuffers_;
+        sample_.freeBuffers_ = settings.minimumBuffers_;
+        policy_.Reset(settings, TIMESTAMP_FREQUENCY);
+        EXPECT_EQ(policy_.Update(sample_), EtwBufferPolicy::ACTION_NONE);
+    }
+
+    EtwBufferPolicy::Action Step(uint32_t ms, uint32_t buffersWritten, uint32_t eventsLost, uint32_t buffersInUse, uint32_t consumerLagMs)
+    {
+        sample_.time_ += TIMESTAMP_FREQUENCY * ms / 1000;
+        sample_.consumerLag_ = TIMESTAMP_FREQUENCY * consumerLagMs / 1000;
+        sample_.buffersWritten_ += buffersWritten;
+        sample_.eventsLost_ += eventsLost;
+        sample_.numberOfBuffers_ = std::max(buffersInUse, sample_.numberOfBuffers_);
+        sample_.freeBuffers_ = sample_.numberOfBuffers_ - buffersInUse;
+
+        auto action = policy_.Update(sample_);
+        actions_.push_back(action);
+        return action;
+    }
+
+    // Repeat a one-second step count times.
+    void Run(uint32_t count, uint32_t buffersPerSecond, uint32_t buffersInUse)
+    {
+        for (uint32_t i = 0; i < count; ++i) {
+            Step(1000, buffersPerSecond, 0, buffersInUse, 0);
+        }
+    }
+};
+
+EtwBufferSettings DefaultSettings()
+{
+    EtwBufferSettings settings = {};
+    settings.bufferSizeKB_ = 64;
+    settings.minimumBuffers_ = 4;
+    settings.maximumBuffers_ = 32;
+    settings.flushTimerMs_ = 1000;
+    return settings;
+}
+
+}
+
+TEST(EtwBufferPolicyTests, IdleSessionFlushesMoreOften)
+{
+    SessionTrace trace(DefaultSettings());
+
+    // Nothing changes until the session has been quiet for quietPeriodMs_.
+    trace.Run(9, 5, 1);
+    for (auto action : trace.actions_) {
+        EXPECT_EQ(action, EtwBufferPolicy::ACTION_NONE);
+    }
+
+    // Then the flush timer halves once per minChangeIntervalMs_, down to
+    // minFlushTimerMs_.
+    trace.Run(1, 5, 1);
+    EXPECT_EQ(trace.actions_.back(), EtwBufferPolicy::ACTION_UPDATE);
+    EXPECT_EQ(trace.policy_.Settings().flushTimerMs_, 500u);
+
+    trace.Run(10, 5, 1);
+    EXPECT_EQ(trace.policy_.Settings().flushTimerMs_, trace.policy_.minFlushTimerMs_);
+    EXPECT_EQ(trace.policy_.Settings().maximumBuffers_, 32u);
+    EXPECT_EQ(trace.policy_.ChangeCount(), 4u); // 500, 250, 125, 100
+    EXPECT_EQ(trace.policy_.RestartSettings().flushTimerMs_, trace.policy_.minFlushTimerMs_);
+}
+
+TEST(EtwBufferPolicyTests, DefaultFlushTimerIsOneSecond)
+{
+    auto settings = DefaultSettings();
+    settings.flushTimerMs_ = 0;
+
+    SessionTrace trace(settings);
+    trace.Run(5, 5, 1);
+    EXPECT_EQ(trace.policy_.ChangeCount(), 0u);
+    EXPECT_EQ(trace.policy_.Settings().flushTimerMs_, 1000u);
+}
+
+TEST(EtwBufferPolicyTests, LostEventsGrowBuffersAndFlushTimer)
+{
+    auto settings = DefaultSettings();
+    settings.flushTimerMs_ = 250;
+
+    SessionTrace trace(settings);
+    trace.Run(5, 5, 1);
+
+    // A burst of 50 buffers/s loses events: the maximum grows to cover the
+    // burst with headroom_, and the flush timer doubles.
+    EXPECT_EQ(trace.Step(1000, 50, 100, 32, 0), EtwBufferPolicy::ACTION_UPDATE);
+    EXPECT_EQ(trace.policy_.Settings().maximumBuffers_, 100u);
+    EXPECT_EQ(trace.policy_.Settings().flushTimerMs_, 500u);
+    EXPECT_EQ(trace.policy_.Settings().bufferSizeKB_, 64u);
+
+    // Once the burst is over the larger maximum is kept, and the flush timer
+    // doesn't shrink again until the session has been quiet for a while.
+    trace.Run(9, 5, 1);
+    EXPECT_EQ(trace.policy_.ChangeCount(), 1u);
+    EXPECT_EQ(trace.policy_.RestartSettings().maximumBuffers_, 100u);
+}
+
+TEST(EtwBufferPolicyTests, BuffersNearlyFullGrowMaximum)
+{
+    SessionTrace trace(DefaultSettings());
+    trace.Run(2, 5, 1);
+
+    // 24 of 32 buffers in use is pressure, even without losses.
+    EXPECT_EQ(trace.Step(1000, 5, 0, 24, 0), EtwBufferPolicy::ACTION_UPDATE);
+    EXPECT_EQ(trace.policy_.Settings().maximumBuffers_, 48u);
+    EXPECT_EQ(trace.policy_.Settings().flushTimerMs_, 1000u);
+}
+
+TEST(EtwBufferPolicyTests, ConsumerLagGrowsMaximum)
+{
+    SessionTrace trace(DefaultSettings());
+    trace.Run(2, 5, 1);
+
+    // 20 buffers/s while the consumer is 2s behind needs 20 * (2s + 1s) * 2
+    // buffers.
+    EXPECT_EQ(trace.Step(1000, 20, 0, 8, 2000), EtwBufferPolicy::ACTION_UPDATE);
+    EXPECT_EQ(trace.policy_.Settings().maximumBuffers_, 120u);
+}
+
+TEST(EtwBufferPolicyTests, TooManyBuffersRecommendsRestart)
+{
+    SessionTrace trace(DefaultSettings());
+    trace.Run(2, 5, 1);
+
+    // 2000 buffers/s needs 4000 64 KB buffers, more than maxMaximumBuffers_.
+    // The running session is limited to maxMaximumBuffers_, and the same
+    // capacity in 256 KB buffers is recommended for the next session.
+    EXPECT_EQ(trace.Step(1000, 2000, 5000, 32, 0), EtwBufferPolicy::ACTION_RESTART);
+    EXPECT_EQ(trace.policy_.Settings().bufferSizeKB_, 64u);
+    EXPECT_EQ(trace.policy_.Settings().maximumBuffers_, trace.policy_.maxMaximumBuffers_);
+    EXPECT_EQ(trace.policy_.RestartSettings().bufferSizeKB_, 256u);
+    EXPECT_EQ(trace.policy_.RestartSettings().maximumBuffers_, 1000u);
+    EXPECT_EQ(trace.policy_.RestartSettings().minimumBuffers_, 4u);
+
+    // Continued losses can't grow the running session any further, and the
+    // flush timer is already at maxFlushTimerMs_.
+    trace.Step(1000, 2000, 5000, 1024, 0);
+    EXPECT_EQ(trace.policy_.Settings().maximumBuffers_, trace.policy_.maxMaximumBuffers_);
+    EXPECT_EQ(trace.policy_.RestartSettings().bufferSizeKB_, 256u);
+}
+
+TEST(EtwBufferPolicyTests, BufferSizeIsLimited)
+{
+    SessionTrace trace(DefaultSettings());
+    trace.policy_.maxBufferSizeKB_ = 128;
+    trace.Run(2, 5, 1);
+
+    EXPECT_EQ(trace.Step(1000, 2000, 5000, 32, 0), EtwBufferPolicy::ACTION_RESTART);
+    EXPECT_EQ(trace.policy_.RestartSettings().bufferSizeKB_, 128u);
+    EXPECT_EQ(trace.policy_.RestartSettings().maximumBuffers_, trace.policy_.maxMaximumBuffers_);
+}
+
+TEST(EtwBufferPolicyTests, ChangesAreRateLimited)
+{
+    SessionTrace trace(DefaultSettings());
+    trace.Run(2, 5, 1);
+
+    // Losses sampled every 250ms only change the settings once per
+    // minChangeIntervalMs_.
+    for (uint32_t i = 0; i < 8; ++i) {
+        trace.Step(250, 10, 10, 32, 0);
+    }
+    EXPECT_EQ(trace.policy_.ChangeCount(), 2u);
+}
+
+TEST(EtwBufferPolicyTests, CounterResetIsABaseline)
+{
+    SessionTrace trace(DefaultSettings());
+    trace.Run(2, 5, 1);
+
+    // If the session was restarted without a Reset() the counters go
+    // backwards, which is only used as the new baseline.
+    trace.sample_.buffersWritten_ = 0;
+    trace.sample_.eventsLost_ = 0;
+    EXPECT_EQ(trace.Step(1000, 0, 0, 1, 0), EtwBufferPolicy::ACTION_NONE);
+    EXPECT_EQ(trace.Step(1000, 5, 0, 1, 0), EtwBufferPolicy::ACTION_NONE);
+    EXPECT_EQ(trace.policy_.ChangeCount(), 0u);
+}
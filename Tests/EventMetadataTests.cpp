@@ -0,0 +1,234 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <initializer_list>
+#include <vector>
+#include "../PresentData/TraceConsumer.hpp"
+
+namespace {
+
+GUID const TEST_PROVIDER = { 0x8c3d2b1a, 0x4f5e, 0x4a6b, { 0x9c, 0x8d, 0x7e, 0x6f, 0x50, 0x41, 0x32, 0x23 } };
+
+struct TestProperty {
+    wchar_t const* name_;
+    USHORT inType_;
+    USHORT length_;
+};
+
+EVENT_DESCRIPTOR MakeDescriptor(USHORT id, UCHAR opcode)
+{
+    EVENT_DESCRIPTOR desc = {};
+    desc.Id = id;
+    desc.Opcode = opcode;
+    return desc;
+}
+
+// Build the TRACE_EVENT_INFO for an event with fixed-size top-level
+// properties, as TDH or an ETL's EventInfo event would provide it.
+std::vector<uint8_t> MakeEventInfo(EVENT_DESCRIPTOR const& desc, std::initializer_list<TestProperty> props)
+{
+    auto namesOffset = (uint32_t) (offsetof(TRACE_EVENT_INFO, EventPropertyInfoArray) + props.size() * sizeof(EVENT_PROPERTY_INFO));
+    auto size = namesOffset;
+    for (auto const& prop : props) {
+        size += (uint32_t) ((wcslen(prop.name_) + 1) * sizeof(WCHAR));
+    }
+
+    std::vector<uint8_t> data(size, 0);
+    auto tei = (TRACE_EVENT_INFO*) data.data();
+    tei->ProviderGuid = TEST_PROVIDER;
+    tei->EventDescriptor = desc;
+    tei->DecodingSource = DecodingSourceXMLFile;
+    tei->PropertyCount = (ULONG) props.size();
+    tei->TopLevelPropertyCount = (ULONG) props.size();
+
+    uint32_t i = 0;
+    auto nameOffset = namesOffset;
+    for (auto const& prop : props) {
+        auto epi = &tei->EventPropertyInfoArray[i++];
+        epi->NameOffset = nameOffset;
+        epi->nonStructType.InType = prop.inType_;
+        epi->count = 1;
+        epi->length = prop.length_;
+
+        auto name = (WCHAR*) (data.data() + nameOffset);
+        for (size_t j = 0; prop.name_[j] != L'\0'; ++j) {
+            name[j] = (WCHAR) prop.name_[j];
+        }
+        nameOffset += (uint32_t) ((wcslen(prop.name_) + 1) * sizeof(WCHAR));
+    }
+
+    return data;
+}
+
+void AddEventInfo(EventMetadata* metadata, std::vector<uint8_t> const& data)
+{
+    EventMetadataKey key;
+    key.guid_ = TEST_PROVIDER;
+    key.desc_ = ((TRACE_EVENT_INFO const*) data.data())->EventDescriptor;
+    metadata->AddEventInfo(key, data.data(), (uint32_t) data.size());
+}
+
+PMEventRecord MakeEventRecord(EVENT_DESCRIPTOR const& desc, void* userData, size_t userDataLength)
+{
+    PMEventRecord eventRecord = {};
+    eventRecord.EventHeader.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+    eventRecord.EventHeader.ProviderId = TEST_PROVIDER;
+    eventRecord.EventHeader.EventDescriptor = desc;
+    eventRecord.UserData = userData;
+    eventRecord.UserDataLength = (uint16_t) userDataLength;
+    return eventRecord;
+}
+
+struct TestView {
+    uint32_t A;
+    uint32_t B;
+
+    static EventViewField const* Fields(uint32_t* count)
+    {
+        static EventViewField const fields[] = {
+            EVENT_VIEW_FIELD(TestView, A),
+            EVENT_VIEW_FIELD(TestView, B),
+        };
+        *count = _countof(fields);
+        return fields;
+    }
+};
+
+}
+
+TEST(EventMetadataTests, ViewLayoutRevalidatedWhenMetadataReplaced)
+{
+    auto desc = MakeDescriptor(1, 0);
+
+    EventMetadata metadata;
+    AddEventInfo(&metadata, MakeEventInfo(desc, {
+        { L"A", TDH_INTYPE_UINT32, 4 },
+        { L"B", TDH_INTYPE_UINT32, 4 },
+    }));
+
+    EventViewLayout layout;
+    TestView view;
+
+    uint32_t data1[] = { 1, 2 };
+    auto eventRecord1 = MakeEventRecord(desc, data1, sizeof(data1));
+    metadata.GetEventView(&eventRecord1, &layout, &view);
+    EXPECT_EQ(layout.state_, EventViewLayout::FIXED);
+    EXPECT_EQ(view.A, 1u);
+    EXPECT_EQ(view.B, 2u);
+
+    // Re-adding identical metadata (e.g., from the next container chunk)
+    // doesn't invalidate anything.
+    auto generation = metadata.generation_;
+    AddEventInfo(&metadata, MakeEventInfo(desc, {
+        { L"A", TDH_INTYPE_UINT32, 4 },
+        { L"B", TDH_INTYPE_UINT32, 4 },
+    }));
+    EXPECT_EQ(metadata.generation_, generation);
+
+    // A new schema for the same event part way through the stream moves the
+    // properties, and the layout has to follow.
+    AddEventInfo(&metadata, MakeEventInfo(desc, {
+        { L"X", TDH_INTYPE_UINT32, 4 },
+        { L"A", TDH_INTYPE_UINT32, 4 },
+        { L"B", TDH_INTYPE_UINT32, 4 },
+    }));
+    EXPECT_NE(metadata.generation_, generation);
+
+    uint32_t data2[] = { 9, 1, 2 };
+    auto eventRecord2 = MakeEventRecord(desc, data2, sizeof(data2));
+    metadata.GetEventView(&eventRecord2, &layout, &view);
+    EXPECT_EQ(layout.state_, EventViewLayout::FIXED);
+    EXPECT_EQ(layout.generation_, metadata.generation_);
+    EXPECT_EQ(view.A, 1u);
+    EXPECT_EQ(view.B, 2u);
+}
+
+TEST(EventMetadataTests, ReplacingWithSmallerMetadataUpdatesSize)
+{
+    EventMetadataKey key = {};
+    key.guid_ = TEST_PROVIDER;
+    key.desc_ = MakeDescriptor(1, 0);
+
+    EventMetadataTable table;
+    bool replaced = false;
+    auto tei = table.Insert(key, 256, &replaced);
+    EXPECT_FALSE(replaced);
+
+    // Smaller metadata reuses the storage, but reports its own size.
+    uint32_t size = 0;
+    EXPECT_EQ(table.Insert(key, 64, &replaced), tei);
+    EXPECT_TRUE(replaced);
+    EXPECT_EQ(table.Find(key, &size), tei);
+    EXPECT_EQ(size, 64u);
+
+    // Storage is reused up to its original size.
+    EXPECT_EQ(table.Insert(key, 256, &replaced), tei);
+    EXPECT_EQ(table.Find(key, &size), tei);
+    EXPECT_EQ(size, 256u);
+
+    auto largerTei = table.Insert(key, 512, &replaced);
+    EXPECT_NE(largerTei, tei);
+    EXPECT_EQ(table.Find(key, &size), largerTei);
+    EXPECT_EQ(size, 512u);
+    EXPECT_EQ(table.Size(), 1u);
+}
+
+TEST(EventMetadataTests, RepeatedSmallerMetadataKeepsPlans)
+{
+    auto desc = MakeDescriptor(1, 0);
+    auto larger = MakeEventInfo(desc, {
+        { L"X", TDH_INTYPE_UINT32, 4 },
+        { L"A", TDH_INTYPE_UINT32, 4 },
+        { L"B", TDH_INTYPE_UINT32, 4 },
+    });
+    auto smaller = MakeEventInfo(desc, {
+        { L"A", TDH_INTYPE_UINT32, 4 },
+        { L"B", TDH_INTYPE_UINT32, 4 },
+    });
+
+    EventMetadata metadata;
+    AddEventInfo(&metadata, larger);
+    AddEventInfo(&metadata, smaller);
+    auto generation = metadata.generation_;
+
+    uint32_t data[] = { 1, 2 };
+    auto eventRecord = MakeEventRecord(desc, data, sizeof(data));
+    EXPECT_EQ(metadata.GetEventData<uint32_t>(&eventRecord, L"B"), 2u);
+    EXPECT_EQ(metadata.plans_.size(), 1u);
+
+    // The smaller metadata is repeated, e.g. at the start of each container
+    // chunk, which must be recognized as identical.
+    AddEventInfo(&metadata, smaller);
+    EXPECT_EQ(metadata.plans_.size(), 1u);
+    EXPECT_EQ(metadata.generation_, generation);
+    EXPECT_EQ(metadata.GetEventData<uint32_t>(&eventRecord, L"B"), 2u);
+}
+
+TEST(EventMetadataTests, ClassicEventsArePlannedPerOpcode)
+{
+    // Classic events all have Id 0 and are only distinguished by Opcode, and
+    // the same property can be at different offsets in each.
+    auto startDesc = MakeDescriptor(0, 1);
+    auto endDesc = MakeDescriptor(0, 2);
+
+    EventMetadata metadata;
+    AddEventInfo(&metadata, MakeEventInfo(startDesc, {
+        { L"ProcessId", TDH_INTYPE_UINT32, 4 },
+        { L"ParentId", TDH_INTYPE_UINT32, 4 },
+    }));
+    AddEventInfo(&metadata, MakeEventInfo(endDesc, {
+        { L"ExitStatus", TDH_INTYPE_UINT32, 4 },
+        { L"ProcessId", TDH_INTYPE_UINT32, 4 },
+    }));
+
+    static wchar_t const* const PROCESS_ID = L"ProcessId";
+
+    uint32_t startData[] = { 10, 20 };
+    uint32_t endData[] = { 30, 10 };
+    auto startRecord = MakeEventRecord(startDesc, startData, sizeof(startData));
+    auto endRecord = MakeEventRecord(endDesc, endData, sizeof(endData));
+    EXPECT_EQ(metadata.GetEventData<uint32_t>(&startRecord, PROCESS_ID), 10u);
+    EXPECT_EQ(metadata.GetEventData<uint32_t>(&endRecord, PROCESS_ID), 10u);
+    EXPECT_EQ(metadata.plans_.size(), 2u);
+}
@@ -0,0 +1,205 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../PresentData/FlightRecorder.hpp"
+#include "../PresentData/PresentMonTraceConsumer.hpp"
+
+namespace {
+
+uint32_t const CAPACITY = 16;
+
+FILE* OpenFile(std::string const& path, char const* mode)
+{
+#ifdef _WIN32
+    FILE* fp = nullptr;
+    return fopen_s(&fp, path.c_str(), mode) == 0 ? fp : nullptr;
+#else
+    return fopen(path.c_str(), mode);
+#endif
+}
+
+// The recordings written by a FlightRecordingWriter started with PathPrefix()
+// are at RecordingPath(n).
+std::wstring PathPrefix()
+{
+    auto path = testing::TempDir() + "FlightRecorderTests";
+    return std::wstring(path.begin(), path.end());
+}
+
+std::string RecordingPath(uint32_t n)
+{
+    return testing::TempDir() + "FlightRecorderTests-" + std::to_string(n) + ".pmfr";
+}
+
+// Record count events, with timestamps continuing from the previous call.
+void RecordEvents(FlightRecorder* recorder, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t data = recorder->RecordCount();
+        PMEventRecord eventRecord = {};
+        eventRecord.EventHeader.TimeStamp.QuadPart = (LONGLONG) (1000 + recorder->RecordCount());
+        eventRecord.EventHeader.ProcessId = 10;
+        eventRecord.EventHeader.ThreadId = 20;
+        eventRecord.UserData = &data;
+        eventRecord.UserDataLength = sizeof(data);
+        recorder->RecordEvent(1, &eventRecord);
+    }
+}
+
+// The records in ring order starting at first, checking that they are the
+// recordCount consecutive events that end at totalRecordCount.
+void ExpectRecords(std::vector<FlightRecord> const& records, uint32_t first, uint32_t recordCount, uint64_t totalRecordCount)
+{
+    for (uint32_t i = 0; i < recordCount; ++i) {
+        auto const& record = records[(first + i) % records.size()];
+        EXPECT_EQ(record.time_, 1000 + totalRecordCount - recordCount + i) << i;
+        EXPECT_EQ(record.event_.kind_, FLIGHT_RECORD_EVENT);
+    }
+}
+
+bool ReadRecording(std::string const& path, FlightRecordingHeader* header, std::vector<FlightRecord>* records)
+{
+    auto fp = OpenFile(path, "rb");
+    if (fp == nullptr) {
+        return false;
+    }
+    bool ok = fread(header, sizeof(*header), 1, fp) == 1;
+    if (ok) {
+        records->resize(header->recordCount_);
+        ok = fread(records->data(), sizeof(FlightRecord), records->size(), fp) == records->size() &&
+             fgetc(fp) == EOF;
+    }
+    fclose(fp);
+    return ok;
+}
+
+}
+
+// TakeRecords() hands off only the records made since the previous call, up
+// to a full ring, and recording continues into the swapped-in buffer.
+TEST(FlightRecorderTests, TakeRecords)
+{
+    FlightRecorder recorder(CAPACITY);
+    recorder.SetTimestampInfo(1000, 10000000);
+    std::vector<FlightRecord> records(CAPACITY);
+    FlightRecordingHeader header = {};
+
+    RecordEvents(&recorder, 5);
+    auto first = recorder.TakeRecords(&records, &header, FLIGHT_RECORDING_ON_DEMAND, 0);
+    EXPECT_EQ(header.magic_, (uint32_t) FLIGHT_RECORDING_MAGIC);
+    EXPECT_EQ(header.recordSize_, sizeof(FlightRecord));
+    EXPECT_EQ(header.recordCount_, 5u);
+    EXPECT_EQ(header.totalRecordCount_, 5u);
+    EXPECT_EQ(header.startTimestamp_, 1000u);
+    EXPECT_EQ(first, 0u);
+    ExpectRecords(records, first, header.recordCount_, header.totalRecordCount_);
+
+    // More than a ring since the last take, so that it wraps.
+    RecordEvents(&recorder, 2 * CAPACITY + 3);
+    first = recorder.TakeRecords(&records, &header, FLIGHT_RECORDING_LOST_PRESENT, 7);
+    EXPECT_EQ(header.recordCount_, CAPACITY);
+    EXPECT_EQ(header.totalRecordCount_, 2 * CAPACITY + 8);
+    EXPECT_EQ(header.reason_, (uint32_t) FLIGHT_RECORDING_LOST_PRESENT);
+    EXPECT_EQ(header.frameId_, 7u);
+    EXPECT_EQ(first, 8u);
+    ExpectRecords(records, first, header.recordCount_, header.totalRecordCount_);
+
+    // Nothing new.
+    recorder.TakeRecords(&records, &header, FLIGHT_RECORDING_ON_DEMAND, 0);
+    EXPECT_EQ(header.recordCount_, 0u);
+    EXPECT_EQ(header.totalRecordCount_, 2 * CAPACITY + 8);
+    EXPECT_EQ(recorder.RecordCount(), 2 * CAPACITY + 8);
+}
+
+TEST(FlightRecorderTests, WriterWritesRecordings)
+{
+    FlightRecorder recorder(CAPACITY);
+    FlightRecordingWriter writer;
+    writer.Start(PathPrefix().c_str(), 2, CAPACITY);
+
+    RecordEvents(&recorder, CAPACITY + 5);
+    EXPECT_TRUE(writer.Submit(&recorder, FLIGHT_RECORDING_LOST_PRESENT, 3));
+    writer.Flush();
+    EXPECT_FALSE(writer.IsBusy());
+    EXPECT_EQ(writer.WrittenCount(), 1u);
+
+    RecordEvents(&recorder, 4);
+    EXPECT_TRUE(writer.Submit(&recorder, FLIGHT_RECORDING_ON_DEMAND, 0));
+    writer.Flush();
+
+    // At most maxFiles recordings are written.
+    RecordEvents(&recorder, 4);
+    EXPECT_FALSE(writer.Submit(&recorder, FLIGHT_RECORDING_ON_DEMAND, 0));
+    EXPECT_EQ(recorder.RecordCount(), CAPACITY + 13u);
+    writer.Stop();
+    EXPECT_EQ(writer.WrittenCount(), 2u);
+    EXPECT_EQ(writer.FailedCount(), 0u);
+
+    FlightRecordingHeader header = {};
+    std::vector<FlightRecord> records;
+    ASSERT_TRUE(ReadRecording(RecordingPath(1), &header, &records));
+    EXPECT_EQ(header.reason_, (uint32_t) FLIGHT_RECORDING_LOST_PRESENT);
+    EXPECT_EQ(header.frameId_, 3u);
+    EXPECT_EQ(header.recordCount_, CAPACITY);
+    ExpectRecords(records, 0, header.recordCount_, CAPACITY + 5);
+
+    ASSERT_TRUE(ReadRecording(RecordingPath(2), &header, &records));
+    EXPECT_EQ(header.reason_, (uint32_t) FLIGHT_RECORDING_ON_DEMAND);
+    EXPECT_EQ(header.recordCount_, 4u);
+    ExpectRecords(records, 0, header.recordCount_, CAPACITY + 9);
+}
+
+TEST(FlightRecorderTests, WriterCountsFailures)
+{
+    auto path = testing::TempDir() + "FlightRecorderTests-missing/x";
+    FlightRecorder recorder(CAPACITY);
+    FlightRecordingWriter writer;
+    writer.Start(std::wstring(path.begin(), path.end()).c_str(), 8, CAPACITY);
+
+    RecordEvents(&recorder, 3);
+    EXPECT_TRUE(writer.Submit(&recorder, FLIGHT_RECORDING_ON_DEMAND, 0));
+    writer.Stop();
+    EXPECT_EQ(writer.WrittenCount(), 0u);
+    EXPECT_EQ(writer.FailedCount(), 1u);
+}
+
+// A request made on another thread is serviced by the consumer, and the
+// recording is then written in the background.
+TEST(FlightRecorderTests, ConsumerRequest)
+{
+    PMTraceConsumer pmConsumer;
+    FlightRecordingWriter writer;
+    writer.Start(PathPrefix().c_str());
+
+    RecordEvents(&pmConsumer.mFlightRecorder, 100);
+    pmConsumer.ServiceFlightRecordingRequest();
+    EXPECT_EQ(pmConsumer.mFlightRecorder.RecordCount(), 100u);
+
+    std::thread requester([&]() { pmConsumer.RequestFlightRecording(); });
+    requester.join();
+    EXPECT_TRUE(pmConsumer.mFlightRecordingRequested);
+
+    // Without a writer, the request is dropped.
+    pmConsumer.ServiceFlightRecordingRequest();
+    EXPECT_FALSE(pmConsumer.mFlightRecordingRequested);
+    EXPECT_EQ(writer.WrittenCount(), 0u);
+
+    pmConsumer.mFlightRecordingWriter = &writer;
+    pmConsumer.RequestFlightRecording();
+    pmConsumer.ServiceFlightRecordingRequest();
+    EXPECT_FALSE(pmConsumer.mFlightRecordingRequested);
+    pmConsumer.mFlightRecordingWriter = nullptr;
+    writer.Stop();
+    EXPECT_EQ(writer.WrittenCount(), 1u);
+
+    FlightRecordingHeader header = {};
+    std::vector<FlightRecord> records;
+    ASSERT_TRUE(ReadRecording(RecordingPath(1), &header, &records));
+    EXPECT_EQ(header.reason_, (uint32_t) FLIGHT_RECORDING_ON_DEMAND);
+    EXPECT_EQ(header.recordCount_, 100u);
+    ExpectRecords(records, 0, header.recordCount_, 100);
+}
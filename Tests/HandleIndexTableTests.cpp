@@ -0,0 +1,187 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include "../PresentData/HandleIndexTable.hpp"
+
+namespace {
+
+typedef std::map<uint64_t, uint32_t> TestModel;
+
+enum { INITIAL_CAPACITY = 64 };
+
+// Kernel-address-like handles: high bits set and low bits zero.
+uint64_t MakeHandle(uint64_t n)
+{
+    return 0xffffa00000000000ull + (n << 4);
+}
+
+// The slot that handle hashes to in a table with the given capacity (see
+// HandleIndexTable::Home()).  Used to build probe runs that collide and wrap
+// around the end of the table.
+size_t HomeSlot(uint64_t handle, size_t capacity)
+{
+    uint32_t shift = 64;
+    for (auto n = capacity; n > 1; n >>= 1) {
+        shift -= 1;
+    }
+    return (size_t) ((handle * 0x9E3779B97F4A7C15ull) >> shift);
+}
+
+// The first count handles whose home slot is slot.
+std::vector<uint64_t> HandlesWithHome(size_t slot, size_t count)
+{
+    std::vector<uint64_t> handles;
+    for (uint64_t n = 1; handles.size() < count; ++n) {
+        if (HomeSlot(MakeHandle(n), INITIAL_CAPACITY) == slot) {
+            handles.push_back(MakeHandle(n));
+        }
+    }
+    return handles;
+}
+
+void ExpectContents(HandleIndexTable const& table, TestModel const& model)
+{
+    ASSERT_EQ(table.size(), model.size());
+    EXPECT_EQ(table.empty(), model.empty());
+    EXPECT_LE(2 * table.size(), table.capacity());
+    for (auto const& pr : model) {
+        EXPECT_EQ(table.Find(pr.first), pr.second) << std::hex << pr.first;
+    }
+}
+
+}
+
+TEST(HandleIndexTableTests, EmptyTable)
+{
+    HandleIndexTable table;
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(table.capacity(), 0u);
+    EXPECT_EQ(table.Find(MakeHandle(1)), (uint32_t) HandleIndexTable::INVALID_INDEX);
+    EXPECT_EQ(table.Erase(MakeHandle(1)), (uint32_t) HandleIndexTable::INVALID_INDEX);
+}
+
+TEST(HandleIndexTableTests, InsertReplacesIndex)
+{
+    HandleIndexTable table;
+    table.Insert(MakeHandle(1), 10);
+    table.Insert(MakeHandle(2), 20);
+    table.Insert(0, 30);                // Zero is a valid handle
+    table.Insert(MakeHandle(1), 11);
+    EXPECT_EQ(table.size(), 3u);
+    EXPECT_EQ(table.Find(MakeHandle(1)), 11u);
+    EXPECT_EQ(table.Find(MakeHandle(2)), 20u);
+    EXPECT_EQ(table.Find(0), 30u);
+    EXPECT_EQ(table.Find(MakeHandle(3)), (uint32_t) HandleIndexTable::INVALID_INDEX);
+
+    EXPECT_EQ(table.Erase(MakeHandle(1)), 11u);
+    EXPECT_EQ(table.Erase(MakeHandle(1)), (uint32_t) HandleIndexTable::INVALID_INDEX);
+    EXPECT_EQ(table.Find(MakeHandle(2)), 20u);
+    EXPECT_EQ(table.size(), 2u);
+}
+
+// Erase every entry of a probe run that starts at the last slot and wraps
+// around to the start of the table, in every order, so that the backward
+// shift has to move entries across the wrap point.
+TEST(HandleIndexTableTests, EraseChainAcrossWrap)
+{
+    auto last = HandlesWithHome(INITIAL_CAPACITY - 1, 3);
+    auto first = HandlesWithHome(0, 2);
+    auto second = HandlesWithHome(1, 1);
+    auto fourth = HandlesWithHome(3, 1);
+
+    // The run occupies slots 63, 0, 1, 2, 3, 4, 5 with entries displaced from
+    // their home slots by up to 3.
+    std::vector<uint64_t> handles = { last[0], last[1], first[0], last[2], second[0], first[1], fourth[0] };
+
+    std::vector<size_t> order(handles.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+
+    size_t permutationCount = 0;
+    do {
+        HandleIndexTable table;
+        TestModel model;
+        for (size_t i = 0; i < handles.size(); ++i) {
+            table.Insert(handles[i], (uint32_t) i);
+            model.emplace(handles[i], (uint32_t) i);
+        }
+        ASSERT_EQ(table.capacity(), (size_t) INITIAL_CAPACITY);
+
+        for (auto i : order) {
+            EXPECT_EQ(table.Erase(handles[i]), (uint32_t) i);
+            EXPECT_EQ(table.Erase(handles[i]), (uint32_t) HandleIndexTable::INVALID_INDEX);
+            model.erase(handles[i]);
+            ExpectContents(table, model);
+            if (HasFailure()) {
+                return;
+            }
+        }
+        permutationCount += 1;
+    } while (std::next_permutation(order.begin(), order.end()));
+    EXPECT_EQ(permutationCount, 5040u);
+}
+
+TEST(HandleIndexTableTests, GrowKeepsEntriesReachable)
+{
+    HandleIndexTable table;
+    TestModel model;
+
+    // Colliding handles, including ones in a run that wraps, with the table
+    // growing several times.
+    auto last = HandlesWithHome(INITIAL_CAPACITY - 1, 20);
+    for (uint32_t i = 0; i < 1000; ++i) {
+        auto handle = i < last.size() ? last[i] : MakeHandle(i);
+        table.Insert(handle, i);
+        model[handle] = i;
+        if (i % 37 == 0) {
+            ExpectContents(table, model);
+        }
+    }
+    ExpectContents(table, model);
+    EXPECT_EQ(table.capacity(), 2048u);
+
+    table.clear();
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(table.Find(last[0]), (uint32_t) HandleIndexTable::INVALID_INDEX);
+    table.Insert(last[0], 1);
+    EXPECT_EQ(table.capacity(), (size_t) INITIAL_CAPACITY);
+    EXPECT_EQ(table.Find(last[0]), 1u);
+}
+
+TEST(HandleIndexTableTests, MatchesMap)
+{
+    HandleIndexTable table;
+    TestModel model;
+    std::mt19937 rng(4321);
+
+    // A small handle space so that runs collide, wrap, and are erased from
+    // the middle, with the table size moving up and down.
+    for (uint32_t i = 0; i < 50000; ++i) {
+        auto handle = MakeHandle(rng() % 96);
+        if (rng() % 2 == 0) {
+            table.Insert(handle, i);
+            model[handle] = i;
+        } else {
+            auto ii = model.find(handle);
+            if (ii == model.end()) {
+                EXPECT_EQ(table.Erase(handle), (uint32_t) HandleIndexTable::INVALID_INDEX);
+            } else {
+                EXPECT_EQ(table.Erase(handle), ii->second);
+                model.erase(ii);
+            }
+        }
+
+        if (i % 101 == 0) {
+            ExpectContents(table, model);
+            if (HasFailure()) {
+                return;
+            }
+        }
+    }
+    ExpectContents(table, model);
+}
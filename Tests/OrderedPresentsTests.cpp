@@ -0,0 +1,173 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include "../PresentData/PresentMonTraceConsumer.hpp"
+
+namespace {
+
+typedef PMTraceConsumer::OrderedPresents OrderedPresents;
+typedef std::unique_ptr<PresentEventPool, PresentEventPool::Detacher> PoolPtr;
+
+PresentEventPtr MakePresent(PresentEventPool* pool, uint64_t presentStartTime)
+{
+    auto present = pool->Allocate();
+    present->PresentStartTime = presentStartTime;
+    return present;
+}
+
+// Check the presents against a model keyed by PresentStartTime.
+void ExpectPresents(OrderedPresents const& presents, std::map<uint64_t, PresentEventPtr> const& expected)
+{
+    ASSERT_EQ(presents.size(), expected.size());
+    EXPECT_EQ(presents.empty(), expected.empty());
+    size_t index = 0;
+    for (auto const& pr : expected) {
+        EXPECT_EQ(presents[index], pr.second) << index;
+        index += 1;
+    }
+}
+
+}
+
+TEST(OrderedPresentsTests, KeepsOrderAcrossWrapAndGrowth)
+{
+    PoolPtr pool(new PresentEventPool);
+    std::map<uint64_t, PresentEventPtr> expected;
+    OrderedPresents presents;
+
+    auto insert = [&](uint64_t presentStartTime) {
+        auto present = MakePresent(pool.get(), presentStartTime);
+        EXPECT_TRUE(presents.Insert(present));
+        expected.emplace(presentStartTime, present);
+        ExpectPresents(presents, expected);
+    };
+    auto erase = [&](uint64_t presentStartTime) {
+        presents.Erase(presentStartTime);
+        expected.erase(presentStartTime);
+        ExpectPresents(presents, expected);
+    };
+
+    // Fill the initial ring, then erase the oldest presents so that the next
+    // appends wrap around the end of the ring.
+    for (uint64_t t = 10; t <= 80; t += 10) {
+        insert(t);
+    }
+    ASSERT_EQ(presents.mRing.size(), 8u);
+    for (uint64_t t = 10; t <= 50; t += 10) {
+        erase(t);
+    }
+    EXPECT_EQ(presents.mFirst, 5u);
+    for (uint64_t t = 90; t <= 120; t += 10) {
+        insert(t);
+    }
+    EXPECT_EQ(presents.mRing.size(), 8u);
+
+    // Out-of-order inserts and erases that shift presents across the wrap
+    // point.
+    insert(65);
+    erase(70);
+    insert(105);
+    EXPECT_EQ(presents.mRing.size(), 8u);
+
+    // Growing while wrapped keeps the order.
+    insert(61);
+    EXPECT_EQ(presents.mRing.size(), 16u);
+    EXPECT_EQ(presents.mFirst, 0u);
+    insert(62);
+    insert(1000);
+
+    // Erase the newest present, and ones that aren't there.
+    erase(1000);
+    erase(63);
+    erase(5000);
+    erase(0);
+}
+
+TEST(OrderedPresentsTests, RejectsDuplicateStartTime)
+{
+    PoolPtr pool(new PresentEventPool);
+    OrderedPresents presents;
+    auto first = MakePresent(pool.get(), 20);
+    EXPECT_TRUE(presents.Insert(first));
+    EXPECT_TRUE(presents.Insert(MakePresent(pool.get(), 30)));
+    EXPECT_TRUE(presents.Insert(MakePresent(pool.get(), 10)));
+
+    EXPECT_FALSE(presents.Insert(MakePresent(pool.get(), 20)));
+    EXPECT_FALSE(presents.Insert(MakePresent(pool.get(), 30)));
+    EXPECT_EQ(presents.size(), 3u);
+    EXPECT_EQ(presents[1], first);
+}
+
+TEST(OrderedPresentsTests, LowerBound)
+{
+    PoolPtr pool(new PresentEventPool);
+    OrderedPresents presents;
+    EXPECT_EQ(presents.LowerBound(5), 0u);
+
+    for (uint64_t t = 10; t <= 100; t += 10) {
+        presents.Insert(MakePresent(pool.get(), t));
+    }
+    presents.Erase(10);
+    presents.Erase(20);
+
+    EXPECT_EQ(presents.LowerBound(0), 0u);
+    EXPECT_EQ(presents.LowerBound(30), 0u);
+    EXPECT_EQ(presents.LowerBound(31), 1u);
+    EXPECT_EQ(presents.LowerBound(100), 7u);
+    EXPECT_EQ(presents.LowerBound(101), 8u);
+}
+
+TEST(OrderedPresentsTests, ErasedPresentsAreReleased)
+{
+    PoolPtr pool(new PresentEventPool);
+    OrderedPresents presents;
+    auto oldest = MakePresent(pool.get(), 10);
+    auto middle = MakePresent(pool.get(), 20);
+    presents.Insert(oldest);
+    presents.Insert(middle);
+    presents.Insert(MakePresent(pool.get(), 30));
+    EXPECT_EQ(oldest->mConsumerRefCount, 2u);
+    EXPECT_EQ(middle->mConsumerRefCount, 2u);
+
+    presents.Erase(20);
+    EXPECT_EQ(middle->mConsumerRefCount, 1u);
+    presents.Erase(10);
+    EXPECT_EQ(oldest->mConsumerRefCount, 1u);
+}
+
+TEST(OrderedPresentsTests, MatchesSortedMap)
+{
+    PoolPtr pool(new PresentEventPool);
+    std::map<uint64_t, PresentEventPtr> expected;
+    OrderedPresents presents;
+    std::mt19937 rng(1234);
+
+    // Mostly appends and erases of the oldest present, as in a trace, with
+    // some out-of-order presents.
+    uint64_t nextTime = 1000;
+    for (uint32_t i = 0; i < 20000; ++i) {
+        auto op = rng() % 16;
+        if (op < 7 || expected.empty()) {
+            nextTime += 1 + rng() % 10;
+            auto t = op == 0 ? nextTime - rng() % 200 : nextTime;
+            auto present = MakePresent(pool.get(), t);
+            EXPECT_EQ(presents.Insert(present), expected.emplace(t, present).second);
+        } else if (op < 14) {
+            auto t = op == 7 ? std::next(expected.begin(), rng() % expected.size())->first : expected.begin()->first;
+            presents.Erase(t);
+            expected.erase(t);
+        } else {
+            auto t = nextTime - rng() % 300;
+            auto index = (size_t) std::distance(expected.begin(), expected.lower_bound(t));
+            EXPECT_EQ(presents.LowerBound(t), index);
+        }
+
+        if (i % 97 == 0 || expected.size() < 4) {
+            ExpectPresents(presents, expected);
+        }
+    }
+    ExpectPresents(presents, expected);
+}
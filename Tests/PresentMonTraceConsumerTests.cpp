@@ -0,0 +1,92 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "../PresentData/PresentMonTraceConsumer.hpp"
+
+namespace {
+
+// Allocate presents from a new consumer, releasing some of them along the way
+// so that the pool reuses their storage, and return their FrameIds.
+std::vector<uint32_t> AllocateFrameIds(uint32_t count)
+{
+    PMTraceConsumer pmConsumer;
+    std::vector<PresentEventPtr> presents;
+    std::vector<uint32_t> frameIds;
+    for (uint32_t i = 0; i < count; ++i) {
+        presents.emplace_back(pmConsumer.mPresentEventPool->Allocate());
+        frameIds.push_back(presents.back()->FrameId);
+        if (presents.size() == 100) {
+            presents.clear();
+        }
+    }
+    return frameIds;
+}
+
+// Complete presentCount deferred presents, which are all held in
+// mCompletedPresents until their deferral expires.
+void CompleteDeferredPresents(PMTraceConsumer* pmConsumer, uint32_t presentCount)
+{
+    pmConsumer->mDeferralTimeLimit = 1000000;
+    for (uint32_t i = 0; i < presentCount; ++i) {
+        auto present = pmConsumer->mPresentEventPool->Allocate();
+        present->ProcessId = 1;
+        present->SwapChainAddress = 2;
+        present->PresentStartTime = 100 + i;
+        present->IsCompleted = true;
+        present->DeferredReason = DeferredReason_WaitingForPresentStop;
+        pmConsumer->AddPresentToCompletedList(present);
+    }
+}
+
+}
+
+TEST(PresentMonTraceConsumerTests, FrameIdsArePerConsumer)
+{
+    enum { PRESENT_COUNT = 100000 };
+
+    std::vector<uint32_t> frameIds[2];
+    std::thread threads[2];
+    for (uint32_t i = 0; i < _countof(threads); ++i) {
+        threads[i] = std::thread([&frameIds, i]() { frameIds[i] = AllocateFrameIds(PRESENT_COUNT); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (auto const& ids : frameIds) {
+        ASSERT_EQ(ids.size(), (size_t) PRESENT_COUNT);
+        for (uint32_t i = 0; i < PRESENT_COUNT; ++i) {
+            ASSERT_EQ(ids[i], i + 1) << i;
+        }
+    }
+}
+
+TEST(PresentMonTraceConsumerTests, CompletedPresentsGrowWithinMemoryLimit)
+{
+    PMTraceConsumer pmConsumer;
+    CompleteDeferredPresents(&pmConsumer, 5000);
+    EXPECT_EQ(pmConsumer.mCompletedCount, 5000u);
+    EXPECT_EQ(pmConsumer.mDroppedPresentCount, 0u);
+    for (uint32_t i = 0; i < pmConsumer.mCompletedCount; ++i) {
+        auto const& present = pmConsumer.mCompletedPresents[pmConsumer.GetCompletedIndex(pmConsumer.mCompletedIndex + i)];
+        ASSERT_EQ(present->PresentStartTime, 100u + i) << i;
+    }
+}
+
+TEST(PresentMonTraceConsumerTests, CompletedPresentsAreDroppedAndCounted)
+{
+    PMTraceConsumer pmConsumer;
+    pmConsumer.mTrackedPresentMemoryLimit = 0;
+    auto capacity = (uint32_t) pmConsumer.mCompletedPresents.size();
+    CompleteDeferredPresents(&pmConsumer, capacity + 100);
+    EXPECT_EQ(pmConsumer.mCompletedPresents.size(), (size_t) capacity);
+    EXPECT_EQ(pmConsumer.mCompletedCount, capacity);
+    EXPECT_EQ(pmConsumer.mDroppedPresentCount, 100u);
+
+    // The oldest presents were dropped.
+    auto const& oldest = pmConsumer.mCompletedPresents[pmConsumer.mCompletedIndex];
+    EXPECT_EQ(oldest->PresentStartTime, 200u);
+}
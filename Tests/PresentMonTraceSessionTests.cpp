@@ -0,0 +1,129 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "../PresentData/PresentMonTraceConsumer.hpp"
+#include "../PresentData/PresentMonTraceSession.hpp"
+#include "../PresentData/RawEventStream.hpp"
+#include "../PresentData/ETW/Microsoft_Windows_DXGI.h"
+#include "../PresentData/ETW/Microsoft_Windows_Dwm_Core.h"
+
+namespace {
+
+// An event Id that the providers' handlers ignore, so that the events are
+// dispatched but don't need to be decodable.
+USHORT const IGNORED_EVENT_ID = 0xfffe;
+
+FILE* OpenFile(std::string const& path, char const* mode)
+{
+#ifdef _WIN32
+    FILE* fp = nullptr;
+    return fopen_s(&fp, path.c_str(), mode) == 0 ? fp : nullptr;
+#else
+    return fopen(path.c_str(), mode);
+#endif
+}
+
+EventMetadataKey MetadataKey(GUID const& providerId)
+{
+    EventMetadataKey key = {};
+    key.guid_ = providerId;
+    key.desc_.Id = IGNORED_EVENT_ID;
+    return key;
+}
+
+// Metadata without any properties.
+void AddMetadata(EventMetadata* metadata, GUID const& providerId)
+{
+    TRACE_EVENT_INFO tei = {};
+    tei.ProviderGuid = providerId;
+    tei.EventDescriptor.Id = IGNORED_EVENT_ID;
+    metadata->AddEventInfo(MetadataKey(providerId), &tei, sizeof(tei));
+}
+
+void WriteEvent(RawEventStreamWriter* writer, EventMetadata* metadata, GUID const& providerId, uint64_t timestamp, uint32_t processId)
+{
+    uint32_t data = processId;
+    PMEventRecord eventRecord = {};
+    eventRecord.EventHeader.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+    eventRecord.EventHeader.ProviderId = providerId;
+    eventRecord.EventHeader.EventDescriptor.Id = IGNORED_EVENT_ID;
+    eventRecord.EventHeader.TimeStamp.QuadPart = (int64_t) timestamp;
+    eventRecord.EventHeader.ProcessId = processId;
+    eventRecord.EventHeader.ThreadId = processId + 1;
+    eventRecord.UserData = &data;
+    eventRecord.UserDataLength = sizeof(data);
+    writer->WriteEvent(&eventRecord, metadata);
+}
+
+}
+
+// One session replaying a raw event stream to two consumers: mPMConsumer
+// doesn't track the display and filters by process, and the additional
+// consumer tracks the display for all processes.  Each consumer only gets the
+// events its own configuration handles, both get the stream's metadata, and
+// the events are written back out with their metadata.
+TEST(PresentMonTraceSessionTests, ReplayToDifferentlyConfiguredConsumers)
+{
+    auto inputPath = testing::TempDir() + "PresentMonTraceSessionTests-in.pmrs";
+    auto outputPath = testing::TempDir() + "PresentMonTraceSessionTests-out.pmrs";
+
+    RawEventStreamHeader header = {};
+    header.timestampFrequency_ = 10000000;
+    {
+        EventMetadata metadata;
+        AddMetadata(&metadata, Microsoft_Windows_DXGI::GUID);
+        AddMetadata(&metadata, Microsoft_Windows_Dwm_Core::GUID);
+
+        RawEventStreamWriter writer;
+        ASSERT_TRUE(writer.Open(OpenFile(inputPath, "wb"), header));
+        WriteEvent(&writer, &metadata, Microsoft_Windows_Dwm_Core::GUID, 1000, 100);
+        WriteEvent(&writer, &metadata, Microsoft_Windows_DXGI::GUID,     1010, 100);
+        WriteEvent(&writer, &metadata, Microsoft_Windows_DXGI::GUID,     1020, 101);
+        writer.Close();
+        ASSERT_FALSE(writer.error_);
+    }
+
+    PMTraceConsumer filteredConsumer;
+    filteredConsumer.mTrackDisplay = false;
+    filteredConsumer.mFilteredProcessIds = true;
+    filteredConsumer.AddTrackedProcessForFiltering(100);
+
+    PMTraceConsumer displayConsumer;
+
+    PMTraceSession session;
+    session.mPMConsumer = &filteredConsumer;
+    session.mAdditionalConsumers.push_back(&displayConsumer);
+
+    RawEventStreamReader reader;
+    ASSERT_TRUE(reader.Open(OpenFile(inputPath, "rb")));
+    session.StartRawEventStream(reader.header_);
+
+    RawEventStreamWriter writer;
+    ASSERT_TRUE(writer.Open(OpenFile(outputPath, "wb"), reader.header_));
+    session.mRawEventStreamWriter = &writer;
+    EXPECT_TRUE(session.ProcessRawEventStream(&reader));
+    session.mRawEventStreamWriter = nullptr;
+    writer.Close();
+    reader.Close();
+
+    EXPECT_EQ(session.mDispatchCount[PMTraceSession::PROVIDER_DWM_CORE], 1u);
+    EXPECT_EQ(session.mDispatchCount[PMTraceSession::PROVIDER_DXGI], 2u);
+    EXPECT_EQ(session.mNumEventsFilteredByProcess, 1u);
+    EXPECT_EQ(filteredConsumer.mFlightRecorder.RecordCount(), 2u);
+    EXPECT_EQ(displayConsumer.mFlightRecorder.RecordCount(), 3u);
+
+    for (auto pmConsumer : { &filteredConsumer, &displayConsumer }) {
+        EXPECT_NE(pmConsumer->mMetadata.metadata_.Find(MetadataKey(Microsoft_Windows_DXGI::GUID)), nullptr);
+        EXPECT_NE(pmConsumer->mMetadata.metadata_.Find(MetadataKey(Microsoft_Windows_Dwm_Core::GUID)), nullptr);
+    }
+
+    EXPECT_FALSE(writer.error_);
+    EXPECT_EQ(writer.eventCount_, 3u);
+    EXPECT_EQ(writer.metadataCount_, 2u);
+
+    remove(inputPath.c_str());
+    remove(outputPath.c_str());
+}
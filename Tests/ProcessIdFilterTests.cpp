@@ -0,0 +1,120 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include "../PresentData/ProcessIdFilter.hpp"
+
+TEST(ProcessIdFilterTests, AddAndRemove)
+{
+    ProcessIdFilter filter;
+    EXPECT_FALSE(filter.Contains(0));
+    EXPECT_FALSE(filter.Contains(1234));
+    filter.Remove(1234);
+
+    // Ids on either side of a bitmap word boundary.
+    for (uint32_t processId : { 0u, 4u, 63u, 64u, 1234u }) {
+        filter.Add(processId);
+    }
+    for (uint32_t processId : { 0u, 4u, 63u, 64u, 1234u }) {
+        EXPECT_TRUE(filter.Contains(processId)) << processId;
+    }
+    for (uint32_t processId : { 1u, 62u, 65u, 128u, 1233u, 1235u }) {
+        EXPECT_FALSE(filter.Contains(processId)) << processId;
+    }
+
+    filter.Add(64);
+    filter.Remove(63);
+    EXPECT_FALSE(filter.Contains(63));
+    EXPECT_TRUE(filter.Contains(64));
+    filter.Remove(63);
+    filter.Remove(64);
+    EXPECT_FALSE(filter.Contains(64));
+    EXPECT_TRUE(filter.Contains(0));
+}
+
+// Ids past the end of the bitmap grow it, keeping the ids already in it.
+TEST(ProcessIdFilterTests, Grow)
+{
+    ProcessIdFilter filter;
+    filter.Add(16383);              // The last id in the initial bitmap
+    filter.Add(7);
+    EXPECT_FALSE(filter.Contains(16384));
+
+    filter.Add(16384);              // Doubles the bitmap
+    filter.Add(100000);             // Grows it by more than double
+    filter.Add(ProcessIdFilter::MAX_BITMAP_ID);
+    for (uint32_t processId : { 7u, 16383u, 16384u, 100000u, (uint32_t) ProcessIdFilter::MAX_BITMAP_ID }) {
+        EXPECT_TRUE(filter.Contains(processId)) << processId;
+    }
+    for (uint32_t processId : { 8u, 16385u, 99999u, 100001u, (uint32_t) ProcessIdFilter::MAX_BITMAP_ID - 1 }) {
+        EXPECT_FALSE(filter.Contains(processId)) << processId;
+    }
+
+    filter.Remove(16383);
+    EXPECT_FALSE(filter.Contains(16383));
+    EXPECT_TRUE(filter.Contains(16384));
+}
+
+// Ids past MAX_BITMAP_ID are kept in the sorted array rather than growing the
+// bitmap.
+TEST(ProcessIdFilterTests, LargeIds)
+{
+    uint32_t const FIRST_LARGE_ID = ProcessIdFilter::MAX_BITMAP_ID + 1;
+
+    ProcessIdFilter filter;
+    EXPECT_FALSE(filter.Contains(FIRST_LARGE_ID));
+    filter.Remove(FIRST_LARGE_ID);
+
+    filter.Add(UINT32_MAX);
+    filter.Add(FIRST_LARGE_ID);
+    filter.Add(0x80000000);
+    filter.Add(0x80000000);
+    filter.Add(5);
+    for (uint32_t processId : { FIRST_LARGE_ID, 0x80000000u, UINT32_MAX, 5u }) {
+        EXPECT_TRUE(filter.Contains(processId)) << processId;
+    }
+    for (uint32_t processId : { FIRST_LARGE_ID + 1, 0x7fffffffu, UINT32_MAX - 1, (uint32_t) ProcessIdFilter::MAX_BITMAP_ID }) {
+        EXPECT_FALSE(filter.Contains(processId)) << processId;
+    }
+
+    filter.Remove(0x80000000);
+    EXPECT_FALSE(filter.Contains(0x80000000));
+    EXPECT_TRUE(filter.Contains(FIRST_LARGE_ID));
+    EXPECT_TRUE(filter.Contains(UINT32_MAX));
+    filter.Remove(FIRST_LARGE_ID);
+    filter.Remove(UINT32_MAX);
+    EXPECT_FALSE(filter.Contains(FIRST_LARGE_ID));
+    EXPECT_FALSE(filter.Contains(UINT32_MAX));
+    EXPECT_TRUE(filter.Contains(5));
+}
+
+// A reader on another thread keeps seeing the ids that were added before it
+// looked, while the writer grows the bitmap and republishes the large ids.
+TEST(ProcessIdFilterTests, ConcurrentReader)
+{
+    uint32_t const COUNT = 2000;
+
+    ProcessIdFilter filter;
+    std::atomic<uint32_t> added{ 0 };
+
+    std::thread reader([&]() {
+        for (uint32_t n; (n = added.load(std::memory_order_acquire)) < COUNT; ) {
+            for (uint32_t i = 0; i < n; i += 1 + i / 8) {
+                EXPECT_TRUE(filter.Contains(i * 997));
+                EXPECT_TRUE(filter.Contains(UINT32_MAX - i));
+            }
+        }
+    });
+
+    for (uint32_t i = 0; i < COUNT; ++i) {
+        filter.Add(i * 997);
+        filter.Add(UINT32_MAX - i);
+        added.store(i + 1, std::memory_order_release);
+    }
+    reader.join();
+
+    EXPECT_FALSE(filter.Contains(998));
+    EXPECT_FALSE(filter.Contains(UINT32_MAX - COUNT));
+}
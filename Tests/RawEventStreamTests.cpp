@@ -0,0 +1,430 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "../PresentData/RawEventContainer.hpp"
+
+namespace {
+
+GUID const PROVIDER_A = { 0x1b5f3e2d, 0x7a6c, 0x4d8e, { 0x9f, 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd } };
+GUID const PROVIDER_B = { 0x2c604f3e, 0x8b7d, 0x4e9f, { 0xa0, 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde } };
+
+uint64_t const FIRST_TIMESTAMP = 1000;
+uint64_t const TIMESTAMP_STEP = 10;
+
+FILE* OpenFile(std::string const& path, char const* mode)
+{
+#ifdef _WIN32
+    FILE* fp = nullptr;
+    return fopen_s(&fp, path.c_str(), mode) == 0 ? fp : nullptr;
+#else
+    return fopen(path.c_str(), mode);
+#endif
+}
+
+std::vector<uint8_t> ReadFile(std::string const& path)
+{
+    std::vector<uint8_t> data;
+    auto fp = OpenFile(path, "rb");
+    if (fp != nullptr) {
+        uint8_t buffer[4096];
+        for (size_t n; (n = fread(buffer, 1, sizeof(buffer), fp)) > 0; ) {
+            data.insert(data.end(), buffer, buffer + n);
+        }
+        fclose(fp);
+    }
+    return data;
+}
+
+void WriteFile(std::string const& path, uint8_t const* data, size_t size)
+{
+    auto fp = OpenFile(path, "wb");
+    ASSERT_NE(fp, nullptr);
+    EXPECT_EQ(fwrite(data, 1, size, fp), size);
+    fclose(fp);
+}
+
+// The events written to each stream: a fixed-size event from PROVIDER_A and
+// a variable-size one from PROVIDER_B, with increasing timestamps.
+struct TestEvent {
+    EVENT_DESCRIPTOR desc_;
+    GUID providerId_;
+    uint64_t timestamp_;
+    uint32_t processId_;
+    std::vector<uint8_t> userData_;
+};
+
+std::vector<TestEvent> MakeEvents(uint32_t count)
+{
+    std::vector<TestEvent> events(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        auto e = &events[i];
+        e->desc_ = {};
+        e->desc_.Id = (USHORT) (i % 2 == 0 ? 1 : 2);
+        e->providerId_ = i % 2 == 0 ? PROVIDER_A : PROVIDER_B;
+        e->timestamp_ = FIRST_TIMESTAMP + i * TIMESTAMP_STEP;
+        e->processId_ = 100 + i % 7;
+        e->userData_.resize(i % 2 == 0 ? 8 : 4 + i % 23);
+        for (size_t j = 0; j < e->userData_.size(); ++j) {
+            e->userData_[j] = (uint8_t) (i + j);
+        }
+    }
+    return events;
+}
+
+// Metadata for each provider's event, with one UINT32 property.
+EventMetadataKey MetadataKey(TestEvent const& e)
+{
+    EventMetadataKey key = {};
+    key.guid_ = e.providerId_;
+    key.desc_ = e.desc_;
+    return key;
+}
+
+void AddMetadata(EventMetadata* metadata, TestEvent const& e)
+{
+    static wchar_t const NAME[] = L"Value";
+
+    std::vector<uint8_t> data(offsetof(TRACE_EVENT_INFO, EventPropertyInfoArray) + sizeof(EVENT_PROPERTY_INFO) + sizeof(NAME) / sizeof(wchar_t) * sizeof(WCHAR), 0);
+    auto tei = (TRACE_EVENT_INFO*) data.data();
+    tei->ProviderGuid = e.providerId_;
+    tei->EventDescriptor = e.desc_;
+    tei->PropertyCount = 1;
+    tei->TopLevelPropertyCount = 1;
+
+    auto epi = &tei->EventPropertyInfoArray[0];
+    epi->NameOffset = (ULONG) (offsetof(TRACE_EVENT_INFO, EventPropertyInfoArray) + sizeof(EVENT_PROPERTY_INFO));
+    epi->nonStructType.InType = TDH_INTYPE_UINT32;
+    epi->count = 1;
+    epi->length = 4;
+    for (size_t i = 0; i < _countof(NAME); ++i) {
+        ((WCHAR*) (data.data() + epi->NameOffset))[i] = (WCHAR) NAME[i];
+    }
+
+    metadata->AddEventInfo(MetadataKey(e), data.data(), (uint32_t) data.size());
+}
+
+PMEventRecord MakeEventRecord(TestEvent* e)
+{
+    PMEventRecord eventRecord = {};
+    eventRecord.EventHeader.Flags = EVENT_HEADER_FLAG_64_BIT_HEADER;
+    eventRecord.EventHeader.ProviderId = e->providerId_;
+    eventRecord.EventHeader.EventDescriptor = e->desc_;
+    eventRecord.EventHeader.TimeStamp.QuadPart = (int64_t) e->timestamp_;
+    eventRecord.EventHeader.ProcessId = e->processId_;
+    eventRecord.EventHeader.ThreadId = e->processId_ + 1;
+    eventRecord.UserData = e->userData_.data();
+    eventRecord.UserDataLength = (uint16_t) e->userData_.size();
+    return eventRecord;
+}
+
+RawEventStreamHeader MakeHeader()
+{
+    RawEventStreamHeader header = {};
+    header.timestampFrequency_ = 10000000;
+    return header;
+}
+
+bool WriteEvents(RawEventStreamWriter* writer, std::vector<TestEvent>* events)
+{
+    EventMetadata metadata;
+    AddMetadata(&metadata, (*events)[0]);
+    AddMetadata(&metadata, (*events)[1]);
+
+    for (auto& e : *events) {
+        auto eventRecord = MakeEventRecord(&e);
+        writer->WriteEvent(&eventRecord, &metadata);
+    }
+    writer->Close();
+    return !writer->error_;
+}
+
+void ExpectEvent(PMEventRecord const* eventRecord, TestEvent const& e)
+{
+    auto const& hdr = eventRecord->EventHeader;
+    EXPECT_EQ(hdr.ProviderId, e.providerId_);
+    EXPECT_EQ(hdr.EventDescriptor.Id, e.desc_.Id);
+    EXPECT_EQ((uint64_t) hdr.TimeStamp.QuadPart, e.timestamp_);
+    EXPECT_EQ(hdr.ProcessId, e.processId_);
+    EXPECT_EQ(hdr.ThreadId, e.processId_ + 1);
+    EXPECT_EQ(hdr.Flags, EVENT_HEADER_FLAG_64_BIT_HEADER);
+    EXPECT_EQ(eventRecord->EtwEventRecord, nullptr);
+    ASSERT_EQ(eventRecord->UserDataLength, e.userData_.size());
+    EXPECT_EQ(memcmp(eventRecord->UserData, e.userData_.data(), e.userData_.size()), 0);
+}
+
+// Read events from the reader until it stops, checking them against
+// events[first, end).
+template<typename Reader>
+RawEventStreamReader::Result ReadEvents(Reader* reader, std::vector<TestEvent> const& events, size_t first, size_t end)
+{
+    EventMetadata metadata;
+    auto i = first;
+    for (;;) {
+        PMEventRecord* eventRecord = nullptr;
+        auto result = reader->ReadNextEvent(&metadata, &eventRecord);
+        if (result != RawEventStreamReader::READ_EVENT) {
+            EXPECT_EQ(i, end);
+            if (result == RawEventStreamReader::READ_END) {
+                EXPECT_NE(metadata.metadata_.Find(MetadataKey(events[0])), nullptr);
+                EXPECT_NE(metadata.metadata_.Find(MetadataKey(events[1])), nullptr);
+            }
+            return result;
+        }
+
+        EXPECT_LT(i, end);
+        if (i < end) {
+            ExpectEvent(eventRecord, events[i]);
+        }
+        i += 1;
+    }
+}
+
+bool Decompresses(std::vector<uint8_t> const& compressed, std::vector<uint8_t> const& expected)
+{
+    std::vector<uint8_t> output(expected.size() + 1, 0xcd);
+    return DecompressRawEventChunk(compressed.data(), compressed.size(), output.data(), expected.size()) &&
+           memcmp(output.data(), expected.data(), expected.size()) == 0 &&
+           output.back() == 0xcd;
+}
+
+}
+
+TEST(RawEventStreamTests, CompressionRoundTrips)
+{
+    std::vector<std::vector<uint8_t>> inputs;
+    inputs.emplace_back(std::vector<uint8_t>{ 7 });
+    inputs.emplace_back(std::vector<uint8_t>{ 1, 2, 3, 4, 5 });
+    inputs.emplace_back(std::vector<uint8_t>(5000, 0xab));         // One long overlapping match
+
+    // Literal runs and matches with extended counts.
+    std::vector<uint8_t> mixed;
+    uint32_t x = 12345;
+    for (uint32_t i = 0; i < 200000; ++i) {
+        x = x * 1103515245 + 12345;
+        mixed.push_back((uint8_t) ((i / 1000) % 3 == 0 ? x >> 16 : i % 300));
+    }
+    inputs.push_back(mixed);
+
+    // A match at the largest offset.
+    std::vector<uint8_t> farMatch(0x10000 + 64);
+    for (size_t i = 0; i < farMatch.size(); ++i) {
+        x = x * 1103515245 + 12345;
+        farMatch[i] = i >= 0xffff ? farMatch[i - 0xffff] : (uint8_t) (x >> 16);
+    }
+    inputs.push_back(farMatch);
+
+    for (auto const& input : inputs) {
+        std::vector<uint8_t> compressed;
+        CompressRawEventChunk(input.data(), input.size(), &compressed);
+        EXPECT_TRUE(Decompresses(compressed, input));
+
+        // The output size has to match exactly.
+        std::vector<uint8_t> output(input.size() + 1);
+        EXPECT_FALSE(DecompressRawEventChunk(compressed.data(), compressed.size(), output.data(), input.size() - 1));
+        EXPECT_FALSE(DecompressRawEventChunk(compressed.data(), compressed.size(), output.data(), input.size() + 1));
+    }
+
+    std::vector<uint8_t> compressed;
+    CompressRawEventChunk(inputs[2].data(), inputs[2].size(), &compressed);
+    EXPECT_LT(compressed.size(), 64u);
+}
+
+TEST(RawEventStreamTests, DecompressionRejectsTruncatedAndCorruptData)
+{
+    std::vector<uint8_t> input;
+    for (uint32_t i = 0; i < 4000; ++i) {
+        input.push_back((uint8_t) (i % 37 + i / 500));
+    }
+    std::vector<uint8_t> compressed;
+    CompressRawEventChunk(input.data(), input.size(), &compressed);
+    ASSERT_TRUE(Decompresses(compressed, input));
+
+    std::vector<uint8_t> output(input.size());
+    for (size_t size = 0; size < compressed.size(); ++size) {
+        EXPECT_FALSE(DecompressRawEventChunk(compressed.data(), size, output.data(), output.size())) << size;
+    }
+
+    // Corrupt data may still decode to something of the right size, but must
+    // never read or write out of bounds.
+    for (size_t i = 0; i < compressed.size(); ++i) {
+        for (uint8_t b : { (uint8_t) 0x00, (uint8_t) 0xff, (uint8_t) (compressed[i] ^ 0x10) }) {
+            auto corrupt = compressed;
+            corrupt[i] = b;
+            DecompressRawEventChunk(corrupt.data(), corrupt.size(), output.data(), output.size());
+        }
+    }
+
+    // A match before the start of the output, or with offset 0.
+    uint8_t const badOffset[] = { 0x10, 'a', 0x02, 0x00, 0x00 };
+    uint8_t const zeroOffset[] = { 0x10, 'a', 0x00, 0x00, 0x00 };
+    EXPECT_FALSE(DecompressRawEventChunk(badOffset, sizeof(badOffset), output.data(), 5));
+    EXPECT_FALSE(DecompressRawEventChunk(zeroOffset, sizeof(zeroOffset), output.data(), 5));
+}
+
+TEST(RawEventStreamTests, StreamRoundTrips)
+{
+    auto path = testing::TempDir() + "RawEventStreamTests.pmrs";
+    auto events = MakeEvents(500);
+
+    RawEventStreamWriter writer;
+    ASSERT_TRUE(writer.Open(OpenFile(path, "wb"), MakeHeader()));
+    ASSERT_TRUE(WriteEvents(&writer, &events));
+    EXPECT_EQ(writer.eventCount_, events.size());
+    EXPECT_EQ(writer.metadataCount_, 2u);
+
+    RawEventStreamReader reader;
+    ASSERT_TRUE(reader.Open(OpenFile(path, "rb")));
+    EXPECT_EQ(reader.header_.timestampFrequency_, 10000000u);
+    EXPECT_EQ(ReadEvents(&reader, events, 0, events.size()), RawEventStreamReader::READ_END);
+    reader.Close();
+
+    // A stream truncated between records just ends early, but one truncated
+    // part way through a record is an error.  The first four records are the
+    // metadata and event from each provider.
+    auto data = ReadFile(path);
+    auto recordEnd = sizeof(RawEventStreamHeader);
+    for (size_t i = 0; i < 4; ++i) {
+        RawEventStreamRecord record;
+        memcpy(&record, data.data() + recordEnd, sizeof(record));
+        recordEnd += sizeof(record) + record.dataSize_;
+    }
+    WriteFile(path, data.data(), recordEnd);
+    ASSERT_TRUE(reader.Open(OpenFile(path, "rb")));
+    EXPECT_EQ(ReadEvents(&reader, events, 0, 2), RawEventStreamReader::READ_END);
+    reader.Close();
+
+    WriteFile(path, data.data(), recordEnd - 1);
+    ASSERT_TRUE(reader.Open(OpenFile(path, "rb")));
+    EXPECT_EQ(ReadEvents(&reader, events, 0, 1), RawEventStreamReader::READ_ERROR);
+    reader.Close();
+
+    WriteFile(path, data.data(), sizeof(RawEventStreamHeader) - 1);
+    EXPECT_FALSE(reader.Open(OpenFile(path, "rb")));
+
+    remove(path.c_str());
+}
+
+TEST(RawEventStreamTests, ContainerRoundTripsAcrossChunks)
+{
+    auto path = testing::TempDir() + "RawEventStreamTests.pmrc";
+    auto events = MakeEvents(2000);
+
+    RawEventStreamWriter writer;
+    ASSERT_TRUE(writer.OpenContainer(OpenFile(path, "wb"), MakeHeader(), 1024));
+    ASSERT_TRUE(WriteEvents(&writer, &events));
+    ASSERT_GT(writer.chunks_.size(), 10u);
+
+    RawEventContainerReader reader;
+    ASSERT_TRUE(reader.Open(OpenFile(path, "rb")));
+    EXPECT_EQ(reader.header_.startTimestamp_, FIRST_TIMESTAMP);
+    ASSERT_EQ(reader.chunks_.size(), writer.chunks_.size());
+    ASSERT_EQ(reader.providers_.size(), 2u);
+    EXPECT_EQ(reader.providers_[0].eventCount_ + reader.providers_[1].eventCount_, events.size());
+
+    // Every chunk repeats the metadata, and the per-chunk provider counts
+    // add up to the chunk's events.
+    uint64_t eventCount = 0;
+    for (size_t i = 0; i < reader.chunks_.size(); ++i) {
+        auto const& chunk = reader.chunks_[i];
+        EXPECT_EQ(chunk.eventCount_, reader.providerEventCounts_[i * 2] + reader.providerEventCounts_[i * 2 + 1]);
+        EXPECT_LE(chunk.firstTimestamp_, chunk.lastTimestamp_);
+        EXPECT_EQ(chunk.firstTimestamp_, events[eventCount].timestamp_);
+        eventCount += chunk.eventCount_;
+    }
+    EXPECT_EQ(eventCount, events.size());
+
+    EXPECT_EQ(ReadEvents(&reader, events, 0, events.size()), RawEventStreamReader::READ_END);
+    reader.Close();
+
+    remove(path.c_str());
+}
+
+TEST(RawEventStreamTests, ContainerSeeksToTimeWindow)
+{
+    auto path = testing::TempDir() + "RawEventStreamTests.pmrc";
+    auto events = MakeEvents(2000);
+
+    RawEventStreamWriter writer;
+    ASSERT_TRUE(writer.OpenContainer(OpenFile(path, "wb"), MakeHeader(), 1024));
+    ASSERT_TRUE(WriteEvents(&writer, &events));
+
+    // Windows starting and ending mid-chunk, on chunk boundaries, outside of
+    // the recording, and a single event.
+    auto chunk3 = writer.chunks_[3];
+    auto chunk7 = writer.chunks_[7];
+    struct {
+        size_t first_;
+        size_t end_;
+    } const windows[] = {
+        { 777, 1234 },
+        { (size_t) ((chunk3.firstTimestamp_ - FIRST_TIMESTAMP) / TIMESTAMP_STEP),
+          (size_t) ((chunk7.lastTimestamp_ - FIRST_TIMESTAMP) / TIMESTAMP_STEP) + 1 },
+        { 0, 1 },
+        { 1500, events.size() },
+        { 1000, 1001 },
+    };
+    for (auto const& window : windows) {
+        RawEventContainerReader reader;
+        ASSERT_TRUE(reader.Open(OpenFile(path, "rb")));
+        reader.SetTimeWindow(events[window.first_].timestamp_, events[window.end_ - 1].timestamp_);
+        EXPECT_EQ(ReadEvents(&reader, events, window.first_, window.end_), RawEventStreamReader::READ_END);
+    }
+
+    RawEventContainerReader reader;
+    ASSERT_TRUE(reader.Open(OpenFile(path, "rb")));
+    reader.SetTimeWindow(events.back().timestamp_ + 1, UINT64_MAX);
+    EXPECT_EQ(reader.firstChunk_, reader.endChunk_);
+    PMEventRecord* eventRecord = nullptr;
+    EventMetadata metadata;
+    EXPECT_EQ(reader.ReadNextEvent(&metadata, &eventRecord), RawEventStreamReader::READ_END);
+    reader.Close();
+
+    remove(path.c_str());
+}
+
+TEST(RawEventStreamTests, ContainerRejectsTruncatedAndCorruptFiles)
+{
+    auto path = testing::TempDir() + "RawEventStreamTests.pmrc";
+    auto corruptPath = testing::TempDir() + "RawEventStreamTests.corrupt.pmrc";
+    auto events = MakeEvents(300);
+
+    RawEventStreamWriter writer;
+    ASSERT_TRUE(writer.OpenContainer(OpenFile(path, "wb"), MakeHeader(), 1024));
+    ASSERT_TRUE(WriteEvents(&writer, &events));
+    auto data = ReadFile(path);
+
+    // Any truncation loses the trailer or misplaces the index.
+    RawEventContainerReader reader;
+    for (size_t size = 0; size < data.size(); size += size < 256 || data.size() - size < 256 ? 1 : 97) {
+        WriteFile(corruptPath, data.data(), size);
+        EXPECT_FALSE(reader.Open(OpenFile(corruptPath, "rb"))) << size;
+    }
+
+    // An index entry pointing past the chunks.
+    auto indexOffset = writer.chunks_.back().fileOffset_ + writer.chunks_.back().compressedSize_;
+    auto chunkEntryOffset = indexOffset + 2 * sizeof(RawEventContainerProvider);
+    auto corrupt = data;
+    RawEventContainerChunk entry;
+    memcpy(&entry, corrupt.data() + chunkEntryOffset, sizeof(entry));
+    entry.compressedSize_ = (uint32_t) (indexOffset - entry.fileOffset_ + 1);
+    entry.uncompressedSize_ = entry.compressedSize_;
+    memcpy(corrupt.data() + chunkEntryOffset, &entry, sizeof(entry));
+    WriteFile(corruptPath, corrupt.data(), corrupt.size());
+    EXPECT_FALSE(reader.Open(OpenFile(corruptPath, "rb")));
+
+    // A chunk that doesn't decompress.  The events before it are still read.
+    auto const& chunk = writer.chunks_[2];
+    ASSERT_LT(chunk.compressedSize_, chunk.uncompressedSize_);
+    corrupt = data;
+    memset(corrupt.data() + chunk.fileOffset_, 0, chunk.compressedSize_);
+    WriteFile(corruptPath, corrupt.data(), corrupt.size());
+    ASSERT_TRUE(reader.Open(OpenFile(corruptPath, "rb")));
+    EXPECT_EQ(ReadEvents(&reader, events, 0, writer.chunks_[0].eventCount_ + writer.chunks_[1].eventCount_), RawEventStreamReader::READ_ERROR);
+    reader.Close();
+
+    remove(corruptPath.c_str());
+    remove(path.c_str());
+}
@@ -0,0 +1,108 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include "../PresentData/SmallFlatMap.hpp"
+
+namespace {
+
+typedef SmallFlatMap<uint64_t, uint64_t, 4> TestMap;
+
+void ExpectEntries(TestMap const& map, uint64_t count)
+{
+    EXPECT_EQ(map.size(), count);
+    EXPECT_EQ((uint64_t) (map.end() - map.begin()), count);
+    for (uint64_t key = 0; key < count; ++key) {
+        auto ii = map.find(key);
+        ASSERT_NE(ii, map.end()) << key;
+        EXPECT_EQ(ii->second, key * 10);
+    }
+    EXPECT_EQ(map.find(count), map.end());
+}
+
+}
+
+TEST(SmallFlatMapTests, SpillsPastInlineCount)
+{
+    TestMap map;
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(map.begin(), map.end());
+
+    for (uint64_t key = 0; key < 4; ++key) {
+        auto r = map.emplace(key, key * 10);
+        EXPECT_TRUE(r.second);
+        EXPECT_EQ(r.first->first, key);
+        ExpectEntries(map, key + 1);
+    }
+
+    // The fifth entry moves everything to the heap, and later entries grow
+    // it past its initial reservation.
+    for (uint64_t key = 4; key < 20; ++key) {
+        auto r = map.emplace(key, key * 10);
+        EXPECT_TRUE(r.second);
+        EXPECT_EQ(r.first->first, key);
+        EXPECT_EQ(r.first->second, key * 10);
+        ExpectEntries(map, key + 1);
+    }
+}
+
+TEST(SmallFlatMapTests, EmplaceKeepsExistingValue)
+{
+    TestMap map;
+    for (uint64_t count : { 3u, 8u }) {
+        map.clear();
+        for (uint64_t key = 0; key < count; ++key) {
+            map.emplace(key, key * 10);
+        }
+
+        // Inline and spilled entries alike.
+        for (uint64_t key = 0; key < count; ++key) {
+            auto r = map.emplace(key, 999);
+            EXPECT_FALSE(r.second);
+            EXPECT_EQ(r.first->second, key * 10);
+        }
+        ExpectEntries(map, count);
+    }
+}
+
+TEST(SmallFlatMapTests, ClearReturnsToInlineStorage)
+{
+    TestMap map;
+    for (uint64_t key = 0; key < 10; ++key) {
+        map.emplace(key, key * 10);
+    }
+    map.clear();
+    EXPECT_TRUE(map.empty());
+    EXPECT_EQ(map.find(0), map.end());
+
+    auto r = map.emplace(0, 0);
+    EXPECT_TRUE(r.second);
+    EXPECT_GE((void const*) r.first, (void const*) &map);
+    EXPECT_LT((void const*) r.first, (void const*) (&map + 1));
+    ExpectEntries(map, 1);
+}
+
+TEST(SmallFlatMapTests, EqualityIgnoresOrder)
+{
+    for (uint64_t count : { 0u, 3u, 4u, 9u }) {
+        TestMap a;
+        TestMap b;
+        for (uint64_t key = 0; key < count; ++key) {
+            a.emplace(key, key * 10);
+            b.emplace(count - 1 - key, (count - 1 - key) * 10);
+        }
+        EXPECT_TRUE(a == b) << count;
+        EXPECT_FALSE(a != b) << count;
+
+        b.emplace(count, 0);
+        EXPECT_TRUE(a != b) << count;
+
+        if (count > 0) {
+            TestMap c;
+            for (uint64_t key = 0; key < count; ++key) {
+                c.emplace(key, key == count / 2 ? 1 : key * 10);
+            }
+            EXPECT_TRUE(a != c) << count;
+        }
+    }
+}
@@ -0,0 +1,142 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include "../PresentData/SpscRing.hpp"
+
+TEST(SpscRingTests, FillAndDrain)
+{
+    SpscRing<std::unique_ptr<uint32_t>> ring(4);
+    EXPECT_EQ(ring.capacity(), 4u);
+    EXPECT_TRUE(ring.empty());
+    EXPECT_FALSE(ring.full());
+
+    // Several rounds, so that the indices wrap around the slots.
+    uint32_t next = 0;
+    uint32_t expected = 0;
+    for (uint32_t round = 0; round < 5; ++round) {
+        for (uint32_t i = 0; i < 4; ++i) {
+            EXPECT_TRUE(ring.TryPush(std::unique_ptr<uint32_t>(new uint32_t(next++))));
+        }
+        EXPECT_TRUE(ring.full());
+
+        // A push to a full ring leaves the value with the caller.
+        std::unique_ptr<uint32_t> rejected(new uint32_t(999));
+        EXPECT_FALSE(ring.TryPush(std::move(rejected)));
+        ASSERT_NE(rejected, nullptr);
+        EXPECT_EQ(*rejected, 999u);
+
+        // Drain part of it, refill, then drain the rest.
+        std::unique_ptr<uint32_t> out[4];
+        EXPECT_EQ(ring.PopBatch(out, 3), 3u);
+        for (uint32_t i = 0; i < 3; ++i) {
+            EXPECT_EQ(*out[i], expected++);
+        }
+        EXPECT_FALSE(ring.full());
+        EXPECT_TRUE(ring.TryPush(std::unique_ptr<uint32_t>(new uint32_t(next++))));
+        EXPECT_TRUE(ring.TryPush(std::unique_ptr<uint32_t>(new uint32_t(next++))));
+
+        std::vector<std::unique_ptr<uint32_t>> all;
+        EXPECT_EQ(ring.PopAll(&all), 3u);
+        for (auto const& value : all) {
+            EXPECT_EQ(*value, expected++);
+        }
+        EXPECT_TRUE(ring.empty());
+        EXPECT_EQ(ring.PopBatch(out, 4), 0u);
+        EXPECT_EQ(ring.PopAll(&all), 0u);
+    }
+}
+
+TEST(SpscRingTests, PoppedValuesAreMovedOut)
+{
+    SpscRing<std::shared_ptr<uint32_t>> ring(2);
+    auto value = std::make_shared<uint32_t>(1);
+    auto copy = value;
+    EXPECT_TRUE(ring.TryPush(std::move(copy)));
+    EXPECT_EQ(value.use_count(), 2);
+
+    std::shared_ptr<uint32_t> out;
+    EXPECT_EQ(ring.PopBatch(&out, 1), 1u);
+    out.reset();
+    EXPECT_EQ(value.use_count(), 1);
+}
+
+// The consumer sees every value exactly once and in order while the producer
+// pushes as fast as it can, waiting through an EventCount when it is empty.
+TEST(SpscRingTests, ProducerConsumer)
+{
+    uint32_t const COUNT = 200000;
+    SpscRing<uint32_t> ring(64);
+    EventCount notEmpty;
+    std::atomic<bool> done{ false };
+
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < COUNT; ) {
+            auto value = i;
+            if (ring.TryPush(std::move(value))) {
+                notEmpty.Notify();
+                i += 1;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        done = true;
+        notEmpty.Notify();
+    });
+
+    uint32_t expected = 0;
+    uint32_t out[16];
+    while (expected < COUNT) {
+        auto count = ring.PopBatch(out, sizeof(out) / sizeof(out[0]));
+        for (size_t i = 0; i < count; ++i) {
+            ASSERT_EQ(out[i], expected);
+            expected += 1;
+        }
+        if (count == 0) {
+            auto key = notEmpty.PrepareWait();
+            if (!ring.empty() || done) {
+                notEmpty.CancelWait();
+            } else {
+                notEmpty.Wait(key, 1000);
+            }
+        }
+    }
+
+    producer.join();
+    EXPECT_TRUE(ring.empty());
+}
+
+TEST(SpscRingTests, EventCount)
+{
+    EventCount eventCount;
+
+    // Notify() with no waiters doesn't affect a later wait.
+    eventCount.Notify();
+    auto key = eventCount.PrepareWait();
+    EXPECT_FALSE(eventCount.Wait(key, 10));
+
+    // A Notify() between PrepareWait() and Wait() isn't lost.
+    key = eventCount.PrepareWait();
+    eventCount.Notify();
+    EXPECT_TRUE(eventCount.Wait(key, 0));
+
+    // Notify() wakes a waiting thread.
+    std::atomic<bool> ready{ false };
+    std::thread waiter([&]() {
+        auto k = eventCount.PrepareWait();
+        ready = true;
+        EXPECT_TRUE(eventCount.Wait(k, 60000));
+    });
+    while (!ready) {
+        std::this_thread::yield();
+    }
+    eventCount.Notify();
+    waiter.join();
+
+    key = eventCount.PrepareWait();
+    eventCount.CancelWait();
+    key = eventCount.PrepareWait();
+    EXPECT_FALSE(eventCount.Wait(key, 0));
+}
@@ -0,0 +1,226 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <random>
+#include "../PresentData/SubmitSequenceTable.hpp"
+
+namespace {
+
+typedef std::shared_ptr<int> TestValue;
+typedef SubmitSequenceTable<TestValue> TestTable;
+typedef std::map<std::pair<uint32_t, uint64_t>, TestValue> TestModel;
+
+enum { INITIAL_CAPACITY = 16 };
+
+// The slot that sequence hashes to in a table with the given capacity (see
+// SubmitSequenceTable::Home()).  Used to build probe runs that collide and
+// wrap around the end of the table.
+size_t HomeSlot(uint32_t sequence, size_t capacity)
+{
+    auto h = (uint64_t) sequence * 0x9E3779B97F4A7C15ull;
+    return (size_t) (h >> 32) & (capacity - 1);
+}
+
+// The first count sequences (from 1) whose home slot is slot.
+std::vector<uint32_t> SequencesWithHome(size_t slot, size_t count)
+{
+    std::vector<uint32_t> sequences;
+    for (uint32_t sequence = 1; sequences.size() < count; ++sequence) {
+        if (HomeSlot(sequence, INITIAL_CAPACITY) == slot) {
+            sequences.push_back(sequence);
+        }
+    }
+    return sequences;
+}
+
+void ExpectContents(TestTable* table, TestModel const& model)
+{
+    ASSERT_EQ(table->size(), model.size());
+    EXPECT_EQ(table->empty(), model.empty());
+
+    for (auto const& pr : model) {
+        auto value = table->Find(pr.first.first, pr.first.second);
+        ASSERT_NE(value, nullptr) << pr.first.first << ", " << pr.first.second;
+        EXPECT_EQ(*value, pr.second);
+
+        size_t count = 0;
+        size_t expectedCount = 0;
+        table->ForEachWithSequence(pr.first.first, [&](uint64_t hContext, TestValue const& v) {
+            auto ii = model.find(std::make_pair(pr.first.first, hContext));
+            EXPECT_NE(ii, model.end());
+            if (ii != model.end()) {
+                EXPECT_EQ(ii->second, v);
+            }
+            count += 1;
+        });
+        for (auto const& other : model) {
+            expectedCount += other.first.first == pr.first.first ? 1 : 0;
+        }
+        EXPECT_EQ(count, expectedCount);
+    }
+
+    size_t count = 0;
+    table->ForEach([&](uint32_t sequence, uint64_t hContext, TestValue const& value) {
+        auto ii = model.find(std::make_pair(sequence, hContext));
+        EXPECT_NE(ii, model.end());
+        if (ii != model.end()) {
+            EXPECT_EQ(ii->second, value);
+        }
+        count += 1;
+    });
+    EXPECT_EQ(count, model.size());
+}
+
+}
+
+TEST(SubmitSequenceTableTests, EmptyTable)
+{
+    TestTable table;
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(table.Find(1, 2), nullptr);
+    EXPECT_FALSE(table.Erase(1, std::make_shared<int>(0)));
+    table.ForEachWithSequence(1, [](uint64_t, TestValue const&) { ADD_FAILURE(); });
+    table.ForEach([](uint32_t, uint64_t, TestValue const&) { ADD_FAILURE(); });
+}
+
+TEST(SubmitSequenceTableTests, InsertReplacesValue)
+{
+    TestTable table;
+    auto a = std::make_shared<int>(1);
+    auto b = std::make_shared<int>(2);
+    table.Insert(5, 100, a);
+    table.Insert(5, 200, a);
+    table.Insert(5, 100, b);
+    EXPECT_EQ(table.size(), 2u);
+    EXPECT_EQ(*table.Find(5, 100), b);
+    EXPECT_EQ(*table.Find(5, 200), a);
+    EXPECT_EQ(table.Find(5, 300), nullptr);
+    EXPECT_EQ(table.Find(6, 100), nullptr);
+
+    // Erase matches the value, not the context.
+    EXPECT_FALSE(table.Erase(5, std::make_shared<int>(1)));
+    EXPECT_TRUE(table.Erase(5, a));
+    EXPECT_EQ(table.Find(5, 200), nullptr);
+    EXPECT_EQ(*table.Find(5, 100), b);
+}
+
+// Erase every entry of a probe run that starts at the last slot and wraps
+// around to the start of the table, in every order, so that the backward
+// shift has to move entries across the wrap point (both back to the end of
+// the table and within the start of it).
+TEST(SubmitSequenceTableTests, EraseChainAcrossWrap)
+{
+    auto last = SequencesWithHome(INITIAL_CAPACITY - 1, 3);
+    auto first = SequencesWithHome(0, 2);
+    auto second = SequencesWithHome(1, 1);
+
+    // (sequence, hContext) in insertion order; the run occupies slots 15, 0,
+    // 1, 2, 3, 4, 5 with entries displaced from their home slots by up to 3.
+    std::vector<std::pair<uint32_t, uint64_t>> keys = {
+        { last[0], 1 },
+        { last[1], 1 },
+        { first[0], 1 },
+        { last[2], 1 },
+        { first[0], 2 },    // A second context with the same sequence
+        { second[0], 1 },
+        { first[1], 1 },
+    };
+
+    std::vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+
+    size_t permutationCount = 0;
+    do {
+        TestTable table;
+        TestModel model;
+        std::vector<TestValue> values;
+        for (auto const& key : keys) {
+            values.push_back(std::make_shared<int>((int) values.size()));
+            table.Insert(key.first, key.second, values.back());
+            model.emplace(key, values.back());
+        }
+        ASSERT_EQ(table.size(), keys.size());
+
+        for (auto i : order) {
+            EXPECT_TRUE(table.Erase(keys[i].first, values[i]));
+            EXPECT_FALSE(table.Erase(keys[i].first, values[i]));
+            model.erase(keys[i]);
+            EXPECT_EQ(values[i].use_count(), 1);
+            ExpectContents(&table, model);
+            if (HasFailure()) {
+                return;
+            }
+        }
+        permutationCount += 1;
+    } while (std::next_permutation(order.begin(), order.end()));
+    EXPECT_EQ(permutationCount, 5040u);
+}
+
+TEST(SubmitSequenceTableTests, GrowKeepsEntriesReachable)
+{
+    TestTable table;
+    TestModel model;
+
+    // Colliding sequences, including ones in a run that wraps, with the
+    // table growing several times.
+    auto last = SequencesWithHome(INITIAL_CAPACITY - 1, 20);
+    for (uint32_t i = 0; i < 200; ++i) {
+        auto sequence = i < last.size() ? last[i] : i;
+        auto value = std::make_shared<int>((int) i);
+        table.Insert(sequence, i % 3, value);
+        model[std::make_pair(sequence, (uint64_t) (i % 3))] = value;
+        if (i % 13 == 0) {
+            ExpectContents(&table, model);
+        }
+    }
+    ExpectContents(&table, model);
+
+    table.clear();
+    EXPECT_TRUE(table.empty());
+    EXPECT_EQ(table.Find(last[0], 0), nullptr);
+    for (auto const& pr : model) {
+        EXPECT_EQ(pr.second.use_count(), 1);
+    }
+}
+
+TEST(SubmitSequenceTableTests, MatchesMap)
+{
+    TestTable table;
+    TestModel model;
+    std::mt19937 rng(5678);
+
+    // A small key space so that runs collide, wrap, and are erased from the
+    // middle, with the table size moving up and down.
+    for (uint32_t i = 0; i < 50000; ++i) {
+        auto sequence = (uint32_t) (rng() % 48);
+        auto hContext = (uint64_t) (rng() % 3);
+        auto key = std::make_pair(sequence, hContext);
+        if (rng() % 2 == 0) {
+            auto value = std::make_shared<int>((int) i);
+            table.Insert(sequence, hContext, value);
+            model[key] = value;
+        } else {
+            auto ii = model.find(key);
+            if (ii == model.end()) {
+                EXPECT_FALSE(table.Erase(sequence, std::make_shared<int>(0)));
+            } else {
+                EXPECT_TRUE(table.Erase(sequence, ii->second));
+                model.erase(ii);
+            }
+        }
+
+        if (i % 101 == 0) {
+            ExpectContents(&table, model);
+            if (HasFailure()) {
+                return;
+            }
+        }
+    }
+    ExpectContents(&table, model);
+}
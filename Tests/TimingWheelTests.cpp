@@ -0,0 +1,254 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <map>
+#include <random>
+#include "../PresentData/TimingWheel.hpp"
+
+namespace {
+
+typedef TimingWheel<uint32_t> TestWheel;
+
+uint64_t const LEVEL1_TICKS = TestWheel::SLOT_COUNT;
+uint64_t const LEVEL2_TICKS = LEVEL1_TICKS * TestWheel::SLOT_COUNT;
+uint64_t const LEVEL3_TICKS = LEVEL2_TICKS * TestWheel::SLOT_COUNT;
+uint64_t const WHEEL_TICKS  = LEVEL3_TICKS * TestWheel::SLOT_COUNT;
+
+// Tracks the values inserted into a wheel and checks that each Advance()
+// expires exactly the values that are due, in tick order.
+struct WheelModel {
+    TestWheel wheel_;
+    std::multimap<uint64_t, uint32_t> pending_;     // tick -> value
+    uint32_t tickShift_ = 0;
+    uint32_t nextValue_ = 0;
+
+    uint64_t Tick(uint64_t deadline) const
+    {
+        return (deadline + (1ull << tickShift_) - 1) >> tickShift_;
+    }
+
+    uint32_t Insert(uint64_t deadline)
+    {
+        auto value = nextValue_++;
+        wheel_.Insert(deadline, value);
+        pending_.emplace(Tick(deadline), value);
+        return value;
+    }
+
+    std::vector<uint32_t> Advance(uint64_t timestamp)
+    {
+        std::vector<uint32_t> expired;
+        uint64_t lastTick = 0;
+        wheel_.Advance(timestamp, [&](uint32_t value) {
+            // Find the value's tick, to check the order and that it's due.
+            auto ii = pending_.begin();
+            while (ii != pending_.end() && ii->second != value) {
+                ++ii;
+            }
+            EXPECT_NE(ii, pending_.end()) << value;
+            if (ii != pending_.end()) {
+                EXPECT_LE(ii->first, timestamp >> tickShift_) << value;
+                EXPECT_GE(ii->first, lastTick) << value;
+                lastTick = ii->first;
+                pending_.erase(ii);
+            }
+            expired.push_back(value);
+        });
+
+        // Nothing that is due is left behind.
+        if (!pending_.empty()) {
+            EXPECT_GT(pending_.begin()->first, timestamp >> tickShift_);
+        }
+        EXPECT_EQ(wheel_.size(), pending_.size());
+        return expired;
+    }
+};
+
+}
+
+TEST(TimingWheelTests, ExpiresAtDeadline)
+{
+    TestWheel wheel;
+    EXPECT_TRUE(wheel.empty());
+
+    wheel.Insert(10, 1);
+    wheel.Insert(10, 2);
+    wheel.Insert(12, 3);
+    EXPECT_EQ(wheel.size(), 3u);
+
+    std::vector<uint32_t> expired;
+    auto collect = [&](uint32_t value) { expired.push_back(value); };
+    wheel.Advance(9, collect);
+    EXPECT_TRUE(expired.empty());
+    wheel.Advance(10, collect);
+    EXPECT_EQ(expired.size(), 2u);
+    wheel.Advance(11, collect);
+    EXPECT_EQ(expired.size(), 2u);
+    wheel.Advance(12, collect);
+    EXPECT_EQ(expired, (std::vector<uint32_t>{ 1, 2, 3 }));
+    EXPECT_TRUE(wheel.empty());
+
+    // Deadlines that have already passed expire on the next Advance(), even
+    // if time doesn't move.
+    wheel.Insert(5, 4);
+    wheel.Advance(12, collect);
+    EXPECT_EQ(expired.back(), 4u);
+
+    // Time doesn't go backwards.
+    wheel.Insert(13, 5);
+    wheel.Advance(1, collect);
+    EXPECT_EQ(expired.size(), 4u);
+    wheel.Advance(13, collect);
+    EXPECT_EQ(expired.back(), 5u);
+}
+
+TEST(TimingWheelTests, DeadlinesRoundUpToTick)
+{
+    WheelModel model;
+    model.tickShift_ = 4;
+    model.wheel_.SetTickShift(4);
+
+    model.Insert(32);   // tick 2
+    model.Insert(33);   // tick 3
+    model.Insert(48);   // tick 3
+    EXPECT_TRUE(model.Advance(31).empty());
+    EXPECT_EQ(model.Advance(32).size(), 1u);
+    EXPECT_TRUE(model.Advance(47).empty());
+    EXPECT_EQ(model.Advance(48).size(), 2u);
+
+    // The tick size can't change while the wheel holds values.
+    model.Insert(100);
+    model.wheel_.SetTickShift(0);
+    EXPECT_TRUE(model.Advance(111).empty());
+    EXPECT_EQ(model.Advance(112).size(), 1u);
+}
+
+// Deadlines on either side of each level boundary, inserted at a time that
+// isn't aligned to any level, must cascade down and expire exactly on their
+// tick.
+TEST(TimingWheelTests, CascadesAcrossLevelBoundaries)
+{
+    for (uint64_t start : { (uint64_t) 0, LEVEL2_TICKS - 3, LEVEL3_TICKS + LEVEL2_TICKS + 17 }) {
+        WheelModel model;
+        model.Advance(start);
+
+        std::vector<uint64_t> deadlines;
+        for (uint64_t boundary : { LEVEL1_TICKS, LEVEL2_TICKS, LEVEL3_TICKS, WHEEL_TICKS }) {
+            for (uint64_t delta : { boundary - 1, boundary, boundary + 1 }) {
+                deadlines.push_back(start + delta);
+            }
+            // The next boundary of the level, from an unaligned start.
+            deadlines.push_back((start / boundary + 1) * boundary);
+            deadlines.push_back((start / boundary + 1) * boundary - 1);
+        }
+        deadlines.push_back(start + 5 * WHEEL_TICKS + 123);     // Beyond the last level
+        for (auto deadline : deadlines) {
+            model.Insert(deadline);
+        }
+
+        std::sort(deadlines.begin(), deadlines.end());
+        deadlines.erase(std::unique(deadlines.begin(), deadlines.end()), deadlines.end());
+        for (auto deadline : deadlines) {
+            model.Advance(deadline - 1);
+            EXPECT_FALSE(model.Advance(deadline).empty()) << start << " " << deadline;
+            if (::testing::Test::HasFailure()) {
+                return;
+            }
+        }
+        EXPECT_TRUE(model.wheel_.empty());
+    }
+}
+
+// One Advance() over a long idle period expires everything that is due, in
+// order, by skipping ahead to each occupied slot.
+TEST(TimingWheelTests, SkipsAheadOverIdleTime)
+{
+    WheelModel model;
+    model.Advance(1000);
+    model.Insert(1000 + 3 * LEVEL3_TICKS + 5);
+    model.Insert(1000 + 2 * LEVEL2_TICKS);
+    model.Insert(1000 + LEVEL1_TICKS + 1);
+    model.Insert(1000 + 7);
+    model.Insert(1000 + 20 * WHEEL_TICKS);
+
+    auto expired = model.Advance(1000 + 10 * WHEEL_TICKS);
+    EXPECT_EQ(expired, (std::vector<uint32_t>{ 3, 2, 1, 0 }));
+    EXPECT_EQ(model.wheel_.size(), 1u);
+
+    EXPECT_TRUE(model.Advance(1000 + 20 * WHEEL_TICKS - 1).empty());
+    EXPECT_EQ(model.Advance(1000 + 20 * WHEEL_TICKS).size(), 1u);
+}
+
+TEST(TimingWheelTests, ExpireCanInsert)
+{
+    TestWheel wheel;
+    wheel.Insert(10, 1);
+    wheel.Insert(20, 2);
+
+    // Values inserted while expiring that are already due expire no later
+    // than the next Advance().
+    std::vector<uint32_t> expired;
+    auto collect = [&](uint32_t value) {
+        expired.push_back(value);
+        if (value == 1) {
+            wheel.Insert(30, 3);
+            wheel.Insert(12, 4);
+        }
+    };
+    wheel.Advance(15, collect);
+    wheel.Advance(15, collect);
+    EXPECT_EQ(expired, (std::vector<uint32_t>{ 1, 4 }));
+    EXPECT_EQ(wheel.size(), 2u);
+
+    wheel.Advance(30, collect);
+    EXPECT_EQ(expired, (std::vector<uint32_t>{ 1, 4, 2, 3 }));
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimingWheelTests, Clear)
+{
+    TestWheel wheel;
+    for (uint32_t i = 0; i < 100; ++i) {
+        wheel.Insert((uint64_t) i * LEVEL2_TICKS / 3, i);
+    }
+    wheel.clear();
+    EXPECT_TRUE(wheel.empty());
+    wheel.Advance(UINT32_MAX, [](uint32_t) { ADD_FAILURE(); });
+
+    wheel.Insert((uint64_t) UINT32_MAX + 1, 1);
+    uint32_t count = 0;
+    wheel.Advance((uint64_t) UINT32_MAX + 1, [&](uint32_t) { count += 1; });
+    EXPECT_EQ(count, 1u);
+}
+
+TEST(TimingWheelTests, MatchesModel)
+{
+    for (uint32_t tickShift : { 0u, 7u }) {
+        WheelModel model;
+        model.tickShift_ = tickShift;
+        model.wheel_.SetTickShift(tickShift);
+        std::mt19937_64 rng(tickShift);
+
+        // Deadlines at every level, and advances from a few ticks to past
+        // several level boundaries at once.
+        uint64_t now = 0;
+        for (uint32_t i = 0; i < 20000; ++i) {
+            auto range = (uint64_t) 1 << (rng() % 27);
+            if (rng() % 3 != 0) {
+                model.Insert(now + (rng() % range << tickShift) + rng() % (1ull << tickShift));
+            } else {
+                now += rng() % (range << tickShift) / 16;
+                model.Advance(now);
+                if (::testing::Test::HasFailure()) {
+                    return;
+                }
+            }
+        }
+
+        model.Advance(UINT64_MAX / 2);
+        EXPECT_TRUE(model.wheel_.empty());
+        EXPECT_TRUE(model.pending_.empty());
+    }
+}
@@ -0,0 +1,992 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+
+#include <algorithm>
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <windows.h>
+#include <tdh.h> // Must include after windows.h
+
+#include <generated/version.h>
+
+#include "../../PresentData/PresentMonTraceConsumer.hpp"
+#include "../../PresentData/SubmitSequenceTable.hpp"
+#include "../../PresentData/TraceConsumer.hpp"
+#include "../../PresentData/ETW/Microsoft_Windows_D3D9.h"
+#include "../../PresentData/ETW/Microsoft_Windows_DXGI.h"
+#include "../../PresentData/ETW/Microsoft_Windows_DxgKrnl.h"
+#include "../../PresentData/ETW/Microsoft_Windows_EventMetadata.h"
+
+// ----------------------------------------------------------------------------
+// Recorded events
+//
+// Benchmarks replay events that were first loaded from an ETL into memory, so
+// that the results only measure the code under test and not ETW's file
+// parsing.
+
+struct RecordedEvents {
+    std::vector<PMEventRecord> records_;
+    std::vector<EVENT_RECORD> etwRecords_;  // For TDH lookups of events without ETL metadata
+    std::vector<uint32_t> userDataOffsets_;
+    std::vector<uint8_t> userData_;
+};
+
+RecordedEvents* gRecordingTarget = nullptr;
+
+void CALLBACK RecordEventCallback(EVENT_RECORD* eventRecord)
+{
+    auto events = gRecordingTarget;
+
+    EVENT_RECORD etwRecord = *eventRecord;
+    etwRecord.ExtendedDataCount = 0;
+    etwRecord.ExtendedData = nullptr;
+    etwRecord.UserData = nullptr;
+    etwRecord.UserContext = nullptr;
+
+    auto const& hdr = eventRecord->EventHeader;
+    PMEventRecord record = {};
+    record.EventHeader.ProviderId      = hdr.ProviderId;
+    record.EventHeader.EventDescriptor = hdr.EventDescriptor;
+    record.EventHeader.TimeStamp       = hdr.TimeStamp;
+    record.EventHeader.ProcessId       = hdr.ProcessId;
+    record.EventHeader.ThreadId        = hdr.ThreadId;
+    record.EventHeader.Flags           = hdr.Flags;
+    record.UserDataLength              = eventRecord->UserDataLength;
+
+    events->records_.push_back(record);
+    events->etwRecords_.push_back(etwRecord);
+    events->userDataOffsets_.push_back((uint32_t) events->userData_.size());
+    events->userData_.insert(events->userData_.end(),
+                             (uint8_t const*) eventRecord->UserData,
+                             (uint8_t const*) eventRecord->UserData + eventRecord->UserDataLength);
+}
+
+bool LoadEtl(wchar_t const* etlFile, RecordedEvents* events)
+{
+    EVENT_TRACE_LOGFILEW traceProps = {};
+    traceProps.LogFileName = (wchar_t*) etlFile;
+    traceProps.ProcessTraceMode = PROCESS_TRACE_MODE_EVENT_RECORD | PROCESS_TRACE_MODE_RAW_TIMESTAMP;
+    traceProps.EventRecordCallback = &RecordEventCallback;
+
+    auto traceHandle = OpenTraceW(&traceProps);
+    if (traceHandle == INVALID_PROCESSTRACE_HANDLE) {
+        fprintf(stderr, "error: failed to open ETL file: %ls\n", etlFile);
+        return false;
+    }
+
+    gRecordingTarget = events;
+    ProcessTrace(&traceHandle, 1, NULL, NULL);
+    CloseTrace(traceHandle);
+    gRecordingTarget = nullptr;
+
+    // Now that userData_ and etwRecords_ won't grow any more, point each
+    // record at its data.
+    for (size_t i = 0, n = events->records_.size(); i < n; ++i) {
+        events->etwRecords_[i].UserData = events->userData_.data() + events->userDataOffsets_[i];
+        events->records_[i].UserData = events->etwRecords_[i].UserData;
+        events->records_[i].EtwEventRecord = &events->etwRecords_[i];
+    }
+
+    return true;
+}
+
+bool IsMetadataEvent(PMEventRecord const& eventRecord)
+{
+    return eventRecord.EventHeader.ProviderId == Microsoft_Windows_EventMetadata::GUID;
+}
+
+// ----------------------------------------------------------------------------
+// Timing helpers
+
+struct Timer {
+    LARGE_INTEGER start_;
+
+    Timer() { QueryPerformanceCounter(&start_); }
+
+    double ElapsedSeconds() const
+    {
+        LARGE_INTEGER end, freq;
+        QueryPerformanceCounter(&end);
+        QueryPerformanceFrequency(&freq);
+        return double(end.QuadPart - start_.QuadPart) / double(freq.QuadPart);
+    }
+};
+
+void PrintResult(char const* name, double seconds, size_t operationCount)
+{
+    printf("    %-24s %10.3f ms  %8.2f ns/op\n", name, seconds * 1000.0,
+           operationCount == 0 ? 0.0 : seconds * 1000000000.0 / double(operationCount));
+}
+
+// ----------------------------------------------------------------------------
+// decode benchmark
+//
+// Replays the property lookups PMTraceConsumer makes for the DxgKrnl, DXGI,
+// and D3D9 events it handles through both EventMetadata::ScanEventData() (the
+// name-search path) and EventMetadata::GetEventData() (the planned path), and
+// checks that both produce the same results.
+
+struct DecodeRequest {
+    GUID const* guid_;
+    uint16_t id_;
+    uint8_t minVersion_;
+    uint8_t maxVersion_;
+    uint32_t optionalCount_;
+    std::vector<wchar_t const*> names_;
+};
+
+std::vector<DecodeRequest> const& GetDecodeRequests()
+{
+    namespace Dxgk = Microsoft_Windows_DxgKrnl;
+    namespace Dxgi = Microsoft_Windows_DXGI;
+    namespace D3D9 = Microsoft_Windows_D3D9;
+    static std::vector<DecodeRequest> const requests = {
+        { &Dxgk::GUID, Dxgk::PresentHistory_Start::Id,            0, 0xff, 0, { L"Token", L"Model", L"TokenData" } },
+        { &Dxgk::GUID, Dxgk::PresentHistoryDetailed_Start::Id,    0, 0xff, 0, { L"Token", L"Model", L"TokenData" } },
+        { &Dxgk::GUID, Dxgk::Flip_Info::Id,                       0, 0xff, 0, { L"FlipInterval", L"MMIOFlip" } },
+        { &Dxgk::GUID, Dxgk::IndependentFlip_Info::Id,            0, 0xff, 0, { L"SubmitSequence", L"FlipInterval" } },
+        { &Dxgk::GUID, Dxgk::QueuePacket_Start::Id,               0, 0xff, 0, { L"PacketType", L"SubmitSequence", L"hContext", L"bPresent" } },
+        { &Dxgk::GUID, Dxgk::QueuePacket_Start_2::Id,             0, 0xff, 0, { L"hContext", L"SubmitSequence" } },
+        { &Dxgk::GUID, Dxgk::QueuePacket_Stop::Id,                0, 0xff, 0, { L"hContext", L"SubmitSequence" } },
+        { &Dxgk::GUID, Dxgk::MMIOFlip_Info::Id,                   0, 0xff, 0, { L"FlipSubmitSequence", L"Flags" } },
+        { &Dxgk::GUID, Dxgk::MMIOFlipMultiPlaneOverlay_Info::Id,  0,    1, 1, { L"FlipSubmitSequence", L"FlipEntryStatusAfterFlip" } },
+        { &Dxgk::GUID, Dxgk::MMIOFlipMultiPlaneOverlay_Info::Id,  2, 0xff, 0, { L"FlipSubmitSequence", L"FlipEntryStatusAfterFlip" } },
+        { &Dxgk::GUID, Dxgk::VSyncDPC_Info::Id,                   0, 0xff, 0, { L"FlipFenceId" } },
+        { &Dxgk::GUID, Dxgk::VSyncDPCMultiPlane_Info::Id,         0,    0, 0, { L"PlaneCount", L"ScannedPhysicalAddress", L"FlipEntryCount", L"FlipSubmitSequence" } },
+        { &Dxgk::GUID, Dxgk::VSyncDPCMultiPlane_Info::Id,         1, 0xff, 0, { L"PlaneCount", L"PresentIdOrPhysicalAddress", L"FlipEntryCount", L"FlipSubmitSequence" } },
+        { &Dxgk::GUID, Dxgk::HSyncDPCMultiPlane_Info::Id,         0, 0xff, 0, { L"PlaneCount", L"ScannedPhysicalAddress", L"FlipEntryCount", L"FlipSubmitSequence" } },
+        { &Dxgk::GUID, Dxgk::Present_Info::Id,                    0, 0xff, 0, { L"hWindow" } },
+        { &Dxgk::GUID, Dxgk::PresentHistory_Info::Id,             0, 0xff, 0, { L"Token" } },
+        { &Dxgk::GUID, Dxgk::Blit_Info::Id,                       0, 0xff, 0, { L"hwnd", L"bRedirectedPresent" } },
+        { &Dxgk::GUID, Dxgk::Context_Start::Id,                   0, 0xff, 0, { L"hContext", L"hDevice", L"NodeOrdinal" } },
+        { &Dxgk::GUID, Dxgk::Context_DCStart::Id,                 0, 0xff, 0, { L"hContext", L"hDevice", L"NodeOrdinal" } },
+        { &Dxgk::GUID, Dxgk::Context_Stop::Id,                    0, 0xff, 0, { L"hContext" } },
+        { &Dxgk::GUID, Dxgk::Device_Start::Id,                    0, 0xff, 0, { L"pDxgAdapter", L"hDevice" } },
+        { &Dxgk::GUID, Dxgk::Device_DCStart::Id,                  0, 0xff, 0, { L"pDxgAdapter", L"hDevice" } },
+        { &Dxgk::GUID, Dxgk::HwQueue_Start::Id,                   0, 0xff, 0, { L"hContext", L"ParentDxgHwQueue" } },
+        { &Dxgk::GUID, Dxgk::HwQueue_DCStart::Id,                 0, 0xff, 0, { L"hContext", L"ParentDxgHwQueue" } },
+        { &Dxgk::GUID, Dxgk::NodeMetadata_Info::Id,               0, 0xff, 0, { L"pDxgAdapter", L"NodeOrdinal", L"EngineType" } },
+        { &Dxgk::GUID, Dxgk::DmaPacket_Start::Id,                 0, 0xff, 0, { L"hContext", L"ulQueueSubmitSequence" } },
+        { &Dxgk::GUID, Dxgk::DmaPacket_Info::Id,                  0, 0xff, 0, { L"hContext", L"ulQueueSubmitSequence" } },
+        { &Dxgk::GUID, Dxgk::MMIOFlipMultiPlaneOverlay3_Info::Id, 8, 0xff, 0, { L"VidPnSourceId", L"PlaneCount", L"PresentId", L"LayerIndex", L"FlipSubmitSequence" } },
+
+        { &Dxgi::GUID, Dxgi::Present_Start::Id,                   0, 0xff, 0, { L"pIDXGISwapChain", L"Flags", L"SyncInterval" } },
+        { &Dxgi::GUID, Dxgi::PresentMultiplaneOverlay_Start::Id,  0, 0xff, 0, { L"pIDXGISwapChain", L"Flags", L"SyncInterval" } },
+        { &Dxgi::GUID, Dxgi::Present_Stop::Id,                    0, 0xff, 0, { L"Result" } },
+        { &Dxgi::GUID, Dxgi::PresentMultiplaneOverlay_Stop::Id,   0, 0xff, 0, { L"Result" } },
+        { &D3D9::GUID, D3D9::Present_Start::Id,                   0, 0xff, 0, { L"pSwapchain", L"Flags" } },
+        { &D3D9::GUID, D3D9::Present_Stop::Id,                    0, 0xff, 0, { L"Result" } },
+    };
+    return requests;
+}
+
+DecodeRequest const* FindDecodeRequest(PMEventRecord const& eventRecord)
+{
+    auto const& hdr = eventRecord.EventHeader;
+    for (auto const& request : GetDecodeRequests()) {
+        if (hdr.ProviderId == *request.guid_ &&
+            hdr.EventDescriptor.Id == request.id_ &&
+            hdr.EventDescriptor.Version >= request.minVersion_ &&
+            hdr.EventDescriptor.Version <= request.maxVersion_) {
+            return &request;
+        }
+    }
+    return nullptr;
+}
+
+struct DecodeWork {
+    PMEventRecord* eventRecord_;
+    DecodeRequest const* request_;
+};
+
+void InitDecodeDesc(DecodeRequest const& request, EventDataDesc* desc)
+{
+    for (size_t i = 0, n = request.names_.size(); i < n; ++i) {
+        desc[i] = {};
+        desc[i].name_ = request.names_[i];
+    }
+}
+
+int RunDecodeBenchmark(RecordedEvents* events, uint32_t iterationCount)
+{
+    enum { MAX_DESC_COUNT = 8 };
+
+    // Load any metadata embedded in the ETL and build the list of events to
+    // decode.
+    EventMetadata metadata;
+    std::vector<DecodeWork> work;
+    for (auto& record : events->records_) {
+        if (IsMetadataEvent(record)) {
+            metadata.AddMetadata(&record);
+            continue;
+        }
+        auto request = FindDecodeRequest(record);
+        if (request != nullptr) {
+            work.push_back({ &record, request });
+        }
+    }
+
+    printf("decode: %zu events, %zu decoded per iteration, %u iterations\n", events->records_.size(), work.size(), iterationCount);
+    if (work.empty()) {
+        return 0;
+    }
+
+    // Validate that both paths find the same data.  This also creates all of
+    // the plans (and TDH metadata lookups) so they're not included in the
+    // timing.
+    size_t mismatchCount = 0;
+    for (auto const& w : work) {
+        EventDataDesc scanDesc[MAX_DESC_COUNT];
+        EventDataDesc planDesc[MAX_DESC_COUNT];
+        auto descCount = (uint32_t) w.request_->names_.size();
+        InitDecodeDesc(*w.request_, scanDesc);
+        InitDecodeDesc(*w.request_, planDesc);
+        metadata.ScanEventData(w.eventRecord_, scanDesc, descCount, w.request_->optionalCount_);
+        metadata.GetEventData(w.eventRecord_, planDesc, descCount, w.request_->optionalCount_);
+        for (uint32_t i = 0; i < descCount; ++i) {
+            if (scanDesc[i].data_   != planDesc[i].data_ ||
+                scanDesc[i].size_   != planDesc[i].size_ ||
+                scanDesc[i].count_  != planDesc[i].count_ ||
+                scanDesc[i].status_ != planDesc[i].status_) {
+                if (mismatchCount == 0) {
+                    fprintf(stderr, "error: event id=%u version=%u property %ls differs between scan and plan\n",
+                            w.eventRecord_->EventHeader.EventDescriptor.Id,
+                            w.eventRecord_->EventHeader.EventDescriptor.Version,
+                            scanDesc[i].name_);
+                }
+                mismatchCount += 1;
+            }
+        }
+    }
+    if (mismatchCount > 0) {
+        fprintf(stderr, "error: %zu property lookups differ between scan and plan\n", mismatchCount);
+        return 1;
+    }
+
+    // Time each path.  The sum of the found sizes is printed to keep the
+    // lookups from being optimized away.
+    uint64_t checksum = 0;
+
+    Timer scanTimer;
+    for (uint32_t iteration = 0; iteration < iterationCount; ++iteration) {
+        for (auto const& w : work) {
+            EventDataDesc desc[MAX_DESC_COUNT];
+            InitDecodeDesc(*w.request_, desc);
+            metadata.ScanEventData(w.eventRecord_, desc, (uint32_t) w.request_->names_.size(), w.request_->optionalCount_);
+            checksum += desc[0].size_;
+        }
+    }
+    auto scanSeconds = scanTimer.ElapsedSeconds();
+
+    Timer planTimer;
+    for (uint32_t iteration = 0; iteration < iterationCount; ++iteration) {
+        for (auto const& w : work) {
+            EventDataDesc desc[MAX_DESC_COUNT];
+            InitDecodeDesc(*w.request_, desc);
+            metadata.GetEventData(w.eventRecord_, desc, (uint32_t) w.request_->names_.size(), w.request_->optionalCount_);
+            checksum += desc[0].size_;
+        }
+    }
+    auto planSeconds = planTimer.ElapsedSeconds();
+
+    auto opCount = work.size() * iterationCount;
+    PrintResult("ScanEventData", scanSeconds, opCount);
+    PrintResult("GetEventData (plan)", planSeconds, opCount);
+    printf("    speedup: %.2fx  plans: %zu  (checksum %llu)\n", planSeconds == 0.0 ? 0.0 : scanSeconds / planSeconds,
+           metadata.plans_.size(), checksum);
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+// metadata benchmark
+//
+// Looks up the TRACE_EVENT_INFO of each recorded event through
+// EventMetadata::GetEventInfo() and through the std::unordered_map that it
+// replaced.  The events are replayed both in their recorded order, where events
+// of the same kind tend to arrive in bursts, and round-robin over the distinct
+// event kinds, which defeats the last-hit cache.
+
+typedef std::unordered_map<EventMetadataKey, std::vector<uint8_t>, EventMetadataKeyHash, EventMetadataKeyEqual> MetadataMap;
+
+EventMetadataKey GetMetadataKey(PMEventRecord const& eventRecord)
+{
+    EventMetadataKey key;
+    key.guid_ = eventRecord.EventHeader.ProviderId;
+    key.desc_ = eventRecord.EventHeader.EventDescriptor;
+    return key;
+}
+
+void TimeMetadataLookups(char const* name, EventMetadata* metadata, MetadataMap const& map,
+                         std::vector<PMEventRecord*> const& order, uint32_t iterationCount)
+{
+    uint64_t checksum = 0;
+
+    Timer mapTimer;
+    for (uint32_t iteration = 0; iteration < iterationCount; ++iteration) {
+        for (auto eventRecord : order) {
+            auto ii = map.find(GetMetadataKey(*eventRecord));
+            checksum += ((TRACE_EVENT_INFO const*) ii->second.data())->PropertyCount;
+        }
+    }
+    auto mapSeconds = mapTimer.ElapsedSeconds();
+
+    Timer tableTimer;
+    for (uint32_t iteration = 0; iteration < iterationCount; ++iteration) {
+        for (auto eventRecord : order) {
+            checksum += metadata->GetEventInfo(eventRecord)->PropertyCount;
+        }
+    }
+    auto tableSeconds = tableTimer.ElapsedSeconds();
+
+    auto opCount = order.size() * iterationCount;
+    printf("  %s:\n", name);
+    PrintResult("unordered_map", mapSeconds, opCount);
+    PrintResult("EventMetadataTable", tableSeconds, opCount);
+    printf("    speedup: %.2fx  (checksum %llu)\n", tableSeconds == 0.0 ? 0.0 : mapSeconds / tableSeconds, checksum);
+}
+
+int RunMetadataBenchmark(RecordedEvents* events, uint32_t iterationCount)
+{
+    // Load any metadata embedded in the ETL, then look up every other event
+    // once so that all metadata (including any from TDH) is cached before
+    // timing.  The map is populated with copies of the TRACE_EVENT_INFO
+    // headers, which is all that the timed loops read.
+    EventMetadata metadata;
+    MetadataMap map;
+    std::vector<PMEventRecord*> recordedOrder;
+    std::vector<PMEventRecord*> distinctKinds;
+    for (auto& record : events->records_) {
+        if (IsMetadataEvent(record)) {
+            metadata.AddMetadata(&record);
+        }
+    }
+    for (auto& record : events->records_) {
+        if (IsMetadataEvent(record)) {
+            continue;
+        }
+
+        auto key = GetMetadataKey(record);
+        if (map.find(key) == map.end()) {
+            auto tei = (uint8_t const*) metadata.GetEventInfo(&record);
+            map.emplace(key, std::vector<uint8_t>(tei, tei + sizeof(TRACE_EVENT_INFO)));
+            distinctKinds.push_back(&record);
+        }
+
+        recordedOrder.push_back(&record);
+    }
+
+    printf("metadata: %zu events, %zu distinct event kinds, %u iterations\n", recordedOrder.size(), distinctKinds.size(), iterationCount);
+    if (recordedOrder.empty()) {
+        return 0;
+    }
+
+    // Round-robin over the distinct kinds for as many lookups as the recorded
+    // order.
+    std::vector<PMEventRecord*> roundRobinOrder;
+    roundRobinOrder.reserve(recordedOrder.size());
+    for (size_t i = 0, n = recordedOrder.size(); i < n; ++i) {
+        roundRobinOrder.push_back(distinctKinds[i % distinctKinds.size()]);
+    }
+
+    TimeMetadataLookups("recorded order", &metadata, map, recordedOrder, iterationCount);
+    TimeMetadataLookups("round-robin", &metadata, map, roundRobinOrder, iterationCount);
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+// submitsequence benchmark
+//
+// Replays the operations PMTraceConsumer makes on mPresentBySubmitSequence for
+// the recorded DxgKrnl events through both SubmitSequenceTable and the map of
+// maps that it replaced:
+//     QueuePacket_Start for a present packet   insert (sequence, hContext)
+//     QueuePacket_Stop                          find (sequence, hContext)
+//     *Flip_Info, VSyncDPC_Info                 find oldest by sequence
+// Presents are removed once more than MAX_IN_FLIGHT newer presents have been
+// inserted, which stands in for present completion.
+
+struct SubmitSequencePresent {
+    uint64_t presentStartTime_;
+};
+
+struct SubmitSequenceOp {
+    enum Type : uint32_t { INSERT, FIND, FIND_BY_SEQUENCE };
+    Type type_;
+    uint32_t sequence_;
+    uint64_t hContext_;
+};
+
+typedef std::unordered_map<uint32_t, std::unordered_map<uint64_t, SubmitSequencePresent*>> SubmitSequenceMap;
+
+struct SubmitSequenceKey {
+    uint32_t sequence_;
+    SubmitSequencePresent* present_;
+};
+
+size_t const MAX_IN_FLIGHT = 16;
+
+SubmitSequencePresent* FindOldest(SubmitSequenceMap const& map, uint32_t sequence)
+{
+    SubmitSequencePresent* present = nullptr;
+    auto ii = map.find(sequence);
+    if (ii != map.end()) {
+        for (auto const& pr : ii->second) {
+            if (present == nullptr || present->presentStartTime_ > pr.second->presentStartTime_) {
+                present = pr.second;
+            }
+        }
+    }
+    return present;
+}
+
+SubmitSequencePresent* FindOldest(SubmitSequenceTable<SubmitSequencePresent*> const& table, uint32_t sequence)
+{
+    SubmitSequencePresent* present = nullptr;
+    table.ForEachWithSequence(sequence, [&](uint64_t, SubmitSequencePresent* p) {
+        if (present == nullptr || present->presentStartTime_ > p->presentStartTime_) {
+            present = p;
+        }
+    });
+    return present;
+}
+
+bool GetSubmitSequenceOp(EventMetadata* metadata, PMEventRecord* eventRecord, SubmitSequenceOp* op)
+{
+    namespace Dxgk = Microsoft_Windows_DxgKrnl;
+
+    auto const& hdr = eventRecord->EventHeader;
+    if (hdr.ProviderId != Dxgk::GUID) {
+        return false;
+    }
+
+    EventDataDesc desc[4] = {};
+    switch (hdr.EventDescriptor.Id) {
+    case Dxgk::QueuePacket_Start::Id: {
+        desc[0].name_ = L"PacketType";
+        desc[1].name_ = L"SubmitSequence";
+        desc[2].name_ = L"hContext";
+        desc[3].name_ = L"bPresent";
+        metadata->GetEventData(eventRecord, desc, _countof(desc));
+        auto packetType = desc[0].GetData<uint32_t>();
+        if (packetType != (uint32_t) Dxgk::QueuePacketType::DXGKETW_MMIOFLIP_COMMAND_BUFFER &&
+            packetType != (uint32_t) Dxgk::QueuePacketType::DXGKETW_SOFTWARE_COMMAND_BUFFER &&
+            desc[3].GetData<BOOL>() == 0) {
+            return false;
+        }
+        op->type_ = SubmitSequenceOp::INSERT;
+        op->sequence_ = desc[1].GetData<uint32_t>();
+        op->hContext_ = desc[2].GetData<uint64_t>();
+        return true;
+    }
+    case Dxgk::QueuePacket_Stop::Id:
+        desc[0].name_ = L"hContext";
+        desc[1].name_ = L"SubmitSequence";
+        metadata->GetEventData(eventRecord, desc, 2);
+        op->type_ = SubmitSequenceOp::FIND;
+        op->sequence_ = desc[1].GetData<uint32_t>();
+        op->hContext_ = desc[0].GetData<uint64_t>();
+        return true;
+    case Dxgk::MMIOFlip_Info::Id:
+        desc[0].name_ = L"FlipSubmitSequence";
+        metadata->GetEventData(eventRecord, desc, 1);
+        op->type_ = SubmitSequenceOp::FIND_BY_SEQUENCE;
+        op->sequence_ = desc[0].GetData<uint32_t>();
+        op->hContext_ = 0;
+        return true;
+    case Dxgk::MMIOFlipMultiPlaneOverlay_Info::Id:
+        desc[0].name_ = L"FlipSubmitSequence";
+        metadata->GetEventData(eventRecord, desc, 1);
+        op->type_ = SubmitSequenceOp::FIND_BY_SEQUENCE;
+        op->sequence_ = (uint32_t) (desc[0].GetData<uint64_t>() >> 32u);
+        op->hContext_ = 0;
+        return true;
+    case Dxgk::IndependentFlip_Info::Id:
+        desc[0].name_ = L"SubmitSequence";
+        metadata->GetEventData(eventRecord, desc, 1);
+        op->type_ = SubmitSequenceOp::FIND_BY_SEQUENCE;
+        op->sequence_ = desc[0].GetData<uint32_t>();
+        op->hContext_ = 0;
+        return true;
+    case Dxgk::VSyncDPC_Info::Id:
+        desc[0].name_ = L"FlipFenceId";
+        metadata->GetEventData(eventRecord, desc, 1);
+        op->type_ = SubmitSequenceOp::FIND_BY_SEQUENCE;
+        op->sequence_ = (uint32_t) (desc[0].GetData<uint64_t>() >> 32u);
+        op->hContext_ = 0;
+        return true;
+    }
+
+    return false;
+}
+
+int RunSubmitSequenceBenchmark(RecordedEvents* events, uint32_t iterationCount)
+{
+    EventMetadata metadata;
+    std::vector<SubmitSequenceOp> ops;
+    size_t insertCount = 0;
+    for (auto& record : events->records_) {
+        if (IsMetadataEvent(record)) {
+            metadata.AddMetadata(&record);
+            continue;
+        }
+        SubmitSequenceOp op;
+        if (GetSubmitSequenceOp(&metadata, &record, &op)) {
+            ops.push_back(op);
+            insertCount += op.type_ == SubmitSequenceOp::INSERT ? 1 : 0;
+        }
+    }
+
+    printf("submitsequence: %zu events, %zu operations (%zu inserts) per iteration, %u iterations\n",
+           events->records_.size(), ops.size(), insertCount, iterationCount);
+    if (ops.empty()) {
+        return 0;
+    }
+
+    // One present per insert, ordered by start time.
+    std::vector<SubmitSequencePresent> presents(insertCount);
+    for (size_t i = 0; i < insertCount; ++i) {
+        presents[i].presentStartTime_ = i;
+    }
+
+    uint64_t mapChecksum = 0;
+    Timer mapTimer;
+    for (uint32_t iteration = 0; iteration < iterationCount; ++iteration) {
+        SubmitSequenceMap map;
+        std::vector<SubmitSequenceKey> inFlight;
+        size_t nextPresent = 0;
+        for (auto const& op : ops) {
+            switch (op.type_) {
+            case SubmitSequenceOp::INSERT: {
+                auto present = &presents[nextPresent++];
+                map[op.sequence_][op.hContext_] = present;
+                inFlight.push_back({ op.sequence_, present });
+                if (inFlight.size() > MAX_IN_FLIGHT) {
+                    auto key = inFlight[inFlight.size() - MAX_IN_FLIGHT - 1];
+                    auto ii = map.find(key.sequence_);
+                    if (ii != map.end()) {
+                        for (auto jj = ii->second.begin(), je = ii->second.end(); jj != je; ++jj) {
+                            if (jj->second == key.present_) {
+                                ii->second.erase(jj);
+                                break;
+                            }
+                        }
+                        if (ii->second.empty()) {
+                            map.erase(ii);
+                        }
+                    }
+                }
+                break;
+            }
+            case SubmitSequenceOp::FIND: {
+                auto ii = map.find(op.sequence_);
+                if (ii != map.end()) {
+                    auto jj = ii->second.find(op.hContext_);
+                    if (jj != ii->second.end()) {
+                        mapChecksum += jj->second->presentStartTime_;
+                    }
+                }
+                break;
+            }
+            case SubmitSequenceOp::FIND_BY_SEQUENCE: {
+                auto present = FindOldest(map, op.sequence_);
+                if (present != nullptr) {
+                    mapChecksum += present->presentStartTime_;
+                }
+                break;
+            }
+            }
+        }
+    }
+    auto mapSeconds = mapTimer.ElapsedSeconds();
+
+    uint64_t tableChecksum = 0;
+    Timer tableTimer;
+    for (uint32_t iteration = 0; iteration < iterationCount; ++iteration) {
+        SubmitSequenceTable<SubmitSequencePresent*> table;
+        std::vector<SubmitSequenceKey> inFlight;
+        size_t nextPresent = 0;
+        for (auto const& op : ops) {
+            switch (op.type_) {
+            case SubmitSequenceOp::INSERT: {
+                auto present = &presents[nextPresent++];
+                table.Insert(op.sequence_, op.hContext_, present);
+                inFlight.push_back({ op.sequence_, present });
+                if (inFlight.size() > MAX_IN_FLIGHT) {
+                    auto key = inFlight[inFlight.size() - MAX_IN_FLIGHT - 1];
+                    table.Erase(key.sequence_, key.present_);
+                }
+                break;
+            }
+            case SubmitSequenceOp::FIND: {
+                auto present = table.Find(op.sequence_, op.hContext_);
+                if (present != nullptr) {
+                    tableChecksum += (*present)->presentStartTime_;
+                }
+                break;
+            }
+            case SubmitSequenceOp::FIND_BY_SEQUENCE: {
+                auto present = FindOldest(table, op.sequence_);
+                if (present != nullptr) {
+                    tableChecksum += present->presentStartTime_;
+                }
+                break;
+            }
+            }
+        }
+    }
+    auto tableSeconds = tableTimer.ElapsedSeconds();
+
+    if (mapChecksum != tableChecksum) {
+        fprintf(stderr, "error: SubmitSequenceTable results differ from the map (%llu vs. %llu)\n", tableChecksum, mapChecksum);
+        return 1;
+    }
+
+    auto opCount = ops.size() * iterationCount;
+    PrintResult("unordered_map of maps", mapSeconds, opCount);
+    PrintResult("SubmitSequenceTable", tableSeconds, opCount);
+    printf("    speedup: %.2fx  (checksum %llu)\n", tableSeconds == 0.0 ? 0.0 : mapSeconds / tableSeconds, tableChecksum);
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+// gputrace benchmark
+//
+// Replays the GpuTrace operations PMTraceConsumer makes for the recorded
+// DxgKrnl device, context, and packet events.  Each iteration replays them
+// through a new GpuTrace, which includes registering every node and context
+// and growing their queues, and then again through a GpuTrace that has
+// already seen the whole recording, which only measures the lookups and queue
+// operations.
+
+struct GpuTraceOp {
+    enum Type : uint32_t {
+        REGISTER_DEVICE, UNREGISTER_DEVICE, REGISTER_CONTEXT, REGISTER_HWQUEUE, UNREGISTER_CONTEXT,
+        SET_ENGINE_TYPE, ENQUEUE_QUEUE_PACKET, COMPLETE_QUEUE_PACKET, ENQUEUE_DMA_PACKET, COMPLETE_DMA_PACKET,
+    };
+    Type type_;
+    uint32_t value_;            // NodeOrdinal, sequence, or EngineType
+    uint64_t handle_;           // hContext, hDevice, or NodeOrdinal
+    uint64_t handle2_;          // hDevice, ParentDxgHwQueue, or pDxgAdapter
+    uint64_t timestamp_;
+    uint32_t processId_;
+    bool isWaitPacket_;
+};
+
+bool GetGpuTraceOp(EventMetadata* metadata, PMEventRecord* eventRecord, GpuTraceOp* op)
+{
+    namespace Dxgk = Microsoft_Windows_DxgKrnl;
+
+    auto const& hdr = eventRecord->EventHeader;
+    if (hdr.ProviderId != Dxgk::GUID) {
+        return false;
+    }
+
+    op->value_ = 0;
+    op->handle_ = 0;
+    op->handle2_ = 0;
+    op->timestamp_ = (uint64_t) hdr.TimeStamp.QuadPart;
+    op->processId_ = hdr.ProcessId;
+    op->isWaitPacket_ = false;
+
+    EventDataDesc desc[4] = {};
+    switch (hdr.EventDescriptor.Id) {
+    case Dxgk::Device_DCStart::Id:
+    case Dxgk::Device_Start::Id:
+        desc[0].name_ = L"pDxgAdapter";
+        desc[1].name_ = L"hDevice";
+        metadata->GetEventData(eventRecord, desc, 2);
+        op->type_ = GpuTraceOp::REGISTER_DEVICE;
+        op->handle_ = desc[1].GetData<uint64_t>();
+        op->handle2_ = desc[0].GetData<uint64_t>();
+        return true;
+    case Dxgk::Device_Stop::Id:
+        desc[0].name_ = L"hDevice";
+        metadata->GetEventData(eventRecord, desc, 1);
+        op->type_ = GpuTraceOp::UNREGISTER_DEVICE;
+        op->handle_ = desc[0].GetData<uint64_t>();
+        return true;
+    case Dxgk::Context_DCStart::Id:
+    case Dxgk::Context_Start::Id:
+        desc[0].name_ = L"hContext";
+        desc[1].name_ = L"hDevice";
+        desc[2].name_ = L"NodeOrdinal";
+        metadata->GetEventData(eventRecord, desc, 3);
+        op->type_ = GpuTraceOp::REGISTER_CONTEXT;
+        op->handle_ = desc[0].GetData<uint64_t>();
+        op->handle2_ = desc[1].GetData<uint64_t>();
+        op->value_ = desc[2].GetData<uint32_t>();
+        op->processId_ = hdr.EventDescriptor.Id == Dxgk::Context_DCStart::Id ? 0 : hdr.ProcessId;
+        return true;
+    case Dxgk::Context_Stop::Id:
+        desc[0].name_ = L"hContext";
+        metadata->GetEventData(eventRecord, desc, 1);
+        op->type_ = GpuTraceOp::UNREGISTER_CONTEXT;
+        op->handle_ = desc[0].GetData<uint64_t>();
+        return true;
+    case Dxgk::HwQueue_DCStart::Id:
+    case Dxgk::HwQueue_Start::Id:
+        desc[0].name_ = L"hContext";
+        desc[1].name_ = L"ParentDxgHwQueue";
+        metadata->GetEventData(eventRecord, desc, 2);
+        op->type_ = GpuTraceOp::REGISTER_HWQUEUE;
+        op->handle_ = desc[0].GetData<uint64_t>();
+        op->handle2_ = desc[1].GetData<uint64_t>();
+        return true;
+    case Dxgk::NodeMetadata_Info::Id:
+        desc[0].name_ = L"pDxgAdapter";
+        desc[1].name_ = L"NodeOrdinal";
+        desc[2].name_ = L"EngineType";
+        metadata->GetEventData(eventRecord, desc, 3);
+        op->type_ = GpuTraceOp::SET_ENGINE_TYPE;
+        op->handle2_ = desc[0].GetData<uint64_t>();
+        op->handle_ = desc[1].GetData<uint32_t>();
+        op->value_ = (uint32_t) desc[2].GetData<Dxgk::DXGK_ENGINE>();
+        return true;
+    case Dxgk::QueuePacket_Start::Id:
+        desc[0].name_ = L"PacketType";
+        desc[1].name_ = L"SubmitSequence";
+        desc[2].name_ = L"hContext";
+        metadata->GetEventData(eventRecord, desc, 3);
+        op->type_ = GpuTraceOp::ENQUEUE_QUEUE_PACKET;
+        op->value_ = desc[1].GetData<uint32_t>();
+        op->handle_ = desc[2].GetData<uint64_t>();
+        op->isWaitPacket_ = desc[0].GetData<uint32_t>() == (uint32_t) Dxgk::QueuePacketType::DXGKETW_WAIT_COMMAND_BUFFER;
+        return true;
+    case Dxgk::QueuePacket_Start_2::Id:
+        desc[0].name_ = L"hContext";
+        desc[1].name_ = L"SubmitSequence";
+        metadata->GetEventData(eventRecord, desc, 2);
+        op->type_ = GpuTraceOp::ENQUEUE_QUEUE_PACKET;
+        op->value_ = desc[1].GetData<uint32_t>();
+        op->handle_ = desc[0].GetData<uint64_t>();
+        op->isWaitPacket_ = true;
+        return true;
+    case Dxgk::QueuePacket_Stop::Id:
+        desc[0].name_ = L"hContext";
+        desc[1].name_ = L"SubmitSequence";
+        metadata->GetEventData(eventRecord, desc, 2);
+        op->type_ = GpuTraceOp::COMPLETE_QUEUE_PACKET;
+        op->value_ = desc[1].GetData<uint32_t>();
+        op->handle_ = desc[0].GetData<uint64_t>();
+        return true;
+    case Dxgk::DmaPacket_Start::Id:
+    case Dxgk::DmaPacket_Info::Id:
+        desc[0].name_ = L"hContext";
+        desc[1].name_ = L"ulQueueSubmitSequence";
+        metadata->GetEventData(eventRecord, desc, 2);
+        op->type_ = hdr.EventDescriptor.Id == Dxgk::DmaPacket_Start::Id ? GpuTraceOp::ENQUEUE_DMA_PACKET
+                                                                       : GpuTraceOp::COMPLETE_DMA_PACKET;
+        op->value_ = desc[1].GetData<uint32_t>();
+        op->handle_ = desc[0].GetData<uint64_t>();
+        return op->value_ != 0;
+    }
+
+    return false;
+}
+
+void ReplayGpuTraceOps(GpuTrace* gpuTrace, std::vector<GpuTraceOp> const& ops)
+{
+    for (auto const& op : ops) {
+        switch (op.type_) {
+        case GpuTraceOp::REGISTER_DEVICE:       gpuTrace->RegisterDevice(op.handle_, op.handle2_); break;
+        case GpuTraceOp::UNREGISTER_DEVICE:     gpuTrace->UnregisterDevice(op.handle_); break;
+        case GpuTraceOp::REGISTER_CONTEXT:      gpuTrace->RegisterContext(op.handle_, op.handle2_, op.value_, op.processId_); break;
+        case GpuTraceOp::REGISTER_HWQUEUE:      gpuTrace->RegisterHwQueueContext(op.handle_, op.handle2_); break;
+        case GpuTraceOp::UNREGISTER_CONTEXT:    gpuTrace->UnregisterContext(op.handle_); break;
+        case GpuTraceOp::SET_ENGINE_TYPE:       gpuTrace->SetEngineType(op.handle2_, (uint32_t) op.handle_, (Microsoft_Windows_DxgKrnl::DXGK_ENGINE) op.value_); break;
+        case GpuTraceOp::ENQUEUE_QUEUE_PACKET:  gpuTrace->EnqueueQueuePacket(op.handle_, op.value_, op.processId_, op.timestamp_, op.isWaitPacket_); break;
+        case GpuTraceOp::COMPLETE_QUEUE_PACKET: gpuTrace->CompleteQueuePacket(op.handle_, op.value_, op.timestamp_); break;
+        case GpuTraceOp::ENQUEUE_DMA_PACKET:    gpuTrace->EnqueueDmaPacket(op.handle_, op.value_, op.timestamp_); break;
+        case GpuTraceOp::COMPLETE_DMA_PACKET:   gpuTrace->CompleteDmaPacket(op.handle_, op.value_, op.timestamp_); break;
+        }
+    }
+}
+
+int RunGpuTraceBenchmark(RecordedEvents* events, uint32_t iterationCount)
+{
+    EventMetadata metadata;
+    std::vector<GpuTraceOp> ops;
+    std::vector<uint32_t> processIds;
+    size_t packetCount = 0;
+    for (auto& record : events->records_) {
+        if (IsMetadataEvent(record)) {
+            metadata.AddMetadata(&record);
+            continue;
+        }
+        GpuTraceOp op;
+        if (GetGpuTraceOp(&metadata, &record, &op)) {
+            ops.push_back(op);
+            if (op.type_ >= GpuTraceOp::ENQUEUE_QUEUE_PACKET) {
+                packetCount += 1;
+            }
+            if (op.processId_ != 0 && std::find(processIds.begin(), processIds.end(), op.processId_) == processIds.end()) {
+                processIds.push_back(op.processId_);
+            }
+        }
+    }
+
+    printf("gputrace: %zu events, %zu operations (%zu packet) per iteration, %u iterations\n",
+           events->records_.size(), ops.size(), packetCount, iterationCount);
+    if (ops.empty()) {
+        return 0;
+    }
+
+    // GpuTrace reads its configuration from the consumer, which is otherwise
+    // unused.
+    PMTraceConsumer consumer;
+    consumer.mTrackGPU = true;
+    consumer.mTrackGPUVideo = true;
+
+    // The number of processes with GPU state afterwards is printed to keep the
+    // replay from being optimized away.
+    auto countProcesses = [&](GpuTrace const& gpuTrace) {
+        size_t count = 0;
+        for (auto processId : processIds) {
+            count += gpuTrace.HasProcessState(processId) ? 1 : 0;
+        }
+        return count;
+    };
+
+    size_t checksum = 0;
+    Timer freshTimer;
+    for (uint32_t iteration = 0; iteration < iterationCount; ++iteration) {
+        GpuTrace gpuTrace(&consumer);
+        ReplayGpuTraceOps(&gpuTrace, ops);
+        checksum += countProcesses(gpuTrace);
+    }
+    auto freshSeconds = freshTimer.ElapsedSeconds();
+
+    GpuTrace warmGpuTrace(&consumer);
+    ReplayGpuTraceOps(&warmGpuTrace, ops);
+
+    Timer warmTimer;
+    for (uint32_t iteration = 0; iteration < iterationCount; ++iteration) {
+        ReplayGpuTraceOps(&warmGpuTrace, ops);
+        checksum += countProcesses(warmGpuTrace);
+    }
+    auto warmSeconds = warmTimer.ElapsedSeconds();
+
+    // Replay again while recording the GPU timeline to a temporary file, to
+    // measure the overhead of --gpu_timeline_file.
+    double timelineSeconds = 0.0;
+    uint64_t timelineRecordCount = 0;
+    uint64_t timelineDroppedCount = 0;
+    GpuTimelineWriter timelineWriter;
+    FILE* timelineFile = nullptr;
+    if (tmpfile_s(&timelineFile) == 0 && timelineWriter.Open(timelineFile, 0, 0)) {
+        consumer.mGpuTimelineWriter = &timelineWriter;
+
+        Timer timelineTimer;
+        for (uint32_t iteration = 0; iteration < iterationCount; ++iteration) {
+            ReplayGpuTraceOps(&warmGpuTrace, ops);
+            checksum += countProcesses(warmGpuTrace);
+        }
+        timelineSeconds = timelineTimer.ElapsedSeconds();
+
+        consumer.mGpuTimelineWriter = nullptr;
+        timelineWriter.Close();
+        timelineRecordCount = timelineWriter.RecordCount();
+        timelineDroppedCount = timelineWriter.DroppedRecordCount();
+    }
+
+    auto opCount = ops.size() * iterationCount;
+    PrintResult("GpuTrace (new)", freshSeconds, opCount);
+    PrintResult("GpuTrace (warm)", warmSeconds, opCount);
+    if (timelineSeconds > 0.0) {
+        PrintResult("GpuTrace (warm, timeline)", timelineSeconds, opCount);
+        printf("    (%llu timeline records, %llu dropped)\n", timelineRecordCount, timelineDroppedCount);
+    }
+    printf("    (checksum %zu)\n", checksum);
+    return 0;
+}
+
+// ----------------------------------------------------------------------------
+
+struct Benchmark {
+    wchar_t const* name_;
+    char const* description_;
+    int (*run_)(RecordedEvents* events, uint32_t iterationCount);
+};
+
+Benchmark const gBenchmarks[] = {
+    { L"decode",         "EventMetadata property lookup: name scan vs. compiled plan", &RunDecodeBenchmark },
+    { L"metadata",       "EventMetadata TRACE_EVENT_INFO lookup: unordered_map vs. flat table", &RunMetadataBenchmark },
+    { L"submitsequence", "Submit sequence present lookup: unordered_map of maps vs. flat table", &RunSubmitSequenceBenchmark },
+    { L"gputrace",       "GpuTrace context, node, and packet queue tracking, with and without the GPU timeline", &RunGpuTraceBenchmark },
+};
+
+void usage()
+{
+    fprintf(stderr,
+        "usage: pm_bench.exe --etl=path [options]\n"
+        "options:\n"
+        "    --etl=path           ETL file whose events are replayed by each benchmark.\n"
+        "    --bench=name         Run only the named benchmark, argument can be used more than once.\n"
+        "    --iterations=count   Number of times to replay the events (default=10).\n"
+        "benchmarks:\n");
+    for (auto const& b : gBenchmarks) {
+        fprintf(stderr, "    %-20ls %s\n", b.name_, b.description_);
+    }
+    fprintf(stderr, "build: %s\n", PRESENT_MON_VERSION);
+}
+
+int wmain(
+    int argc,
+    wchar_t** argv)
+{
+    wchar_t const* etlFile = nullptr;
+    std::vector<std::wstring> benchNames;
+    uint32_t iterationCount = 10;
+    for (int i = 1; i < argc; ++i) {
+        if (wcsncmp(argv[i], L"--etl=", 6) == 0) {
+            etlFile = argv[i] + 6;
+            continue;
+        }
+
+        if (wcsncmp(argv[i], L"--bench=", 8) == 0) {
+            benchNames.emplace_back(argv[i] + 8);
+            continue;
+        }
+
+        if (wcsncmp(argv[i], L"--iterations=", 13) == 0) {
+            iterationCount = wcstoul(argv[i] + 13, nullptr, 10);
+            if (iterationCount > 0) {
+                continue;
+            }
+        }
+
+        fprintf(stderr, "error: unrecognized argument: %ls\n", argv[i]);
+        usage();
+        return 1;
+    }
+
+    if (etlFile == nullptr) {
+        usage();
+        return 1;
+    }
+
+    RecordedEvents events;
+    if (!LoadEtl(etlFile, &events)) {
+        return 1;
+    }
+
+    int result = 0;
+    for (auto const& b : gBenchmarks) {
+        auto run = benchNames.empty();
+        for (auto const& name : benchNames) {
+            run = run || name == b.name_;
+        }
+        if (run) {
+            result |= b.run_(&events, iterationCount);
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,241 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// pm_flight_decode prints a flight recording written by PMTraceConsumer (see
+// PresentData/FlightRecorder.hpp) in the same layout as PresentMon's verbose
+// trace.  Event records show the event's name and the start of its data, and
+// present records show the present's state when it was created, completed,
+// lost, or evicted.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <windows.h>
+
+#include <generated/version.h>
+
+#include "../../PresentData/FlightRecorder.hpp"
+#include "../../PresentData/PresentMonTraceConsumer.hpp"
+#include "../../PresentData/PresentMonTraceSession.hpp"
+
+namespace {
+
+FlightRecordingHeader gHeader;
+
+char* AddCommas(uint64_t t)
+{
+    static char buf[128];
+    auto r = sprintf_s(buf, "%llu", t);
+
+    auto commaCount = r == 0 ? 0 : ((r - 1) / 3);
+    for (int i = 0; i < commaCount; ++i) {
+        auto p = r + commaCount - 4 * i;
+        auto q = r - 3 * i;
+        buf[p - 1] = buf[q - 1];
+        buf[p - 2] = buf[q - 2];
+        buf[p - 3] = buf[q - 3];
+        buf[p - 4] = ',';
+    }
+
+    r += commaCount;
+    buf[r] = '\0';
+    return buf;
+}
+
+void PrintRecordHeader(FlightRecord const& record)
+{
+    auto frequency = gHeader.timestampFrequency_ == 0 ? 10000000ull : gHeader.timestampFrequency_;
+    auto start = gHeader.startTimestamp_;
+    if (record.time_ < start) {
+        wprintf(L"%15hs- %5u %5u ", AddCommas(1000000000ull * (start - record.time_) / frequency), record.processId_, record.threadId_);
+    } else {
+        wprintf(L"%16hs %5u %5u ", AddCommas(1000000000ull * (record.time_ - start) / frequency), record.processId_, record.threadId_);
+    }
+}
+
+char const* RuntimeName(uint8_t value)
+{
+    switch ((Runtime) value) {
+    case Runtime::DXGI:  return "DXGI";
+    case Runtime::D3D9:  return "D3D9";
+    case Runtime::Other: return "Other";
+    }
+    return "Unknown";
+}
+
+char const* PresentModeName(uint8_t value)
+{
+    switch ((PresentMode) value) {
+    case PresentMode::Unknown:                              return "Unknown";
+    case PresentMode::Hardware_Legacy_Flip:                 return "Hardware_Legacy_Flip";
+    case PresentMode::Hardware_Legacy_Copy_To_Front_Buffer: return "Hardware_Legacy_Copy_To_Front_Buffer";
+    case PresentMode::Hardware_Independent_Flip:            return "Hardware_Independent_Flip";
+    case PresentMode::Composed_Flip:                        return "Composed_Flip";
+    case PresentMode::Composed_Copy_GPU_GDI:                return "Composed_Copy_GPU_GDI";
+    case PresentMode::Composed_Copy_CPU_GDI:                return "Composed_Copy_CPU_GDI";
+    case PresentMode::Hardware_Composed_Independent_Flip:   return "Hardware_Composed_Independent_Flip";
+    }
+    return "Unknown";
+}
+
+char const* PresentResultName(uint8_t value)
+{
+    switch ((PresentResult) value) {
+    case PresentResult::Unknown:   return "Unknown";
+    case PresentResult::Presented: return "Presented";
+    case PresentResult::Discarded: return "Discarded";
+    }
+    return "Unknown";
+}
+
+char const* FrameTypeName(uint8_t value)
+{
+    switch ((FrameType) value) {
+    case FrameType::NotSet:      return "NotSet";
+    case FrameType::Unspecified: return "Unspecified";
+    case FrameType::Application: return "Application";
+    case FrameType::Repeated:    return "Repeated";
+    case FrameType::AMD_AFMF:    return "AMD_AFMF";
+    }
+    return "Unknown";
+}
+
+void PrintEventRecord(FlightRecord const& record)
+{
+    auto const& event = record.event_;
+
+    PrintRecordHeader(record);
+
+    auto name = GetFlightRecordEventName(event);
+    if (name == nullptr) {
+        wprintf(L"%hs Id=%u Opcode=%u", GetFlightRecordProviderName(event.provider_), event.id_, event.opcode_);
+    } else {
+        wprintf(L"%hs", name);
+    }
+    wprintf(L" Version=%u", event.version_);
+
+    if (event.dataSize_ > 0) {
+        auto n = event.dataSize_ < FLIGHT_RECORD_DATA_SIZE ? event.dataSize_ : (uint16_t) FLIGHT_RECORD_DATA_SIZE;
+        wprintf(L" Data=");
+        for (uint16_t i = 0; i < n; ++i) {
+            wprintf(L"%02x", event.data_[i]);
+        }
+        if (n < event.dataSize_) {
+            wprintf(L"... (%u bytes)", event.dataSize_);
+        }
+    }
+    wprintf(L"\n");
+}
+
+void PrintPresentRecord(FlightRecord const& record)
+{
+    auto const& present = record.present_;
+
+    PrintRecordHeader(record);
+
+    switch (present.kind_) {
+    case FLIGHT_RECORD_PRESENT_START:    wprintf(L"p%u Start", present.frameId_); break;
+    case FLIGHT_RECORD_PRESENT_COMPLETE: wprintf(L"p%u Completed", present.frameId_); break;
+    case FLIGHT_RECORD_PRESENT_LOST:     wprintf(L"p%u Lost", present.frameId_); break;
+    case FLIGHT_RECORD_PRESENT_EVICTED:  wprintf(L"p%u Evicted", present.frameId_); break;
+    }
+
+    wprintf(L" Runtime=%hs PresentMode=%hs FinalState=%hs FrameType=%hs",
+        RuntimeName(present.runtime_),
+        PresentModeName(present.presentMode_),
+        PresentResultName(present.finalState_),
+        FrameTypeName(present.frameType_));
+
+    if (present.deferredReason_ != DeferredReason_None) {
+        wprintf(L" DeferredReason=");
+        auto separator = L"";
+        if (present.deferredReason_ & DeferredReason_WaitingForPresentStop) {
+            wprintf(L"WaitingForPresentStop");
+            separator = L"|";
+        }
+        if (present.deferredReason_ & DeferredReason_WaitingForFlipFrameType) {
+            wprintf(L"%sWaitingForFlipFrameType", separator);
+        }
+    }
+
+    struct {
+        uint16_t flag_;
+        wchar_t const* name_;
+    } const flags[] = {
+        { FLIGHT_PRESENT_SUPPORTS_TEARING,      L"SupportsTearing" },
+        { FLIGHT_PRESENT_WAIT_FOR_FLIP,         L"WaitForFlipEvent" },
+        { FLIGHT_PRESENT_WAIT_FOR_MPO_FLIP,     L"WaitForMPOFlipEvent" },
+        { FLIGHT_PRESENT_SEEN_DXGK_PRESENT,     L"SeenDxgkPresent" },
+        { FLIGHT_PRESENT_SEEN_WIN32K_EVENTS,    L"SeenWin32KEvents" },
+        { FLIGHT_PRESENT_SEEN_IN_FRAME_EVENT,   L"SeenInFrameEvent" },
+        { FLIGHT_PRESENT_GPU_FRAME_COMPLETED,   L"GpuFrameCompleted" },
+        { FLIGHT_PRESENT_IS_COMPLETED,          L"IsCompleted" },
+        { FLIGHT_PRESENT_IS_LOST,               L"IsLost" },
+        { FLIGHT_PRESENT_FAILED,                L"PresentFailed" },
+        { FLIGHT_PRESENT_IN_DWM_WAITING_STRUCT, L"PresentInDwmWaitingStruct" },
+    };
+    for (auto const& f : flags) {
+        if (present.flags_ & f.flag_) {
+            wprintf(L" %s", f.name_);
+        }
+    }
+    wprintf(L"\n");
+}
+
+void usage()
+{
+    fprintf(stderr,
+        "usage: pm_flight_decode.exe path.pmfr\n"
+        "build: %s\n", PRESENT_MON_VERSION);
+}
+
+}
+
+int wmain(
+    int argc,
+    wchar_t** argv)
+{
+    if (argc != 2) {
+        usage();
+        return 1;
+    }
+
+    FILE* fp = nullptr;
+    if (_wfopen_s(&fp, argv[1], L"rb") != 0) {
+        fprintf(stderr, "error: failed to open flight recording: %ls\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<FlightRecord> records;
+    auto ok = fread(&gHeader, sizeof(gHeader), 1, fp) == 1 &&
+              gHeader.magic_ == FLIGHT_RECORDING_MAGIC &&
+              gHeader.version_ == FLIGHT_RECORDING_VERSION &&
+              gHeader.recordSize_ == sizeof(FlightRecord);
+    if (ok) {
+        records.resize(gHeader.recordCount_);
+        ok = fread(records.data(), sizeof(FlightRecord), records.size(), fp) == records.size();
+    }
+    fclose(fp);
+
+    if (!ok) {
+        fprintf(stderr, "error: not a valid flight recording: %ls\n", argv[1]);
+        return 1;
+    }
+
+    switch (gHeader.reason_) {
+    case FLIGHT_RECORDING_LOST_PRESENT: wprintf(L"Recorded when p%u was lost.\n", gHeader.frameId_); break;
+    default:                            wprintf(L"Recorded on demand.\n"); break;
+    }
+    wprintf(L"%u of %llu records.\n", gHeader.recordCount_, gHeader.totalRecordCount_);
+    wprintf(L"       Time (ns)   PID   TID EVENT\n");
+
+    for (auto const& record : records) {
+        if (record.event_.kind_ == FLIGHT_RECORD_EVENT) {
+            PrintEventRecord(record);
+        } else {
+            PrintPresentRecord(record);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,282 @@
+// Copyright (C) 2017-2024 Intel Corporation
+// SPDX-License-Identifier: MIT
+//
+// pm_gpu_timeline converts a GPU timeline written by PresentMon's
+// --gpu_timeline_file (see PresentData/GpuTimeline.hpp) into Chrome trace
+// JSON, which can be opened with Perfetto or chrome://tracing.
+//
+// Each packet becomes a slice from when it started running to when it
+// completed, on a track for its GPU context under its process.  As in
+// GpuTrace, a packet's execution is attributed to the next frame whose GPU
+// work completes in the same process, so slices are held until that frame is
+// seen and then labeled with its FrameId.  Wait packets aren't attributed to
+// frames, and are written as soon as they complete.
+
+#include <map>
+#include <stdio.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <windows.h>
+
+#include <generated/version.h>
+
+#include "../../PresentData/GpuTimeline.hpp"
+
+namespace {
+
+struct Packet {
+    uint64_t enqueueTime_;
+    uint64_t startTime_;    // 0 until the packet starts
+    uint64_t hContext_;
+    uint32_t processId_;
+    uint8_t flags_;
+};
+
+struct Slice {
+    uint64_t enqueueTime_;
+    uint64_t startTime_;
+    uint64_t completeTime_;
+    uint64_t hContext_;
+    uint32_t sequenceId_;
+    uint32_t node_;
+    uint8_t flags_;
+};
+
+GpuTimelineHeader gHeader;
+uint64_t gStartTime;
+FILE* gOutput;
+bool gFirstEvent = true;
+
+// Tracks are numbered in the order their context is first seen, per process.
+std::map<std::pair<uint32_t, uint64_t>, uint32_t> gTracks;
+std::unordered_map<uint32_t, uint32_t> gProcessTrackCount;
+std::unordered_set<uint32_t> gNamedProcesses;
+
+double Microseconds(uint64_t time)
+{
+    auto frequency = gHeader.timestampFrequency_ == 0 ? 10000000ull : gHeader.timestampFrequency_;
+    return time < gStartTime
+        ? -1000000.0 * (double) (gStartTime - time) / (double) frequency
+        :  1000000.0 * (double) (time - gStartTime) / (double) frequency;
+}
+
+void BeginEvent()
+{
+    fprintf(gOutput, gFirstEvent ? "\n" : ",\n");
+    gFirstEvent = false;
+}
+
+void NameProcess(uint32_t processId)
+{
+    if (gNamedProcesses.insert(processId).second) {
+        BeginEvent();
+        fprintf(gOutput, R"({"ph":"M","name":"process_name","pid":%u,"args":{"name":"Process %u"}})", processId, processId);
+    }
+}
+
+uint32_t GetTrack(uint32_t processId, uint64_t hContext, uint32_t node, uint8_t flags)
+{
+    auto ii = gTracks.find(std::make_pair(processId, hContext));
+    if (ii != gTracks.end()) {
+        return ii->second;
+    }
+
+    NameProcess(processId);
+
+    auto trackCount = &gProcessTrackCount[processId];
+    *trackCount += 1;
+    auto track = *trackCount;
+    gTracks.emplace(std::make_pair(processId, hContext), track);
+
+    BeginEvent();
+    fprintf(gOutput, R"({"ph":"M","name":"thread_name","pid":%u,"tid":%u,"args":{"name":"Context 0x%llx node %u%s%s"}})",
+            processId, track, hContext, node,
+            (flags & GPU_TIMELINE_HW_QUEUE) ? " (hw queue)" : "",
+            (flags & GPU_TIMELINE_VIDEO_NODE) ? " (video)" : "");
+    return track;
+}
+
+void WriteSlice(uint32_t processId, Slice const& slice, uint32_t const* frameId)
+{
+    auto track = GetTrack(processId, slice.hContext_, slice.node_, slice.flags_);
+
+    BeginEvent();
+    fprintf(gOutput, R"({"ph":"X","name":"%s","cat":"%s","pid":%u,"tid":%u,"ts":%.3f,"dur":%.3f,"args":{"SequenceId":%u,"Node":%u,"QueuedUs":%.3f)",
+            (slice.flags_ & GPU_TIMELINE_WAIT_PACKET) ? "Wait" : "Packet",
+            (slice.flags_ & GPU_TIMELINE_VIDEO_NODE) ? "video" : "gpu",
+            processId, track,
+            Microseconds(slice.startTime_),
+            Microseconds(slice.completeTime_) - Microseconds(slice.startTime_),
+            slice.sequenceId_, slice.node_,
+            Microseconds(slice.startTime_) - Microseconds(slice.enqueueTime_));
+    if (frameId != nullptr) {
+        fprintf(gOutput, R"(,"Frame":%u)", *frameId);
+    }
+    fprintf(gOutput, "}}");
+}
+
+void usage()
+{
+    fprintf(stderr,
+        "usage: pm_gpu_timeline.exe path.pmgt output.json\n"
+        "build: %s\n", PRESENT_MON_VERSION);
+}
+
+}
+
+int wmain(
+    int argc,
+    wchar_t** argv)
+{
+    if (argc != 3) {
+        usage();
+        return 1;
+    }
+
+    FILE* fp = nullptr;
+    if (_wfopen_s(&fp, argv[1], L"rb") != 0) {
+        fprintf(stderr, "error: failed to open GPU timeline: %ls\n", argv[1]);
+        return 1;
+    }
+
+    // Read all the records.  The header's recordCount_ is only set if the
+    // writer was closed, so read until the end of the file.
+    std::vector<GpuTimelineRecord> records;
+    auto ok = fread(&gHeader, sizeof(gHeader), 1, fp) == 1 &&
+              gHeader.magic_ == GPU_TIMELINE_MAGIC &&
+              gHeader.version_ == GPU_TIMELINE_VERSION &&
+              gHeader.recordSize_ == sizeof(GpuTimelineRecord);
+    if (ok) {
+        for (;;) {
+            auto count = records.size();
+            records.resize(count + 64 * 1024);
+            auto readCount = fread(records.data() + count, sizeof(GpuTimelineRecord), 64 * 1024, fp);
+            records.resize(count + readCount);
+            if (readCount < 64 * 1024) {
+                break;
+            }
+        }
+    }
+    fclose(fp);
+
+    if (!ok) {
+        fprintf(stderr, "error: not a valid GPU timeline: %ls\n", argv[1]);
+        return 1;
+    }
+
+    if (_wfopen_s(&gOutput, argv[2], L"w") != 0) {
+        fprintf(stderr, "error: failed to create output file: %ls\n", argv[2]);
+        return 1;
+    }
+
+    gStartTime = gHeader.startTimestamp_ != 0 || records.empty() ? gHeader.startTimestamp_ : records[0].time_;
+
+    fprintf(gOutput, R"({"displayTimeUnit":"ns","traceEvents":[)");
+
+    // Packets that have been enqueued but not completed, by (node, SequenceId),
+    // and completed packets waiting for the next frame of their process.
+    std::map<std::pair<uint32_t, uint32_t>, Packet> packets;
+    std::unordered_map<uint32_t, std::vector<Slice>> unattributedSlices;
+    uint64_t unmatchedCount = 0;
+
+    for (auto const& record : records) {
+        switch (record.kind_) {
+        case GPU_TIMELINE_ENQUEUE: {
+            auto packet = &packets[std::make_pair(record.node_, record.id_)];
+            packet->enqueueTime_ = record.time_;
+            packet->startTime_ = 0;
+            packet->hContext_ = record.handle_;
+            packet->processId_ = record.processId_;
+            packet->flags_ = record.flags_;
+            break;
+        }
+
+        case GPU_TIMELINE_START: {
+            auto ii = packets.find(std::make_pair(record.node_, record.id_));
+            if (ii == packets.end()) {
+                unmatchedCount += 1;
+            } else {
+                ii->second.startTime_ = record.time_;
+            }
+            break;
+        }
+
+        case GPU_TIMELINE_COMPLETE: {
+            // Packets that complete without starting were skipped by GpuTrace
+            // due to missing events, and aren't shown.
+            auto ii = packets.find(std::make_pair(record.node_, record.id_));
+            if (ii == packets.end()) {
+                unmatchedCount += 1;
+                break;
+            }
+
+            auto const& packet = ii->second;
+            if (packet.startTime_ != 0) {
+                Slice slice;
+                slice.enqueueTime_ = packet.enqueueTime_;
+                slice.startTime_ = packet.startTime_;
+                slice.completeTime_ = record.time_;
+                slice.hContext_ = packet.hContext_;
+                slice.sequenceId_ = record.id_;
+                slice.node_ = record.node_;
+                slice.flags_ = packet.flags_;
+                if (packet.flags_ & GPU_TIMELINE_WAIT_PACKET) {
+                    WriteSlice(packet.processId_, slice, nullptr);
+                } else {
+                    unattributedSlices[packet.processId_].push_back(slice);
+                }
+            }
+            packets.erase(ii);
+            break;
+        }
+
+        case GPU_TIMELINE_FRAME: {
+            auto ii = unattributedSlices.find(record.processId_);
+            if (ii != unattributedSlices.end()) {
+                for (auto const& slice : ii->second) {
+                    WriteSlice(record.processId_, slice, &record.id_);
+                }
+                ii->second.clear();
+            }
+
+            NameProcess(record.processId_);
+
+            BeginEvent();
+            fprintf(gOutput, R"({"ph":"i","s":"p","name":"Frame %u","pid":%u,"ts":%.3f,"args":{"FrameId":%u,"SwapChainAddress":"0x%llx"}})",
+                    record.id_, record.processId_, Microseconds(record.time_), record.id_, record.handle_);
+            break;
+        }
+
+        default:
+            unmatchedCount += 1;
+            break;
+        }
+    }
+
+    // Packets that completed after the last frame of their process.
+    for (auto const& ii : unattributedSlices) {
+        for (auto const& slice : ii.second) {
+            WriteSlice(ii.first, slice, nullptr);
+        }
+    }
+
+    fprintf(gOutput, "\n]}\n");
+    auto writeError = ferror(gOutput) != 0;
+    fclose(gOutput);
+
+    if (writeError) {
+        fprintf(stderr, "error: failed to write output file: %ls\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(stderr, "%zu records, %llu packets still running at the end, %llu unmatched records", records.size(),
+            (unsigned long long) packets.size(), unmatchedCount);
+    if (gHeader.droppedRecordCount_ > 0) {
+        fprintf(stderr, ", %llu records were dropped while recording", gHeader.droppedRecordCount_);
+    }
+    fprintf(stderr, ".\n");
+
+    return 0;
+}